@@ -9,6 +9,7 @@
 #endif
 
 #include <thread>
+#include <atomic>
 #include <inttypes.h>
 #include <math.h>
 #include <limits.h>
@@ -16,9 +17,81 @@
 #include <stdint.h>
 #include <assert.h>
 #include "globalhelper.h"
+#include "mediaio.h"
+#include "keyframeindex.h"
+#include "probecache.h"
+#include "preopen.h"
+#include "framepool.h"
+#include "decoderprofile.h"
+#include "pixelrepack.h"
+#include "swsslice.h"
+#include "framepacer.h"
+
+/* 调试版本检查SDL音频回调是否满足实时要求：回调线程中不允许分配内存和加锁
+ * 检查范围：
+ * - 堆分配：MSVC调试版CRT的分配钩子捕获所有malloc/new；glibc上拦截malloc/calloc/realloc（不含posix_memalign等对齐分配）；
+ *   其他平台只替换全局operator new，直接调用malloc的不会被发现
+ * - 加锁：只检查包含本头文件的代码中直接调用的SDL_LockMutex，std::mutex、QMutex以及FFmpeg/SDL内部的锁不检查
+ * - 对齐分配：包含本头文件的代码中直接调用的av_malloc/av_mallocz/av_fast_malloc
+ */
+#if !defined(AUDIO_RT_CHECK) && defined(_DEBUG)
+#define AUDIO_RT_CHECK 1
+#endif
+
+#if AUDIO_RT_CHECK
+extern thread_local int audio_rt_thread;	// 当前线程正在执行SDL音频回调
+extern std::atomic<int64_t> audio_rt_violations;	// 回调中分配内存或加锁的次数
+extern std::atomic<const char*> audio_rt_first_violation;	// 第一次违规的位置
+
+//只记录，不能在回调线程里打日志（av_log本身会加锁）
+static void audio_rt_violation(const char* where)
+{
+	const char* expected = NULL;
+
+	audio_rt_violations++;
+	audio_rt_first_violation.compare_exchange_strong(expected, where);
+}
+
+#define AUDIO_RT_WHERE(what) what " at " __FILE__ ":" AV_STRINGIFY(__LINE__)
+
+static int audio_rt_lock_mutex(SDL_mutex* mutex, const char* where)
+{
+	if (audio_rt_thread)
+		audio_rt_violation(where);
+	return (SDL_LockMutex)(mutex);
+}
+
+static void* audio_rt_malloc(size_t size, const char* where)
+{
+	if (audio_rt_thread)
+		audio_rt_violation(where);
+	return (av_malloc)(size);
+}
+
+static void* audio_rt_mallocz(size_t size, const char* where)
+{
+	if (audio_rt_thread)
+		audio_rt_violation(where);
+	return (av_mallocz)(size);
+}
+
+static void audio_rt_fast_malloc(void* ptr, unsigned int* size, size_t min_size, const char* where)
+{
+	if (audio_rt_thread && min_size > *size)
+		audio_rt_violation(where);
+	(av_fast_malloc)(ptr, size, min_size);
+}
+
+//之后的代码中这些调用都经过检查
+#define SDL_LockMutex(mutex) audio_rt_lock_mutex(mutex, AUDIO_RT_WHERE("SDL_LockMutex"))
+#define av_malloc(size) audio_rt_malloc(size, AUDIO_RT_WHERE("av_malloc"))
+#define av_mallocz(size) audio_rt_mallocz(size, AUDIO_RT_WHERE("av_mallocz"))
+#define av_fast_malloc(ptr, size, min_size) audio_rt_fast_malloc(ptr, size, min_size, AUDIO_RT_WHERE("av_fast_malloc"))
+#endif
 
-#define MAX_QUEUE_SIZE (15 * 1024 * 1024)
-#define MIN_FRAMES 25
+#define MAX_QUEUE_SIZE (15 * 1024 * 1024)	// 包队列内存上限的下限值，实际上限由BufferPolicy按码率放大
+#define MAX_QUEUE_SIZE_LIMIT (256 * 1024 * 1024)	// 包队列内存上限的绝对上限
+#define MIN_FRAMES 25	// 队列时长未知（包不带duration）时的最少包数
 #define EXTERNAL_CLOCK_MIN_FRAMES 2
 #define EXTERNAL_CLOCK_MAX_FRAMES 10
 
@@ -61,30 +134,185 @@
 
 #define USE_ONEPASS_SUBTITLE_RENDER 1
 
+/* 视频帧队列的默认（最小）深度、最大深度，以及队列中解码图像占用内存的预算。实际深度按解码耗时抖动在两者之间调整 */
 #define VIDEO_PICTURE_QUEUE_SIZE 3
+#define VIDEO_PICTURE_QUEUE_MAX 16
+#define VIDEO_PICTURE_QUEUE_BUDGET (256 * 1024 * 1024)
 #define SUBPICTURE_QUEUE_SIZE 16
 #define SAMPLE_QUEUE_SIZE 9
-#define FRAME_QUEUE_SIZE FFMAX(SAMPLE_QUEUE_SIZE, FFMAX(VIDEO_PICTURE_QUEUE_SIZE, SUBPICTURE_QUEUE_SIZE))
+/* 需要更浅的队列持续这么多帧后才缩小一级，避免来回调整 */
+#define FRAME_QUEUE_SHRINK_FRAMES 50
+/* 渲染线程在空闲时提前上传的帧数，以及轮流使用的视频纹理数（正在显示的一帧、提前上传的帧，再多一个） */
+#define TEXTURE_PREUPLOAD_AHEAD 2
+/* 上传耗时的平滑系数 */
+#define TEXTURE_UPLOAD_COST_ALPHA 0.1
+#define TEXTURE_RING_SIZE (TEXTURE_PREUPLOAD_AHEAD + 2)
+
+/* 视频落后主时钟的平均时间（秒）超过它时让解码器多跳过一级帧，领先超过SKIP_FRAME_LOWER_LEAD时少跳过一级 */
+#define SKIP_FRAME_RAISE_LAG 0.1
+#define SKIP_FRAME_LOWER_LEAD 0.02
+/* 两次调整的最短间隔（微秒）；降级后很快又要升级时，降级前的观察时间加倍，直到上限 */
+#define SKIP_FRAME_HOLD_TIME 500000
+#define SKIP_FRAME_MAX_HOLD_TIME 8000000
+
+/* 每帧解码耗时与帧时长之比（负载）的滑动平均超过QUALITY_DEGRADE_LOAD时降低一级画质，低于QUALITY_RESTORE_LOAD时恢复一级 */
+#define QUALITY_DEGRADE_LOAD 0.9
+#define QUALITY_RESTORE_LOAD 0.5
+/* 每次调整后至少观察这么久（微秒）、这么多帧；恢复后很快又要降级时，恢复前的观察时间加倍，直到上限 */
+#define QUALITY_HOLD_TIME 2000000
+#define QUALITY_HOLD_FRAMES 30
+#define QUALITY_MAX_HOLD_TIME 60000000
+
+/* 按显示区域选择lowres时的最大值（MPEG-4、MJPEG等解码器支持到3），以及显示区域大小稳定这么久（微秒）后才重新打开解码器 */
+#define DISPLAY_LOWRES_MAX 3
+#define DISPLAY_LOWRES_SETTLE_TIME 300000
+
+/* 音频PCM环形缓冲区：生产线程保持的最短缓冲时长（秒，不少于两个SDL缓冲区），以及数据段描述的槽位数（2的幂） */
+#define AUDIO_RING_MIN_DURATION 0.05
+#define AUDIO_RING_CHUNKS 256
+
+/* 对比用：置1时不启动音频生产线程，回到在SDL音频回调中直接取帧、重采样和变速的做法，
+ * 欠载次数按与PCM环形缓冲区相同的口径统计（回调需要数据时帧队列为空），可以比较两种做法 */
+#ifndef AUDIO_DIRECT_CALLBACK
+#define AUDIO_DIRECT_CALLBACK 0
+#endif
+
+/* 包队列环形缓冲区的槽位数，必须为2的幂。按AAC 48kHz约47包/秒估算可缓存40秒以上的音频 */
+#define PACKET_QUEUE_CAPACITY 2048
 
-//数据包列表
+//数据包队列的槽位
 typedef struct MyAVPacketList {
 	AVPacket pkt;	//解封装后的数据
-	struct MyAVPacketList* next;	//下⼀个节点
 	int serial;	//播放序列，每做⼀次seek，该serial都会做+1的递增，以区分不同的播放序列
 } MyAVPacketList;
 
+/* 共用一个读线程唤醒器的包队列数（音频、视频、字幕） */
+#define READ_WAKEUP_MAX_QUEUES 3
+
+//读线程唤醒器
+//ReadThread在缓冲已满或读到结尾后休眠，由以下事件唤醒：消费者把队列消费到低水位以下、帧队列播放排空、解码结束、seek/暂停/退出等命令。
+//pending受mutex保护，唤醒请求在ReadThread尚未进入等待时也不会丢失；waiting让消费者只有在ReadThread确实休眠时才需要加锁。
+typedef struct ReadWakeup {
+	SDL_mutex* mutex;
+	SDL_cond* cond;
+	std::atomic<int> waiting;	// ReadThread已登记休眠（正在或即将等待）
+	int pending;	// 未处理的唤醒请求
+	std::atomic<int64_t> wakeups;	// 唤醒次数统计
+	struct PacketQueue* queues[READ_WAKEUP_MAX_QUEUES];	// 共用该唤醒器的队列，用于按总字节数判断
+	int nb_queues;
+	std::atomic<int64_t> wake_bytes;	// 各队列的总字节数不多于该值时唤醒，-1表示不检查
+} ReadWakeup;
+
 //数据包队列
+//ReadThread是唯一的生产者，对应的解码线程是唯一的消费者，因此采用单生产者单消费者（SPSC）的无锁环形缓冲区。
+//windex只由生产者推进；rindex正常由消费者推进，packet_queue_flush时由清空方通过CAS一次性推进到windex。
+//mutex/cond只在队列空（消费者）或满（生产者）需要阻塞时才使用。
 typedef struct PacketQueue {
-	MyAVPacketList* first_pkt, * last_pkt;	// 队⾸，队尾指针
-	int nb_packets;	// 包数量，也就是队列元素数量
-	int size;	// 队列所有元素的数据⼤⼩总和
-	int64_t duration;	// 队列所有元素的数据播放持续时间
+	MyAVPacketList* ring;	// 环形缓冲区
+	int capacity;	// 槽位数（2的幂）
+	std::atomic<uint64_t> windex;	// 写计数，单调递增，槽位为windex & (capacity - 1)
+	std::atomic<uint64_t> rindex;	// 读计数，单调递增
+	std::atomic<int> nb_packets;	// 包数量，也就是队列元素数量
+	std::atomic<int> size;	// 队列所有元素的数据⼤⼩总和
+	std::atomic<int64_t> duration;	// 队列所有元素的数据播放持续时间
+	std::atomic<int> waiters;	// 正在阻塞等待的一方：PACKET_QUEUE_WAIT_GET/PACKET_QUEUE_WAIT_PUT
 	int abort_request;	// ⽤户退出请求标志
-	int serial;	// 播放序列号，和MyAVPacketList的serial作⽤相同
-	SDL_mutex* mutex;	// ⽤于维持PacketQueue的多线程安全(SDL_mutex可以按pthread_mutex_t理解）
+	std::atomic<int> serial;	// 播放序列号，和MyAVPacketList的serial作⽤相同。只由生产者修改，解码线程和时钟随时读取
+	SDL_mutex* mutex;	// 仅用于队列空/满时的阻塞等待
 	SDL_cond* cond;	// ⽤于读、写线程相互通知(SDL_cond可以按pthread_cond_t理解)
+	ReadWakeup* wakeup;	// 消费到低水位以下时用于唤醒ReadThread
+	std::atomic<int> wake_packets;	// 包数不多于该值时唤醒，-1表示不检查
+	std::atomic<int64_t> wake_duration;	// 时长（流时间基）低于该值时唤醒，0表示不检查
+	int64_t puts;	// 放入的数据包数，不含flush_pkt（只由生产者修改）
+	int64_t node_allocs;	// 为存放数据包分配节点内存的次数：环形缓冲区只在初始化时分配一次，之后每个包都不再分配
 } PacketQueue;
 
+#define PACKET_QUEUE_WAIT_GET 1
+#define PACKET_QUEUE_WAIT_PUT 2
+
+/* 已解封装包的回看窗口：时长、字节数上限，以及包数、关键帧数上限（2的幂） */
+#define PACKET_CACHE_DURATION (30 * AV_TIME_BASE)
+#define PACKET_CACHE_MAX_BYTES (96 * 1024 * 1024)
+#define PACKET_CACHE_CAPACITY 16384
+#define PACKET_CACHE_MAX_KEYFRAMES 2048
+
+typedef struct PacketCacheEntry {
+	AVPacket pkt;	// 包的引用，与送入PacketQueue的包共享负载
+	int64_t ts;	// 显示时间（AV_TIME_BASE），未知时为AV_NOPTS_VALUE
+} PacketCacheEntry;
+
+//最近解封装的包的滚动窗口（只由ReadThread访问）
+//包按解封装顺序存放，并为主参考流（有视频时为视频流，否则为音频流）建立关键帧索引。
+//seek目标落在窗口内时从最近的关键帧开始回放缓存中的包，不调用avformat_seek_file，也不读磁盘；
+//回放结束后解封装器的读位置正好接在窗口末尾，继续av_read_frame即可。
+typedef struct PacketCache {
+	PacketCacheEntry* entries;	// 环形缓冲区，序号seq的包在entries[seq & (PACKET_CACHE_CAPACITY - 1)]
+	uint64_t head;	// 最旧的包序号
+	uint64_t tail;	// 下一个写入的包序号
+	uint64_t replay;	// 回放位置，小于tail时处于回放中
+	uint64_t keyframes[PACKET_CACHE_MAX_KEYFRAMES];	// 主参考流关键帧的包序号
+	uint64_t key_head, key_tail;
+	int64_t bytes;	// 缓存的负载字节数
+	int64_t last_ts;	// 主参考流最新的显示时间
+	int key_stream;	// 主参考流
+	int audio_stream, video_stream, subtitle_stream;	// 建立缓存时选中的流，切换后缓存作废
+	int64_t hits;	// 由缓存完成的seek次数
+	int64_t misses;	// 需要avformat_seek_file的seek次数
+	int64_t hit_latency, miss_latency;	// seek请求到新位置第一帧可显示的累计耗时（微秒）
+	int64_t hit_latency_count, miss_latency_count;
+} PacketCache;
+
+/* 码率指数平滑的时间常数（秒），按两次更新的间隔加权，与包的频率无关 */
+#define BUFFER_BITRATE_TIME_CONSTANT 2.0
+
+//数据源类型，决定缓冲策略的目标时长
+enum {
+	BUFFER_SOURCE_LOCAL,	// 本地文件：读取快，少量缓冲即可
+	BUFFER_SOURCE_NETWORK,	// 网络点播：读取抖动大，需要更多缓冲
+	BUFFER_SOURCE_REALTIME,	// 实时流：低延迟优先
+};
+
+//缓冲健康程度
+enum {
+	BUFFER_HEALTH_EMPTY,	// 某个流的队列已空
+	BUFFER_HEALTH_LOW,	// 低于低水位
+	BUFFER_HEALTH_OK,	// 介于低水位与高水位之间
+	BUFFER_HEALTH_FULL,	// 达到高水位
+};
+
+//单个流的缓冲策略（时长均以秒为单位）
+typedef struct StreamBufferPolicy {
+	double target_duration;	// 期望缓冲时长
+	double low_water;	// 低水位，低于它需要继续读取
+	double high_water;	// 高水位，达到它才停止读取
+	double bitrate;	// 由队列size/duration估算出的码率（bit/s），0表示未知
+	int64_t bitrate_time;	// 上次更新码率的时刻（微秒）
+} StreamBufferPolicy;
+
+//读取线程的缓冲策略：按时长而不是固定包数/字节数决定是否继续读取
+typedef struct BufferPolicy {
+	int source_type;	// BUFFER_SOURCE_*
+	int full;	// =1 所有流都达到高水位后置1，直到某个流低于低水位才清0（滞回，避免频繁启停读取）
+	int64_t max_bytes;	// 所有包队列的内存上限，按估算码率*高水位调整
+	StreamBufferPolicy audio;
+	StreamBufferPolicy video;
+	StreamBufferPolicy subtitle;
+} BufferPolicy;
+
+//缓冲健康状况（供界面或调试查询）
+typedef struct BufferHealth {
+	int source_type;	// BUFFER_SOURCE_*
+	int level;	// BUFFER_HEALTH_*，取各流中最差的一个
+	double audio_duration;	// ⾳频队列缓冲时长（秒）
+	double video_duration;	// 视频队列缓冲时长（秒）
+	double audio_bitrate;	// ⾳频估算码率（bit/s）
+	double video_bitrate;	// 视频估算码率（bit/s）
+	double low_water;	// 当前策略的低水位（秒）
+	double high_water;	// 当前策略的高水位（秒）
+	int64_t bytes;	// 所有包队列占用的字节数
+	int64_t max_bytes;	// 当前内存上限
+} BufferHealth;
+
 //音频参数
 typedef struct AudioParams {
 	int freq;	
@@ -103,7 +331,7 @@ typedef struct Clock {
 	double speed;	// 时钟速度控制，⽤于控制播放速度
 	int serial;           // 播放序列，所谓播放序列就是⼀段连续的播放动作，⼀个seek操作会启动⼀段新的播放序列
 	int paused;	// = 1 说明是暂停状态
-	int* queue_serial;    // 指向packet_serial，指针
+	const std::atomic<int>* queue_serial;    // 指向对应包队列的serial，NULL表示不跟随包队列（外部时钟）
 } Clock;
 
 /* Common struct for handling all types of decoded data and allocated render buffers. */
@@ -121,22 +349,77 @@ typedef struct Frame {
 	AVRational sar;	// 图像的宽⾼⽐，如果未知或未指定则为0/1
 	int uploaded;	// 当前帧是否上传到GPU
 	int flip_v;	// =1则旋转180， = 0则正常播放
+	int staged;	// =1时图像已由解码线程写入该槽位的纹理（TextureSlot），frame中不再保留数据
+	int ring_index;	// 未零拷贝的帧上传到的视频纹理（VideoState::vid_textures的下标），-1表示还没有上传
 } Frame;
 
 //帧队列
 typedef struct FrameQueue {
-	Frame queue[FRAME_QUEUE_SIZE];	// FRAME_QUEUE_SIZE 最⼤size, 数字太⼤时会占⽤⼤量的内存，需要注意该值的设置
-	int rindex;	// rindex指示已经显示的最近一帧（一般是未调用frame_queue_next之前以适应暂停时候显示画面或者窗口变化时作为参考帧）或正等待被显示的帧起始位置。frame_queue_next()会改变其位置;
-	int windex;	// 写索引
-	int size;	// size 并非表示内存大小，而是当前队列中帧的数量
-	int max_size;	// 可存储最⼤帧数；认情况下，max_size 的值可能比实际的数组大小（如 FRAME_QUEUE_SIZE）小，以确保在高分辨率视频情况下不会占用过多内存
+	Frame* queue;	// 按capacity分配的槽位，每个槽位预先分配AVFrame结构（图像数据只在帧入队时占用）
+	int capacity;	// 槽位数，读写索引按它回绕
+	std::atomic<int> rindex;	// rindex指示已经显示的最近一帧（一般是未调用frame_queue_next之前以适应暂停时候显示画面或者窗口变化时作为参考帧）或正等待被显示的帧起始位置。frame_queue_next()会改变其位置（只由消费者修改）;
+	std::atomic<int> windex;	// 写索引（只由生产者修改）
+	std::atomic<int> size;	// size 并非表示内存大小，而是当前队列中帧的数量
+	std::atomic<int> max_size;	// 当前允许存储的最⼤帧数（队列深度），不超过capacity，运行时可由生产者调整
 	int keep_last;	// 音频流与视频流都已经写死为1，字母流写死为0;keep_last 决定了在播放完一帧后，是否将其保留在队列中而不立即销毁。启用 keep_last 的主要目的是在需要重新渲染上一帧时（例如窗口大小变化）能够直接获取，而无需重新解码。
-	int rindex_shown;	//【本程序写死Keep_last为1,；读取第一帧的时候rindex_shown就被设置为1】默认情况下，rindex_shown 为 0，表示直接读取 rindex 所指向的帧。当启用了 keep_last 功能且 rindex_shown 被设置为 1 时，读取帧时会使用 rindex + rindex_shown 作为索引，以确保能够正确读取下一帧。​
-	SDL_mutex* mutex;	// 互斥量
+	std::atomic<int> rindex_shown;	//【本程序写死Keep_last为1,；读取第一帧的时候rindex_shown就被设置为1】默认情况下，rindex_shown 为 0，表示直接读取 rindex 所指向的帧。当启用了 keep_last 功能且 rindex_shown 被设置为 1 时，读取帧时会使用 rindex + rindex_shown 作为索引，以确保能够正确读取下一帧。​
+	std::atomic<int> waiters;	// 正在阻塞等待的一方：FRAME_QUEUE_WAIT_READ/FRAME_QUEUE_WAIT_WRITE
+	SDL_mutex* mutex;	// 仅用于队列空/满时的阻塞等待
 	SDL_cond* cond;	// 条件变量
 	PacketQueue* pktq;	// 数据包缓冲队列
+	int64_t pushes;	// 写入的帧数（只由生产者修改）
+	int64_t write_waits;	// 生产者因队列满而阻塞的次数
+	int64_t read_waits;	// 消费者因队列空而阻塞的次数
 } FrameQueue;
 
+#define FRAME_QUEUE_WAIT_READ 1
+#define FRAME_QUEUE_WAIT_WRITE 2
+
+//视频帧槽位对应纹理的状态
+enum {
+	TEXTURE_SLOT_NONE = 0,	// 没有加锁的纹理（未创建，或加锁失败）
+	TEXTURE_SLOT_READY,	// 渲染线程已加锁并发布了像素指针，视频解码线程可以直接写入
+	TEXTURE_SLOT_STALE,	// 格式或尺寸与新的帧不一致，解码线程已放弃该纹理，等待渲染线程重建
+	TEXTURE_SLOT_SHOWN,	// 已解锁上传（提前上传或已显示），帧出队前纹理不能重新加锁
+};
+
+//零拷贝上传时视频帧队列每个槽位对应的流式纹理
+//渲染线程提前SDL_LockTexture并发布像素指针；视频解码线程入队时把帧直接写入锁定的纹理内存并立即释放解码缓冲区；
+//渲染线程显示该帧时只需SDL_UnlockTexture。READY状态下纹理归写入方，其余状态归渲染线程。
+typedef struct TextureSlot {
+	SDL_Texture* texture;
+	std::atomic<int> state;	// TEXTURE_SLOT_*
+	int64_t key;	// 加锁时纹理的格式和尺寸（texture_slot_key）
+	uint8_t* pixels[3];	// 锁定的纹理内存中各平面的起始位置
+	int pitch[3];
+} TextureSlot;
+
+//播放控件中视频显示区域的一份几何信息
+typedef struct ShowRect {
+	std::atomic<int> x, y, w, h;
+} ShowRect;
+
+//Qt线程发布、渲染线程读取的显示区域。两份副本轮流更新：写方修改一份时读方读另一份，
+//读方只在读的过程中发生了更新时重读，任何时候都能拿到一份完整的区域，双方都不会阻塞
+typedef struct ShowRectLatch {
+	ShowRect copy[2];
+	std::atomic<unsigned> seq;	// 更新次数，最低位为当前可读的副本
+} ShowRectLatch;
+
+//视频帧队列深度的自适应控制（只由视频解码线程修改）
+typedef struct FrameQueueDepth {
+	int min_depth;	// 深度下限
+	int max_depth;	// 深度上限（不超过队列槽位数）
+	int64_t budget;	// 队列中解码图像的内存预算（字节）
+	double decode_avg;	// 出帧耗时的指数平均（秒）
+	double decode_dev;	// 出帧耗时的平均偏差（秒），反映抖动
+	int nb_samples;
+	int last_serial;	// seek后第一帧的耗时包含等待新数据的时间，不计入统计
+	int frame_bytes;	// 一帧解码图像的字节数
+	int shrink_count;	// 连续需要更浅队列的帧数
+	int changes;	// 深度调整次数
+} FrameQueueDepth;
+
 enum {
 	AV_SYNC_AUDIO_MASTER, /* default choice */
 	AV_SYNC_VIDEO_MASTER,
@@ -152,14 +435,142 @@ typedef struct Decoder {
 	int pkt_serial;
 	int finished;
 	int packet_pending;
-	SDL_cond* empty_queue_cond;	//外部总管VideoState传进来的
+	int wait_keyframe;	// 解码器重新打开后丢弃数据包直到下一个关键帧
+	ReadWakeup* empty_queue_wakeup;	//外部总管VideoState传进来的
 	int64_t start_pts;
 	AVRational start_pts_tb;
 	int64_t next_pts;
 	AVRational next_pts_tb;
 	std::thread decode_thread;
+	int64_t packets_sent;	// 送入解码器的包数（只由解码线程修改）
+	int64_t frames_received;	// 解码器输出的帧数
+	int64_t wait_time;	// 最近一次decoder_decode_frame中等待空队列来包的时间（微秒），不属于解码耗时
 } Decoder;
 
+//解码前丢帧的级别，依次对应avctx->skip_frame的AVDISCARD_DEFAULT/NONREF/BIDIR/NONKEY
+enum {
+	SKIP_LEVEL_NONE = 0,	// 不跳过
+	SKIP_LEVEL_NONREF,	// 跳过不被参考的帧
+	SKIP_LEVEL_BIDIR,	// 跳过所有B帧
+	SKIP_LEVEL_NONKEY,	// 只解码关键帧
+	SKIP_LEVEL_NB
+};
+
+//解码前丢帧的控制器（只由视频解码线程访问）
+//get_video_frame和video_refresh的丢帧都发生在解码之后，解码的开销已经付出；
+//视频持续落后主时钟时逐级提高skip_frame，让解码器直接跳过部分帧，赶上后再逐级降低。
+typedef struct SkipFrameControl {
+	int level;	// SKIP_LEVEL_*
+	int floor;	// 画质阶梯要求的最低级别，实际生效的是level和floor中较高的一个
+	double lag;	// 视频落后主时钟时间的滑动平均（秒），为负表示领先
+	int lag_valid;
+	int serial;	// 播放序列变化后重新统计
+	int64_t next_change;	// 下一次允许调整的时刻
+	int64_t lower_hold;	// 升级后至少保持这么久才允许降级
+	int64_t last_raise, last_lower;	// 最近一次升级/降级的时刻
+	int64_t last_pending;	// 上次统计时已送入解码器但还没有输出的包数
+	int64_t skipped[SKIP_LEVEL_NB];	// 各级别下被跳过的帧数（按送入的包数与输出的帧数之差估算，误差在解码器延迟的帧数以内）
+	int raises, lowers;	// 升级/降级次数
+} SkipFrameControl;
+
+//解码持续过载时的画质阶梯，逐级减少每帧的解码工作量
+enum {
+	QUALITY_LEVEL_FULL = 0,	// 完整解码
+	QUALITY_LEVEL_SKIP_LOOP_FILTER,	// 跳过环路滤波（去块、SAO）
+	QUALITY_LEVEL_SKIP_IDCT,	// 非参考帧跳过IDCT
+	QUALITY_LEVEL_LOWRES,	// 降低解码分辨率（只有解码器支持lowres时才使用这一级）
+	QUALITY_LEVEL_KEYFRAME,	// 只解码关键帧
+	QUALITY_LEVEL_NB
+};
+
+//画质阶梯的控制器（只由视频解码线程修改）
+//以每个送入解码器的包的平均解码耗时与帧时长之比作为负载，等待数据包的时间不计入。
+typedef struct QualityLadder {
+	int enabled;
+	int level;	// QUALITY_LEVEL_*
+	int lowres_supported;	// 解码器支持lowres且重新打开没有失败过
+	double load;	// 负载的滑动平均
+	int nb_samples;	// 当前级别下的样本数
+	int64_t busy;	// 还没有分摊到数据包上的解码耗时（微秒）
+	int64_t last_packets;	// 上次统计时解码器已送入的包数
+	int serial;
+	int64_t next_change;	// 下一次允许调整的时刻
+	int64_t restore_hold;	// 降级后至少保持这么久才允许恢复
+	int64_t last_degrade, last_restore;	// 最近一次降级/恢复的时刻
+	int changes;	// 调整次数
+	int max_level;	// 本次播放达到过的最低画质
+} QualityLadder;
+
+//PCM环形缓冲区中的一段数据，对应一帧重采样（和变速）后的音频
+typedef struct AudioChunk {
+	int size;	// 字节数
+	int serial;	// 播放序列
+	double clock;	// 该段结束位置的音频时钟（帧的pts+时长），未知时为NAN
+	double rate;	// 生成该段时的播放速率
+} AudioChunk;
+
+//设备格式PCM的环形缓冲区
+//音频生产线程是唯一的生产者，负责取帧、同步补偿、重采样和变速；SDL音频回调是唯一的消费者，只做拷贝或混音。
+//字节和数据段描述各用一个SPSC环形缓冲区，生产者先写字节再发布描述，回调取到描述时数据一定已经就绪。
+typedef struct AudioRing {
+	uint8_t* data;
+	int capacity;	// 字节数（2的幂）
+	int target;	// 生产线程保持的缓冲字节数
+	std::atomic<uint64_t> windex, rindex;	// 字节写/读计数，单调递增
+	AudioChunk chunks[AUDIO_RING_CHUNKS];
+	std::atomic<uint64_t> chunk_windex, chunk_rindex;	// 数据段写/读计数
+	std::atomic<int> abort_request;	// 通知生产线程退出
+	std::atomic<int64_t> callbacks;	// 回调次数
+	std::atomic<int64_t> underruns;	// 回调时没有数据、只能输出静音的次数
+	std::atomic<int64_t> underrun_bytes;	// 因此输出的静音字节数
+} AudioRing;
+
+//读线程状态：读到结尾和播放结束都只发生一次状态转换，seek后回到READ_STATE_READING
+enum {
+	READ_STATE_READING = 0,	// 正常读取
+	READ_STATE_EOF,	// 已读到结尾并送入空包，等待解码和播放排空
+	READ_STATE_FINISHED,	// 播放结束，已发出SigStop，只等待seek或退出
+};
+
+/* 统计快照的发布间隔（微秒） */
+#define STATS_PUBLISH_INTERVAL 500000
+
+//供界面查询的统计快照：维护各项统计的线程定期把自己的统计复制进来（受VideoCtl::m_pStatsMutex保护），
+//界面线程只读快照、不接触VideoState；停止播放时在各线程退出后清空
+typedef struct PlaybackStats {
+	int active;	// 正在播放，打开文件后置1
+	int has_buffer;	// buffer已发布
+	BufferHealth buffer;	// 由ReadThread发布
+	int64_t packet_puts, packet_node_allocs;	// 各包队列放入的数据包数/分配节点内存的次数之和，由ReadThread发布
+	int64_t seek_hits, seek_misses;	// 回看缓存命中/未命中的seek次数，由ReadThread在seek时发布
+	double seek_hit_latency, seek_miss_latency;	// 命中/未命中时seek到第一帧的平均耗时（毫秒），由统计seek延迟的线程发布
+	double probe_time;	// 打开文件并获得流信息的耗时（毫秒），由ReadThread发布
+	int probe_cached;	// 使用了缓存的探测结果，由ReadThread发布
+	double first_frame_time;	// 从打开到第一帧显示的耗时（毫秒），0表示还未显示，由first_frame_check发布
+	//以下由视频解码线程发布
+	int has_video;
+	int video_depth;	// 视频帧队列当前允许缓冲的帧数
+	int video_frames;	// 发布时已缓冲、未显示的帧数
+	int video_depth_changes;
+	int64_t pool_frames, pool_fallbacks;	// 从arena分配/回退到默认分配的帧数
+	int pool_in_use, pool_slots;	// 当前arena借出的槽位数和槽位总数
+	int64_t pool_committed;	// 当前arena已提交物理内存的字节数
+	int skip_level;	// 解码前丢帧的级别SKIP_LEVEL_*
+	int64_t skip_skipped[SKIP_LEVEL_NB];	// 各级别下被跳过的帧数
+	int quality_level;	// 画质阶梯的级别QUALITY_LEVEL_*
+	double quality_load;	// 每帧解码耗时与帧时长之比的滑动平均
+	int quality_changes;
+	//以下由音频生产线程（AUDIO_DIRECT_CALLBACK时为音频解码线程）发布
+	int has_audio;
+	int64_t audio_callbacks, audio_underruns;	// SDL音频回调次数/回调时没有数据的次数
+	double audio_buffered;	// PCM环形缓冲区中已准备好的数据时长（毫秒）
+	//以下由渲染线程发布
+	int pacing_locked;	// 调度器已锁定刷新间隔
+	double pacing_rate;	// 学到的刷新率（Hz）
+	int64_t pacing_frames, pacing_missed;	// 记录了误差的帧数/晚于计划的vblank显示的帧数
+	double pacing_avg_error, pacing_max_error;	// present时刻相对理想时刻的平均（绝对值）/最大误差（毫秒）
+} PlaybackStats;
+
 //视频状态，管理所有的视频信息及数据
 //仿照ffplay的结构体设计
 typedef struct VideoState {
@@ -176,6 +587,7 @@ typedef struct VideoState {
 	int64_t seek_rel;	// >0-用户请求在目标位置之前;<0-用户希望在目标位置之后的一个区间内进行搜索
 	int read_pause_return;
 	AVFormatContext* ic;	// iformat的上下⽂
+	AVIOContext* file_pb;	// 本地文件的自定义输入（内存映射或预读缓存），不为NULL时作为ic->pb（需要自行释放）
 	int realtime;	// =1为实时流
 	Clock audclk;	// ⾳频时钟
 	Clock vidclk;	// 视频时钟
@@ -183,6 +595,14 @@ typedef struct VideoState {
 	FrameQueue pictq;	// 视频Frame队列
 	FrameQueue subpq;	// 字幕Frame队列
 	FrameQueue sampq;	// 采样Frame队列
+	FrameQueueDepth pictq_depth;	// 视频Frame队列深度的自适应控制
+	FramePool frame_pool;	// 视频解码器的帧缓冲池
+	SkipFrameControl video_skip;	// 视频解码前丢帧的控制
+	QualityLadder video_quality;	// 视频解码过载时的画质阶梯
+	std::atomic<int> display_lowres;	// 按显示区域大小选择的lowres，由显示线程更新
+	int display_lowres_pending;	// 视频解码线程观察到的display_lowres，稳定后才生效
+	int64_t display_lowres_time;	// display_lowres_pending开始的时刻
+	int display_lowres_active;	// 已生效的按显示区域选择的lowres
 	Decoder auddec;	// ⾳频解码器
 	Decoder viddec;	// 视频解码器
 	Decoder subdec;	// 字幕解码器
@@ -203,15 +623,19 @@ typedef struct VideoState {
 	// 若经过重采样则指向audio_buf1，否则指向frame中的⾳频
 	uint8_t* audio_buf;	// 指向需要重采样的数据（指向音频数据缓冲区的指针）
 	uint8_t* audio_buf1;	// 指向重采样后的数据
-	// 待播放的⼀帧⾳频数据(audio_buf指向)的⼤⼩（字节）
+	// 回调正在播放的数据段（audio_ring中的一段）的⼤⼩（字节）
 	unsigned int audio_buf_size; 
 	// 申请到的⾳频缓冲区audio_buf1的实际尺⼨
 	unsigned int audio_buf1_size;
-	// 指示当前已处理或播放的音频数据在 audio_buf 中的偏移量（以字节为单位）。
+	// 指示当前数据段中已拷贝给SDL的字节数
 	int audio_buf_index; 
 	// 当前⾳频帧中尚未拷⼊SDL⾳频缓冲区的数据量:
 	// audio_buf_size = audio_buf_index + audio_write_buf_size
 	int audio_write_buf_size;
+	double audio_clock_rate;	// 当前数据段生成时的播放速率
+	int64_t audio_callback_time;	// 本次SDL音频回调开始的时刻
+	AudioRing audio_ring;	// 重采样后等待回调取走的PCM
+	std::thread audio_render_tid;	// 音频生产线程
 	int audio_volume;	// ⾳量
 	struct AudioParams audio_src;	// ⾳频frame的参数
 	struct AudioParams audio_tgt;	// SDL⽀持的⾳频参数，重采样转换：audio_src->audio_tgt
@@ -229,61 +653,369 @@ typedef struct VideoState {
 	int xpos;
 	double last_vis_time;
 	SDL_Texture* sub_texture;	// 字幕显示
-	SDL_Texture* vid_texture;	// 视频显示
+	SDL_Texture* vid_textures[TEXTURE_RING_SIZE];	// 视频显示，渲染线程轮流上传，每个上传了而未出队的帧各占一个
+	int vid_texture_next;	// 下一次上传优先使用的纹理
+	int64_t tex_preuploaded, tex_late;	// 空闲时提前上传/显示时才上传的帧数
+	double tex_upload_cost;	// 上传一帧的平均耗时（秒），离下一次刷新的时间不够时不提前上传
+	TextureSlot* tex_slots;	// 零拷贝上传时视频帧队列各槽位的纹理，按pictq.capacity分配
+	std::atomic<int64_t> tex_slot_key;	// 视频解码线程最近一帧需要的纹理格式和尺寸，0表示不能零拷贝
+	int tex_slot_failed;	// 纹理创建或加锁失败，本次播放不再使用零拷贝上传
+	int64_t tex_staged, tex_fallback;	// 零拷贝上传/回退到渲染线程上传的帧数
 	int subtitle_stream;	// 字幕流索引
 	AVStream* subtitle_st;	// 字幕流
 	PacketQueue subtitleq;	// 字幕packet队列
 	double frame_timer;	// 前正在显示的帧在系统时间中的播放时刻
+	FramePacer pacer;	// 按vblank节拍安排帧的切换时刻
+	int64_t stats_render_time;	// 渲染线程上一次发布统计快照的时刻
 	double frame_last_returned_time;
 	double frame_last_filter_delay;
 	int video_stream;// 视频流索引
 	AVStream* video_st;	// 视频流
 	PacketQueue videoq;	// 视频队列
 	double max_frame_duration;      // ⼀帧最⼤间隔 - above this, we consider the jump a timestamp discontinuity
-	struct SwsContext* img_convert_ctx;	// 视频尺⼨格式变换
+	SwsSlicePool img_convert_pool;	// 视频格式变换（分片多线程）
+	SwsSlicePool stage_convert_pool;	// 零拷贝上传时视频解码线程的格式变换
 	struct SwsContext* sub_convert_ctx;	// 字幕尺⼨格式变换
-	int eof;	// 是否读取结束
+	int read_state;	// 读线程状态 READ_STATE_*
 	char* filename;	// ⽂件名
 	int width, height, xleft, ytop;	// 宽、⾼，x起始坐标，y起始坐标
 	int step;	// 【主要用于暂停时候seek请求】=1 单步播放模式, =0 其他模式（在单步模式下，每次显示完一帧视频后，自动暂停播放，等待用户触发下一步操作（例如，按键事件）以继续播放下一帧。这样可以实现逐帧查看视频内容的功能。）
 	// 保留最近的相应audio、video、subtitle流的steam index
 	int last_video_stream, last_audio_stream, last_subtitle_stream;
-	SDL_cond* continue_read_thread;	// 当读取数据队列满了后进⼊休眠时，可以通过该condition唤醒读线程
+	ReadWakeup continue_read_thread;	// 当读取数据队列满了或读到结尾后进⼊休眠时，通过它唤醒读线程
+	BufferPolicy buffer_policy;	// 读取缓冲策略
+	PacketCache pkt_cache;	// 最近解封装的包的回看窗口
+	int64_t seek_req_time;	// 最近一次seek请求的时刻，用于统计seek延迟
+	int seek_wait_serial;	// 等待该播放序列的第一帧以统计seek延迟，-1表示不在统计
+	int seek_from_cache;	// 最近一次seek是否由回看缓存完成
+	KeyframeIndex kf_index;	// 本地文件的关键帧索引（容器索引不完整时使用）
+	int64_t open_time;	// 开始打开的时刻，用于统计首帧耗时
+	int64_t probe_time;	// 打开文件并获得流信息的耗时（微秒）
+	int probe_cached;	// 本次打开是否使用了缓存的探测结果
+	int64_t first_frame_time;	// 从开始打开到第一帧显示的耗时（微秒），0表示还未显示
+	PreopenState* preopen;	// 后台预打开的结果，不为NULL时ReadThread直接接管
 } VideoState;
 
 //缓冲包
 static AVPacket flush_pkt;
 
-//数据包队列存放数据包（供队列内部使用）
+//距上一次发布统计快照超过STATS_PUBLISH_INTERVAL时更新*last
+/// <returns>1-需要发布</returns>
+static int stats_publish_due(int64_t* last)
+{
+	int64_t now = av_gettime_relative();
+	if (*last && now - *last < STATS_PUBLISH_INTERVAL)
+		return 0;
+	*last = now;
+	return 1;
+}
+
+static int packet_cache_init(PacketCache* c)
+{
+	memset(c, 0, sizeof(PacketCache));
+	c->entries = (PacketCacheEntry*)av_mallocz_array(PACKET_CACHE_CAPACITY, sizeof(PacketCacheEntry));
+	if (!c->entries)
+		return AVERROR(ENOMEM);
+	c->key_stream = c->audio_stream = c->video_stream = c->subtitle_stream = -1;
+	c->last_ts = AV_NOPTS_VALUE;
+	return 0;
+}
+
+//丢弃窗口中所有的包（解封装器读位置跳变后窗口不再连续）
+static void packet_cache_clear(PacketCache* c)
+{
+	if (!c->entries)
+		return;
+	for (; c->head != c->tail; c->head++)
+		av_packet_unref(&c->entries[c->head & (PACKET_CACHE_CAPACITY - 1)].pkt);
+	c->replay = c->tail;
+	c->key_head = c->key_tail;
+	c->bytes = 0;
+	c->last_ts = AV_NOPTS_VALUE;
+}
+
+static void packet_cache_destroy(PacketCache* c)
+{
+	packet_cache_clear(c);
+	av_freep(&c->entries);
+}
+
+//选中的流变化后（切换音轨/字幕）缓存中缺少新流的包，整体作废
+static void packet_cache_set_streams(PacketCache* c, int audio_stream, int video_stream, int subtitle_stream)
+{
+	if (c->audio_stream == audio_stream && c->video_stream == video_stream && c->subtitle_stream == subtitle_stream)
+		return;
+	packet_cache_clear(c);
+	c->audio_stream = audio_stream;
+	c->video_stream = video_stream;
+	c->subtitle_stream = subtitle_stream;
+	c->key_stream = video_stream >= 0 ? video_stream : audio_stream;
+}
+
+//淘汰最旧的包
+static void packet_cache_drop_oldest(PacketCache* c)
+{
+	PacketCacheEntry* e = &c->entries[c->head & (PACKET_CACHE_CAPACITY - 1)];
+	c->bytes -= e->pkt.size;
+	av_packet_unref(&e->pkt);
+	c->head++;
+	while (c->key_head != c->key_tail && c->keyframes[c->key_head & (PACKET_CACHE_MAX_KEYFRAMES - 1)] < c->head)
+		c->key_head++;
+}
+
+/// <summary>
+/// 把新解封装的包加入窗口（保存一份引用），并淘汰超出时长/字节数/包数上限的旧包。回放中不能调用
+/// </summary>
+/// <param name="c"></param>
+/// <param name="pkt">要送入PacketQueue的包</param>
+/// <param name="st">包所属的流</param>
+static void packet_cache_add(PacketCache* c, AVPacket* pkt, AVStream* st)
+{
+	PacketCacheEntry* e;
+	int64_t ts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+	uint64_t first_key;
+
+	if (!c->entries || c->key_stream < 0)
+		return;
+	if (ts != AV_NOPTS_VALUE)
+		ts = av_rescale_q(ts, st->time_base, av_get_time_base_q());
+
+	while (c->head != c->tail &&
+		(c->tail - c->head >= PACKET_CACHE_CAPACITY || c->bytes + pkt->size > PACKET_CACHE_MAX_BYTES))
+		packet_cache_drop_oldest(c);
+	//按主参考流最旧的关键帧计算窗口时长
+	while (c->key_head != c->key_tail && ts != AV_NOPTS_VALUE && pkt->stream_index == c->key_stream) {
+		first_key = c->keyframes[c->key_head & (PACKET_CACHE_MAX_KEYFRAMES - 1)];
+		if (ts - c->entries[first_key & (PACKET_CACHE_CAPACITY - 1)].ts <= PACKET_CACHE_DURATION)
+			break;
+		//把最旧的关键帧以及它之前的包都淘汰
+		while (c->head <= first_key && c->head != c->tail)
+			packet_cache_drop_oldest(c);
+	}
+
+	e = &c->entries[c->tail & (PACKET_CACHE_CAPACITY - 1)];
+	if (av_packet_ref(&e->pkt, pkt) < 0)
+		return;
+	e->ts = ts;
+	c->bytes += pkt->size;
+	if (pkt->stream_index == c->key_stream) {
+		if (ts != AV_NOPTS_VALUE)
+			c->last_ts = c->last_ts == AV_NOPTS_VALUE ? ts : FFMAX(c->last_ts, ts);
+		if ((pkt->flags & AV_PKT_FLAG_KEY) && ts != AV_NOPTS_VALUE) {
+			if (c->key_tail - c->key_head >= PACKET_CACHE_MAX_KEYFRAMES)
+				c->key_head++;
+			c->keyframes[c->key_tail++ & (PACKET_CACHE_MAX_KEYFRAMES - 1)] = c->tail;
+		}
+	}
+	c->tail++;
+	c->replay = c->tail;
+}
+
+/// <summary>
+/// 尝试在窗口内完成seek：找到显示时间不晚于target的最近关键帧，从它开始回放
+/// </summary>
+/// <param name="c"></param>
+/// <param name="target">目标时间（AV_TIME_BASE）</param>
+/// <returns>1-命中，之后通过packet_cache_next取包；0-未命中</returns>
+static int packet_cache_seek(PacketCache* c, int64_t target)
+{
+	uint64_t k;
+
+	if (!c->entries || c->key_head == c->key_tail || c->last_ts == AV_NOPTS_VALUE || target > c->last_ts)
+		return 0;
+	for (k = c->key_tail; k != c->key_head; k--) {
+		uint64_t seq = c->keyframes[(k - 1) & (PACKET_CACHE_MAX_KEYFRAMES - 1)];
+		if (c->entries[seq & (PACKET_CACHE_CAPACITY - 1)].ts <= target) {
+			c->replay = seq;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+//回放中取出下一个包（新的引用）。没有要回放的包时返回0
+static int packet_cache_next(PacketCache* c, AVPacket* pkt)
+{
+	if (!c->entries || c->replay >= c->tail)
+		return 0;
+	if (av_packet_ref(pkt, &c->entries[c->replay & (PACKET_CACHE_CAPACITY - 1)].pkt) < 0) {
+		//内存不足时放弃剩余的回放，接着从解封装器读取
+		av_log(NULL, AV_LOG_WARNING, "packet cache: replay aborted\n");
+		c->replay = c->tail;
+		return 0;
+	}
+	c->replay++;
+	return 1;
+}
+
+//打印回看缓存的命中率和seek延迟
+static void packet_cache_log(PacketCache* c)
+{
+	if (!c->hits && !c->misses)
+		return;
+	av_log(NULL, AV_LOG_INFO, "packet cache: seeks=%" PRId64 " hits=%" PRId64 " (%.1f%%) avg latency hit=%.1fms miss=%.1fms\n",
+		c->hits + c->misses, c->hits, 100.0 * c->hits / (c->hits + c->misses),
+		c->hit_latency_count ? c->hit_latency / 1000.0 / c->hit_latency_count : 0.0,
+		c->miss_latency_count ? c->miss_latency / 1000.0 / c->miss_latency_count : 0.0);
+}
+
+static int read_wakeup_init(ReadWakeup* w)
+{
+	w->mutex = SDL_CreateMutex();
+	if (!w->mutex) {
+		av_log(NULL, AV_LOG_FATAL, "SDL_CreateMutex(): %s\n", SDL_GetError());
+		return AVERROR(ENOMEM);
+	}
+	w->cond = SDL_CreateCond();
+	if (!w->cond) {
+		av_log(NULL, AV_LOG_FATAL, "SDL_CreateCond(): %s\n", SDL_GetError());
+		return AVERROR(ENOMEM);
+	}
+	w->nb_queues = 0;
+	w->wake_bytes = -1;
+	return 0;
+}
+
+static void read_wakeup_destroy(ReadWakeup* w)
+{
+	SDL_DestroyMutex(w->mutex);
+	SDL_DestroyCond(w->cond);
+	w->mutex = NULL;
+	w->cond = NULL;
+}
+
+//把队列挂到唤醒器上：消费者取包后按队列自身和所有队列的总字节数判断是否唤醒ReadThread
+static void read_wakeup_add_queue(ReadWakeup* w, PacketQueue* q)
+{
+	if (w->nb_queues < READ_WAKEUP_MAX_QUEUES)
+		w->queues[w->nb_queues++] = q;
+	q->wakeup = w;
+}
+
+//无条件唤醒ReadThread（seek、暂停、退出、解码结束等命令）
+static void read_wakeup_signal(ReadWakeup* w)
+{
+	if (!w || !w->mutex)
+		return;
+	SDL_LockMutex(w->mutex);
+	w->pending = 1;
+	w->waiting = 0;
+	SDL_CondSignal(w->cond);
+	SDL_UnlockMutex(w->mutex);
+}
+
+//只有ReadThread确实在休眠时才唤醒它（消费者热路径上调用，不休眠时不加锁）
+static void read_wakeup_signal_if_waiting(ReadWakeup* w)
+{
+	if (w && w->waiting.load() && w->waiting.exchange(0))
+		read_wakeup_signal(w);
+}
+
+//ReadThread登记休眠。登记之后调用方必须复查唤醒条件，条件已满足时调用read_wakeup_cancel而不是等待
+static void read_wakeup_prepare(ReadWakeup* w)
+{
+	w->waiting = 1;
+}
+
+static void read_wakeup_cancel(ReadWakeup* w)
+{
+	w->waiting = 0;
+}
+
+/// <summary>
+/// ReadThread休眠直到被唤醒
+/// </summary>
+/// <param name="w"></param>
+/// <param name="timeout_ms">小于0表示一直等待</param>
+static void read_wakeup_wait(ReadWakeup* w, int timeout_ms)
+{
+	SDL_LockMutex(w->mutex);
+	if (timeout_ms < 0) {
+		while (!w->pending)
+			SDL_CondWait(w->cond, w->mutex);
+	}
+	else if (!w->pending) {
+		SDL_CondWaitTimeout(w->cond, w->mutex, timeout_ms);
+	}
+	if (w->pending)
+		w->wakeups++;
+	w->pending = 0;
+	w->waiting = 0;
+	SDL_UnlockMutex(w->mutex);
+}
+
+//队列是否已被消费到唤醒阈值以下
+static int packet_queue_below_wake(PacketQueue* q)
+{
+	int64_t wake_duration = q->wake_duration.load();
+	return q->nb_packets <= q->wake_packets ||
+		(wake_duration > 0 && q->duration < wake_duration);
+}
+
+//共用唤醒器的各队列的总字节数是否已降到阈值以下（ReadThread因总字节数超限而休眠时）
+static int read_wakeup_below_bytes(ReadWakeup* w)
+{
+	int64_t wake_bytes = w->wake_bytes.load(), size = 0;
+	int i;
+
+	if (wake_bytes < 0)
+		return 0;
+	for (i = 0; i < w->nb_queues; i++)
+		size += w->queues[i]->size;
+	return size <= wake_bytes;
+}
+
+//唤醒阻塞在队列上的另一方（只有对方确实在等待时才会加锁）
+static void packet_queue_wake(PacketQueue* q, int waiter)
+{
+	if (q->waiters.load() & waiter) {
+		SDL_LockMutex(q->mutex);
+		SDL_CondBroadcast(q->cond);
+		SDL_UnlockMutex(q->mutex);
+	}
+}
+
+//数据包队列存放数据包（供队列内部使用，只能由生产者调用）
 static int packet_queue_put_private(PacketQueue* q, AVPacket* pkt)
 {
 	MyAVPacketList* pkt1;
+	uint64_t w;
 
 	if (q->abort_request)
 		return -1;
 
-	pkt1 = (MyAVPacketList*)av_malloc(sizeof(MyAVPacketList));
-	if (!pkt1)
-		return -1;
+	w = q->windex.load(std::memory_order_relaxed);
+	//队列满，阻塞等待消费者取走数据
+	if (w - q->rindex.load() >= (uint64_t)q->capacity) {
+		SDL_LockMutex(q->mutex);
+		q->waiters.fetch_or(PACKET_QUEUE_WAIT_PUT);
+		while (w - q->rindex.load() >= (uint64_t)q->capacity && !q->abort_request)
+			SDL_CondWait(q->cond, q->mutex);
+		q->waiters.fetch_and(~PACKET_QUEUE_WAIT_PUT);
+		SDL_UnlockMutex(q->mutex);
+		if (q->abort_request)
+			return -1;
+	}
+
+	pkt1 = &q->ring[w & (q->capacity - 1)];
 	// 没有做引⽤计数，那这⾥也说明av_read_frame不会释放替⽤户释放buffer。
 	//拷⻉AVPacket(浅拷⻉，AVPacket.data等内存并没有拷贝)
 	pkt1->pkt = *pkt;
-	pkt1->next = NULL;
 	//如果放⼊的是flush_pkt，需要增加队列的播放序列号，以区分不连续的两段数据
+	//新序列号在下面发布槽位（windex）之前写入，消费者取到flush_pkt时一定能看到它
 	if (pkt == &flush_pkt)
-		q->serial++;
-	pkt1->serial = q->serial;
+		q->serial.fetch_add(1, std::memory_order_release);
+	pkt1->serial = q->serial.load(std::memory_order_relaxed);
 
-	if (!q->last_pkt)
-		q->first_pkt = pkt1;
-	else
-		q->last_pkt->next = pkt1;
-	q->last_pkt = pkt1;
 	q->nb_packets++;
+	if (pkt != &flush_pkt)
+		q->puts++;
 	q->size += pkt1->pkt.size + sizeof(*pkt1);
 	q->duration += pkt1->pkt.duration;
+	//发布槽位，此后消费者才能看到该包
+	q->windex.store(w + 1);
 	/* XXX: should duplicate packet data in DV case */
-	SDL_CondSignal(q->cond);
+	packet_queue_wake(q, PACKET_QUEUE_WAIT_GET);
 	return 0;
 }
 
@@ -292,9 +1024,7 @@ static int packet_queue_put(PacketQueue* q, AVPacket* pkt)
 {
 	int ret;
 
-	SDL_LockMutex(q->mutex);
 	ret = packet_queue_put_private(q, pkt);
-	SDL_UnlockMutex(q->mutex);
 
 	if (pkt != &flush_pkt && ret < 0)
 		av_packet_unref(pkt);
@@ -313,6 +1043,12 @@ static int packet_queue_put_nullpacket(PacketQueue* q, int stream_index)
 	return packet_queue_put(q, pkt);
 }
 
+//环形缓冲区是否已满（生产者在读取新包前检查，避免在put中阻塞而无法响应seek等请求）
+static int packet_queue_full(PacketQueue* q)
+{
+	return q->windex.load() - q->rindex.load() >= (uint64_t)q->capacity;
+}
+
 /// <summary>
 /// 数据包队列初始化
 /// </summary>
@@ -321,6 +1057,13 @@ static int packet_queue_put_nullpacket(PacketQueue* q, int stream_index)
 static int packet_queue_init(PacketQueue* q)
 {
 	memset(q, 0, sizeof(PacketQueue));
+	q->capacity = PACKET_QUEUE_CAPACITY;
+	q->ring = (MyAVPacketList*)av_mallocz_array(q->capacity, sizeof(MyAVPacketList));
+	if (!q->ring) {
+		av_log(NULL, AV_LOG_FATAL, "Could not allocate packet queue ring.\n");
+		return AVERROR(ENOMEM);
+	}
+	q->node_allocs = 1;
 	q->mutex = SDL_CreateMutex();
 	if (!q->mutex) {
 		av_log(NULL, AV_LOG_FATAL, "SDL_CreateMutex(): %s\n", SDL_GetError());
@@ -336,29 +1079,40 @@ static int packet_queue_init(PacketQueue* q)
 }
 
 //数据包队列清空
+//先用CAS把rindex推进到当前windex，一次性取得[r, w)区间内所有包的所有权，再逐个释放。
+//若消费者恰好在读取同一槽位，它的CAS会失败并丢弃拷贝，不会使用已释放的数据。
 static void packet_queue_flush(PacketQueue* q)
 {
-	MyAVPacketList* pkt, * pkt1;
+	uint64_t r, w, i;
 
-	SDL_LockMutex(q->mutex);
-	for (pkt = q->first_pkt; pkt; pkt = pkt1) {
-		pkt1 = pkt->next;
-		av_packet_unref(&pkt->pkt);
-		av_freep(&pkt);
-	}
-	q->last_pkt = NULL;
-	q->first_pkt = NULL;
-	q->nb_packets = 0;
-	q->size = 0;
-	q->duration = 0;
-	SDL_UnlockMutex(q->mutex);
+	if (!q->ring)
+		return;
+	r = q->rindex.load();
+	do {
+		w = q->windex.load();
+		if (r == w)
+			return;
+	} while (!q->rindex.compare_exchange_weak(r, w));
+
+	for (i = r; i != w; i++) {
+		MyAVPacketList* pkt1 = &q->ring[i & (q->capacity - 1)];
+		q->nb_packets--;
+		q->size -= pkt1->pkt.size + sizeof(*pkt1);
+		q->duration -= pkt1->pkt.duration;
+		av_packet_unref(&pkt1->pkt);
+	}
+	packet_queue_wake(q, PACKET_QUEUE_WAIT_PUT);
 }
 
 //数据包队列销毁
 static void packet_queue_destroy(PacketQueue* q)
 {
+	if (q->puts)
+		av_log(NULL, AV_LOG_VERBOSE, "packet queue: %" PRId64 " packets, %" PRId64 " node allocations\n",
+			q->puts, q->node_allocs);
 	//先清除所有的节点
 	packet_queue_flush(q);
+	av_freep(&q->ring);
 	SDL_DestroyMutex(q->mutex);
 	SDL_DestroyCond(q->cond);
 }
@@ -370,7 +1124,7 @@ static void packet_queue_abort(PacketQueue* q)
 
 	q->abort_request = 1;	//请求退出
 
-	SDL_CondSignal(q->cond);
+	SDL_CondBroadcast(q->cond);
 
 	SDL_UnlockMutex(q->mutex);
 }
@@ -381,66 +1135,192 @@ static void packet_queue_start(PacketQueue* q)
 	//初始化清理包
 	av_init_packet(&flush_pkt);
 	flush_pkt.data = (uint8_t*)&flush_pkt;
-	SDL_LockMutex(q->mutex);
 	q->abort_request = 0;
 	//放入了一个flush_pkt，目的新增serial以区分之前的队列，触发解码器清空⾃身缓存 avcodec_flush_buffers()
 	packet_queue_put_private(q, &flush_pkt);	
-	SDL_UnlockMutex(q->mutex);
 }
 
 /* return < 0 if aborted, 0 if no packet and > 0 if packet.  */
-//从数据包队列中获取数据包
+//从数据包队列中获取数据包（只能由消费者调用）
 static int packet_queue_get(PacketQueue* q, AVPacket* pkt, int block, int* serial)
 {
-	MyAVPacketList* pkt1;
-	int ret;
-
-	SDL_LockMutex(q->mutex);
+	MyAVPacketList pkt1;
+	uint64_t r;
 
 	for (;;) {
-		if (q->abort_request) {
-			ret = -1;
-			break;
-		}
+		if (q->abort_request)
+			return -1;
 
-		pkt1 = q->first_pkt;
-		if (pkt1) {
-			q->first_pkt = pkt1->next;
-			if (!q->first_pkt)
-				q->last_pkt = NULL;
+		r = q->rindex.load();
+		if (r != q->windex.load()) {
+			//先拷贝槽位，再用CAS确认该槽位没有被packet_queue_flush抢先回收
+			pkt1 = q->ring[r & (q->capacity - 1)];
+			if (!q->rindex.compare_exchange_strong(r, r + 1))
+				continue;
 			q->nb_packets--;
-			q->size -= pkt1->pkt.size + sizeof(*pkt1);
-			q->duration -= pkt1->pkt.duration;
+			q->size -= pkt1.pkt.size + sizeof(pkt1);
+			q->duration -= pkt1.pkt.duration;
 			//返回AVPacket，这⾥发⽣⼀次AVPacket结构体拷⻉，AVPacket的data只拷贝了指针
-			*pkt = pkt1->pkt;
+			*pkt = pkt1.pkt;
 			//更新frame_queue的serial
 			if (serial)	
-				*serial = pkt1->serial;
-			//释放节点内存,只是释放节点，⽽不是释放AVPacket
-			av_free(pkt1);
-			ret = 1;
-			break;
+				*serial = pkt1.serial;
+			packet_queue_wake(q, PACKET_QUEUE_WAIT_PUT);
+			//ReadThread因缓冲已满而休眠时，消费到低水位以下就唤醒它
+			if (q->wakeup && q->wakeup->waiting.load() && (packet_queue_below_wake(q) || read_wakeup_below_bytes(q->wakeup)))
+				read_wakeup_signal_if_waiting(q->wakeup);
+			return 1;
 		}
 		else if (!block) {	//队列中没有数据，且⾮阻塞调⽤
-			ret = 0;
-			break;
+			return 0;
 		}
-		else {
-			//队列中没有数据，且阻塞调⽤
-			//这⾥没有break。for循环的另⼀个作⽤是在条件变量满⾜后重复上述代码取出节点
+		//队列中没有数据，且阻塞调⽤
+		//先登记等待标志再复查，与生产者“先发布windex再检查等待标志”配合，避免丢失唤醒
+		SDL_LockMutex(q->mutex);
+		q->waiters.fetch_or(PACKET_QUEUE_WAIT_GET);
+		while (q->rindex.load() == q->windex.load() && !q->abort_request)
 			SDL_CondWait(q->cond, q->mutex);
-		}
+		q->waiters.fetch_and(~PACKET_QUEUE_WAIT_GET);
+		SDL_UnlockMutex(q->mutex);
 	}
-	SDL_UnlockMutex(q->mutex);
-	return ret;
+}
+
+/// <summary>
+/// 按数据源类型初始化缓冲策略
+/// </summary>
+/// <param name="bp"></param>
+/// <param name="source_type">BUFFER_SOURCE_*</param>
+static void buffer_policy_init(BufferPolicy* bp, int source_type)
+{
+	StreamBufferPolicy sp;
+
+	memset(bp, 0, sizeof(BufferPolicy));
+	bp->source_type = source_type;
+	switch (source_type) {
+	case BUFFER_SOURCE_NETWORK:
+		sp.target_duration = 5.0;
+		sp.low_water = 2.0;
+		sp.high_water = 10.0;
+		break;
+	case BUFFER_SOURCE_REALTIME:
+		sp.target_duration = 0.5;
+		sp.low_water = 0.2;
+		sp.high_water = 1.0;
+		break;
+	default:
+		sp.target_duration = 2.0;
+		sp.low_water = 1.0;
+		sp.high_water = 4.0;
+		break;
+	}
+	sp.bitrate = 0;
+	sp.bitrate_time = 0;
+	bp->audio = bp->video = bp->subtitle = sp;
+	bp->max_bytes = MAX_QUEUE_SIZE;
+}
+
+//队列中已缓冲的时长（秒），包不带duration时返回-1
+static double packet_queue_seconds(PacketQueue* q, AVStream* st)
+{
+	int64_t duration = q->duration;
+	if (!st || duration <= 0)
+		return q->nb_packets ? -1 : 0;
+	return duration * av_q2d(st->time_base);
+}
+
+//由队列size/duration估算码率，时长太短时估算不可靠，使用流参数中的码率
+static void stream_buffer_update_bitrate(StreamBufferPolicy* sp, PacketQueue* q, AVStream* st, int64_t now)
+{
+	double seconds = packet_queue_seconds(q, st);
+	double bitrate, alpha;
+
+	if (seconds >= 0.5)
+		bitrate = q->size * 8.0 / seconds;
+	else if (st && st->codecpar->bit_rate > 0)
+		bitrate = (double)st->codecpar->bit_rate;
+	else
+		return;
+	//指数平滑，避免单个大关键帧造成抖动；权重按距上次更新的时间计算，每秒几十个包和几千个包的流平滑程度相同
+	if (sp->bitrate > 0) {
+		alpha = 1.0 - exp(-(now - sp->bitrate_time) / (BUFFER_BITRATE_TIME_CONSTANT * 1000000.0));
+		sp->bitrate += alpha * (bitrate - sp->bitrate);
+	}
+	else {
+		sp->bitrate = bitrate;
+	}
+	sp->bitrate_time = now;
+}
+
+//根据估算码率调整内存上限：足够容纳高水位对应的数据量，并留出余量
+static void buffer_policy_update_limit(BufferPolicy* bp)
+{
+	double bytes = (bp->audio.bitrate * bp->audio.high_water +
+		bp->video.bitrate * bp->video.high_water +
+		bp->subtitle.bitrate * bp->subtitle.high_water) / 8.0 * 1.5;
+	bp->max_bytes = (int64_t)FFMIN(FFMAX(bytes, (double)MAX_QUEUE_SIZE), (double)MAX_QUEUE_SIZE_LIMIT);
+}
+
+//单个流的缓冲健康程度
+static int stream_health_level(AVStream* st, PacketQueue* q, StreamBufferPolicy* sp)
+{
+	double seconds;
+	if (!q->nb_packets)
+		return BUFFER_HEALTH_EMPTY;
+	if (st && (st->disposition & AV_DISPOSITION_ATTACHED_PIC))
+		return BUFFER_HEALTH_FULL;
+	seconds = packet_queue_seconds(q, st);
+	if (seconds < 0)
+		return q->nb_packets > MIN_FRAMES ? BUFFER_HEALTH_OK : BUFFER_HEALTH_LOW;
+	if (seconds < sp->low_water)
+		return BUFFER_HEALTH_LOW;
+	if (seconds < sp->high_water)
+		return BUFFER_HEALTH_OK;
+	return BUFFER_HEALTH_FULL;
+}
+
+/// <summary>
+/// 设置ReadThread休眠期间该队列的唤醒阈值：环形缓冲区腾出一半，或时长低于低水位（时长未知时包数不多于MIN_FRAMES）。
+/// 因总字节数超限而休眠时只有总字节数降下来才能继续读取，不设低水位阈值，总字节数由唤醒器的wake_bytes判断
+/// </summary>
+/// <param name="q"></param>
+/// <param name="st">流，为NULL表示该队列不参与低水位判断（如字幕）</param>
+/// <param name="sp">该流的缓冲策略</param>
+/// <param name="bytes_full">是否因总字节数超限而休眠</param>
+static void packet_queue_set_wake(PacketQueue* q, AVStream* st, StreamBufferPolicy* sp, int bytes_full)
+{
+	int wake_packets = -1;
+	int64_t wake_duration = 0;
+
+	if (packet_queue_full(q)) {
+		wake_packets = q->capacity / 2;
+	}
+	else if (!bytes_full && st && !(st->disposition & AV_DISPOSITION_ATTACHED_PIC)) {
+		if (packet_queue_seconds(q, st) < 0)
+			wake_packets = MIN_FRAMES;
+		else
+			wake_duration = FFMAX((int64_t)(sp->low_water / av_q2d(st->time_base)), 1);
+	}
+	q->wake_packets = wake_packets;
+	q->wake_duration = wake_duration;
+}
+
+//视频解码器改从按分辨率划分的arena中分配帧。在avcodec_open2之前或之后、开始解码之前调用均可
+//（帧线程在每次送包时从用户上下文同步get_buffer2和opaque），预打开的解码器在接管时调用
+static void decoder_attach_frame_pool(AVCodecContext* avctx, FramePool* pool, int mode, int queue_depth)
+{
+	if (avctx->codec_type != AVMEDIA_TYPE_VIDEO || frame_pool_init(pool, mode, queue_depth) < 0)
+		return;
+	avctx->opaque = pool;
+	avctx->get_buffer2 = frame_pool_get_buffer2;
+	avctx->thread_safe_callbacks = 1;
 }
 
 //解码器初始化（绑定解码结构体、数据包队列、信号量，初始化pts）
-static void decoder_init(Decoder* d, AVCodecContext* avctx, PacketQueue* queue, SDL_cond* empty_queue_cond) {
+static void decoder_init(Decoder* d, AVCodecContext* avctx, PacketQueue* queue, ReadWakeup* empty_queue_wakeup) {
 	memset(d, 0, sizeof(Decoder));
 	d->avctx = avctx;
 	d->queue = queue;
-	d->empty_queue_cond = empty_queue_cond;
+	d->empty_queue_wakeup = empty_queue_wakeup;
 	d->start_pts = AV_NOPTS_VALUE;
 }
 
@@ -460,7 +1340,7 @@ static int decoder_decode_frame(Decoder* d, AVFrame* frame, AVSubtitle* sub) {
 			AVPacket pkt;
 			do {
 				if (d->queue->nb_packets == 0)
-					SDL_CondSignal(d->empty_queue_cond);
+					read_wakeup_signal_if_waiting(d->empty_queue_wakeup);
 				//从对应的队列中获取原始数据
 				if (packet_queue_get(d->queue, &pkt, 1, &d->pkt_serial) < 0)
 					return -1;
@@ -540,6 +1420,8 @@ static int decoder_decode_frame(Decoder* d, AVFrame* frame, AVSubtitle* sub) {
 #if 1
 static int decoder_decode_frame(Decoder* d, AVFrame* frame, AVSubtitle* sub) {
 	int ret = AVERROR(EAGAIN);
+	int64_t wait_start;
+	d->wait_time = 0;
 	for (;;) {
 		AVPacket pkt;
 		// 1. 流连续情况下获取解码后的帧
@@ -553,6 +1435,7 @@ static int decoder_decode_frame(Decoder* d, AVFrame* frame, AVSubtitle* sub) {
 					ret = avcodec_receive_frame(d->avctx, frame);
 					//printf("frame pts:%ld, dts:%ld\n", frame->pts, frame->pkt_dts);
 					if (ret >= 0) {
+						d->frames_received++;
 						if (decoder_reorder_pts == -1) {
 							frame->pts = frame->best_effort_timestamp;
 						}
@@ -588,6 +1471,8 @@ static int decoder_decode_frame(Decoder* d, AVFrame* frame, AVSubtitle* sub) {
 					d->finished = d->pkt_serial;
 					printf("avcodec_flush_buffers %s(%d)\n", __FUNCTION__, __LINE__);
 					avcodec_flush_buffers(d->avctx);
+					// 解码结束，通知处于READ_STATE_EOF的read_thread检查播放是否结束
+					read_wakeup_signal(d->empty_queue_wakeup);
 					return 0;
 				}
 				// 1.4. 正常解码返回1
@@ -599,20 +1484,23 @@ static int decoder_decode_frame(Decoder* d, AVFrame* frame, AVSubtitle* sub) {
 		do {
 			// 2.1 如果没有数据可读则唤醒read_thread, 实际是continue_read_thread SDL_cond
 			if (d->queue->nb_packets == 0)  // 没有数据可读
-				SDL_CondSignal(d->empty_queue_cond);// 通知read_thread放入packet
+				read_wakeup_signal_if_waiting(d->empty_queue_wakeup);// 通知read_thread放入packet
 			// 2.2 如果还有pending的packet则使用它
 			if (d->packet_pending) {
 				av_packet_move_ref(&pkt, &d->pkt);
 				d->packet_pending = 0;
 			}
 			else {
-				// 2.3 阻塞式读取packet
+				// 2.3 阻塞式读取packet，队列为空时记下等待的时间
+				wait_start = d->queue->nb_packets == 0 ? av_gettime_relative() : 0;
 				if (packet_queue_get(d->queue, &pkt, 1, &d->pkt_serial) < 0)
 					return -1;
+				if (wait_start)
+					d->wait_time += av_gettime_relative() - wait_start;
 			}
 			if (d->queue->serial != d->pkt_serial) {
 				printf("%s(%d) discontinue:queue->serial:%d,pkt_serial:%d\n",
-					__FUNCTION__, __LINE__, d->queue->serial, d->pkt_serial);
+					__FUNCTION__, __LINE__, d->queue->serial.load(), d->pkt_serial);
 				av_packet_unref(&pkt); // fixed me? 释放要过滤的packet
 			}
 		} while (d->queue->serial != d->pkt_serial);// 如果不是同一播放序列(流不连续)则继续读取
@@ -641,11 +1529,19 @@ static int decoder_decode_frame(Decoder* d, AVFrame* frame, AVSubtitle* sub) {
 				}
 			}
 			else {
-				if (avcodec_send_packet(d->avctx, &pkt) == AVERROR(EAGAIN)) {
+				int send_ret;
+				if (d->wait_keyframe && pkt.data && !(pkt.flags & AV_PKT_FLAG_KEY)) {
+					//解码器重新打开后，关键帧之前的包直接丢弃
+				}
+				else if ((send_ret = avcodec_send_packet(d->avctx, &pkt)) == AVERROR(EAGAIN)) {
 					av_log(d->avctx, AV_LOG_ERROR, "Receive_frame and send_packet both returned EAGAIN, which is an API violation.\n");
 					d->packet_pending = 1;
 					av_packet_move_ref(&d->pkt, &pkt);
 				}
+				else if (send_ret >= 0 && pkt.data) {
+					d->packets_sent++;
+					d->wait_keyframe = 0;
+				}
 			}
 			av_packet_unref(&pkt);	// 一定要自己去释放音视频数据
 		}
@@ -670,10 +1566,11 @@ static void frame_queue_unref_item(Frame* vp)
 /// </summary>
 /// <param name="f">：is->AVFrame队列</param>
 /// <param name="pktq">：is->AVPacket队列</param>
-/// <param name="max_size">：AVFrame队列的初始设定[视频：VIDEO_PICTURE_QUEUE_SIZE=3；音频：SAMPLE_QUEUE_SIZE=9]</param>
+/// <param name="capacity">：分配的槽位数，即深度的上限</param>
+/// <param name="max_size">：AVFrame队列的初始深度[视频：VIDEO_PICTURE_QUEUE_SIZE=3；音频：SAMPLE_QUEUE_SIZE=9]</param>
 /// <param name="keep_last">：默认传值1</param>
 /// <returns>0-成功</returns>
-static int frame_queue_init(FrameQueue* f, PacketQueue* pktq, int max_size, int keep_last)
+static int frame_queue_init(FrameQueue* f, PacketQueue* pktq, int capacity, int max_size, int keep_last)
 {
 	int i;
 	memset(f, 0, sizeof(FrameQueue));
@@ -686,10 +1583,15 @@ static int frame_queue_init(FrameQueue* f, PacketQueue* pktq, int max_size, int
 		return AVERROR(ENOMEM);
 	}
 	f->pktq = pktq;
-	f->max_size = FFMIN(max_size, FRAME_QUEUE_SIZE);
+	f->capacity = FFMAX(capacity, 1);
 	f->keep_last = !!keep_last;
+	//与frame_queue_set_depth相同，keep_last时深度至少为2
+	f->max_size = av_clip(max_size, FFMIN(1 + f->keep_last, f->capacity), f->capacity);
+	f->queue = (Frame*)av_mallocz_array(f->capacity, sizeof(Frame));
+	if (!f->queue)
+		return AVERROR(ENOMEM);
 	//为队列中所有的缓存帧预先申请内存
-	for (i = 0; i < f->max_size; i++)
+	for (i = 0; i < f->capacity; i++)
 		if (!(f->queue[i].frame = av_frame_alloc()))
 			return AVERROR(ENOMEM);
 	return 0;
@@ -699,22 +1601,36 @@ static int frame_queue_init(FrameQueue* f, PacketQueue* pktq, int max_size, int
 static void frame_queue_destory(FrameQueue* f)
 {
 	int i;
-	for (i = 0; i < f->max_size; i++) {
+	if (f->pushes)
+		av_log(NULL, AV_LOG_VERBOSE, "frame queue: %" PRId64 " frames, %" PRId64 " writer waits, %" PRId64 " reader waits\n",
+			f->pushes, f->write_waits, f->read_waits);
+	for (i = 0; f->queue && i < f->capacity; i++) {
 		Frame* vp = &f->queue[i];
 		frame_queue_unref_item(vp);
 		av_frame_free(&vp->frame);
 	}
+	av_freep(&f->queue);
 	SDL_DestroyMutex(f->mutex);
 	SDL_DestroyCond(f->cond);
 }
 
-//帧队列信号
+//帧队列信号（中止时唤醒所有等待方）
 static void frame_queue_signal(FrameQueue* f)
 {
 	SDL_LockMutex(f->mutex);
-	SDL_CondSignal(f->cond);
+	SDL_CondBroadcast(f->cond);
 	SDL_UnlockMutex(f->mutex);
 }
+
+//有一方登记了阻塞等待时才加锁唤醒，读写的快速路径不加锁
+static void frame_queue_wake(FrameQueue* f, int waiter)
+{
+	if (f->waiters.load() & waiter) {
+		SDL_LockMutex(f->mutex);
+		SDL_CondBroadcast(f->cond);
+		SDL_UnlockMutex(f->mutex);
+	}
+}
 /// <summary>
 /// 该函数返回当前可显示的帧，即读索引加上显示偏移量所指向的帧。​这对于在保留最后一帧的情况下，确保获取到正确的帧进行显示非常重要。
 /// </summary>
@@ -722,7 +1638,7 @@ static void frame_queue_signal(FrameQueue* f)
 /// <returns></returns>
 static Frame* frame_queue_peek(FrameQueue* f)
 {
-	return &f->queue[(f->rindex + f->rindex_shown) % f->max_size];
+	return &f->queue[(f->rindex.load(std::memory_order_relaxed) + f->rindex_shown.load(std::memory_order_relaxed)) % f->capacity];
 }
 /// <summary>
 /// 该函数返回在当前显示帧的基础上再前进一个位置。​这在需要预取或预览下一帧内容时非常有用。
@@ -731,7 +1647,7 @@ static Frame* frame_queue_peek(FrameQueue* f)
 /// <returns></returns>
 static Frame* frame_queue_peek_next(FrameQueue* f)
 {
-	return &f->queue[(f->rindex + f->rindex_shown + 1) % f->max_size];
+	return &f->queue[(f->rindex.load(std::memory_order_relaxed) + f->rindex_shown.load(std::memory_order_relaxed) + 1) % f->capacity];
 }
 /// <summary>
 /// 该函数返回最后一个已显示的帧，即当前读索引所指向的帧。​这对于需要重新渲染或重复显示最后一帧的场景非常有用。
@@ -740,7 +1656,7 @@ static Frame* frame_queue_peek_next(FrameQueue* f)
 /// <returns></returns>
 static Frame* frame_queue_peek_last(FrameQueue* f)
 {
-	return &f->queue[f->rindex];
+	return &f->queue[f->rindex.load(std::memory_order_relaxed)];
 }
 /// <summary>
 /// 该函数用于获取一个可写入的新帧位置。​如果帧队列已满，函数会等待直到有空间可写或接收到中止请求。​这确保了生产者线程在队列满时不会覆盖未处理的帧。​
@@ -750,14 +1666,21 @@ static Frame* frame_queue_peek_last(FrameQueue* f)
 static Frame* frame_queue_peek_writable(FrameQueue* f)
 {
 	/* wait until we have space to put a new frame */
-	SDL_LockMutex(f->mutex);
-	while (f->size >= f->max_size &&!f->pktq->abort_request) {
-		SDL_CondWait(f->cond, f->mutex);
+	for (;;) {
+		if (f->pktq->abort_request)
+			return NULL;
+		//size的递减发生在消费者释放槽位之后，看到有空位即可安全写入
+		if (f->size.load() < f->max_size)
+			return &f->queue[f->windex.load(std::memory_order_relaxed)];
+		//先登记等待标志再复查，与消费者“先更新size再检查等待标志”配合，避免丢失唤醒
+		SDL_LockMutex(f->mutex);
+		f->waiters.fetch_or(FRAME_QUEUE_WAIT_WRITE);
+		f->write_waits++;
+		while (f->size.load() >= f->max_size && !f->pktq->abort_request)
+			SDL_CondWait(f->cond, f->mutex);
+		f->waiters.fetch_and(~FRAME_QUEUE_WAIT_WRITE);
+		SDL_UnlockMutex(f->mutex);
 	}
-	SDL_UnlockMutex(f->mutex);
-	if (f->pktq->abort_request)
-		return NULL;
-	return &f->queue[f->windex];
 }
 /// <summary>
 /// 该函数用于获取一个可读取的帧。​如果没有可读帧，函数会等待直到有新帧可读或接收到中止请求。​这确保了消费者线程在没有可用帧时不会读取无效数据。
@@ -767,17 +1690,21 @@ static Frame* frame_queue_peek_writable(FrameQueue* f)
 static Frame* frame_queue_peek_readable(FrameQueue* f)
 {
 	/* wait until we have a readable a new frame */
-	SDL_LockMutex(f->mutex);
-	while (f->size - f->rindex_shown <= 0 &&
-		!f->pktq->abort_request) {
-		SDL_CondWait(f->cond, f->mutex);
+	for (;;) {
+		if (f->pktq->abort_request)
+			return NULL;
+		//size的递增发生在生产者写完帧之后，看到新帧即可安全读取
+		if (f->size.load() - f->rindex_shown.load(std::memory_order_relaxed) > 0)
+			return frame_queue_peek(f);
+		SDL_LockMutex(f->mutex);
+		f->waiters.fetch_or(FRAME_QUEUE_WAIT_READ);
+		f->read_waits++;
+		while (f->size.load() - f->rindex_shown.load(std::memory_order_relaxed) <= 0 &&
+			!f->pktq->abort_request)
+			SDL_CondWait(f->cond, f->mutex);
+		f->waiters.fetch_and(~FRAME_QUEUE_WAIT_READ);
+		SDL_UnlockMutex(f->mutex);
 	}
-	SDL_UnlockMutex(f->mutex);
-
-	if (f->pktq->abort_request)
-		return NULL;
-
-	return &f->queue[(f->rindex + f->rindex_shown) % f->max_size];
 }
 /// <summary>
 /// 该函数在帧被写入后调用，移动写索引并更新队列大小。​如果写索引达到最大值，则循环回到起始位置。​同时，函数会发出信号通知可能等待的读取操作。
@@ -785,12 +1712,12 @@ static Frame* frame_queue_peek_readable(FrameQueue* f)
 /// <param name="f"></param>
 static void frame_queue_push(FrameQueue* f)
 {
-	if (++f->windex == f->max_size)
-		f->windex = 0;
-	SDL_LockMutex(f->mutex);
-	f->size++;
-	SDL_CondSignal(f->cond);
-	SDL_UnlockMutex(f->mutex);
+	int w = f->windex.load(std::memory_order_relaxed) + 1;
+	f->windex.store(w == f->capacity ? 0 : w, std::memory_order_relaxed);
+	f->pushes++;
+	//发布新帧：之前对槽位的写入对看到新size的消费者可见
+	f->size.fetch_add(1);
+	frame_queue_wake(f, FRAME_QUEUE_WAIT_READ);
 }
 /// <summary>
 /// 该函数在帧被消费后调用，移动读索引并更新队列大小。​如果设置了 keep_last，则保留最后一帧以供重复显示。​同时，函数会发出信号通知可能等待的写入操作。
@@ -800,18 +1727,22 @@ static void frame_queue_next(FrameQueue* f)
 {
 	//start
 	//第一帧会进入，此后不会进入
-	if (f->keep_last && !f->rindex_shown) {
-		f->rindex_shown = 1;
+	int r;
+
+	if (f->keep_last && !f->rindex_shown.load(std::memory_order_relaxed)) {
+		f->rindex_shown.store(1);
 		return;
 	}
 	//end
-	frame_queue_unref_item(&f->queue[f->rindex]);
-	if (++f->rindex == f->max_size)
-		f->rindex = 0;
-	SDL_LockMutex(f->mutex);
-	f->size--;
-	SDL_CondSignal(f->cond);
-	SDL_UnlockMutex(f->mutex);
+	r = f->rindex.load(std::memory_order_relaxed);
+	frame_queue_unref_item(&f->queue[r]);
+	f->rindex.store(r + 1 == f->capacity ? 0 : r + 1, std::memory_order_relaxed);
+	//归还槽位：释放帧之后再递减size，生产者看到空位时该槽位已可写
+	f->size.fetch_sub(1);
+	frame_queue_wake(f, FRAME_QUEUE_WAIT_WRITE);
+	//帧和包都已排空时通知read_thread（读到结尾后据此判断播放结束）
+	if (f->size.load() - f->rindex_shown.load() <= 0 && f->pktq->nb_packets == 0)
+		read_wakeup_signal_if_waiting(f->pktq->wakeup);
 }
 
 /// <summary>
@@ -832,13 +1763,525 @@ static int frame_queue_nb_remaining(FrameQueue* f)
 /// <returns></returns>
 static int64_t frame_queue_last_pos(FrameQueue* f)
 {
-	Frame* fp = &f->queue[f->rindex];
+	Frame* fp = frame_queue_peek_last(f);
 	if (f->rindex_shown && fp->serial == f->pktq->serial)
 		return fp->pos;
 	else
 		return -1;
 }
 
+//调整队列深度（只由生产者调用），变浅时已入队的帧不受影响，消费到新深度以下后才能继续写入
+//keep_last时保留的已显示帧也占一个位置，深度至少要再多一帧，否则生产者等空位、消费者等新帧，互相等待
+static void frame_queue_set_depth(FrameQueue* f, int depth)
+{
+	f->max_size = av_clip(depth, FFMIN(1 + f->keep_last, f->capacity), f->capacity);
+}
+
+static void frame_queue_depth_init(FrameQueueDepth* d, FrameQueue* f, int min_depth, int64_t budget)
+{
+	memset(d, 0, sizeof(FrameQueueDepth));
+	d->max_depth = f->capacity;
+	d->min_depth = av_clip(min_depth, 1, d->max_depth);
+	d->budget = budget;
+	d->last_serial = -1;
+	frame_queue_set_depth(f, d->min_depth);
+}
+
+/// <summary>
+/// 每解码出一帧视频后调用：按出帧耗时的抖动估计需要缓冲的帧数，按帧大小和内存预算限制，调整帧队列深度
+/// </summary>
+/// <param name="d"></param>
+/// <param name="f">视频帧队列</param>
+/// <param name="frame">解码出的帧</param>
+/// <param name="decode_time">得到这一帧的耗时（微秒，不含等待帧队列空位和等待数据包的时间）</param>
+/// <param name="frame_duration">一帧的显示时长（秒）</param>
+/// <param name="serial">帧的播放序列</param>
+static void frame_queue_depth_update(FrameQueueDepth* d, FrameQueue* f, AVFrame* frame, int64_t decode_time, double frame_duration, int serial)
+{
+	double t = decode_time / 1000000.0;
+	int depth = f->max_size.load();
+	int want, limit;
+
+	if (serial != d->last_serial) {
+		d->last_serial = serial;
+		return;
+	}
+	if (frame_duration <= 0)
+		frame_duration = 1.0 / 25;
+	d->frame_bytes = av_image_get_buffer_size((AVPixelFormat)frame->format, frame->width, frame->height, 1);
+	if (!d->nb_samples++) {
+		d->decode_avg = t;
+		d->decode_dev = t / 2;
+	}
+	else {
+		d->decode_dev += (fabs(t - d->decode_avg) - d->decode_dev) / 8;
+		d->decode_avg += (t - d->decode_avg) / 16;
+	}
+	//覆盖一次耗时峰值所需的帧数，加上保留的已显示帧和正在等待显示的帧
+	want = (int)ceil((d->decode_avg + 4 * d->decode_dev) / frame_duration) + 2;
+	limit = d->max_depth;
+	if (d->frame_bytes > 0)
+		limit = (int)FFMIN(limit, d->budget / d->frame_bytes);
+	want = av_clip(want, d->min_depth, FFMAX(limit, d->min_depth));
+	if (want > depth) {
+		d->shrink_count = 0;
+	}
+	else if (want < depth && ++d->shrink_count >= FRAME_QUEUE_SHRINK_FRAMES) {
+		d->shrink_count = 0;
+		want = depth - 1;
+	}
+	else {
+		if (want == depth)
+			d->shrink_count = 0;
+		return;
+	}
+	frame_queue_set_depth(f, want);
+	d->changes++;
+	av_log(NULL, AV_LOG_VERBOSE, "video frame queue depth %d -> %d (decode %.1fms +- %.1fms, frame %d bytes)\n",
+		depth, want, d->decode_avg * 1000, d->decode_dev * 1000, d->frame_bytes);
+}
+
+static const enum AVDiscard skip_frame_discard[SKIP_LEVEL_NB] = {
+	AVDISCARD_DEFAULT, AVDISCARD_NONREF, AVDISCARD_BIDIR, AVDISCARD_NONKEY
+};
+
+//seek后解码器被清空，重新开始估计
+static void skip_frame_reset(SkipFrameControl* s, Decoder* d)
+{
+	s->lag_valid = 0;
+	s->serial = d->pkt_serial;
+	s->last_pending = d->packets_sent - d->frames_received;
+	s->next_change = av_gettime_relative() + SKIP_FRAME_HOLD_TIME;
+}
+
+static void skip_frame_init(SkipFrameControl* s, Decoder* d)
+{
+	memset(s, 0, sizeof(SkipFrameControl));
+	s->lower_hold = SKIP_FRAME_HOLD_TIME;
+	s->last_raise = s->last_lower = INT64_MIN / 2;
+	d->avctx->skip_frame = AVDISCARD_DEFAULT;
+	skip_frame_reset(s, d);
+}
+
+static void skip_frame_set_level(SkipFrameControl* s, Decoder* d, int level, int64_t now)
+{
+	av_log(NULL, AV_LOG_VERBOSE, "video skip_frame level %d -> %d (lag %.1fms)\n", s->level, level, s->lag * 1000);
+	s->level = level;
+	//解码线程在两次送包之间修改，帧线程会在下一个包送入时同步该值
+	d->avctx->skip_frame = skip_frame_discard[FFMAX(level, s->floor)];
+	s->lag_valid = 0;
+	s->next_change = now + SKIP_FRAME_HOLD_TIME;
+}
+
+/// <summary>
+/// 视频解码线程每输出一帧调用一次，按视频落后主时钟的时间调整skip_frame
+/// </summary>
+/// <param name="s"></param>
+/// <param name="d">视频解码器</param>
+/// <param name="lag">该帧落后主时钟的时间（秒），为负表示领先，未知时为NAN</param>
+static void skip_frame_update(SkipFrameControl* s, Decoder* d, double lag)
+{
+	int64_t now = av_gettime_relative();
+	int64_t pending = d->packets_sent - d->frames_received;
+	int level;
+
+	if (s->serial != d->pkt_serial) {
+		skip_frame_reset(s, d);
+		return;
+	}
+	level = FFMAX(s->level, s->floor);
+	if (level > SKIP_LEVEL_NONE)
+		s->skipped[level] = FFMAX(s->skipped[level] + pending - s->last_pending, 0);
+	s->last_pending = pending;
+	if (isnan(lag) || fabs(lag) > AV_NOSYNC_THRESHOLD)
+		return;
+	s->lag = s->lag_valid ? s->lag * 0.9 + lag * 0.1 : lag;
+	s->lag_valid = 1;
+	if (now < s->next_change)
+		return;
+	if (s->lag > SKIP_FRAME_RAISE_LAG && s->level < SKIP_LEVEL_NB - 1) {
+		//刚降级不久又落后，说明降得太早，下次多观察一段时间；长时间稳定后恢复
+		if (now - s->last_lower < 2 * s->lower_hold)
+			s->lower_hold = FFMIN(s->lower_hold * 2, SKIP_FRAME_MAX_HOLD_TIME);
+		else if (now - s->last_lower > SKIP_FRAME_MAX_HOLD_TIME)
+			s->lower_hold = SKIP_FRAME_HOLD_TIME;
+		s->raises++;
+		s->last_raise = now;
+		skip_frame_set_level(s, d, s->level + 1, now);
+	}
+	else if (s->lag < -SKIP_FRAME_LOWER_LEAD && s->level > SKIP_LEVEL_NONE &&
+		now - s->last_raise >= s->lower_hold) {
+		s->lowers++;
+		s->last_lower = now;
+		skip_frame_set_level(s, d, s->level - 1, now);
+	}
+}
+
+//设置画质阶梯要求的最低级别
+static void skip_frame_set_floor(SkipFrameControl* s, Decoder* d, int floor)
+{
+	s->floor = floor;
+	d->avctx->skip_frame = skip_frame_discard[FFMAX(s->level, floor)];
+}
+
+static const char* quality_level_name(int level)
+{
+	static const char* names[QUALITY_LEVEL_NB] = { "full", "skip_loop_filter", "skip_idct", "lowres", "keyframe" };
+	return level >= 0 && level < QUALITY_LEVEL_NB ? names[level] : "unknown";
+}
+
+static void quality_ladder_init(QualityLadder* q, Decoder* d, int enabled)
+{
+	memset(q, 0, sizeof(QualityLadder));
+	q->enabled = enabled;
+	q->lowres_supported = av_codec_get_max_lowres(d->avctx->codec) > 0;
+	q->serial = d->pkt_serial;
+	q->last_packets = d->packets_sent;
+	q->restore_hold = QUALITY_HOLD_TIME;
+	q->last_degrade = q->last_restore = INT64_MIN / 2;
+}
+
+//把当前级别应用到解码器（lowres需要重新打开解码器，由调用方处理）
+static void quality_ladder_apply(QualityLadder* q, Decoder* d, SkipFrameControl* s)
+{
+	d->avctx->skip_loop_filter = q->level >= QUALITY_LEVEL_SKIP_LOOP_FILTER ? AVDISCARD_ALL : AVDISCARD_DEFAULT;
+	d->avctx->skip_idct = q->level >= QUALITY_LEVEL_SKIP_IDCT ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+	skip_frame_set_floor(s, d, q->level >= QUALITY_LEVEL_KEYFRAME ? SKIP_LEVEL_NONKEY : SKIP_LEVEL_NONE);
+}
+
+//显示区域远小于图像时，选择缩小后仍不小于显示区域的最大lowres，缩小后SDL不需要再放大
+static int display_lowres_for_rect(int pic_width, int pic_height, int rect_width, int rect_height)
+{
+	int lowres = 0;
+
+	if (pic_width <= 0 || pic_height <= 0)
+		return 0;
+	while (lowres < DISPLAY_LOWRES_MAX &&
+		AV_CEIL_RSHIFT(pic_width, lowres + 1) >= rect_width &&
+		AV_CEIL_RSHIFT(pic_height, lowres + 1) >= rect_height)
+		lowres++;
+	return lowres;
+}
+
+//当前级别要求的lowres
+static int quality_ladder_lowres(QualityLadder* q)
+{
+	return q->level >= QUALITY_LEVEL_LOWRES && q->lowres_supported ? 1 : 0;
+}
+
+static void quality_ladder_set_level(QualityLadder* q, Decoder* d, SkipFrameControl* s, int level, int64_t now)
+{
+	av_log(NULL, AV_LOG_INFO, "video quality %s -> %s (decode load %.2f)\n",
+		quality_level_name(q->level), quality_level_name(level), q->load);
+	q->level = level;
+	q->max_level = FFMAX(q->max_level, level);
+	q->changes++;
+	q->nb_samples = 0;
+	q->next_change = now + QUALITY_HOLD_TIME;
+	quality_ladder_apply(q, d, s);
+}
+
+/// <summary>
+/// 视频解码线程每次调用get_video_frame后调用，按解码负载调整画质级别
+/// </summary>
+/// <param name="q"></param>
+/// <param name="d">视频解码器</param>
+/// <param name="s">解码前丢帧的控制器，只解码关键帧一级通过它生效</param>
+/// <param name="elapsed">本次get_video_frame的耗时（微秒，不含等待数据包的时间）</param>
+/// <param name="frame_duration">按播放速率折算后的帧时长（秒）</param>
+/// <param name="starved">本次调用中等待过数据包，解码受输入限制，不作为负载样本</param>
+static void quality_ladder_update(QualityLadder* q, Decoder* d, SkipFrameControl* s, int64_t elapsed, double frame_duration, int starved)
+{
+	int64_t now = av_gettime_relative();
+	int64_t packets = d->packets_sent - q->last_packets;
+	double sample;
+	int level;
+
+	if (!q->enabled || frame_duration <= 0)
+		return;
+	if (q->serial != d->pkt_serial || starved) {
+		q->serial = d->pkt_serial;
+		q->busy = 0;
+		q->last_packets = d->packets_sent;
+		return;
+	}
+	//帧线程下一次调用可能只送包不出帧，耗时累计到送入了数据包时再分摊
+	q->busy += elapsed;
+	if (packets <= 0)
+		return;
+	sample = q->busy / 1000000.0 / packets / frame_duration;
+	q->busy = 0;
+	q->last_packets = d->packets_sent;
+	q->load = q->nb_samples ? q->load * 0.95 + sample * 0.05 : sample;
+	q->nb_samples++;
+	if (now < q->next_change || q->nb_samples < QUALITY_HOLD_FRAMES)
+		return;
+	if (q->load > QUALITY_DEGRADE_LOAD && q->level < QUALITY_LEVEL_NB - 1) {
+		level = q->level + 1;
+		if (level == QUALITY_LEVEL_LOWRES && !q->lowres_supported)
+			level++;
+		//刚恢复不久又过载，说明恢复得太早，下次多观察一段时间；长时间稳定后复原
+		if (now - q->last_restore < 2 * q->restore_hold)
+			q->restore_hold = FFMIN(q->restore_hold * 2, QUALITY_MAX_HOLD_TIME);
+		else if (now - q->last_restore > QUALITY_MAX_HOLD_TIME)
+			q->restore_hold = QUALITY_HOLD_TIME;
+		q->last_degrade = now;
+		quality_ladder_set_level(q, d, s, level, now);
+	}
+	else if (q->load < QUALITY_RESTORE_LOAD && q->level > QUALITY_LEVEL_FULL &&
+		now - q->last_degrade >= q->restore_hold) {
+		level = q->level - 1;
+		if (level == QUALITY_LEVEL_LOWRES && !q->lowres_supported)
+			level--;
+		q->last_restore = now;
+		quality_ladder_set_level(q, d, s, level, now);
+	}
+}
+
+//纹理格式和尺寸合成一个值，便于两个线程原子地比较
+static int64_t texture_slot_key(Uint32 sdl_format, int width, int height)
+{
+	if (width <= 0 || height <= 0 || width > 0xFFFF || height > 0xFFFF)
+		return 0;
+	return ((int64_t)sdl_format << 32) | ((int64_t)width << 16) | height;
+}
+
+/// <summary>
+/// 视频解码线程把帧写入槽位上已锁定的纹理
+/// </summary>
+/// <param name="slot">帧所在槽位的纹理</param>
+/// <param name="want_key">发布这一帧需要的纹理格式和尺寸，供渲染线程准备纹理</param>
+/// <param name="repack">帧的像素格式对应的纹理格式（pixel_repack_find），为NULL时用swscale转换为BGRA</param>
+/// <param name="convert_pool">转换为BGRA用的分片转换池</param>
+/// <param name="frame">解码输出的帧</param>
+/// <returns>1-已写入；0-纹理没有准备好，按原方式由渲染线程上传</returns>
+static int texture_slot_stage(TextureSlot* slot, std::atomic<int64_t>* want_key, const PixelRepack* repack,
+	SwsSlicePool* convert_pool, AVFrame* frame)
+{
+	int64_t key = texture_slot_key(repack ? repack->sdl_format : SDL_PIXELFORMAT_ARGB8888, frame->width, frame->height);
+
+	want_key->store(key);
+	if (!key || slot->state.load(std::memory_order_acquire) != TEXTURE_SLOT_READY)
+		return 0;
+	if (slot->key != key) {
+		slot->state.store(TEXTURE_SLOT_STALE, std::memory_order_release);
+		return 0;
+	}
+	//linesize为负（倒置的图像）时逐行重排会顺带翻正
+	if (repack)
+		repack->convert(frame, slot->pixels, slot->pitch);
+	else if (sws_slice_convert(convert_pool, frame, AV_PIX_FMT_BGRA, slot->pixels[0], slot->pitch[0]) < 0)
+		return 0;
+	return 1;
+}
+
+/// <summary>
+/// 发布新的显示区域（只能由一个线程调用）
+/// </summary>
+/// <param name="latch"></param>
+/// <param name="x">相对播放控件的左上角横坐标</param>
+/// <param name="y">相对播放控件的左上角纵坐标</param>
+/// <param name="w">宽</param>
+/// <param name="h">高</param>
+static void show_rect_publish(ShowRectLatch* latch, int x, int y, int w, int h)
+{
+	unsigned seq = latch->seq.load(std::memory_order_relaxed);
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		//读方转向另一份副本后再修改这一份；release栅栏保证读到新值的读方也能看到新的seq
+		latch->seq.store(seq + i + 1, i ? std::memory_order_release : std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		latch->copy[(seq + i) & 1].x.store(x, std::memory_order_relaxed);
+		latch->copy[(seq + i) & 1].y.store(y, std::memory_order_relaxed);
+		latch->copy[(seq + i) & 1].w.store(w, std::memory_order_relaxed);
+		latch->copy[(seq + i) & 1].h.store(h, std::memory_order_relaxed);
+	}
+}
+
+/// <summary>
+/// 读取最近发布的显示区域
+/// </summary>
+/// <param name="latch"></param>
+/// <param name="rect">输出的区域，还没有发布过时为全0</param>
+static void show_rect_read(ShowRectLatch* latch, SDL_Rect* rect)
+{
+	unsigned seq;
+	ShowRect* copy;
+
+	do {
+		seq = latch->seq.load(std::memory_order_acquire);
+		copy = &latch->copy[seq & 1];
+		rect->x = copy->x.load(std::memory_order_relaxed);
+		rect->y = copy->y.load(std::memory_order_relaxed);
+		rect->w = copy->w.load(std::memory_order_relaxed);
+		rect->h = copy->h.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+	} while (latch->seq.load(std::memory_order_relaxed) != seq);
+}
+
+/// <summary>
+/// 在解码线程中以新的lowres重新打开解码器，不重启流。
+/// 旧解码器中缓存的帧被丢弃，之后丢弃数据包直到下一个关键帧；跳帧设置和帧缓冲池沿用旧解码器的。
+/// </summary>
+/// <param name="d">解码器</param>
+/// <param name="st">解码器对应的流</param>
+/// <param name="lowres">新的lowres，超过解码器支持的上限时取上限</param>
+/// <returns>0-成功；失败时继续使用旧解码器</returns>
+static int decoder_reopen(Decoder* d, AVStream* st, int lowres)
+{
+	AVCodecContext* avctx, * old = d->avctx;
+	const AVCodec* codec = old->codec;
+	AVDictionary* opts = NULL;
+	int ret;
+
+	avctx = avcodec_alloc_context3(NULL);
+	if (!avctx)
+		return AVERROR(ENOMEM);
+	if ((ret = avcodec_parameters_to_context(avctx, st->codecpar)) < 0)
+		goto fail;
+	av_codec_set_pkt_timebase(avctx, st->time_base);
+	avctx->codec_id = codec->id;
+	lowres = FFMIN(lowres, av_codec_get_max_lowres(codec));
+	av_codec_set_lowres(avctx, lowres);
+	if (lowres)
+		av_dict_set_int(&opts, "lowres", lowres, 0);
+	decoder_profile_apply(avctx, &opts);
+	av_dict_set(&opts, "refcounted_frames", "1", 0);
+	if (old->get_buffer2 == frame_pool_get_buffer2) {
+		avctx->opaque = old->opaque;
+		avctx->get_buffer2 = frame_pool_get_buffer2;
+		avctx->thread_safe_callbacks = 1;
+	}
+	avctx->skip_frame = old->skip_frame;
+	avctx->skip_loop_filter = old->skip_loop_filter;
+	avctx->skip_idct = old->skip_idct;
+	if ((ret = avcodec_open2(avctx, codec, &opts)) < 0)
+		goto fail;
+	av_dict_free(&opts);
+	av_log(NULL, AV_LOG_INFO, "video decoder reopened with lowres %d\n", lowres);
+	d->avctx = avctx;
+	avcodec_free_context(&old);
+	d->wait_keyframe = 1;
+	return 0;
+fail:
+	av_log(NULL, AV_LOG_WARNING, "video decoder reopen with lowres %d failed\n", lowres);
+	av_dict_free(&opts);
+	avcodec_free_context(&avctx);
+	return ret;
+}
+
+//按设备格式分配PCM环形缓冲区
+static int audio_ring_init(AudioRing* r, int bytes_per_sec, int hw_buf_size)
+{
+	int capacity = 1;
+
+	r->target = FFMAX(2 * hw_buf_size, (int)(bytes_per_sec * AUDIO_RING_MIN_DURATION));
+	//除保持的数据外还要放得下最长的一段（半速播放时一帧可能有0.2秒以上）
+	while (capacity < r->target + bytes_per_sec / 2)
+		capacity <<= 1;
+	r->data = (uint8_t*)av_malloc(capacity);
+	if (!r->data)
+		return AVERROR(ENOMEM);
+	r->capacity = capacity;
+	r->windex = 0;
+	r->rindex = 0;
+	r->chunk_windex = 0;
+	r->chunk_rindex = 0;
+	r->abort_request = 0;
+	r->callbacks = 0;
+	r->underruns = 0;
+	r->underrun_bytes = 0;
+	return 0;
+}
+
+static void audio_ring_destroy(AudioRing* r)
+{
+	if (r->callbacks)
+		av_log(NULL, AV_LOG_INFO, "audio ring: %" PRId64 " callbacks, %" PRId64 " underruns (%" PRId64 " bytes of silence)\n",
+			r->callbacks.load(), r->underruns.load(), r->underrun_bytes.load());
+	av_freep(&r->data);
+	r->capacity = 0;
+}
+
+//已缓冲、尚未被回调取走的字节数
+static int audio_ring_filled(AudioRing* r)
+{
+	return (int)(r->windex.load() - r->rindex.load());
+}
+
+/// <summary>
+/// 生产线程写入一段PCM，空间不足时轮询等待回调取走数据
+/// </summary>
+/// <param name="r"></param>
+/// <param name="buf">设备格式的PCM</param>
+/// <param name="size">字节数，超过容量的部分被截掉</param>
+/// <param name="serial">播放序列</param>
+/// <param name="clock">该段结束位置的音频时钟</param>
+/// <param name="rate">播放速率</param>
+/// <param name="poll_us">轮询间隔（微秒）</param>
+/// <returns>0-成功；<0-已中止</returns>
+static int audio_ring_write(AudioRing* r, const uint8_t* buf, int size, int serial, double clock, double rate, int poll_us)
+{
+	uint64_t w, cw;
+	int pos, n;
+	AudioChunk* chunk;
+
+	size = FFMIN(size, r->capacity);
+	while (!r->abort_request &&
+		(r->windex.load(std::memory_order_relaxed) + size - r->rindex.load(std::memory_order_acquire) > (uint64_t)r->capacity ||
+			r->chunk_windex.load(std::memory_order_relaxed) - r->chunk_rindex.load(std::memory_order_acquire) >= AUDIO_RING_CHUNKS))
+		av_usleep(poll_us);
+	if (r->abort_request)
+		return -1;
+	w = r->windex.load(std::memory_order_relaxed);
+	pos = (int)(w & (r->capacity - 1));
+	n = FFMIN(size, r->capacity - pos);
+	memcpy(r->data + pos, buf, n);
+	memcpy(r->data, buf + n, size - n);
+	r->windex.store(w + size, std::memory_order_release);
+
+	cw = r->chunk_windex.load(std::memory_order_relaxed);
+	chunk = &r->chunks[cw & (AUDIO_RING_CHUNKS - 1)];
+	chunk->size = size;
+	chunk->serial = serial;
+	chunk->clock = clock;
+	chunk->rate = rate;
+	r->chunk_windex.store(cw + 1, std::memory_order_release);
+	return 0;
+}
+
+//回调取出下一段的描述，没有时返回0；段中的数据随后用audio_ring_read读取
+static int audio_ring_next_chunk(AudioRing* r, AudioChunk* chunk)
+{
+	uint64_t cr = r->chunk_rindex.load(std::memory_order_relaxed);
+
+	if (cr == r->chunk_windex.load(std::memory_order_acquire))
+		return 0;
+	*chunk = r->chunks[cr & (AUDIO_RING_CHUNKS - 1)];
+	r->chunk_rindex.store(cr + 1, std::memory_order_release);
+	return 1;
+}
+
+//回调读取len字节到SDL缓冲区（dst为NULL时直接丢弃），音量不是最大时混音
+static void audio_ring_read(AudioRing* r, uint8_t* dst, int len, int volume)
+{
+	uint64_t rd = r->rindex.load(std::memory_order_relaxed);
+	int pos = (int)(rd & (r->capacity - 1));
+	int n = FFMIN(len, r->capacity - pos);
+
+	if (dst && volume == SDL_MIX_MAXVOLUME) {
+		memcpy(dst, r->data + pos, n);
+		memcpy(dst + n, r->data, len - n);
+	}
+	else if (dst) {
+		memset(dst, 0, len);
+		SDL_MixAudio(dst, r->data + pos, n, volume);
+		SDL_MixAudio(dst + n, r->data, len - n, volume);
+	}
+	r->rindex.store(rd + len, std::memory_order_release);
+}
+
 static void decoder_abort(Decoder* d, FrameQueue* fq)
 {
 	packet_queue_abort(d->queue);
@@ -0,0 +1,371 @@
+﻿/*
+ * @file 	decoderprofile.cpp
+ *
+ * @brief 	按编码格式和分辨率选择解码器的线程配置
+ * @note
+ */
+
+#include <QFile>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+
+#include <inttypes.h>
+#include <limits.h>
+#include "decoderprofile.h"
+
+#define PIXELS_720P (1280 * 720)
+#define PIXELS_4K (3840 * 2160)
+#define PIXELS_8K (7680 * 4320)
+
+//内置配置表，按顺序取第一条匹配项
+static const DecoderProfile builtin_profiles[] = {
+	//8K：帧线程+切片线程，并允许不严格符合规范的加速
+	{ AV_CODEC_ID_NONE, PIXELS_8K, 0, 0, FF_THREAD_FRAME | FF_THREAD_SLICE, AV_CODEC_FLAG2_FAST },
+	//低分辨率的H.264/HEVC解码很快，少开帧线程以减少延迟和参考帧内存
+	{ AV_CODEC_ID_H264, 0, PIXELS_720P - 1, 2, FF_THREAD_FRAME, 0 },
+	{ AV_CODEC_ID_HEVC, 0, PIXELS_720P - 1, 2, FF_THREAD_FRAME | FF_THREAD_SLICE, 0 },
+	//VP9的切片线程按tile列划分，大多数码流tile列很少，以帧线程为主
+	{ AV_CODEC_ID_VP9, 0, 0, 0, FF_THREAD_FRAME, 0 },
+	//每行宏块一个切片或按切片独立编码的格式，切片线程没有额外延迟且扩展性好
+	{ AV_CODEC_ID_MPEG2VIDEO, 0, 0, 0, FF_THREAD_SLICE, 0 },
+	{ AV_CODEC_ID_DNXHD, 0, 0, 0, FF_THREAD_SLICE, 0 },
+	{ AV_CODEC_ID_FFV1, 0, 0, 0, FF_THREAD_SLICE, 0 },
+	//其余与FFmpeg默认一致
+	{ AV_CODEC_ID_NONE, 0, 0, 0, FF_THREAD_FRAME | FF_THREAD_SLICE, 0 },
+};
+
+static std::mutex override_mutex;
+static std::vector<DecoderProfile> override_profiles;
+
+static int decoder_profile_match(const DecoderProfile* p, enum AVCodecID codec_id, int64_t pixels)
+{
+	return (p->codec_id == AV_CODEC_ID_NONE || p->codec_id == codec_id) &&
+		pixels >= p->min_pixels &&
+		(p->max_pixels <= 0 || pixels <= p->max_pixels);
+}
+
+//分辨率可以写成"1920x1080"、"hd1080"等，也可以直接写像素数
+static int decoder_profile_parse_pixels(const char* value, int* pixels)
+{
+	int w, h;
+	char* end;
+	long n;
+
+	if (av_parse_video_size(&w, &h, value) >= 0) {
+		*pixels = w * h;
+		return 0;
+	}
+	n = strtol(value, &end, 10);
+	if (end == value || *end || n < 0 || n > INT_MAX)
+		return -1;
+	*pixels = (int)n;
+	return 0;
+}
+
+static int decoder_profile_parse(const char* spec, DecoderProfile* p)
+{
+	AVDictionary* d = NULL;
+	AVDictionaryEntry* e = NULL;
+	const AVCodecDescriptor* desc;
+	int ret = 0;
+
+	memset(p, 0, sizeof(*p));
+	p->codec_id = AV_CODEC_ID_NONE;
+	p->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+	if (av_dict_parse_string(&d, spec, "=", ",", 0) < 0 || !av_dict_count(d))
+		ret = -1;
+	while (!ret && (e = av_dict_get(d, "", e, AV_DICT_IGNORE_SUFFIX))) {
+		if (!strcmp(e->key, "codec")) {
+			desc = avcodec_descriptor_get_by_name(e->value);
+			if (desc)
+				p->codec_id = desc->id;
+			else
+				ret = -1;
+		} else if (!strcmp(e->key, "min")) {
+			ret = decoder_profile_parse_pixels(e->value, &p->min_pixels);
+		} else if (!strcmp(e->key, "max")) {
+			ret = decoder_profile_parse_pixels(e->value, &p->max_pixels);
+		} else if (!strcmp(e->key, "threads")) {
+			p->thread_count = strcmp(e->value, "auto") ? atoi(e->value) : 0;
+			if (p->thread_count < 0)
+				ret = -1;
+		} else if (!strcmp(e->key, "type")) {
+			p->thread_type = (strstr(e->value, "frame") ? FF_THREAD_FRAME : 0) |
+				(strstr(e->value, "slice") ? FF_THREAD_SLICE : 0);
+		} else if (!strcmp(e->key, "fast")) {
+			p->flags2 = atoi(e->value) ? AV_CODEC_FLAG2_FAST : 0;
+		} else {
+			ret = -1;
+		}
+	}
+	av_dict_free(&d);
+	return ret;
+}
+
+int decoder_profile_set_overrides(const QStringList& listProfiles)
+{
+	std::vector<DecoderProfile> profiles;
+	DecoderProfile p;
+
+	for (const QString& strProfile : listProfiles) {
+		QByteArray spec = strProfile.trimmed().toUtf8();
+		if (spec.isEmpty())
+			continue;
+		if (decoder_profile_parse(spec.constData(), &p) < 0) {
+			av_log(NULL, AV_LOG_WARNING, "decoder profile: ignoring invalid entry '%s'\n", spec.constData());
+			continue;
+		}
+		profiles.push_back(p);
+	}
+	std::lock_guard<std::mutex> lock(override_mutex);
+	override_profiles.swap(profiles);
+	return (int)override_profiles.size();
+}
+
+void decoder_profile_find(enum AVCodecID codec_id, int width, int height, DecoderProfile* profile)
+{
+	int64_t pixels = (int64_t)FFMAX(width, 0) * FFMAX(height, 0);
+	size_t i;
+
+	{
+		std::lock_guard<std::mutex> lock(override_mutex);
+		for (i = 0; i < override_profiles.size(); i++) {
+			if (decoder_profile_match(&override_profiles[i], codec_id, pixels)) {
+				*profile = override_profiles[i];
+				return;
+			}
+		}
+	}
+	//内置表的最后一项匹配所有格式
+	for (i = 0; i < FF_ARRAY_ELEMS(builtin_profiles); i++) {
+		if (decoder_profile_match(&builtin_profiles[i], codec_id, pixels))
+			break;
+	}
+	*profile = builtin_profiles[FFMIN(i, FF_ARRAY_ELEMS(builtin_profiles) - 1)];
+}
+
+static const char* decoder_profile_type_name(int thread_type)
+{
+	switch (thread_type) {
+	case FF_THREAD_FRAME | FF_THREAD_SLICE: return "frame+slice";
+	case FF_THREAD_FRAME: return "frame";
+	case FF_THREAD_SLICE: return "slice";
+	default: return "none";
+	}
+}
+
+static void decoder_profile_set_options(AVCodecContext* avctx, const DecoderProfile* p, AVDictionary** opts)
+{
+	if (!av_dict_get(*opts, "threads", NULL, 0)) {
+		if (p->thread_count > 0)
+			av_dict_set_int(opts, "threads", p->thread_count, 0);
+		else
+			av_dict_set(opts, "threads", "auto", 0);
+	}
+	//thread_type为0时avcodec_open2会拒绝该值，此时保持默认
+	if (!av_dict_get(*opts, "thread_type", NULL, 0) && p->thread_type)
+		av_dict_set(opts, "thread_type", decoder_profile_type_name(p->thread_type), 0);
+	avctx->flags2 |= p->flags2;
+}
+
+void decoder_profile_apply(AVCodecContext* avctx, AVDictionary** opts)
+{
+	DecoderProfile p;
+	char buf[128];
+
+	decoder_profile_find(avctx->codec_id, avctx->width, avctx->height, &p);
+	decoder_profile_set_options(avctx, &p, opts);
+	if (avctx->codec_type == AVMEDIA_TYPE_VIDEO) {
+		decoder_profile_format(&p, buf, sizeof(buf));
+		av_log(NULL, AV_LOG_VERBOSE, "decoder profile for %s %dx%d: %s\n",
+			avcodec_get_name(avctx->codec_id), avctx->width, avctx->height, buf);
+	}
+}
+
+void decoder_profile_format(const DecoderProfile* profile, char* buf, int size)
+{
+	char codec[64] = "", max[32] = "";
+
+	if (profile->codec_id != AV_CODEC_ID_NONE)
+		snprintf(codec, sizeof(codec), "codec=%s,", avcodec_get_name(profile->codec_id));
+	if (profile->max_pixels > 0)
+		snprintf(max, sizeof(max), ",max=%d", profile->max_pixels);
+	snprintf(buf, size, "%smin=%d%s,threads=%d,type=%s,fast=%d",
+		codec, profile->min_pixels, max, profile->thread_count,
+		decoder_profile_type_name(profile->thread_type),
+		(profile->flags2 & AV_CODEC_FLAG2_FAST) ? 1 : 0);
+}
+
+typedef struct DecoderBenchResult {
+	DecoderProfile profile;
+	int frames;
+	double fps;
+	double avg_latency;	// 毫秒
+	double p95_latency;
+	double max_latency;
+} DecoderBenchResult;
+
+//用一种配置从头解码最多max_frames帧
+//每个数据包送入前把当前时刻写入reordered_opaque，解码器把它带到由该包解出的帧上，据此得到每帧延迟
+static int decoder_profile_bench_run(AVFormatContext* ic, int stream_index, int max_frames, DecoderBenchResult* r)
+{
+	AVStream* st = ic->streams[stream_index];
+	AVCodecContext* avctx;
+	AVCodec* codec;
+	AVDictionary* opts = NULL;
+	AVPacket pkt;
+	AVFrame* frame;
+	std::vector<int64_t> latencies;
+	int64_t start, now, ts;
+	int ret, eof = 0;
+
+	avctx = avcodec_alloc_context3(NULL);
+	frame = av_frame_alloc();
+	if (!avctx || !frame) {
+		ret = AVERROR(ENOMEM);
+		goto end;
+	}
+	if ((ret = avcodec_parameters_to_context(avctx, st->codecpar)) < 0)
+		goto end;
+	av_codec_set_pkt_timebase(avctx, st->time_base);
+	codec = avcodec_find_decoder(avctx->codec_id);
+	if (!codec) {
+		ret = AVERROR_DECODER_NOT_FOUND;
+		goto end;
+	}
+	decoder_profile_set_options(avctx, &r->profile, &opts);
+	if ((ret = avcodec_open2(avctx, codec, &opts)) < 0)
+		goto end;
+	ts = ic->start_time != AV_NOPTS_VALUE ? ic->start_time : 0;
+	if ((ret = avformat_seek_file(ic, -1, INT64_MIN, ts, ts, 0)) < 0)
+		goto end;
+
+	latencies.reserve(max_frames);
+	av_init_packet(&pkt);
+	start = av_gettime_relative();
+	while ((int)latencies.size() < max_frames) {
+		if (!eof) {
+			ret = av_read_frame(ic, &pkt);
+			if (ret == AVERROR(EAGAIN))
+				continue;
+			if (ret < 0) {
+				//读完后送空包取出解码器中剩余的帧
+				eof = 1;
+				avcodec_send_packet(avctx, NULL);
+			} else if (pkt.stream_index != stream_index) {
+				av_packet_unref(&pkt);
+				continue;
+			} else {
+				avctx->reordered_opaque = av_gettime_relative();
+				ret = avcodec_send_packet(avctx, &pkt);
+				av_packet_unref(&pkt);
+				if (ret < 0 && ret != AVERROR_INVALIDDATA)
+					break;
+			}
+		}
+		while ((int)latencies.size() < max_frames && (ret = avcodec_receive_frame(avctx, frame)) >= 0) {
+			latencies.push_back(av_gettime_relative() - frame->reordered_opaque);
+			av_frame_unref(frame);
+		}
+		if (eof && ret < 0)
+			break;
+	}
+	now = av_gettime_relative();
+	ret = 0;
+
+	r->frames = (int)latencies.size();
+	r->fps = now > start ? r->frames * 1000000.0 / (now - start) : 0;
+	r->avg_latency = r->p95_latency = r->max_latency = 0;
+	if (r->frames > 0) {
+		int64_t sum = 0;
+		for (int64_t l : latencies)
+			sum += l;
+		std::sort(latencies.begin(), latencies.end());
+		r->avg_latency = sum / 1000.0 / r->frames;
+		r->p95_latency = latencies[(r->frames - 1) * 95 / 100] / 1000.0;
+		r->max_latency = latencies.back() / 1000.0;
+	}
+end:
+	av_dict_free(&opts);
+	av_frame_free(&frame);
+	avcodec_free_context(&avctx);
+	return ret;
+}
+
+int decoder_profile_bench(const char* filename, const char* report, int max_frames)
+{
+	static const int thread_counts[] = { 1, 2, 4, 8, 0 };
+	static const int thread_types[] = { FF_THREAD_SLICE, FF_THREAD_FRAME, FF_THREAD_FRAME | FF_THREAD_SLICE };
+	AVFormatContext* ic = NULL;
+	AVCodecParameters* par;
+	std::vector<DecoderBenchResult> results;
+	DecoderBenchResult r, * best = NULL;
+	QByteArray csv;
+	char line[256];
+	int stream_index, ret;
+	size_t i, j;
+	int fast;
+
+	if ((ret = avformat_open_input(&ic, filename, NULL, NULL)) < 0)
+		goto end;
+	if ((ret = avformat_find_stream_info(ic, NULL)) < 0)
+		goto end;
+	stream_index = av_find_best_stream(ic, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+	if (stream_index < 0) {
+		ret = stream_index;
+		goto end;
+	}
+	par = ic->streams[stream_index]->codecpar;
+	av_log(NULL, AV_LOG_INFO, "decoder bench: %s, %s %dx%d, %d frames per run\n",
+		filename, avcodec_get_name(par->codec_id), par->width, par->height, max_frames);
+
+	csv = "threads,thread_type,fast,frames,fps,avg_latency_ms,p95_latency_ms,max_latency_ms\n";
+	for (fast = 0; fast <= 1; fast++) {
+		for (i = 0; i < FF_ARRAY_ELEMS(thread_types); i++) {
+			for (j = 0; j < FF_ARRAY_ELEMS(thread_counts); j++) {
+				//单线程时线程类型没有区别，只测一次
+				if (thread_counts[j] == 1 && i > 0)
+					continue;
+				memset(&r, 0, sizeof(r));
+				r.profile.codec_id = par->codec_id;
+				r.profile.thread_count = thread_counts[j];
+				r.profile.thread_type = thread_types[i];
+				r.profile.flags2 = fast ? AV_CODEC_FLAG2_FAST : 0;
+				if (decoder_profile_bench_run(ic, stream_index, max_frames, &r) < 0 || r.frames <= 0)
+					continue;
+				snprintf(line, sizeof(line), "%d,%s,%d,%d,%.2f,%.2f,%.2f,%.2f\n",
+					r.profile.thread_count, decoder_profile_type_name(r.profile.thread_type), fast,
+					r.frames, r.fps, r.avg_latency, r.p95_latency, r.max_latency);
+				av_log(NULL, AV_LOG_INFO, "decoder bench: %s", line);
+				csv += line;
+				results.push_back(r);
+			}
+		}
+	}
+	//fps相差不到5%时取延迟低的配置
+	for (i = 0; i < results.size(); i++) {
+		if (!best || results[i].fps > best->fps * 1.05 ||
+			(results[i].fps > best->fps * 0.95 && results[i].p95_latency < best->p95_latency))
+			best = &results[i];
+	}
+	if (!best) {
+		ret = AVERROR_DECODER_NOT_FOUND;
+		goto end;
+	}
+	//建议的覆盖项只针对该格式和不低于该分辨率的视频
+	best->profile.min_pixels = par->width * par->height;
+	decoder_profile_format(&best->profile, line, sizeof(line));
+	av_log(NULL, AV_LOG_INFO, "decoder bench: best profile %s (%.2f fps, p95 latency %.2f ms)\n",
+		line, best->fps, best->p95_latency);
+	csv += QByteArray("# best: ") + line + "\n";
+	if (report) {
+		QFile file(QString::fromLocal8Bit(report));
+		if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(csv) != csv.size())
+			av_log(NULL, AV_LOG_ERROR, "decoder bench: could not write %s\n", report);
+	}
+	ret = 0;
+end:
+	avformat_close_input(&ic);
+	return ret;
+}
@@ -0,0 +1,67 @@
+﻿/*
+ * @file 	decoderprofile.h
+ *
+ * @brief 	按编码格式和分辨率选择解码器的线程配置
+ * @note	"threads=auto"加默认的thread_type并不总是最好的：帧线程每多一个线程就多一帧延迟和一帧的参考内存，
+ *			而切片线程在只有一个切片的码流上几乎没有加速。
+ *			这里用一张按编码格式、分辨率匹配的配置表决定thread_count、thread_type以及AV_CODEC_FLAG2_FAST等标志。
+ *			配置文件中的覆盖项优先于内置表，覆盖项的格式与av_dict_parse_string一致，例如：
+ *				codec=h264,min=1920x1080,threads=4,type=frame,fast=1
+ *			其中codec省略时匹配所有格式，min/max为分辨率（像素数）范围，threads=0表示自动。
+ *			decoder_profile_bench对给定文件遍历各种配置，统计解码fps和每帧延迟，用于得到合适的覆盖项。
+ */
+#pragma once
+
+#include <QStringList>
+#include "globalhelper.h"
+
+typedef struct DecoderProfile {
+	enum AVCodecID codec_id;	// AV_CODEC_ID_NONE匹配所有格式
+	int min_pixels;	// 宽*高不小于该值时匹配
+	int max_pixels;	// 宽*高不大于该值时匹配，0表示不限
+	int thread_count;	// 0表示自动
+	int thread_type;	// FF_THREAD_FRAME/FF_THREAD_SLICE的组合
+	int flags2;	// 额外的AV_CODEC_FLAG2_*，如AV_CODEC_FLAG2_FAST
+} DecoderProfile;
+
+/// <summary>
+/// 设置配置文件中的覆盖项，替换之前的覆盖项
+/// </summary>
+/// <param name="listProfiles">每项一条配置，格式见文件头说明</param>
+/// <returns>成功解析的条数，无法解析的项被忽略</returns>
+int decoder_profile_set_overrides(const QStringList& listProfiles);
+
+/// <summary>
+/// 查找与解码器参数匹配的配置，覆盖项优先
+/// </summary>
+/// <param name="codec_id">编码格式</param>
+/// <param name="width">宽</param>
+/// <param name="height">高</param>
+/// <param name="profile">输出的配置</param>
+void decoder_profile_find(enum AVCodecID codec_id, int width, int height, DecoderProfile* profile);
+
+/// <summary>
+/// 按匹配的配置设置解码器选项，在avcodec_open2之前调用。已在opts中指定的选项不被覆盖
+/// </summary>
+/// <param name="avctx">待打开的解码器</param>
+/// <param name="opts">传给avcodec_open2的选项</param>
+void decoder_profile_apply(AVCodecContext* avctx, AVDictionary** opts);
+
+/// <summary>
+/// 把配置格式化为覆盖项字符串
+/// </summary>
+/// <param name="profile"></param>
+/// <param name="buf">输出缓冲区</param>
+/// <param name="size">缓冲区大小</param>
+void decoder_profile_format(const DecoderProfile* profile, char* buf, int size);
+
+/// <summary>
+/// 基准测试：对文件的视频流逐一尝试线程数、线程类型和FAST标志的组合，
+/// 每种组合从头解码最多max_frames帧，记录解码fps和每帧延迟（送入数据包到取得该帧）。
+/// 结果以CSV写入report（为NULL时只输出到日志），并给出fps最高的配置对应的覆盖项。
+/// </summary>
+/// <param name="filename">文件名</param>
+/// <param name="report">CSV报告的路径，可为NULL</param>
+/// <param name="max_frames">每种组合解码的帧数上限</param>
+/// <returns>0-成功；<0-文件无法打开或没有视频流</returns>
+int decoder_profile_bench(const char* filename, const char* report, int max_frames);
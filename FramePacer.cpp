@@ -0,0 +1,181 @@
+﻿/*
+ * @file 	framepacer.cpp
+ *
+ * @brief 	按显示器的vblank节拍安排视频帧的显示
+ * @note
+ */
+
+#include <inttypes.h>
+#include <math.h>
+
+#include "framepacer.h"
+
+void frame_pacer_init(FramePacer* pacer, int enable)
+{
+	pacer->enabled = enable;
+	pacer->last_slot = -1;
+	pacer->next_slot = -1;
+	pacer->shown_slot = -1;
+}
+
+void frame_pacer_start(FramePacer* pacer, int refresh_rate, int vsync)
+{
+	pacer->started = 1;
+	pacer->period = 1.0 / (refresh_rate > 0 ? refresh_rate : FRAME_PACER_DEFAULT_RATE);
+	if (pacer->enabled && !vsync)
+		av_log(NULL, AV_LOG_INFO, "pacer: renderer has no vsync, keeping the polling refresh\n");
+	pacer->enabled = pacer->enabled && vsync;
+	if (pacer->enabled)
+		av_log(NULL, AV_LOG_VERBOSE, "pacer: learning the refresh interval, display mode reports %dHz\n", refresh_rate);
+}
+
+int frame_pacer_active(FramePacer* pacer)
+{
+	return pacer->enabled && pacer->started;
+}
+
+double frame_pacer_schedule(FramePacer* pacer, double target, double duration)
+{
+	double x, pos;
+	int64_t n;
+
+	pacer->next_target = target;
+	pacer->next_slot = -1;
+	if (!frame_pacer_active(pacer) || !pacer->locked)
+		return target;
+	//理想时刻换算为vblank序号（带小数）
+	x = pacer->vsync_count + (target - pacer->vsync_time) / pacer->period;
+	//节拍位置按上一帧的时长推进，再向理想位置靠拢一点，取整即为vblank：24p在60Hz上相隔3、2交替
+	pos = pacer->pos + duration / pacer->period;
+	pos += FRAME_PACER_TRACK * (x - pos);
+	n = (int64_t)llrint(pos);
+	pacer->next_resync = pacer->last_slot < 0 || fabs(x - n) > FRAME_PACER_HOLD;
+	if (pacer->next_resync) {
+		//没有上一帧，或节拍偏离了理想时刻：从离理想时刻最近的vblank重新开始
+		pos = x;
+		n = (int64_t)llrint(x);
+	}
+	//每个vblank最多显示一帧
+	if (pacer->last_slot >= 0)
+		n = FFMAX(n, pacer->last_slot + 1);
+	//理想时刻已经过去（视频落后），只能在下一个vblank显示，误差照常记录
+	n = FFMAX(n, pacer->vsync_count + 1);
+	pacer->next_pos = pos;
+	pacer->next_slot = n;
+	//在目标vblank的前一个vblank之后切换，present正好等到目标vblank
+	return pacer->vsync_time + (n - 1 - pacer->vsync_count + FRAME_PACER_MARGIN) * pacer->period;
+}
+
+void frame_pacer_commit(FramePacer* pacer)
+{
+	if (!frame_pacer_active(pacer))
+		return;
+	if (pacer->next_slot >= 0) {
+		if (pacer->next_resync)
+			pacer->resyncs++;
+		pacer->last_slot = pacer->next_slot;
+		pacer->pos = pacer->next_pos;
+	}
+	pacer->pending = 1;
+	pacer->pending_slot = pacer->next_slot;
+	pacer->pending_target = pacer->next_target;
+}
+
+void frame_pacer_resync(FramePacer* pacer)
+{
+	pacer->last_slot = -1;
+	pacer->shown_slot = -1;
+	pacer->pending = 0;
+}
+
+//更新刷新间隔和vblank相位
+static void frame_pacer_track(FramePacer* pacer, double time)
+{
+	double d = time - pacer->last_present;
+	int64_t k;
+
+	if (!pacer->last_present) {
+		pacer->vsync_time = time;
+		return;
+	}
+	k = (int64_t)llrint(d / pacer->period);
+	if (k >= 1 && k <= FRAME_PACER_MAX_GAP && fabs(d - k * pacer->period) < FRAME_PACER_TOLERANCE * pacer->period) {
+		//按整数个刷新间隔推进相位，再向实测时刻靠拢
+		pacer->vsync_count += k;
+		pacer->vsync_time += k * pacer->period;
+		pacer->vsync_time += FRAME_PACER_PHASE_ALPHA * (time - pacer->vsync_time);
+		pacer->period += FRAME_PACER_ALPHA * (d / k - pacer->period);
+		if (++pacer->aligned >= FRAME_PACER_LOCK_PRESENTS && !pacer->locked) {
+			pacer->locked = 1;
+			av_log(NULL, AV_LOG_INFO, "pacer: locked to %.3fHz\n", 1.0 / pacer->period);
+		}
+	}
+	else {
+		//present没有等到vblank，或中间停顿过：重新对齐相位，下一帧按理想时刻安排
+		if (!pacer->locked && k <= 1 && d > 1.0 / FRAME_PACER_MAX_RATE && d < 1.0 / FRAME_PACER_MIN_RATE)
+			pacer->period = d;
+		pacer->vsync_count += FFMAX(k, 1);
+		pacer->vsync_time = time;
+		pacer->aligned = 0;
+		frame_pacer_resync(pacer);
+	}
+}
+
+void frame_pacer_presented(FramePacer* pacer, double time)
+{
+	double err;
+	int64_t slot;
+
+	if (!frame_pacer_active(pacer))
+		return;
+	frame_pacer_track(pacer, time);
+	pacer->last_present = time;
+	if (!pacer->locked && ++pacer->presents >= FRAME_PACER_GIVEUP_PRESENTS) {
+		av_log(NULL, AV_LOG_WARNING, "pacer: presents do not follow vsync, keeping the polling refresh\n");
+		pacer->enabled = 0;
+		return;
+	}
+	if (!pacer->pending)
+		return;
+	pacer->pending = 0;
+	slot = pacer->vsync_count;
+	err = time - pacer->pending_target;
+	pacer->frames++;
+	pacer->err_sum += err;
+	pacer->err_abs_sum += fabs(err);
+	pacer->err_max = FFMAX(pacer->err_max, fabs(err));
+	if (pacer->pending_slot >= 0 && slot > pacer->pending_slot)
+		pacer->missed++;
+	if (pacer->shown_slot >= 0 && slot > pacer->shown_slot)
+		pacer->cadence[FFMIN(slot - pacer->shown_slot, FRAME_PACER_CADENCE_MAX)]++;
+	pacer->shown_slot = slot;
+	av_log(NULL, AV_LOG_DEBUG, "pacer: frame at vblank %" PRId64 " (planned %" PRId64 "), present error %+.2fms\n",
+		slot, pacer->pending_slot, err * 1000.0);
+}
+
+double frame_pacer_wait(FramePacer* pacer, double time)
+{
+	//present会阻塞到下一个vblank，醒来后尽早绘制
+	return FFMAX(pacer->vsync_time + FRAME_PACER_WAKE * pacer->period - time, 0.0);
+}
+
+void frame_pacer_log(FramePacer* pacer)
+{
+	char cadence[128];
+	int i, len = 0;
+
+	if (!pacer->frames)
+		return;
+	cadence[0] = 0;
+	for (i = 1; i <= FRAME_PACER_CADENCE_MAX; i++) {
+		if (pacer->cadence[i])
+			len += snprintf(cadence + len, sizeof(cadence) - len, " %d:%" PRId64, i, pacer->cadence[i]);
+		if (len >= (int)sizeof(cadence))
+			break;
+	}
+	av_log(NULL, AV_LOG_INFO, "pacer: %s%.3fHz, %" PRId64 " frames, present error avg %+.2fms abs %.2fms max %.2fms, "
+		"%" PRId64 " missed, %" PRId64 " resyncs, cadence%s\n",
+		pacer->locked ? "" : "not locked, ", 1.0 / pacer->period, pacer->frames,
+		pacer->err_sum * 1000.0 / pacer->frames, pacer->err_abs_sum * 1000.0 / pacer->frames, pacer->err_max * 1000.0,
+		pacer->missed, pacer->resyncs, cadence);
+}
@@ -0,0 +1,134 @@
+﻿/*
+ * @file 	framepacer.h
+ *
+ * @brief 	按显示器的vblank节拍安排视频帧的显示
+ * @note	video_refresh原先在frame_timer + delay之后的第一次轮询（间隔REFRESH_RATE）切换帧，再由垂直同步的present等到下一个vblank，
+ *			帧落在哪个vblank取决于轮询和present的时机：24p/25p在60Hz显示器上的3:2节拍时乱时不乱，画面抖动。
+ *			这里从present返回的时刻学习刷新间隔和vblank相位（开启后每个vblank都重新present当前帧，present的返回时刻随vblank对齐），
+ *			锁定后把每帧的理想显示时刻换算为vblank序号：节拍位置按帧时长逐帧推进、再缓慢向理想位置靠拢，取整后决定相邻两帧相隔几个vblank（24p为3、2交替），
+ *			理想时刻的抖动（音视频同步的微调）不会让节拍忽3忽2，刷新间隔估计的偏差也不会让节拍逐渐偏离理想时刻；
+ *			只有节拍与理想时刻相差超过FRAME_PACER_HOLD个刷新间隔（seek、音视频同步的调整、丢帧）时才重新对齐。
+ *			帧在目标vblank的前一个vblank之后切换并绘制，present正好等到目标vblank。
+ *			每帧记录present时刻相对理想时刻的误差、实际相隔的vblank数（节拍分布）和晚于计划的帧数。
+ *			渲染器没有垂直同步，或present的返回时刻一直不随vblank对齐时不启用，保持原来的轮询方式。
+ */
+#pragma once
+
+#include "globalhelper.h"
+
+/* 显示模式没有给出刷新率时假设的刷新率（Hz） */
+#define FRAME_PACER_DEFAULT_RATE 60
+/* 锁定前两次present的间隔在这个范围内（Hz）而不是整数个刷新间隔时，改用实测的间隔（显示模式报告的刷新率不对） */
+#define FRAME_PACER_MIN_RATE 20
+#define FRAME_PACER_MAX_RATE 400
+/* 刷新间隔和vblank相位的平滑系数 */
+#define FRAME_PACER_ALPHA 0.02
+#define FRAME_PACER_PHASE_ALPHA 0.1
+/* 节拍位置每帧向理想位置靠拢的比例 */
+#define FRAME_PACER_TRACK 0.05
+/* 两次present的间隔与整数个刷新间隔的偏差不超过这么多个刷新间隔时，认为present对齐了vblank */
+#define FRAME_PACER_TOLERANCE 0.2
+/* 连续对齐这么多次后锁定刷新间隔，开始按vblank安排帧 */
+#define FRAME_PACER_LOCK_PRESENTS 60
+/* present这么多次仍未锁定时停用 */
+#define FRAME_PACER_GIVEUP_PRESENTS 600
+/* 两次present相隔超过这么多个刷新间隔（暂停、窗口被遮挡）时重新对齐相位 */
+#define FRAME_PACER_MAX_GAP 8
+/* 按节拍预测的vblank与理想时刻相差不超过这么多个刷新间隔时沿用预测 */
+#define FRAME_PACER_HOLD 0.75
+/* 在目标vblank的前一个vblank之后这么多个刷新间隔时切换帧 */
+#define FRAME_PACER_MARGIN 0.1
+/* present返回后等待这么多个刷新间隔再绘制下一次，present不阻塞时也不会空转 */
+#define FRAME_PACER_WAKE 0.25
+/* 节拍分布统计的最大vblank数，更大的计入最后一项 */
+#define FRAME_PACER_CADENCE_MAX 8
+
+typedef struct FramePacer {
+	int enabled;	// 允许按vblank安排帧（渲染器开启了垂直同步）
+	int started;	// 已按显示模式初始化
+	int locked;	// 已学到稳定的刷新间隔
+	double period;	// 刷新间隔（秒）
+	double vsync_time;	// 最近一次present对应的vblank时刻（平滑后）
+	int64_t vsync_count;	// vsync_time对应的vblank序号
+	double last_present;	// 上一次present返回的时刻，0表示还没有present过
+	int aligned;	// 连续对齐vblank的present次数
+	int64_t presents;
+	//排帧
+	int64_t last_slot;	// 上一帧安排的vblank序号，-1表示需要按理想时刻重新对齐
+	double pos;	// 上一帧在节拍上的位置（以vblank计，带小数）
+	int64_t next_slot;	// frame_pacer_schedule为待切换的帧选择的vblank，-1表示没有按vblank安排
+	double next_pos;
+	double next_target;
+	int next_resync;
+	int pending;	// 已切换、等待present的帧
+	int64_t pending_slot;
+	double pending_target;
+	int64_t shown_slot;	// 上一帧实际显示的vblank序号
+	//统计
+	int64_t frames;	// 记录了误差的帧数
+	int64_t missed;	// 晚于计划的vblank显示的帧数
+	int64_t resyncs;	// 重新对齐的次数
+	int64_t cadence[FRAME_PACER_CADENCE_MAX + 1];	// 相邻两帧实际相隔的vblank数的分布
+	double err_sum;	// present时刻相对理想时刻的误差之和（秒）
+	double err_abs_sum;
+	double err_max;	// 误差绝对值的最大值
+} FramePacer;
+
+/// <summary>
+/// 初始化，在打开流时调用
+/// </summary>
+/// <param name="pacer">以全0初始化的结构</param>
+/// <param name="enable">是否允许按vblank安排帧</param>
+void frame_pacer_init(FramePacer* pacer, int enable);
+
+/// <summary>
+/// 渲染器创建后按显示模式设置初始的刷新间隔
+/// </summary>
+/// <param name="pacer"></param>
+/// <param name="refresh_rate">显示模式的刷新率（Hz），0表示未知</param>
+/// <param name="vsync">渲染器是否开启了垂直同步，否则不启用</param>
+void frame_pacer_start(FramePacer* pacer, int refresh_rate, int vsync);
+
+/// <summary>
+/// 是否由调度器接管显示节奏：每次刷新都重新present当前帧，按frame_pacer_wait等待
+/// </summary>
+int frame_pacer_active(FramePacer* pacer);
+
+/// <summary>
+/// 为下一帧选择vblank，返回应当切换到该帧的时刻。结果在frame_pacer_commit之前可以重复计算
+/// </summary>
+/// <param name="pacer"></param>
+/// <param name="target">帧的理想显示时刻（frame_timer + delay，秒）</param>
+/// <param name="duration">上一帧的标称时长（秒），决定两帧相隔的vblank数</param>
+/// <returns>未锁定时返回target，即原来的行为</returns>
+double frame_pacer_schedule(FramePacer* pacer, double target, double duration);
+
+/// <summary>
+/// 确认切换到frame_pacer_schedule安排的帧，下一次present时记录它的误差
+/// </summary>
+void frame_pacer_commit(FramePacer* pacer);
+
+/// <summary>
+/// 节拍被打断（seek、暂停）后，下一帧按理想时刻重新对齐
+/// </summary>
+void frame_pacer_resync(FramePacer* pacer);
+
+/// <summary>
+/// 在present返回后调用，更新刷新间隔和vblank相位，并记录刚显示的帧的误差
+/// </summary>
+/// <param name="pacer"></param>
+/// <param name="time">present返回的时刻（秒）</param>
+void frame_pacer_presented(FramePacer* pacer, double time);
+
+/// <summary>
+/// 距离下一次绘制还要等待的时间
+/// </summary>
+/// <param name="pacer"></param>
+/// <param name="time">当前时刻（秒）</param>
+/// <returns>秒</returns>
+double frame_pacer_wait(FramePacer* pacer, double time);
+
+/// <summary>
+/// 输出统计到日志
+/// </summary>
+void frame_pacer_log(FramePacer* pacer);
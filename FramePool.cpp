@@ -0,0 +1,303 @@
+﻿/*
+ * @file 	framepool.cpp
+ *
+ * @brief 	视频解码器的自定义帧缓冲池（get_buffer2）
+ * @note
+ */
+
+#include <inttypes.h>
+#include <limits.h>
+#include "framepool.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+/* 槽位按页对齐，启用透明大页时按2MB对齐，保证每个槽位都能整页映射 */
+#define FRAME_POOL_PAGE_SIZE 4096
+#define FRAME_POOL_HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+//只预留地址空间，物理内存在槽位第一次借出时才提交（Linux上由缺页按需分配）
+static uint8_t* frame_pool_reserve(size_t size, int want_hugepages, int* hugepages)
+{
+	*hugepages = 0;
+#ifdef _WIN32
+	//Windows的大页需要SeLockMemoryPrivilege且不能按需提交，这里不使用
+	(void)want_hugepages;
+	return (uint8_t*)VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_READWRITE);
+#else
+	void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+#ifdef MADV_HUGEPAGE
+	if (want_hugepages && !madvise(p, size, MADV_HUGEPAGE))
+		*hugepages = 1;
+#else
+	(void)want_hugepages;
+#endif
+	return (uint8_t*)p;
+#endif
+}
+
+static int frame_pool_commit(FramePoolArena* a, int slot)
+{
+#ifdef _WIN32
+	if (!VirtualAlloc(a->base + (size_t)slot * a->slot_size, a->slot_size, MEM_COMMIT, PAGE_READWRITE))
+		return AVERROR(ENOMEM);
+#else
+	(void)a;
+	(void)slot;
+#endif
+	return 0;
+}
+
+static void frame_pool_arena_free(FramePoolArena* a)
+{
+	if (a->base) {
+#ifdef _WIN32
+		VirtualFree(a->base, 0, MEM_RELEASE);
+#else
+		munmap(a->base, a->reserved);
+#endif
+	}
+	if (a->mutex)
+		SDL_DestroyMutex(a->mutex);
+	av_freep(&a->free_slots);
+	av_freep(&a->committed);
+	delete a;
+}
+
+static void frame_pool_arena_unref(FramePoolArena* a)
+{
+	if (a && a->refs.fetch_sub(1) == 1)
+		frame_pool_arena_free(a);
+}
+
+//计算一帧在槽位中的布局：按解码器要求对齐宽高，行宽向上取整到FRAME_POOL_ALIGN，所有平面连续存放
+static int frame_pool_layout(AVCodecContext* avctx, AVFrame* frame, int linesize[4], ptrdiff_t offset[4])
+{
+	enum AVPixelFormat fmt = (enum AVPixelFormat)frame->format;
+	int w = frame->width, h = frame->height;
+	int stride_align[AV_NUM_DATA_POINTERS];
+	uint8_t* data[4];
+	int i, size;
+
+	avcodec_align_dimensions2(avctx, &w, &h, stride_align);
+	if (av_image_fill_linesizes(linesize, fmt, w) < 0)
+		return -1;
+	for (i = 0; i < 4; i++)
+		linesize[i] = FFALIGN(linesize[i], FRAME_POOL_ALIGN);
+	//以NULL为基址得到的指针就是各平面的偏移
+	size = av_image_fill_pointers(data, fmt, h, NULL, linesize);
+	if (size < 0)
+		return -1;
+	for (i = 0; i < 4; i++)
+		offset[i] = (intptr_t)data[i];
+	//末尾留出SIMD越界读取的余量
+	return size + AV_INPUT_BUFFER_PADDING_SIZE + FRAME_POOL_ALIGN;
+}
+
+static FramePoolArena* frame_pool_arena_create(FramePool* pool, AVCodecContext* avctx, AVFrame* frame)
+{
+	FramePoolArena* a;
+	int size, wanted, i;
+	size_t align;
+
+	a = new FramePoolArena();
+	a->format = frame->format;
+	a->width = frame->width;
+	a->height = frame->height;
+	size = frame_pool_layout(avctx, frame, a->linesize, a->offset);
+	if (size <= 0)
+		goto fail;
+	align = pool->mode == FRAME_POOL_HUGEPAGES && size >= FRAME_POOL_HUGEPAGE_SIZE / 2 ?
+		FRAME_POOL_HUGEPAGE_SIZE : FRAME_POOL_PAGE_SIZE;
+	if ((size_t)size > INT_MAX - align)
+		goto fail;
+	a->slot_size = (int)FFALIGN((size_t)size, align);
+	//帧队列中的帧 + 解码器持有的参考帧 + 帧线程各自正在解码的帧
+	wanted = pool->queue_depth + FRAME_POOL_DECODER_FRAMES + FFMAX(avctx->thread_count, 1);
+	a->nb_slots = (int)FFMIN((size_t)wanted, FRAME_POOL_MAX_ARENA / a->slot_size);
+	if (a->nb_slots <= 0)
+		goto fail;
+	a->reserved = (size_t)a->nb_slots * a->slot_size;
+	a->base = frame_pool_reserve(a->reserved, pool->mode == FRAME_POOL_HUGEPAGES, &a->hugepages);
+	a->free_slots = (int*)av_malloc_array(a->nb_slots, sizeof(int));
+	a->committed = (uint8_t*)av_mallocz(a->nb_slots);
+	a->mutex = SDL_CreateMutex();
+	if (!a->base || !a->free_slots || !a->committed || !a->mutex)
+		goto fail;
+	//按从低地址到高地址的顺序借出，尽量复用已提交的槽位
+	for (i = 0; i < a->nb_slots; i++)
+		a->free_slots[i] = a->nb_slots - 1 - i;
+	a->nb_free = a->nb_slots;
+	a->refs = 1;
+	av_log(NULL, AV_LOG_INFO, "frame pool: %dx%d %s, %d slots of %d bytes%s\n",
+		a->width, a->height, av_get_pix_fmt_name((enum AVPixelFormat)a->format),
+		a->nb_slots, a->slot_size, a->hugepages ? ", transparent hugepages" : "");
+	return a;
+fail:
+	frame_pool_arena_free(a);
+	return NULL;
+}
+
+//AVBuffer的释放回调，可能在解码线程、显示线程或ReadThread（清空队列时）中调用，只访问arena
+static void frame_pool_release(void* opaque, uint8_t* data)
+{
+	FramePoolArena* a = (FramePoolArena*)opaque;
+	int slot = (int)((data - a->base) / a->slot_size);
+
+	SDL_LockMutex(a->mutex);
+	a->free_slots[a->nb_free++] = slot;
+	a->in_use--;
+	SDL_UnlockMutex(a->mutex);
+	frame_pool_arena_unref(a);
+}
+
+//取得与帧参数一致的arena并增加引用，参数变化时换成新的arena
+static FramePoolArena* frame_pool_get_arena(FramePool* pool, AVCodecContext* avctx, AVFrame* frame)
+{
+	FramePoolArena* a;
+
+	SDL_LockMutex(pool->mutex);
+	a = pool->arena;
+	if (!a || a->format != frame->format || a->width != frame->width || a->height != frame->height) {
+		if (a) {
+			pool->arena = NULL;
+			frame_pool_arena_unref(a);
+		}
+		a = frame_pool_arena_create(pool, avctx, frame);
+		if (a) {
+			pool->arena = a;
+			pool->arenas++;
+		}
+	}
+	if (a)
+		a->refs++;
+	SDL_UnlockMutex(pool->mutex);
+	return a;
+}
+
+int frame_pool_init(FramePool* pool, int mode, int queue_depth)
+{
+	pool->mode = mode;
+	pool->queue_depth = queue_depth;
+	pool->arena = NULL;
+	pool->mutex = NULL;
+	pool->gets = 0;
+	pool->fallbacks = 0;
+	pool->arenas = 0;
+	pool->peak_in_use = 0;
+	pool->peak_committed = 0;
+	if (mode == FRAME_POOL_OFF)
+		return AVERROR(EINVAL);
+	pool->mutex = SDL_CreateMutex();
+	if (!pool->mutex) {
+		av_log(NULL, AV_LOG_FATAL, "SDL_CreateMutex(): %s\n", SDL_GetError());
+		return AVERROR(ENOMEM);
+	}
+	return 0;
+}
+
+int frame_pool_get_buffer2(AVCodecContext* avctx, AVFrame* frame, int flags)
+{
+	FramePool* pool = (FramePool*)avctx->opaque;
+	const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get((enum AVPixelFormat)frame->format);
+	FramePoolArena* a;
+	uint8_t* base;
+	int slot = -1, in_use = 0, i;
+	int64_t committed = 0;
+
+	//不支持DR1的解码器必须使用默认分配；硬件帧和调色板格式的布局不适合放进槽位
+	if (!pool || !pool->mutex ||
+		!(avctx->codec->capabilities & AV_CODEC_CAP_DR1) ||
+		!desc || (desc->flags & (AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_PAL)) ||
+		frame->width <= 0 || frame->height <= 0)
+		goto fallback;
+	a = frame_pool_get_arena(pool, avctx, frame);
+	if (!a)
+		goto fallback;
+
+	SDL_LockMutex(a->mutex);
+	if (a->nb_free > 0) {
+		slot = a->free_slots[--a->nb_free];
+		if (!a->committed[slot]) {
+			if (frame_pool_commit(a, slot) < 0) {
+				a->free_slots[a->nb_free++] = slot;
+				slot = -1;
+			} else {
+				a->committed[slot] = 1;
+				a->nb_committed++;
+			}
+		}
+		if (slot >= 0)
+			in_use = ++a->in_use;
+		committed = (int64_t)a->nb_committed * a->slot_size;
+	}
+	SDL_UnlockMutex(a->mutex);
+	if (slot < 0) {
+		//槽位用尽（解码器或下游持有的帧比预计多）
+		frame_pool_arena_unref(a);
+		goto fallback;
+	}
+
+	base = a->base + (size_t)slot * a->slot_size;
+	frame->buf[0] = av_buffer_create(base, a->slot_size, frame_pool_release, a, 0);
+	if (!frame->buf[0]) {
+		frame_pool_release(a, base);
+		goto fallback;
+	}
+	for (i = 0; i < 4; i++) {
+		frame->data[i] = a->linesize[i] ? base + a->offset[i] : NULL;
+		frame->linesize[i] = a->linesize[i];
+	}
+	frame->extended_data = frame->data;
+	pool->gets++;
+	//统计值只用于报告，允许不同解码线程之间的竞争
+	if (in_use > pool->peak_in_use)
+		pool->peak_in_use = in_use;
+	if (committed > pool->peak_committed)
+		pool->peak_committed = committed;
+	return 0;
+fallback:
+	if (pool)
+		pool->fallbacks++;
+	return avcodec_default_get_buffer2(avctx, frame, flags);
+}
+
+void frame_pool_usage(FramePool* pool, int* in_use, int* nb_slots, int64_t* committed)
+{
+	FramePoolArena* a;
+
+	*in_use = 0;
+	*nb_slots = 0;
+	*committed = 0;
+	if (!pool->mutex)
+		return;
+	SDL_LockMutex(pool->mutex);
+	a = pool->arena;
+	if (a) {
+		SDL_LockMutex(a->mutex);
+		*in_use = a->in_use;
+		*nb_slots = a->nb_slots;
+		*committed = (int64_t)a->nb_committed * a->slot_size;
+		SDL_UnlockMutex(a->mutex);
+	}
+	SDL_UnlockMutex(pool->mutex);
+}
+
+void frame_pool_uninit(FramePool* pool)
+{
+	if (!pool->mutex)
+		return;
+	if (pool->gets || pool->fallbacks)
+		av_log(NULL, AV_LOG_INFO, "frame pool: %" PRId64 " frames from arena, %" PRId64 " fallbacks, "
+			"%d arenas, peak %d slots in use, peak %" PRId64 " bytes committed\n",
+			pool->gets.load(), pool->fallbacks.load(), pool->arenas, pool->peak_in_use, pool->peak_committed);
+	frame_pool_arena_unref(pool->arena);
+	pool->arena = NULL;
+	SDL_DestroyMutex(pool->mutex);
+	pool->mutex = NULL;
+}
@@ -0,0 +1,90 @@
+﻿/*
+ * @file 	framepool.h
+ *
+ * @brief 	视频解码器的自定义帧缓冲池（get_buffer2）
+ * @note	默认的get_buffer2为每个平面单独从AVBufferPool取缓冲区，分辨率变化或池被清空后要重新向系统申请，
+ *			4K/8K的大帧在解码线程里分配、清零缺页都会造成明显的抖动。
+ *			这里按分辨率和像素格式建立一块连续的内存区（arena），切成固定大小的槽位，每个槽位容纳一帧的全部平面：
+ *			行宽和平面起点按64字节对齐；Linux上可以对整个区域启用透明大页，减少TLB缺失。
+ *			槽位数由帧队列深度加上解码器的参考帧和线程延迟决定，只预留地址空间，第一次用到时才提交物理内存。
+ *			硬件帧、调色板格式、不支持DR1的解码器以及槽位用尽时回退到avcodec_default_get_buffer2，并计数。
+ */
+#pragma once
+
+#include <atomic>
+#include "globalhelper.h"
+
+/* 行宽与平面起点的对齐字节数 */
+#define FRAME_POOL_ALIGN 64
+/* 除帧队列外，解码器自己持有的帧数：H.264/HEVC最多16个参考帧，加上当前帧和输出延迟 */
+#define FRAME_POOL_DECODER_FRAMES 18
+/* 单个arena预留的地址空间上限 */
+#define FRAME_POOL_MAX_ARENA ((size_t)8 * 1024 * 1024 * 1024)
+
+//帧缓冲池的工作方式
+enum {
+	FRAME_POOL_OFF = 0,	// 使用FFmpeg默认的分配
+	FRAME_POOL_ON,	// 使用arena
+	FRAME_POOL_HUGEPAGES,	// 使用arena，并在支持的系统上启用透明大页
+};
+
+//一种分辨率/像素格式对应的连续内存区
+//池本身持有一个引用，每个借出的槽位各持有一个引用；分辨率变化后旧arena由最后归还的帧释放。
+typedef struct FramePoolArena {
+	uint8_t* base;	// 预留的地址空间起点
+	size_t reserved;	// 预留的字节数
+	int slot_size;	// 每个槽位的字节数
+	int nb_slots;	// 槽位数
+	int* free_slots;	// 空闲槽位栈
+	int nb_free;
+	uint8_t* committed;	// 槽位是否已提交物理内存
+	int nb_committed;
+	int in_use;	// 借出的槽位数
+	int hugepages;	// 是否启用了透明大页
+	int format, width, height;	// 对应的帧参数
+	int linesize[4];	// 各平面的行宽
+	ptrdiff_t offset[4];	// 各平面在槽位中的偏移
+	std::atomic<int> refs;
+	SDL_mutex* mutex;	// 保护空闲栈（帧可能在任意线程被释放）
+} FramePoolArena;
+
+typedef struct FramePool {
+	int mode;	// FRAME_POOL_*
+	int queue_depth;	// 帧队列的槽位数，用于决定arena的槽位数
+	FramePoolArena* arena;	// 当前分辨率的arena
+	SDL_mutex* mutex;	// 保护arena的切换
+	std::atomic<int64_t> gets;	// 从arena分配的帧数
+	std::atomic<int64_t> fallbacks;	// 回退到默认分配的帧数
+	int arenas;	// 创建过的arena数（分辨率/格式变化次数+1）
+	int peak_in_use;	// 同时借出的最大槽位数
+	int64_t peak_committed;	// 提交物理内存的最大字节数
+} FramePool;
+
+/// <summary>
+/// 初始化帧缓冲池，在打开视频解码器之前调用
+/// </summary>
+/// <param name="pool"></param>
+/// <param name="mode">FRAME_POOL_*</param>
+/// <param name="queue_depth">视频帧队列的槽位数</param>
+/// <returns>0-成功；失败时池不可用，解码器使用默认分配</returns>
+int frame_pool_init(FramePool* pool, int mode, int queue_depth);
+
+/// <summary>
+/// 作为AVCodecContext::get_buffer2使用，avctx->opaque必须指向FramePool
+/// </summary>
+int frame_pool_get_buffer2(AVCodecContext* avctx, AVFrame* frame, int flags);
+
+/// <summary>
+/// 查询当前arena的使用情况
+/// </summary>
+/// <param name="pool"></param>
+/// <param name="in_use">借出的槽位数</param>
+/// <param name="nb_slots">槽位总数</param>
+/// <param name="committed">已提交物理内存的字节数</param>
+void frame_pool_usage(FramePool* pool, int* in_use, int* nb_slots, int64_t* committed);
+
+/// <summary>
+/// 释放帧缓冲池，仍被帧引用的arena在最后一帧释放时才归还内存
+/// </summary>
+/// <param name="pool"></param>
+void frame_pool_uninit(FramePool* pool);
@@ -3,6 +3,9 @@
 #include <QSettings>
 #include <QCoreApplication>
 #include <QDir>
+#include <QFileInfo>
+#include <QStandardPaths>
+#include <QCryptographicHash>
 
 #include "GlobalHelper.h"
 
@@ -92,7 +95,42 @@ void GlobalHelper::GetPlayVolume(double& nVolume)
 	nVolume = settings.value("volume/size", nVolume).toDouble();
 }
 
+void GlobalHelper::SaveDecoderProfiles(QStringList& listProfiles)
+{
+	QString strPlayerConfigFileName = PLAYER_CONFIG_BASEDIR + QDir::separator() + PLAYER_CONFIG;
+	QSettings settings(strPlayerConfigFileName, QSettings::IniFormat);
+	settings.beginWriteArray("decoder_profiles");
+	for (int i = 0; i < listProfiles.size(); ++i)
+	{
+		settings.setArrayIndex(i);
+		settings.setValue("profile", listProfiles.at(i));
+	}
+	settings.endArray();
+}
+
+void GlobalHelper::GetDecoderProfiles(QStringList& listProfiles)
+{
+	QString strPlayerConfigFileName = PLAYER_CONFIG_BASEDIR + QDir::separator() + PLAYER_CONFIG;
+	QSettings settings(strPlayerConfigFileName, QSettings::IniFormat);
+
+	int size = settings.beginReadArray("decoder_profiles");
+	for (int i = 0; i < size; ++i)
+	{
+		settings.setArrayIndex(i);
+		listProfiles.append(settings.value("profile").toString());
+	}
+	settings.endArray();
+}
+
 QString GlobalHelper::GetAppVersion()
 {
 	return APP_VERSION;
 }
+
+QString GlobalHelper::GetMediaCachePath(const QString& strFile, const QString& strSubDir, const QString& strSuffix)
+{
+	QString strDir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/" + strSubDir;
+	QByteArray hash = QCryptographicHash::hash(QFileInfo(strFile).absoluteFilePath().toUtf8(), QCryptographicHash::Md5);
+	QDir().mkpath(strDir);
+	return strDir + "/" + QString::fromLatin1(hash.toHex()) + strSuffix;
+}
@@ -38,8 +38,20 @@ public:
 	static void GetPlaylist(QStringList& playList);     // 获取播放列表
 	static void SavePlayVolume(double& nVolume);        // 保存音量
 	static void GetPlayVolume(double& nVolume);         // 获取音量
+	static void SaveDecoderProfiles(QStringList& listProfiles);    // 保存解码器线程配置的覆盖项
+	static void GetDecoderProfiles(QStringList& listProfiles);     // 获取解码器线程配置的覆盖项
 
 	static QString GetAppVersion();
+
+	/**
+	 * 获取本地媒体文件的缓存文件路径（关键帧索引、探测结果等）
+	 *
+	 * @param	strFile 媒体文件路径
+	 * @param	strSubDir 缓存目录下的子目录，不存在时创建
+	 * @param	strSuffix 缓存文件后缀
+	 * @return	以媒体文件绝对路径的MD5命名的缓存文件路径
+	 */
+	static QString GetMediaCachePath(const QString& strFile, const QString& strSubDir, const QString& strSuffix);
 };
 
 //必须加以下内容,否则编译不能通过,为了兼容C和C99标准
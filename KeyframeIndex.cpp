@@ -0,0 +1,236 @@
+﻿/*
+ * @file 	keyframeindex.cpp
+ *
+ * @brief 	持久化的关键帧索引（显示时间 -> 字节偏移）
+ * @note
+ */
+
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+
+#include <inttypes.h>
+#include "keyframeindex.h"
+
+//容器自带的索引是否缺失或只覆盖了一部分（如FLV没有keyframes元数据、TS没有索引）
+static int keyframe_index_needed(AVFormatContext* ic, int stream_index)
+{
+	AVStream* st = ic->streams[stream_index];
+	int64_t start, covered;
+
+	if (ic->duration == AV_NOPTS_VALUE || ic->duration <= 0)
+		return 0;
+	if (st->nb_index_entries < 2)
+		return 1;
+	start = st->start_time != AV_NOPTS_VALUE ? st->start_time : 0;
+	covered = av_rescale_q(st->index_entries[st->nb_index_entries - 1].timestamp - start, st->time_base, av_get_time_base_q());
+	return covered < ic->duration * KEYFRAME_INDEX_MIN_COVERAGE;
+}
+
+//映射旁路文件，文件头中的键与当前文件不一致时视为无效
+static int keyframe_index_load(KeyframeIndex* ki)
+{
+	QFile* file = new QFile(QString::fromLocal8Bit(ki->sidecar));
+	const KeyframeIndexHeader* hdr = NULL;
+	qint64 size;
+
+	if (file->open(QIODevice::ReadOnly) && (size = file->size()) >= (qint64)sizeof(KeyframeIndexHeader))
+		ki->map_data = file->map(0, size);
+	if (ki->map_data)
+		hdr = (const KeyframeIndexHeader*)ki->map_data;
+	if (!hdr ||
+		memcmp(hdr->magic, "KFI1", 4) ||
+		hdr->version != KEYFRAME_INDEX_VERSION ||
+		hdr->file_size != ki->file_size ||
+		hdr->mtime != ki->mtime ||
+		hdr->stream_index != ki->stream_index ||
+		hdr->count <= 0 ||
+		file->size() < (qint64)(sizeof(KeyframeIndexHeader) + hdr->count * sizeof(KeyframeIndexEntry))) {
+		if (ki->map_data)
+			file->unmap(ki->map_data);
+		ki->map_data = NULL;
+		delete file;
+		return 0;
+	}
+	ki->map_file = file;
+	ki->entries = (const KeyframeIndexEntry*)(ki->map_data + sizeof(KeyframeIndexHeader));
+	ki->count = hdr->count;
+	ki->ready = 1;
+	return 1;
+}
+
+//先写临时文件再改名，避免留下写了一半的旁路文件
+static void keyframe_index_save(KeyframeIndex* ki, int count)
+{
+	KeyframeIndexHeader hdr;
+	QString strPath = QString::fromLocal8Bit(ki->sidecar);
+	QFile file(strPath + ".tmp");
+	qint64 entries_size = (qint64)count * sizeof(KeyframeIndexEntry);
+	bool bOk;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, "KFI1", 4);
+	hdr.version = KEYFRAME_INDEX_VERSION;
+	hdr.file_size = ki->file_size;
+	hdr.mtime = ki->mtime;
+	hdr.stream_index = ki->stream_index;
+	hdr.count = count;
+
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+		return;
+	bOk = file.write((const char*)&hdr, sizeof(hdr)) == (qint64)sizeof(hdr) &&
+		file.write((const char*)ki->built, entries_size) == entries_size;
+	file.close();
+	QFile::remove(strPath);
+	if (!bOk || !QFile::rename(strPath + ".tmp", strPath))
+		QFile::remove(strPath + ".tmp");
+}
+
+static int keyframe_index_interrupt_cb(void* ctx)
+{
+	KeyframeIndex* ki = (KeyframeIndex*)ctx;
+	return ki->abort_request.load();
+}
+
+//后台扫描线程：用独立的格式上下文顺序读完整个文件，只记录参考流的关键帧
+static void keyframe_index_scan(KeyframeIndex* ki)
+{
+	AVFormatContext* ic;
+	AVStream* st;
+	AVPacket pkt;
+	int64_t ts, last_pts = INT64_MIN, start = av_gettime_relative();
+	int count = 0, ret = 0;
+	unsigned int i;
+	KeyframeIndexEntry* entries;
+
+	//不与播放争抢CPU
+	SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW);
+	ic = avformat_alloc_context();
+	if (!ic)
+		return;
+	ic->interrupt_callback.callback = keyframe_index_interrupt_cb;
+	ic->interrupt_callback.opaque = ki;
+	if (avformat_open_input(&ic, ki->filename, NULL, NULL) < 0)
+		return;
+	if (avformat_find_stream_info(ic, NULL) < 0 || ki->stream_index >= (int)ic->nb_streams)
+		goto end;
+	for (i = 0; i < ic->nb_streams; i++)
+		ic->streams[i]->discard = (int)i == ki->stream_index ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+	st = ic->streams[ki->stream_index];
+
+	av_init_packet(&pkt);
+	while (!ki->abort_request) {
+		ret = av_read_frame(ic, &pkt);
+		if (ret == AVERROR(EAGAIN)) {
+			av_usleep(10000);
+			continue;
+		}
+		if (ret < 0)
+			break;
+		if (pkt.stream_index == ki->stream_index && (pkt.flags & AV_PKT_FLAG_KEY) && pkt.pos >= 0) {
+			ts = pkt.pts != AV_NOPTS_VALUE ? pkt.pts : pkt.dts;
+			if (ts != AV_NOPTS_VALUE) {
+				ts = av_rescale_q(ts, st->time_base, av_get_time_base_q());
+				//只保留时间递增的关键帧，保证可以二分查找
+				if (ts > last_pts) {
+					entries = (KeyframeIndexEntry*)av_fast_realloc(ki->built, &ki->built_size, (count + 1) * sizeof(KeyframeIndexEntry));
+					if (!entries) {
+						av_packet_unref(&pkt);
+						ret = AVERROR(ENOMEM);
+						break;
+					}
+					ki->built = entries;
+					ki->built[count].pts = ts;
+					ki->built[count].pos = pkt.pos;
+					count++;
+					last_pts = ts;
+				}
+			}
+		}
+		av_packet_unref(&pkt);
+	}
+	if (ret == AVERROR_EOF && !ki->abort_request && count > 0) {
+		keyframe_index_save(ki, count);
+		ki->entries = ki->built;
+		ki->count = count;
+		ki->ready = 1;
+		av_log(NULL, AV_LOG_INFO, "keyframe index: %d keyframes scanned in %.1fs\n",
+			count, (av_gettime_relative() - start) / 1000000.0);
+	}
+end:
+	avformat_close_input(&ic);
+}
+
+void keyframe_index_open(KeyframeIndex* ki, AVFormatContext* ic, const char* filename, int stream_index)
+{
+	const char* path = filename;
+
+	if (!filename || stream_index < 0)
+		return;
+	av_strstart(filename, "file:", &path);
+	if (strstr(path, "://"))
+		return;
+	//只能用于支持按字节seek的格式（mp4等不支持，它们的索引也是完整的）
+	if (ic->iformat->flags & AVFMT_NO_BYTE_SEEK)
+		return;
+	QFileInfo fileInfo(QString::fromLocal8Bit(path));
+	if (!fileInfo.isFile())
+		return;
+
+	ki->stream_index = stream_index;
+	ki->file_size = fileInfo.size();
+	ki->mtime = fileInfo.lastModified().toMSecsSinceEpoch();
+	ki->filename = av_strdup(filename);
+	ki->sidecar = av_strdup(GlobalHelper::GetMediaCachePath(fileInfo.absoluteFilePath(), "keyframe_index", ".kfi").toLocal8Bit().constData());
+	if (!ki->filename || !ki->sidecar)
+		return;
+
+	if (keyframe_index_load(ki)) {
+		av_log(NULL, AV_LOG_INFO, "keyframe index: loaded %d keyframes from %s\n", ki->count, ki->sidecar);
+		return;
+	}
+	if (keyframe_index_needed(ic, stream_index))
+		ki->scan_tid = std::thread(keyframe_index_scan, ki);
+}
+
+int64_t keyframe_index_lookup(KeyframeIndex* ki, int64_t target, int64_t* pts)
+{
+	int lo, hi, mid;
+
+	if (!ki->ready.load() || ki->count <= 0 || target < ki->entries[0].pts)
+		return -1;
+	lo = 0;
+	hi = ki->count - 1;
+	while (lo < hi) {
+		mid = (lo + hi + 1) / 2;
+		if (ki->entries[mid].pts <= target)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	ki->lookups++;
+	*pts = ki->entries[lo].pts;
+	return ki->entries[lo].pos;
+}
+
+void keyframe_index_close(KeyframeIndex* ki)
+{
+	ki->abort_request = 1;
+	if (ki->scan_tid.joinable())
+		ki->scan_tid.join();
+	if (ki->lookups)
+		av_log(NULL, AV_LOG_INFO, "keyframe index: %" PRId64 " seeks by byte offset\n", ki->lookups);
+	if (ki->map_file) {
+		ki->map_file->unmap(ki->map_data);
+		ki->map_file->close();
+		delete ki->map_file;
+		ki->map_file = NULL;
+		ki->map_data = NULL;
+	}
+	ki->ready = 0;
+	ki->entries = NULL;
+	ki->count = 0;
+	av_freep(&ki->built);
+	av_freep(&ki->filename);
+	av_freep(&ki->sidecar);
+}
@@ -0,0 +1,77 @@
+﻿/*
+ * @file 	keyframeindex.h
+ *
+ * @brief 	持久化的关键帧索引（显示时间 -> 字节偏移）
+ * @note	AVI、FLV、TS等索引缺失或不完整的文件，avformat_seek_file只能按码率估算或二分查找，既慢又不准。
+ *			第一次播放时在后台线程单独扫描一遍文件，记录参考流每个关键帧的时间和字节偏移，
+ *			保存为以路径、大小、修改时间为键的旁路文件；之后的播放直接内存映射该文件，seek时按字节偏移跳到目标前的关键帧。
+ */
+#pragma once
+
+#include <thread>
+#include <atomic>
+#include "globalhelper.h"
+
+class QFile;
+
+/* 旁路文件格式版本，格式变化时递增，旧文件自动重建 */
+#define KEYFRAME_INDEX_VERSION 1
+/* 容器自带索引覆盖的时长低于总时长的该比例时，认为索引不完整，需要扫描 */
+#define KEYFRAME_INDEX_MIN_COVERAGE 0.9
+
+typedef struct KeyframeIndexEntry {
+	int64_t pts;	// 显示时间（AV_TIME_BASE）
+	int64_t pos;	// 关键帧所在包的字节偏移
+} KeyframeIndexEntry;
+
+//旁路文件头，后面紧跟count个KeyframeIndexEntry
+typedef struct KeyframeIndexHeader {
+	char magic[4];	// "KFI1"
+	int32_t version;
+	int64_t file_size;	// 媒体文件大小
+	int64_t mtime;	// 媒体文件修改时间（毫秒）
+	int32_t stream_index;	// 建立索引的流
+	int32_t count;
+} KeyframeIndexHeader;
+
+typedef struct KeyframeIndex {
+	const KeyframeIndexEntry* entries;	// 可用的索引（按pts递增），ready之后才能读取
+	int count;
+	std::atomic<int> ready;	// 索引已可用
+	std::atomic<int> abort_request;	// 让扫描线程退出
+	KeyframeIndexEntry* built;	// 扫描线程建立的索引
+	unsigned int built_size;
+	QFile* map_file;	// 内存映射的旁路文件
+	uchar* map_data;
+	char* filename;	// 媒体文件
+	char* sidecar;	// 旁路文件路径（本地8位编码）
+	int64_t file_size;
+	int64_t mtime;
+	int stream_index;
+	std::thread scan_tid;	// 后台扫描线程
+	int64_t lookups;	// 使用索引的seek次数
+} KeyframeIndex;
+
+/// <summary>
+/// 为本地文件准备关键帧索引：旁路文件有效时直接映射；容器自带索引不完整时启动后台扫描
+/// </summary>
+/// <param name="ki">由av_mallocz清零的结构体</param>
+/// <param name="ic">播放用的格式上下文</param>
+/// <param name="filename">文件名</param>
+/// <param name="stream_index">建立索引的流（有视频时为视频流，否则为音频流）</param>
+void keyframe_index_open(KeyframeIndex* ki, AVFormatContext* ic, const char* filename, int stream_index);
+
+/// <summary>
+/// 查找显示时间不晚于target的最近关键帧
+/// </summary>
+/// <param name="ki"></param>
+/// <param name="target">目标时间（AV_TIME_BASE）</param>
+/// <param name="pts">输出关键帧的显示时间</param>
+/// <returns>关键帧的字节偏移，索引不可用或目标超出索引范围时返回-1</returns>
+int64_t keyframe_index_lookup(KeyframeIndex* ki, int64_t target, int64_t* pts);
+
+/// <summary>
+/// 停止扫描线程并释放索引
+/// </summary>
+/// <param name="ki"></param>
+void keyframe_index_close(KeyframeIndex* ki);
@@ -0,0 +1,785 @@
+﻿/*
+ * @file 	mediaio.cpp
+ *
+ * @brief 	本地文件的自定义输入（AVIOContext）
+ * @note
+ */
+
+#include <QFile>
+#include <inttypes.h>
+#include "mediaio.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/vfs.h>
+#endif
+#endif
+
+#ifdef _WIN32
+//PrefetchVirtualMemory只在Windows 8及以上提供，运行时动态获取
+typedef struct MemoryRangeEntry {
+	PVOID VirtualAddress;
+	SIZE_T NumberOfBytes;
+} MemoryRangeEntry;
+typedef BOOL(WINAPI* PrefetchVirtualMemoryFunc)(HANDLE, ULONG_PTR, MemoryRangeEntry*, ULONG);
+
+static PrefetchVirtualMemoryFunc get_prefetch_func()
+{
+	static PrefetchVirtualMemoryFunc func = (PrefetchVirtualMemoryFunc)GetProcAddress(
+		GetModuleHandleA("kernel32.dll"), "PrefetchVirtualMemory");
+	return func;
+}
+#endif
+
+//提示内核把[pos, pos + len)预读进页缓存
+static void mapped_file_advise(MappedFile* mf, int64_t pos, int64_t len)
+{
+	len = FFMIN(len, mf->io.size - pos);
+	if (len <= 0)
+		return;
+#ifdef _WIN32
+	PrefetchVirtualMemoryFunc prefetch = get_prefetch_func();
+	if (prefetch) {
+		MemoryRangeEntry range;
+		range.VirtualAddress = (PVOID)(mf->data + pos);
+		range.NumberOfBytes = (SIZE_T)len;
+		prefetch(GetCurrentProcess(), 1, &range, 0);
+	}
+#else
+	//madvise要求起始地址按页对齐
+	long page = sysconf(_SC_PAGESIZE);
+	int64_t start = pos & ~((int64_t)page - 1);
+	madvise((void*)(mf->data + start), (size_t)(len + pos - start), MADV_WILLNEED);
+#endif
+}
+
+//顺序读到预读窗口的后半段，或seek到窗口之外时，提示预读下一个窗口
+static void mapped_file_readahead(MappedFile* mf)
+{
+	int64_t pos = mf->io.pos;
+	if (pos + MEDIA_IO_READAHEAD_SIZE / 2 < mf->readahead_pos &&
+		pos + MEDIA_IO_READAHEAD_SIZE >= mf->readahead_pos)
+		return;
+	mapped_file_advise(mf, pos, MEDIA_IO_READAHEAD_SIZE);
+	mf->readahead_pos = pos + MEDIA_IO_READAHEAD_SIZE;
+}
+
+//从映射区拷贝数据。文件在播放过程中被截断或所在的设备出错时，访问映射区会产生异常而不是返回错误
+static int mapped_file_copy(uint8_t* dst, const uint8_t* src, int size)
+{
+#ifdef _WIN32
+	__try {
+		memcpy(dst, src, size);
+	}
+	__except (GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR ? EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH) {
+		return AVERROR(EIO);
+	}
+#else
+	memcpy(dst, src, size);
+#endif
+	return size;
+}
+
+//AVIOContext读回调
+static int mapped_file_read(void* opaque, uint8_t* buf, int buf_size)
+{
+	MappedFile* mf = (MappedFile*)opaque;
+	int64_t start;
+	int len;
+
+	if (mf->io.pos >= mf->io.size)
+		return AVERROR_EOF;
+	len = (int)FFMIN(mf->io.size - mf->io.pos, (int64_t)buf_size);
+	mapped_file_readahead(mf);
+
+	start = av_gettime_relative();
+	if (mapped_file_copy(buf, mf->data + mf->io.pos, len) < 0) {
+		av_log(NULL, AV_LOG_ERROR, "mmap io: page fault at offset %" PRId64 "\n", mf->io.pos);
+		return AVERROR(EIO);
+	}
+	mf->io.io_time += av_gettime_relative() - start;
+
+	mf->io.pos += len;
+	mf->io.reads++;
+	mf->io.bytes += len;
+	return len;
+}
+
+//计算seek的目标位置
+static int64_t media_io_seek_pos(MediaIO* io, int64_t offset, int whence)
+{
+	switch (whence & ~AVSEEK_FORCE) {
+	case SEEK_SET:
+		return offset;
+	case SEEK_CUR:
+		return io->pos + offset;
+	case SEEK_END:
+		return io->size + offset;
+	default:
+		return AVERROR(EINVAL);
+	}
+}
+
+//AVIOContext seek回调，只是移动读位置
+static int64_t mapped_file_seek(void* opaque, int64_t offset, int whence)
+{
+	MappedFile* mf = (MappedFile*)opaque;
+	int64_t pos;
+
+	if (whence & AVSEEK_SIZE)
+		return mf->io.size;
+	pos = media_io_seek_pos(&mf->io, offset, whence);
+	if (pos < 0)
+		return AVERROR(EINVAL);
+	mf->io.pos = FFMIN(pos, mf->io.size);
+	mf->io.seeks++;
+	return mf->io.pos;
+}
+
+static void mapped_file_close(MappedFile* mf)
+{
+#ifdef _WIN32
+	if (mf->data)
+		UnmapViewOfFile(mf->data);
+	if (mf->mapping)
+		CloseHandle(mf->mapping);
+	if (mf->file && mf->file != INVALID_HANDLE_VALUE)
+		CloseHandle(mf->file);
+#else
+	if (mf->data)
+		munmap((void*)mf->data, (size_t)mf->io.size);
+	if (mf->fd >= 0)
+		close(mf->fd);
+#endif
+	av_free(mf);
+}
+
+//映射整个文件，不是普通文件、文件为空或地址空间不足时失败
+static MappedFile* mapped_file_open(const char* path)
+{
+	MappedFile* mf = (MappedFile*)av_mallocz(sizeof(MappedFile));
+	if (!mf)
+		return NULL;
+	mf->io.type = MEDIA_IO_MMAP;
+#ifdef _WIN32
+	LARGE_INTEGER size;
+	//文件名来自QString::toLocal8Bit，与ANSI代码页一致
+	mf->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (mf->file == INVALID_HANDLE_VALUE ||
+		GetFileType(mf->file) != FILE_TYPE_DISK ||
+		!GetFileSizeEx(mf->file, &size) ||
+		size.QuadPart <= 0 ||
+		(uint64_t)size.QuadPart > (uint64_t)SIZE_MAX / 2)
+		goto fail;
+	mf->io.size = size.QuadPart;
+	mf->mapping = CreateFileMappingA(mf->file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!mf->mapping)
+		goto fail;
+	mf->data = (const uint8_t*)MapViewOfFile(mf->mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!mf->data)
+		goto fail;
+#else
+	struct stat st;
+	void* data;
+	mf->fd = open(path, O_RDONLY);
+	if (mf->fd < 0 ||
+		fstat(mf->fd, &st) < 0 ||
+		!S_ISREG(st.st_mode) ||
+		st.st_size <= 0 ||
+		(uint64_t)st.st_size > (uint64_t)SIZE_MAX / 2)
+		goto fail;
+	mf->io.size = st.st_size;
+	data = mmap(NULL, (size_t)mf->io.size, PROT_READ, MAP_PRIVATE, mf->fd, 0);
+	if (data == MAP_FAILED)
+		goto fail;
+	mf->data = (const uint8_t*)data;
+	//整体按顺序读取处理：加大内核预读，已读过的页可以尽早回收
+	madvise(data, (size_t)mf->io.size, MADV_SEQUENTIAL);
+#endif
+	return mf;
+fail:
+	mapped_file_close(mf);
+	return NULL;
+}
+
+//按偏移读取一整块（文件末尾的块可能不满），返回读到的字节数
+static int prefetch_file_pread(PrefetchFile* pf, uint8_t* buf, int size, int64_t offset)
+{
+	int total = 0;
+	while (total < size) {
+#ifdef _WIN32
+		OVERLAPPED ov;
+		DWORD got = 0;
+		memset(&ov, 0, sizeof(ov));
+		ov.Offset = (DWORD)((offset + total) & 0xFFFFFFFF);
+		ov.OffsetHigh = (DWORD)((offset + total) >> 32);
+		if (!ReadFile(pf->file, buf + total, size - total, &got, &ov)) {
+			if (GetLastError() == ERROR_HANDLE_EOF)
+				break;
+			return AVERROR(EIO);
+		}
+#else
+		ssize_t got = pread(pf->fd, buf + total, size - total, offset + total);
+		if (got < 0) {
+			if (errno == EINTR)
+				continue;
+			return AVERROR(errno);
+		}
+#endif
+		if (got == 0)
+			break;
+		total += (int)got;
+	}
+	return total;
+}
+
+//I/O线程：取离当前读位置最近的待读块
+static PrefetchBlock* prefetch_file_next_pending(PrefetchFile* pf)
+{
+	PrefetchBlock* best = NULL;
+	int i;
+	for (i = 0; i < PREFETCH_NB_BLOCKS; i++) {
+		PrefetchBlock* b = &pf->blocks[i];
+		if (b->state != PREFETCH_BLOCK_PENDING)
+			continue;
+		if (!best ||
+			(b->index >= pf->cur_block && (best->index < pf->cur_block || b->index < best->index)))
+			best = b;
+	}
+	return best;
+}
+
+static void prefetch_file_worker(PrefetchFile* pf)
+{
+	SDL_LockMutex(pf->mutex);
+	for (;;) {
+		PrefetchBlock* b = NULL;
+		int64_t index;
+		int ret;
+		while (!pf->abort_request && !(b = prefetch_file_next_pending(pf)))
+			SDL_CondWait(pf->cond, pf->mutex);
+		if (pf->abort_request)
+			break;
+		//LOADING状态的块不会被淘汰，读取期间可以不持锁
+		b->state = PREFETCH_BLOCK_LOADING;
+		index = b->index;
+		SDL_UnlockMutex(pf->mutex);
+
+		ret = prefetch_file_pread(pf, b->data, PREFETCH_BLOCK_SIZE, index * PREFETCH_BLOCK_SIZE);
+
+		SDL_LockMutex(pf->mutex);
+		b->state = ret < 0 ? PREFETCH_BLOCK_ERROR : PREFETCH_BLOCK_READY;
+		b->size = FFMAX(ret, 0);
+		SDL_CondBroadcast(pf->cond);
+	}
+	SDL_UnlockMutex(pf->mutex);
+}
+
+//查找缓存中的块（需持锁）
+static PrefetchBlock* prefetch_file_find(PrefetchFile* pf, int64_t index)
+{
+	int i;
+	for (i = 0; i < PREFETCH_NB_BLOCKS; i++) {
+		if (pf->blocks[i].state != PREFETCH_BLOCK_EMPTY && pf->blocks[i].index == index)
+			return &pf->blocks[i];
+	}
+	return NULL;
+}
+
+//为窗口[first, last]中的块腾出位置：优先空块，其次过期的预读请求，最后是窗口外最久未使用的已读块（需持锁）
+static PrefetchBlock* prefetch_file_evict(PrefetchFile* pf, int64_t first, int64_t last)
+{
+	PrefetchBlock* best = NULL;
+	int i;
+	for (i = 0; i < PREFETCH_NB_BLOCKS; i++) {
+		PrefetchBlock* b = &pf->blocks[i];
+		if (b->state == PREFETCH_BLOCK_EMPTY)
+			return b;
+		if (b->state == PREFETCH_BLOCK_LOADING || (b->index >= first && b->index <= last))
+			continue;
+		if (b->state == PREFETCH_BLOCK_PENDING) {
+			pf->cancels++;
+			return b;
+		}
+		if (!best || b->last_used < best->last_used)
+			best = b;
+	}
+	return best;
+}
+
+//以index为当前块，请求读取[index, index + PREFETCH_DEPTH]中还不在缓存里的块（需持锁）
+static void prefetch_file_schedule(PrefetchFile* pf, int64_t index)
+{
+	int64_t last = FFMIN(index + PREFETCH_DEPTH, (pf->io.size - 1) / PREFETCH_BLOCK_SIZE);
+	int64_t i;
+	int requested = 0;
+
+	pf->cur_block = index;
+	for (i = index; i <= last; i++) {
+		PrefetchBlock* b = prefetch_file_find(pf, i);
+		if (!b) {
+			b = prefetch_file_evict(pf, index, last);
+			if (!b)
+				break;
+			b->index = i;
+			b->state = PREFETCH_BLOCK_PENDING;
+			b->size = 0;
+			requested = 1;
+		}
+		if (i == index)
+			b->last_used = ++pf->use_counter;
+	}
+	if (requested)
+		SDL_CondBroadcast(pf->cond);
+}
+
+//seek后取消新窗口之外还没开始的预读请求（需持锁）
+static void prefetch_file_cancel(PrefetchFile* pf, int64_t index)
+{
+	int i;
+	for (i = 0; i < PREFETCH_NB_BLOCKS; i++) {
+		PrefetchBlock* b = &pf->blocks[i];
+		if (b->state == PREFETCH_BLOCK_PENDING &&
+			(b->index < index || b->index > index + PREFETCH_DEPTH)) {
+			b->state = PREFETCH_BLOCK_EMPTY;
+			pf->cancels++;
+		}
+	}
+}
+
+//AVIOContext读回调：只从块缓存拷贝，块还没读完时等待I/O线程
+static int prefetch_file_read(void* opaque, uint8_t* buf, int buf_size)
+{
+	PrefetchFile* pf = (PrefetchFile*)opaque;
+	PrefetchBlock* b;
+	int64_t index, start, wait_start;
+	int offset, len;
+
+	if (pf->io.pos >= pf->io.size)
+		return AVERROR_EOF;
+	start = av_gettime_relative();
+	index = pf->io.pos / PREFETCH_BLOCK_SIZE;
+
+	SDL_LockMutex(pf->mutex);
+	prefetch_file_schedule(pf, index);
+	b = prefetch_file_find(pf, index);
+	if (!b) {
+		SDL_UnlockMutex(pf->mutex);
+		return AVERROR(ENOMEM);
+	}
+	if (b->state == PREFETCH_BLOCK_READY) {
+		pf->hits++;
+	}
+	else {
+		pf->waits++;
+		wait_start = av_gettime_relative();
+		while (b->state == PREFETCH_BLOCK_PENDING || b->state == PREFETCH_BLOCK_LOADING) {
+			if (pf->io.int_cb.callback && pf->io.int_cb.callback(pf->io.int_cb.opaque)) {
+				SDL_UnlockMutex(pf->mutex);
+				return AVERROR_EXIT;
+			}
+			//定时醒来只为检查中断回调，块读完会立即被唤醒
+			SDL_CondWaitTimeout(pf->cond, pf->mutex, 100);
+		}
+		pf->wait_time += av_gettime_relative() - wait_start;
+	}
+	if (b->state == PREFETCH_BLOCK_ERROR) {
+		//下次读取时重新请求
+		b->state = PREFETCH_BLOCK_EMPTY;
+		SDL_UnlockMutex(pf->mutex);
+		av_log(NULL, AV_LOG_ERROR, "prefetch io: read error at block %" PRId64 "\n", index);
+		return AVERROR(EIO);
+	}
+	SDL_UnlockMutex(pf->mutex);
+
+	//已读完的块只会被本线程（在schedule中）淘汰，拷贝时不需要持锁
+	offset = (int)(pf->io.pos - index * PREFETCH_BLOCK_SIZE);
+	len = FFMIN(b->size - offset, buf_size);
+	if (len <= 0)
+		return AVERROR_EOF;
+	memcpy(buf, b->data + offset, len);
+
+	pf->io.pos += len;
+	pf->io.reads++;
+	pf->io.bytes += len;
+	pf->io.io_time += av_gettime_relative() - start;
+	return len;
+}
+
+//AVIOContext seek回调：移动读位置，取消过期的预读并立即在新位置开始预读
+static int64_t prefetch_file_seek(void* opaque, int64_t offset, int whence)
+{
+	PrefetchFile* pf = (PrefetchFile*)opaque;
+	int64_t pos, index;
+
+	if (whence & AVSEEK_SIZE)
+		return pf->io.size;
+	pos = media_io_seek_pos(&pf->io, offset, whence);
+	if (pos < 0)
+		return AVERROR(EINVAL);
+	pf->io.pos = FFMIN(pos, pf->io.size);
+	pf->io.seeks++;
+
+	index = pf->io.pos / PREFETCH_BLOCK_SIZE;
+	if (index != pf->cur_block && pf->io.pos < pf->io.size) {
+		SDL_LockMutex(pf->mutex);
+		prefetch_file_cancel(pf, index);
+		prefetch_file_schedule(pf, index);
+		SDL_UnlockMutex(pf->mutex);
+	}
+	return pf->io.pos;
+}
+
+static void prefetch_file_close(PrefetchFile* pf)
+{
+	int i;
+	if (pf->mutex) {
+		SDL_LockMutex(pf->mutex);
+		pf->abort_request = 1;
+		SDL_CondBroadcast(pf->cond);
+		SDL_UnlockMutex(pf->mutex);
+	}
+	for (i = 0; i < PREFETCH_NB_THREADS; i++) {
+		if (pf->workers[i].joinable())
+			pf->workers[i].join();
+	}
+	for (i = 0; i < PREFETCH_NB_BLOCKS; i++)
+		av_freep(&pf->blocks[i].data);
+#ifdef _WIN32
+	if (pf->file && pf->file != INVALID_HANDLE_VALUE)
+		CloseHandle(pf->file);
+#else
+	if (pf->fd >= 0)
+		close(pf->fd);
+#endif
+	SDL_DestroyMutex(pf->mutex);
+	SDL_DestroyCond(pf->cond);
+	av_free(pf);
+}
+
+static PrefetchFile* prefetch_file_open(const char* path)
+{
+	int i;
+	PrefetchFile* pf = (PrefetchFile*)av_mallocz(sizeof(PrefetchFile));
+	if (!pf)
+		return NULL;
+	pf->io.type = MEDIA_IO_PREFETCH;
+#ifdef _WIN32
+	LARGE_INTEGER size;
+	pf->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (pf->file == INVALID_HANDLE_VALUE ||
+		GetFileType(pf->file) != FILE_TYPE_DISK ||
+		!GetFileSizeEx(pf->file, &size) ||
+		size.QuadPart <= 0)
+		goto fail;
+	pf->io.size = size.QuadPart;
+#else
+	struct stat st;
+	pf->fd = open(path, O_RDONLY);
+	if (pf->fd < 0 ||
+		fstat(pf->fd, &st) < 0 ||
+		!S_ISREG(st.st_mode) ||
+		st.st_size <= 0)
+		goto fail;
+	pf->io.size = st.st_size;
+	//缓存自己做预读，关闭内核的顺序预读以免重复读取
+	posix_fadvise(pf->fd, 0, 0, POSIX_FADV_RANDOM);
+#endif
+	for (i = 0; i < PREFETCH_NB_BLOCKS; i++) {
+		pf->blocks[i].index = -1;
+		pf->blocks[i].data = (uint8_t*)av_malloc(PREFETCH_BLOCK_SIZE);
+		if (!pf->blocks[i].data)
+			goto fail;
+	}
+	pf->mutex = SDL_CreateMutex();
+	pf->cond = SDL_CreateCond();
+	if (!pf->mutex || !pf->cond)
+		goto fail;
+	for (i = 0; i < PREFETCH_NB_THREADS; i++)
+		pf->workers[i] = std::thread(prefetch_file_worker, pf);
+	//打开时就开始预读文件头
+	SDL_LockMutex(pf->mutex);
+	prefetch_file_schedule(pf, 0);
+	SDL_UnlockMutex(pf->mutex);
+	return pf;
+fail:
+	prefetch_file_close(pf);
+	return NULL;
+}
+
+//文件是否位于网络共享、可移动磁盘等访问延迟大的设备上，这类设备上内存映射的缺页会直接阻塞读线程
+static int media_io_is_slow_device(const char* path)
+{
+#ifdef _WIN32
+	char root[4];
+	UINT type;
+	if ((path[0] == '\\' && path[1] == '\\') || (path[0] == '/' && path[1] == '/'))
+		return 1;
+	if (!path[0] || path[1] != ':')
+		return 0;
+	root[0] = path[0];
+	root[1] = ':';
+	root[2] = '\\';
+	root[3] = 0;
+	type = GetDriveTypeA(root);
+	return type == DRIVE_REMOTE || type == DRIVE_REMOVABLE || type == DRIVE_CDROM;
+#elif defined(__linux__)
+	struct statfs sfs;
+	if (statfs(path, &sfs) < 0)
+		return 0;
+	switch ((uint32_t)sfs.f_type) {
+	case 0x6969:		// NFS
+	case 0x517B:		// SMB
+	case 0xFF534D42:	// CIFS
+	case 0xFE534D42:	// SMB2
+	case 0x65735546:	// FUSE
+		return 1;
+	default:
+		return 0;
+	}
+#else
+	return 0;
+#endif
+}
+
+AVIOContext* media_io_open(const char* filename, int mode, const AVIOInterruptCB* int_cb)
+{
+	const char* path = filename;
+	MediaIO* io = NULL;
+	uint8_t* buffer;
+	AVIOContext* pb;
+
+	if (!filename || mode == MEDIA_IO_DEFAULT)
+		return NULL;
+	//带协议头的输入（http://、rtmp://等）走默认协议，file:前缀去掉后按本地文件处理
+	if (!av_strstart(filename, "file:", &path) && strstr(filename, "://"))
+		return NULL;
+
+	if (mode == MEDIA_IO_AUTO)
+		mode = media_io_is_slow_device(path) ? MEDIA_IO_PREFETCH : MEDIA_IO_MMAP;
+	if (mode == MEDIA_IO_MMAP)
+		io = (MediaIO*)mapped_file_open(path);
+	//映射失败（如32位进程地址空间不足）时退回预读缓存
+	if (!io)
+		io = (MediaIO*)prefetch_file_open(path);
+	if (!io)
+		return NULL;
+	if (int_cb)
+		io->int_cb = *int_cb;
+
+	buffer = (uint8_t*)av_malloc(MEDIA_IO_BUFFER_SIZE);
+	pb = buffer ? avio_alloc_context(buffer, MEDIA_IO_BUFFER_SIZE, 0, io,
+		io->type == MEDIA_IO_MMAP ? mapped_file_read : prefetch_file_read, NULL,
+		io->type == MEDIA_IO_MMAP ? mapped_file_seek : prefetch_file_seek) : NULL;
+	if (!pb) {
+		av_free(buffer);
+		if (io->type == MEDIA_IO_MMAP)
+			mapped_file_close((MappedFile*)io);
+		else
+			prefetch_file_close((PrefetchFile*)io);
+		return NULL;
+	}
+	av_log(NULL, AV_LOG_INFO, "%s io: opened %s (%" PRId64 " bytes)\n",
+		io->type == MEDIA_IO_MMAP ? "mmap" : "prefetch", path, io->size);
+	return pb;
+}
+
+void media_io_close(AVIOContext** pb)
+{
+	MediaIO* io;
+
+	if (!pb || !*pb)
+		return;
+	io = (MediaIO*)(*pb)->opaque;
+	//默认file协议下每次填充和seek都各是一次read/lseek系统调用
+	av_log(NULL, AV_LOG_INFO,
+		"%s io: %" PRId64 " refills, %" PRId64 " seeks (read/lseek syscalls saved), %" PRId64 " bytes, %.1f MB/s read throughput\n",
+		io->type == MEDIA_IO_MMAP ? "mmap" : "prefetch",
+		io->reads, io->seeks, io->bytes,
+		io->io_time > 0 ? io->bytes / (double)io->io_time : 0.0);
+	av_freep(&(*pb)->buffer);
+	avio_context_free(pb);
+	if (io->type == MEDIA_IO_MMAP) {
+		mapped_file_close((MappedFile*)io);
+	}
+	else {
+		PrefetchFile* pf = (PrefetchFile*)io;
+		av_log(NULL, AV_LOG_INFO,
+			"prefetch io: %" PRId64 " cache hits, %" PRId64 " waits (%.1f ms), %" PRId64 " cancelled prefetches\n",
+			pf->hits, pf->waits, pf->wait_time / 1000.0, pf->cancels);
+		prefetch_file_close(pf);
+	}
+}
+
+//基准测试中计数的默认file协议：内层是以AVIO_FLAG_DIRECT打开的默认协议，每次读、seek都直接对应一次read/lseek系统调用；
+//外层缓冲区与默认file协议大小相同，外层每次填充即默认协议下的一次read
+typedef struct CountedFile {
+	MediaIO io;
+	AVIOContext* inner;
+} CountedFile;
+
+static int counted_file_read(void* opaque, uint8_t* buf, int buf_size)
+{
+	CountedFile* cf = (CountedFile*)opaque;
+	int64_t start = av_gettime_relative();
+	int len = avio_read_partial(cf->inner, buf, buf_size);
+
+	cf->io.io_time += av_gettime_relative() - start;
+	if (len == 0)
+		return AVERROR_EOF;
+	if (len < 0)
+		return len;
+	cf->io.reads++;
+	cf->io.bytes += len;
+	return len;
+}
+
+static int64_t counted_file_seek(void* opaque, int64_t offset, int whence)
+{
+	CountedFile* cf = (CountedFile*)opaque;
+
+	if (whence & AVSEEK_SIZE)
+		return avio_size(cf->inner);
+	cf->io.seeks++;
+	return avio_seek(cf->inner, offset, whence & ~AVSEEK_FORCE);
+}
+
+static void counted_file_close(AVIOContext** pb)
+{
+	CountedFile* cf;
+
+	if (!*pb)
+		return;
+	cf = (CountedFile*)(*pb)->opaque;
+	av_freep(&(*pb)->buffer);
+	avio_context_free(pb);
+	avio_closep(&cf->inner);
+	av_free(cf);
+}
+
+static AVIOContext* counted_file_open(const char* filename)
+{
+	CountedFile* cf = (CountedFile*)av_mallocz(sizeof(CountedFile));
+	uint8_t* buffer = (uint8_t*)av_malloc(MEDIA_IO_BENCH_FILE_BUFFER_SIZE);
+	AVIOContext* pb = NULL;
+
+	if (cf && buffer && avio_open2(&cf->inner, filename, AVIO_FLAG_READ | AVIO_FLAG_DIRECT, NULL, NULL) >= 0) {
+		cf->io.type = MEDIA_IO_DEFAULT;
+		pb = avio_alloc_context(buffer, MEDIA_IO_BENCH_FILE_BUFFER_SIZE, 0, cf, counted_file_read, NULL, counted_file_seek);
+	}
+	if (!pb) {
+		av_free(buffer);
+		if (cf)
+			avio_closep(&cf->inner);
+		av_free(cf);
+	}
+	return pb;
+}
+
+//用指定的输入方式解封装一遍文件，结果追加到csv（为NULL时只预热系统缓存，不记录）
+static int media_io_bench_run(const char* filename, int mode, QByteArray* csv)
+{
+	AVFormatContext* ic = NULL;
+	AVIOContext* pb = NULL;
+	AVPacket pkt;
+	MediaIO* io;
+	const char* name = "file";
+	char line[256];
+	int64_t start, packets = 0, bytes = 0, duration;
+	double read_ms, seek_ms;
+	int i, n, ret;
+
+	pb = mode == MEDIA_IO_DEFAULT ? counted_file_open(filename) : media_io_open(filename, mode, NULL);
+	if (!pb)
+		return AVERROR(EINVAL);
+	io = (MediaIO*)pb->opaque;
+	if (io->type != MEDIA_IO_DEFAULT)
+		name = io->type == MEDIA_IO_MMAP ? "mmap" : "prefetch";
+	ic = avformat_alloc_context();
+	if (!ic) {
+		ret = AVERROR(ENOMEM);
+		goto end;
+	}
+	ic->pb = pb;
+	ic->flags |= AVFMT_FLAG_CUSTOM_IO;
+	//打开和探测也计入读取耗时，与ReadThread打开文件时一致
+	start = av_gettime_relative();
+	if ((ret = avformat_open_input(&ic, filename, NULL, NULL)) < 0)
+		goto end;
+	if ((ret = avformat_find_stream_info(ic, NULL)) < 0)
+		goto end;
+	while ((ret = av_read_frame(ic, &pkt)) >= 0) {
+		packets++;
+		bytes += pkt.size;
+		av_packet_unref(&pkt);
+	}
+	if (ret != AVERROR_EOF)
+		goto end;
+	read_ms = (av_gettime_relative() - start) / 1000.0;
+
+	//在整个时长内按固定的伪随机序列seek，各输入方式的位置相同
+	duration = ic->duration > 0 ? ic->duration : 0;
+	start = av_gettime_relative();
+	for (i = 0; i < MEDIA_IO_BENCH_SEEKS && duration > 0; i++) {
+		int64_t ts = (int64_t)((i * 7919LL) % MEDIA_IO_BENCH_SEEKS * (duration / MEDIA_IO_BENCH_SEEKS));
+		if (ic->start_time != AV_NOPTS_VALUE)
+			ts += ic->start_time;
+		if (avformat_seek_file(ic, -1, INT64_MIN, ts, INT64_MAX, 0) < 0)
+			continue;
+		for (n = 0; n < MEDIA_IO_BENCH_SEEK_PACKETS && av_read_frame(ic, &pkt) >= 0; n++)
+			av_packet_unref(&pkt);
+	}
+	seek_ms = (av_gettime_relative() - start) / 1000.0;
+
+	//reads/seeks为整个过程（打开、探测、顺序读取和随机seek）中填充缓冲区和seek的次数
+	snprintf(line, sizeof(line), "%s,%" PRId64 ",%" PRId64 ",%" PRId64 ",%" PRId64 ",%.1f,%.1f,%d,%.1f\n", name,
+		packets, bytes, io->reads, io->seeks, read_ms, read_ms > 0 ? bytes / (read_ms * 1000.0) : 0.0,
+		duration > 0 ? MEDIA_IO_BENCH_SEEKS : 0, seek_ms);
+	if (csv) {
+		av_log(NULL, AV_LOG_INFO, "io bench: %s", line);
+		*csv += line;
+	}
+	ret = 0;
+end:
+	if (ret < 0)
+		av_log(NULL, AV_LOG_ERROR, "io bench: %s input failed on %s\n", name, filename);
+	avformat_close_input(&ic);
+	//自定义输入在关闭时输出填充和seek的统计
+	if (mode == MEDIA_IO_DEFAULT)
+		counted_file_close(&pb);
+	else
+		media_io_close(&pb);
+	return ret;
+}
+
+int media_io_bench(const char* filename, const char* report)
+{
+	static const int modes[] = { MEDIA_IO_DEFAULT, MEDIA_IO_MMAP, MEDIA_IO_PREFETCH };
+	QByteArray csv;
+	size_t i;
+	int ret = 0;
+
+	av_log(NULL, AV_LOG_INFO, "io bench: %s\n", filename);
+	//先不计入地读一遍，各输入方式都在热缓存下比较，测的是系统调用和拷贝的开销而不是磁盘
+	if ((ret = media_io_bench_run(filename, MEDIA_IO_DEFAULT, NULL)) < 0)
+		return ret;
+	csv = "io,packets,bytes,reads,seeks,read_ms,mb_per_s,random_seeks,seek_ms\n";
+	for (i = 0; i < FF_ARRAY_ELEMS(modes) && ret >= 0; i++)
+		ret = media_io_bench_run(filename, modes[i], &csv);
+	if (ret < 0)
+		return ret;
+	if (report) {
+		QFile file(QString::fromLocal8Bit(report));
+		if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(csv) != csv.size())
+			av_log(NULL, AV_LOG_ERROR, "io bench: could not write %s\n", report);
+	}
+	return 0;
+}
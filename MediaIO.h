@@ -0,0 +1,126 @@
+﻿/*
+ * @file 	mediaio.h
+ *
+ * @brief 	本地文件的自定义输入（AVIOContext）
+ * @note	内存映射：把整个文件映射到进程地址空间，读取变为内存拷贝，seek变为指针运算，
+ *			不再需要默认file协议每次填充缓冲区时的read()/lseek()系统调用。
+ *			预读缓存：独立的I/O线程按对齐的大块提前读入块缓存，解封装只从缓存拷贝，
+ *			慢速磁盘/网络共享上的读取不再阻塞ReadThread；seek时取消尚未开始的预读并在新位置重新预读。
+ *			只用于普通本地文件，其他输入（网络流、设备、管道等）返回NULL，由调用方退回默认协议。
+ */
+#pragma once
+
+#include <thread>
+#include "globalhelper.h"
+
+/* 自定义AVIOContext的缓冲区大小，每次填充只是一次memcpy，取大一些减少回调次数 */
+#define MEDIA_IO_BUFFER_SIZE (256 * 1024)
+/* 内存映射顺序读取时提前提示内核预读的窗口大小 */
+#define MEDIA_IO_READAHEAD_SIZE (8 * 1024 * 1024)
+
+/* 预读缓存：块大小（块按该大小对齐）、缓存块数、当前块之后预读的块数、I/O线程数 */
+#define PREFETCH_BLOCK_SIZE (1024 * 1024)
+#define PREFETCH_NB_BLOCKS 12
+#define PREFETCH_DEPTH 6
+#define PREFETCH_NB_THREADS 2
+
+/* 基准测试中顺序读完后做的随机seek次数，以及每次seek后读取的包数 */
+#define MEDIA_IO_BENCH_SEEKS 50
+#define MEDIA_IO_BENCH_SEEK_PACKETS 32
+/* 基准测试中统计默认file协议的系统调用时使用的缓冲区大小，与默认file协议的缓冲区大小（IO_BUFFER_SIZE）相同 */
+#define MEDIA_IO_BENCH_FILE_BUFFER_SIZE 32768
+
+//输入方式
+enum {
+	MEDIA_IO_DEFAULT = 0,	// 默认file协议
+	MEDIA_IO_AUTO,	// 本地磁盘用内存映射，网络共享/可移动磁盘用预读缓存
+	MEDIA_IO_MMAP,	// 优先内存映射，失败时用预读缓存
+	MEDIA_IO_PREFETCH,	// 预读缓存
+};
+
+//各种自定义输入共同的头部，AVIOContext::opaque指向它
+typedef struct MediaIO {
+	int type;	// MEDIA_IO_MMAP/MEDIA_IO_PREFETCH
+	int64_t size;	// 文件大小
+	int64_t pos;	// 当前读位置
+	int64_t reads;	// 填充缓冲区的次数（默认file协议下每次都是一次read系统调用）
+	int64_t seeks;	// seek次数（默认file协议下每次都是一次lseek系统调用）
+	int64_t bytes;	// 读取的总字节数
+	int64_t io_time;	// 读回调累计耗时（微秒），用于统计吞吐量
+	AVIOInterruptCB int_cb;	// 等待预读时检查是否退出
+} MediaIO;
+
+//内存映射的文件
+typedef struct MappedFile {
+	MediaIO io;
+	const uint8_t* data;	// 映射的起始地址
+	int64_t readahead_pos;	// 已提示预读到的位置
+#ifdef _WIN32
+	void* file;	// 文件句柄
+	void* mapping;	// 文件映射句柄
+#else
+	int fd;
+#endif
+} MappedFile;
+
+//预读缓存块状态
+enum {
+	PREFETCH_BLOCK_EMPTY = 0,
+	PREFETCH_BLOCK_PENDING,	// 已请求，等待I/O线程读取（seek时可以取消）
+	PREFETCH_BLOCK_LOADING,	// I/O线程正在读取
+	PREFETCH_BLOCK_READY,
+	PREFETCH_BLOCK_ERROR,
+};
+
+typedef struct PrefetchBlock {
+	int64_t index;	// 块序号，文件偏移为index * PREFETCH_BLOCK_SIZE
+	int state;	// PREFETCH_BLOCK_*
+	int size;	// 有效字节数（文件最后一块可能不满）
+	int64_t last_used;	// 最近使用的读序号，用于淘汰
+	uint8_t* data;
+} PrefetchBlock;
+
+//带预读块缓存的文件
+typedef struct PrefetchFile {
+	MediaIO io;
+#ifdef _WIN32
+	void* file;
+#else
+	int fd;
+#endif
+	PrefetchBlock blocks[PREFETCH_NB_BLOCKS];
+	int64_t cur_block;	// 读位置所在的块，I/O线程优先读取离它最近的块
+	int64_t use_counter;
+	int abort_request;
+	SDL_mutex* mutex;
+	SDL_cond* cond;	// 有新的请求（I/O线程等待）或有块读完（读回调等待）
+	std::thread workers[PREFETCH_NB_THREADS];
+	int64_t hits;	// 需要的块已在缓存中
+	int64_t waits;	// 需要等待I/O线程读取
+	int64_t cancels;	// seek后取消的预读请求
+	int64_t wait_time;	// 等待I/O的累计耗时（微秒）
+} PrefetchFile;
+
+/// <summary>
+/// 为本地普通文件创建自定义输入
+/// </summary>
+/// <param name="filename">文件名（可带file:前缀）</param>
+/// <param name="mode">MEDIA_IO_*</param>
+/// <param name="int_cb">等待I/O时检查的中断回调，可以为NULL</param>
+/// <returns>失败、MEDIA_IO_DEFAULT或不是普通本地文件时返回NULL，调用方应退回默认协议</returns>
+AVIOContext* media_io_open(const char* filename, int mode, const AVIOInterruptCB* int_cb);
+
+/// <summary>
+/// 释放media_io_open创建的AVIOContext（avformat_close_input不会释放自定义的pb）
+/// </summary>
+/// <param name="pb">释放后置为NULL</param>
+void media_io_close(AVIOContext** pb);
+
+/// <summary>
+/// 输入方式的基准测试：分别用默认file协议、内存映射和预读缓存解封装同一文件，
+/// 比较填充缓冲区和seek的次数（默认file协议下即read/lseek系统调用次数）、顺序读完所有包的吞吐量，以及随机seek后读取若干包的耗时
+/// </summary>
+/// <param name="filename">本地文件</param>
+/// <param name="report">CSV报告文件，NULL表示只输出日志</param>
+/// <returns>0-成功；<0-失败</returns>
+int media_io_bench(const char* filename, const char* report);
@@ -0,0 +1,396 @@
+﻿/*
+ * @file 	pixelrepack.cpp
+ *
+ * @brief 	解码输出的像素格式到SDL纹理格式的映射与重排
+ * @note
+ */
+
+#include <QFile>
+
+#include "pixelrepack.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PIXEL_REPACK_SSE2 1
+#else
+#define PIXEL_REPACK_SSE2 0
+#endif
+
+//YUV420P -> IYUV：三个平面直接拷贝
+static void repack_yuv420p(const AVFrame* frame, uint8_t* const planes[3], const int pitches[3])
+{
+	int cw = AV_CEIL_RSHIFT(frame->width, 1), ch = AV_CEIL_RSHIFT(frame->height, 1);
+
+	av_image_copy_plane(planes[0], pitches[0], frame->data[0], frame->linesize[0], frame->width, frame->height);
+	av_image_copy_plane(planes[1], pitches[1], frame->data[1], frame->linesize[1], cw, ch);
+	av_image_copy_plane(planes[2], pitches[2], frame->data[2], frame->linesize[2], cw, ch);
+}
+
+//NV12 -> NV12、NV21 -> NV21：亮度平面和交织的色度平面直接拷贝
+static void repack_nv(const AVFrame* frame, uint8_t* const planes[3], const int pitches[3])
+{
+	av_image_copy_plane(planes[0], pitches[0], frame->data[0], frame->linesize[0], frame->width, frame->height);
+	av_image_copy_plane(planes[1], pitches[1], frame->data[1], frame->linesize[1],
+		AV_CEIL_RSHIFT(frame->width, 1) * 2, AV_CEIL_RSHIFT(frame->height, 1));
+}
+
+//YUYV422 -> YUY2、UYVY422 -> UYVY、BGRA -> ARGB8888：单个打包平面直接拷贝
+static void repack_packed(const AVFrame* frame, uint8_t* const planes[3], const int pitches[3])
+{
+	int bytes = frame->format == AV_PIX_FMT_BGRA ? frame->width * 4 : AV_CEIL_RSHIFT(frame->width, 1) * 4;
+
+	av_image_copy_plane(planes[0], pitches[0], frame->data[0], frame->linesize[0], bytes, frame->height);
+}
+
+//把交织的色度行拆成两个平面
+static void repack_deinterleave_row(uint8_t* a, uint8_t* b, const uint8_t* src, int n)
+{
+	int x = 0;
+#if PIXEL_REPACK_SSE2
+	const __m128i mask = _mm_set1_epi16(0x00FF);
+	for (; x + 16 <= n; x += 16) {
+		__m128i v0 = _mm_loadu_si128((const __m128i*)(src + 2 * x));
+		__m128i v1 = _mm_loadu_si128((const __m128i*)(src + 2 * x + 16));
+		_mm_storeu_si128((__m128i*)(a + x), _mm_packus_epi16(_mm_and_si128(v0, mask), _mm_and_si128(v1, mask)));
+		_mm_storeu_si128((__m128i*)(b + x), _mm_packus_epi16(_mm_srli_epi16(v0, 8), _mm_srli_epi16(v1, 8)));
+	}
+#endif
+	for (; x < n; x++) {
+		a[x] = src[2 * x];
+		b[x] = src[2 * x + 1];
+	}
+}
+
+//NV12/NV21 -> IYUV（渲染器不支持NV12/NV21纹理时）：去交织色度
+static void repack_nv_to_planar(const AVFrame* frame, uint8_t* const planes[3], const int pitches[3])
+{
+	int cw = AV_CEIL_RSHIFT(frame->width, 1), ch = AV_CEIL_RSHIFT(frame->height, 1), y;
+	//NV21的色度顺序是VU
+	uint8_t* u = frame->format == AV_PIX_FMT_NV21 ? planes[2] : planes[1];
+	uint8_t* v = frame->format == AV_PIX_FMT_NV21 ? planes[1] : planes[2];
+
+	av_image_copy_plane(planes[0], pitches[0], frame->data[0], frame->linesize[0], frame->width, frame->height);
+	for (y = 0; y < ch; y++)
+		repack_deinterleave_row(u + y * pitches[1], v + y * pitches[2], frame->data[1] + y * frame->linesize[1], cw);
+}
+
+//YUV422P -> YUY2：按Y0 U Y1 V交织，不损失色度
+static void repack_yuv422p_to_yuy2(const AVFrame* frame, uint8_t* const planes[3], const int pitches[3])
+{
+	int pairs = frame->width / 2, x, y;
+
+	for (y = 0; y < frame->height; y++) {
+		const uint8_t* sy = frame->data[0] + y * frame->linesize[0];
+		const uint8_t* su = frame->data[1] + y * frame->linesize[1];
+		const uint8_t* sv = frame->data[2] + y * frame->linesize[2];
+		uint8_t* d = planes[0] + y * pitches[0];
+		x = 0;
+#if PIXEL_REPACK_SSE2
+		for (; x + 8 <= pairs; x += 8) {
+			__m128i yy = _mm_loadu_si128((const __m128i*)(sy + 2 * x));
+			__m128i uv = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(su + x)), _mm_loadl_epi64((const __m128i*)(sv + x)));
+			_mm_storeu_si128((__m128i*)(d + 4 * x), _mm_unpacklo_epi8(yy, uv));
+			_mm_storeu_si128((__m128i*)(d + 4 * x + 16), _mm_unpackhi_epi8(yy, uv));
+		}
+#endif
+		for (; x < pairs; x++) {
+			d[4 * x] = sy[2 * x];
+			d[4 * x + 1] = su[x];
+			d[4 * x + 2] = sy[2 * x + 1];
+			d[4 * x + 3] = sv[x];
+		}
+		//宽度为奇数时最后一个像素重复一次
+		if (frame->width & 1) {
+			d[4 * x] = d[4 * x + 2] = sy[2 * x];
+			d[4 * x + 1] = su[x];
+			d[4 * x + 3] = sv[x];
+		}
+	}
+}
+
+//两行取平均（第二行不存在时直接拷贝）
+static void repack_average_rows(uint8_t* dst, const uint8_t* a, const uint8_t* b, int n)
+{
+	int x = 0;
+#if PIXEL_REPACK_SSE2
+	for (; x + 16 <= n; x += 16)
+		_mm_storeu_si128((__m128i*)(dst + x), _mm_avg_epu8(_mm_loadu_si128((const __m128i*)(a + x)), _mm_loadu_si128((const __m128i*)(b + x))));
+#endif
+	for (; x < n; x++)
+		dst[x] = (a[x] + b[x] + 1) >> 1;
+}
+
+//两行取平均后再水平两两取平均，即2x2平均
+static void repack_average_2x2(uint8_t* dst, const uint8_t* a, const uint8_t* b, int src_width)
+{
+	int n = src_width / 2, x = 0;
+#if PIXEL_REPACK_SSE2
+	const __m128i mask = _mm_set1_epi16(0x00FF);
+	for (; x + 8 <= n; x += 8) {
+		__m128i v = _mm_avg_epu8(_mm_loadu_si128((const __m128i*)(a + 2 * x)), _mm_loadu_si128((const __m128i*)(b + 2 * x)));
+		__m128i avg = _mm_avg_epu16(_mm_and_si128(v, mask), _mm_srli_epi16(v, 8));
+		_mm_storel_epi64((__m128i*)(dst + x), _mm_packus_epi16(avg, avg));
+	}
+#endif
+	//与SIMD部分相同的舍入方式，结果不随宽度变化
+	for (; x < n; x++)
+		dst[x] = (((a[2 * x] + b[2 * x] + 1) >> 1) + ((a[2 * x + 1] + b[2 * x + 1] + 1) >> 1) + 1) >> 1;
+	if (src_width & 1)
+		dst[n] = (a[2 * n] + b[2 * n] + 1) >> 1;
+}
+
+//YUV422P -> IYUV（渲染器不支持YUY2纹理时）：相邻两行色度取平均
+static void repack_yuv422p_to_420(const AVFrame* frame, uint8_t* const planes[3], const int pitches[3])
+{
+	int cw = AV_CEIL_RSHIFT(frame->width, 1), ch = AV_CEIL_RSHIFT(frame->height, 1), i, y;
+
+	av_image_copy_plane(planes[0], pitches[0], frame->data[0], frame->linesize[0], frame->width, frame->height);
+	for (i = 1; i < 3; i++) {
+		for (y = 0; y < ch; y++) {
+			const uint8_t* a = frame->data[i] + 2 * y * frame->linesize[i];
+			const uint8_t* b = 2 * y + 1 < frame->height ? a + frame->linesize[i] : a;
+			repack_average_rows(planes[i] + y * pitches[i], a, b, cw);
+		}
+	}
+}
+
+//YUV444P -> IYUV：色度2x2平均
+static void repack_yuv444p_to_420(const AVFrame* frame, uint8_t* const planes[3], const int pitches[3])
+{
+	int ch = AV_CEIL_RSHIFT(frame->height, 1), i, y;
+
+	av_image_copy_plane(planes[0], pitches[0], frame->data[0], frame->linesize[0], frame->width, frame->height);
+	for (i = 1; i < 3; i++) {
+		for (y = 0; y < ch; y++) {
+			const uint8_t* a = frame->data[i] + 2 * y * frame->linesize[i];
+			const uint8_t* b = 2 * y + 1 < frame->height ? a + frame->linesize[i] : a;
+			repack_average_2x2(planes[i] + y * pitches[i], a, b, frame->width);
+		}
+	}
+}
+
+//16位采样右移shift位截断为8位
+static void repack_narrow_row(uint8_t* dst, const uint16_t* src, int n, int shift)
+{
+	int x = 0;
+#if PIXEL_REPACK_SSE2
+	const __m128i count = _mm_cvtsi32_si128(shift);
+	for (; x + 16 <= n; x += 16) {
+		__m128i v0 = _mm_srl_epi16(_mm_loadu_si128((const __m128i*)(src + x)), count);
+		__m128i v1 = _mm_srl_epi16(_mm_loadu_si128((const __m128i*)(src + x + 8)), count);
+		_mm_storeu_si128((__m128i*)(dst + x), _mm_packus_epi16(v0, v1));
+	}
+#endif
+	for (; x < n; x++)
+		dst[x] = (uint8_t)FFMIN(src[x] >> shift, 255);
+}
+
+static void repack_narrow_plane(uint8_t* dst, int dst_pitch, const uint8_t* src, int src_pitch, int samples, int rows, int shift)
+{
+	int y;
+
+	for (y = 0; y < rows; y++)
+		repack_narrow_row(dst + y * dst_pitch, (const uint16_t*)(src + y * src_pitch), samples, shift);
+}
+
+//YUV420P10 -> IYUV：10位采样在低位，右移2位
+static void repack_yuv420p10_to_420(const AVFrame* frame, uint8_t* const planes[3], const int pitches[3])
+{
+	int cw = AV_CEIL_RSHIFT(frame->width, 1), ch = AV_CEIL_RSHIFT(frame->height, 1);
+
+	repack_narrow_plane(planes[0], pitches[0], frame->data[0], frame->linesize[0], frame->width, frame->height, 2);
+	repack_narrow_plane(planes[1], pitches[1], frame->data[1], frame->linesize[1], cw, ch, 2);
+	repack_narrow_plane(planes[2], pitches[2], frame->data[2], frame->linesize[2], cw, ch, 2);
+}
+
+//P010 -> NV12：10位采样在高位，取高字节
+static void repack_p010_to_nv12(const AVFrame* frame, uint8_t* const planes[3], const int pitches[3])
+{
+	repack_narrow_plane(planes[0], pitches[0], frame->data[0], frame->linesize[0], frame->width, frame->height, 8);
+	repack_narrow_plane(planes[1], pitches[1], frame->data[1], frame->linesize[1],
+		AV_CEIL_RSHIFT(frame->width, 1) * 2, AV_CEIL_RSHIFT(frame->height, 1), 8);
+}
+
+//同一格式靠前的映射优先，渲染器不支持其纹理格式时依次尝试后面的
+static const PixelRepack repack_table[] = {
+	{ AV_PIX_FMT_YUV420P, SDL_PIXELFORMAT_IYUV, "yuv420p>IYUV", repack_yuv420p },
+	{ AV_PIX_FMT_NV12, SDL_PIXELFORMAT_NV12, "nv12>NV12", repack_nv },
+	{ AV_PIX_FMT_NV12, SDL_PIXELFORMAT_IYUV, "nv12>IYUV", repack_nv_to_planar },
+	{ AV_PIX_FMT_NV21, SDL_PIXELFORMAT_NV21, "nv21>NV21", repack_nv },
+	{ AV_PIX_FMT_NV21, SDL_PIXELFORMAT_IYUV, "nv21>IYUV", repack_nv_to_planar },
+	{ AV_PIX_FMT_YUYV422, SDL_PIXELFORMAT_YUY2, "yuyv422>YUY2", repack_packed },
+	{ AV_PIX_FMT_UYVY422, SDL_PIXELFORMAT_UYVY, "uyvy422>UYVY", repack_packed },
+	{ AV_PIX_FMT_YUV422P, SDL_PIXELFORMAT_YUY2, "yuv422p>YUY2", repack_yuv422p_to_yuy2 },
+	{ AV_PIX_FMT_YUV422P, SDL_PIXELFORMAT_IYUV, "yuv422p>IYUV", repack_yuv422p_to_420 },
+	{ AV_PIX_FMT_YUV444P, SDL_PIXELFORMAT_IYUV, "yuv444p>IYUV", repack_yuv444p_to_420 },
+	{ AV_PIX_FMT_YUV420P10LE, SDL_PIXELFORMAT_IYUV, "yuv420p10>IYUV", repack_yuv420p10_to_420 },
+	{ AV_PIX_FMT_P010LE, SDL_PIXELFORMAT_NV12, "p010>NV12", repack_p010_to_nv12 },
+	{ AV_PIX_FMT_BGRA, SDL_PIXELFORMAT_ARGB8888, "bgra>ARGB8888", repack_packed },
+};
+
+static int pixel_repack_supported(const SDL_RendererInfo* info, Uint32 sdl_format)
+{
+	Uint32 i;
+
+	if (sdl_format == SDL_PIXELFORMAT_IYUV || sdl_format == SDL_PIXELFORMAT_ARGB8888)
+		return 1;
+	if (!info)
+		return 0;
+	for (i = 0; i < info->num_texture_formats; i++) {
+		if (info->texture_formats[i] == sdl_format)
+			return 1;
+	}
+	return 0;
+}
+
+const PixelRepack* pixel_repack_find(int format, const SDL_RendererInfo* info)
+{
+	size_t i;
+
+	for (i = 0; i < FF_ARRAY_ELEMS(repack_table); i++) {
+		if (repack_table[i].src_format == format && pixel_repack_supported(info, repack_table[i].sdl_format))
+			return &repack_table[i];
+	}
+	return NULL;
+}
+
+void pixel_repack_planes(Uint32 sdl_format, uint8_t* pixels, int pitch, int height, uint8_t* planes[3], int pitches[3])
+{
+	planes[0] = pixels;
+	pitches[0] = pitch;
+	planes[1] = planes[2] = NULL;
+	pitches[1] = pitches[2] = 0;
+	switch (sdl_format) {
+	case SDL_PIXELFORMAT_IYUV:
+		//连续的Y、U、V三个平面，色度平面的宽高和行宽都是亮度的一半（向上取整）
+		pitches[1] = pitches[2] = (pitch + 1) / 2;
+		planes[1] = pixels + pitch * height;
+		planes[2] = planes[1] + pitches[1] * ((height + 1) / 2);
+		break;
+	case SDL_PIXELFORMAT_NV12:
+	case SDL_PIXELFORMAT_NV21:
+		//亮度平面之后是交织的色度平面
+		pitches[1] = 2 * ((pitch + 1) / 2);
+		planes[1] = pixels + pitch * height;
+		break;
+	default:
+		break;
+	}
+}
+
+int pixel_repack_upload(SDL_Texture* tex, const PixelRepack* repack, const AVFrame* frame)
+{
+	uint8_t* planes[3];
+	int pitches[3];
+	void* pixels;
+	int pitch;
+
+	if (SDL_LockTexture(tex, NULL, &pixels, &pitch) < 0)
+		return -1;
+	pixel_repack_planes(repack->sdl_format, (uint8_t*)pixels, pitch, frame->height, planes, pitches);
+	repack->convert(frame, planes, pitches);
+	SDL_UnlockTexture(tex);
+	return 0;
+}
+
+//纹理一行的字节数
+static int pixel_repack_pitch(Uint32 sdl_format, int width)
+{
+	switch (sdl_format) {
+	case SDL_PIXELFORMAT_ARGB8888:
+		return width * 4;
+	case SDL_PIXELFORMAT_YUY2:
+	case SDL_PIXELFORMAT_UYVY:
+		return AV_CEIL_RSHIFT(width, 1) * 4;
+	default:
+		return FFALIGN(width, 2);
+	}
+}
+
+void pixel_repack_fill_grey(AVFrame* frame)
+{
+	const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get((enum AVPixelFormat)frame->format);
+	int depth = desc->comp[0].depth;
+	int value = (1 << (depth - 1)) << desc->comp[0].shift;
+	int n, i;
+
+	for (n = 0; n < 4 && frame->buf[n]; n++) {
+		uint8_t* data = frame->buf[n]->data;
+		if (depth <= 8) {
+			memset(data, value, frame->buf[n]->size);
+			continue;
+		}
+		//高位深按小端16位写入
+		for (i = 0; i + 1 < frame->buf[n]->size; i += 2) {
+			data[i] = value & 0xff;
+			data[i + 1] = value >> 8;
+		}
+	}
+}
+
+int pixel_repack_bench(int width, int height, const char* report, int iterations)
+{
+	AVFrame* frame = NULL;
+	struct SwsContext* sws = NULL;
+	uint8_t* buf = NULL;
+	uint8_t* planes[3];
+	int pitches[3];
+	QByteArray csv;
+	char line[256];
+	int64_t start;
+	double repack_ms, sws_ms;
+	size_t i;
+	int n, ret = AVERROR(ENOMEM);
+
+	//最大的纹理（ARGB8888）所需的内存
+	buf = (uint8_t*)av_malloc((size_t)width * 4 * height + 64);
+	frame = av_frame_alloc();
+	if (!buf || !frame)
+		goto end;
+	av_log(NULL, AV_LOG_INFO, "upload bench: %dx%d, %d iterations, SSE2 %s\n",
+		width, height, iterations, PIXEL_REPACK_SSE2 ? "on" : "off");
+	csv = "format,texture,width,height,repack_ms,sws_bgra_ms\n";
+	for (i = 0; i < FF_ARRAY_ELEMS(repack_table); i++) {
+		const PixelRepack* repack = &repack_table[i];
+		av_frame_unref(frame);
+		frame->format = repack->src_format;
+		frame->width = width;
+		frame->height = height;
+		if (av_frame_get_buffer(frame, 32) < 0)
+			goto end;
+		pixel_repack_fill_grey(frame);
+		pixel_repack_planes(repack->sdl_format, buf, pixel_repack_pitch(repack->sdl_format, width), height, planes, pitches);
+
+		start = av_gettime_relative();
+		for (n = 0; n < iterations; n++)
+			repack->convert(frame, planes, pitches);
+		repack_ms = (av_gettime_relative() - start) / 1000.0 / iterations;
+
+		//原来的回退路径：swscale双三次转换为BGRA
+		sws_ms = 0;
+		sws = sws_getCachedContext(sws, width, height, repack->src_format, width, height, AV_PIX_FMT_BGRA, SWS_BICUBIC, NULL, NULL, NULL);
+		if (sws && repack->src_format != AV_PIX_FMT_BGRA) {
+			uint8_t* dst[4] = { buf, NULL, NULL, NULL };
+			int dst_linesize[4] = { width * 4, 0, 0, 0 };
+			start = av_gettime_relative();
+			for (n = 0; n < iterations; n++)
+				sws_scale(sws, (const uint8_t* const*)frame->data, frame->linesize, 0, height, dst, dst_linesize);
+			sws_ms = (av_gettime_relative() - start) / 1000.0 / iterations;
+		}
+		snprintf(line, sizeof(line), "%s,%s,%d,%d,%.3f,%.3f\n", av_get_pix_fmt_name(repack->src_format),
+			SDL_GetPixelFormatName(repack->sdl_format), width, height, repack_ms, sws_ms);
+		av_log(NULL, AV_LOG_INFO, "upload bench: %s", line);
+		csv += line;
+	}
+	if (report) {
+		QFile file(QString::fromLocal8Bit(report));
+		if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(csv) != csv.size())
+			av_log(NULL, AV_LOG_ERROR, "upload bench: could not write %s\n", report);
+	}
+	ret = 0;
+end:
+	sws_freeContext(sws);
+	av_frame_free(&frame);
+	av_free(buf);
+	return ret;
+}
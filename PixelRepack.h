@@ -0,0 +1,67 @@
+﻿/*
+ * @file 	pixelrepack.h
+ *
+ * @brief 	解码输出的像素格式到SDL纹理格式的映射与重排
+ * @note	upload_texture原先只对YUV420P和BGRA直接上传，其余格式（NV12、10位、4:2:2等）都在渲染线程上用SWS_BICUBIC整帧转换为BGRA。
+ *			这里按渲染器原生支持的纹理格式为常见的解码输出选择YUV纹理：能直接对应的只拷贝平面（NV12/NV21/YUY2/UYVY），
+ *			不能直接对应的做廉价的重排（交织、去交织、10位截断为8位、色度降采样为4:2:0），都不经过RGB，主要循环有SSE2实现。
+ *			全范围（YUVJ）等SDL的YUV纹理无法正确显示的格式没有映射，仍由调用方用swscale转换为BGRA。
+ *			pixel_repack_bench统计各映射每帧的耗时，并与swscale转换为BGRA对比。
+ */
+#pragma once
+
+#include "globalhelper.h"
+
+//一种像素格式到纹理格式的映射
+typedef struct PixelRepack {
+	enum AVPixelFormat src_format;	// 解码输出的格式
+	Uint32 sdl_format;	// 纹理格式
+	const char* name;	// 用于日志和基准测试
+	// 把帧写入锁定的纹理，planes/pitches由pixel_repack_planes按纹理格式给出
+	void (*convert)(const AVFrame* frame, uint8_t* const planes[3], const int pitches[3]);
+} PixelRepack;
+
+/// <summary>
+/// 为像素格式选择渲染器支持的纹理格式，表中靠前的映射优先
+/// </summary>
+/// <param name="format">AVPixelFormat</param>
+/// <param name="info">渲染器信息，IYUV和ARGB8888总是可用（SDL在渲染器不支持时内部转换）</param>
+/// <returns>没有合适的映射时返回NULL</returns>
+const PixelRepack* pixel_repack_find(int format, const SDL_RendererInfo* info);
+
+/// <summary>
+/// 按纹理格式计算SDL_LockTexture返回的内存中各平面的位置
+/// </summary>
+/// <param name="sdl_format">纹理格式</param>
+/// <param name="pixels">SDL_LockTexture返回的像素指针</param>
+/// <param name="pitch">SDL_LockTexture返回的行宽</param>
+/// <param name="height">纹理高度</param>
+/// <param name="planes">输出的各平面起始位置</param>
+/// <param name="pitches">输出的各平面行宽</param>
+void pixel_repack_planes(Uint32 sdl_format, uint8_t* pixels, int pitch, int height, uint8_t* planes[3], int pitches[3]);
+
+/// <summary>
+/// 锁定纹理并写入帧
+/// </summary>
+/// <param name="tex">格式为repack->sdl_format、尺寸与帧一致的流式纹理</param>
+/// <param name="repack">pixel_repack_find的结果</param>
+/// <param name="frame"></param>
+/// <returns>0-成功；<0-加锁失败</returns>
+int pixel_repack_upload(SDL_Texture* tex, const PixelRepack* repack, const AVFrame* frame);
+
+/// <summary>
+/// 按像素格式的位深把帧填充为中灰（各分量取值范围的一半，色度为中性），供基准测试使用
+/// </summary>
+/// <param name="frame">已用av_frame_get_buffer分配的帧，高位深格式须为小端</param>
+void pixel_repack_fill_grey(AVFrame* frame);
+
+/// <summary>
+/// 基准测试：对表中每种映射以及swscale转换为BGRA（原来的回退路径），各转换iterations次，
+/// 记录每帧的平均耗时。结果以CSV写入report（为NULL时只输出到日志）。
+/// </summary>
+/// <param name="width">帧宽</param>
+/// <param name="height">帧高</param>
+/// <param name="report">CSV报告的路径，可为NULL</param>
+/// <param name="iterations">每种格式的转换次数</param>
+/// <returns>0-成功；<0-内存不足</returns>
+int pixel_repack_bench(int width, int height, const char* report, int iterations);
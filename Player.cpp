@@ -154,6 +154,7 @@ bool  Player::ConnectSignalSlots()
 	connect(&m_stTitle, &Title::SigShowMenu, this, &Player::OnShowMenu);
 
 	connect(&m_stPlaylist, &Playlist::SigPlay, ui->ShowWid, &Show::SigPlay);
+	connect(&m_stPlaylist, &Playlist::SigPreOpen, VideoCtl::GetInstance(), &VideoCtl::OnPreOpen);
 
 	connect(ui->ShowWid, &Show::SigOpenFile, &m_stPlaylist, &Playlist::OnAddFileAndPlay);
 	connect(ui->ShowWid, &Show::SigFullScreen, this, &Player::OnFullScreenPlay);
@@ -100,6 +100,12 @@ void Playlist::on_List_itemDoubleClicked(QListWidgetItem* item)
 	emit SigPlay(item->data(Qt::UserRole).toString());
 	m_nCurrentPlayListIndex = ui->List->row(item);
 	ui->List->setCurrentRow(m_nCurrentPlayListIndex);
+	//与OnForwardPlay相同的循环顺序
+	if (ui->List->count() > 1)
+	{
+		QListWidgetItem* pNextItem = ui->List->item((m_nCurrentPlayListIndex + 1) % ui->List->count());
+		emit SigPreOpen(pNextItem->data(Qt::UserRole).toString());
+	}
 }
 
 bool Playlist::GetPlaylistStatus()
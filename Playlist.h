@@ -77,6 +77,11 @@ signals:
     /// </summary>
     /// <param name="strFile"></param>
     void SigPlay(QString strFile); //< 播放文件
+    /// <summary>
+    /// 与VideoCtl::OnPreOpen连接，开始播放后通知在后台预打开下一个文件
+    /// </summary>
+    /// <param name="strFile"></param>
+    void SigPreOpen(QString strFile);
 private:
     bool InitUi();
     bool ConnectSignalSlots();
@@ -0,0 +1,251 @@
+﻿/*
+ * @file 	preopen.cpp
+ *
+ * @brief 	后台预打开播放列表中的下一个文件
+ * @note
+ */
+
+#include "preopen.h"
+#include "mediaio.h"
+#include "probecache.h"
+#include "decoderprofile.h"
+
+static int preopen_interrupt_cb(void* ctx)
+{
+	PreopenState* pre = (PreopenState*)ctx;
+	return pre->abort_request.load();
+}
+
+//与stream_component_open使用相同的解码器选项
+static int preopen_open_decoder(PreopenState* pre, int stream_index)
+{
+	AVStream* st = pre->ic->streams[stream_index];
+	AVCodecContext* avctx;
+	AVCodec* codec;
+	AVDictionary* opts = NULL;
+	int lowres = st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO ? pre->lowres : 0;
+	int ret;
+
+	avctx = avcodec_alloc_context3(NULL);
+	if (!avctx)
+		return AVERROR(ENOMEM);
+	ret = avcodec_parameters_to_context(avctx, st->codecpar);
+	if (ret < 0)
+		goto fail;
+	av_codec_set_pkt_timebase(avctx, st->time_base);
+	codec = avcodec_find_decoder(avctx->codec_id);
+	if (!codec) {
+		ret = AVERROR_DECODER_NOT_FOUND;
+		goto fail;
+	}
+	avctx->codec_id = codec->id;
+	//lowres与正常打开时相同，否则开始播放后video_update_lowres会立即重新打开解码器
+	if (lowres > av_codec_get_max_lowres(codec))
+		lowres = av_codec_get_max_lowres(codec);
+	av_codec_set_lowres(avctx, lowres);
+#if FF_API_EMU_EDGE
+	if (lowres) avctx->flags |= CODEC_FLAG_EMU_EDGE;
+#endif
+#if FF_API_EMU_EDGE
+	if (codec->capabilities & AV_CODEC_CAP_DR1)
+		avctx->flags |= CODEC_FLAG_EMU_EDGE;
+#endif
+	decoder_profile_apply(avctx, &opts);
+	if (lowres)
+		av_dict_set_int(&opts, "lowres", lowres, 0);
+	if (avctx->codec_type == AVMEDIA_TYPE_VIDEO || avctx->codec_type == AVMEDIA_TYPE_AUDIO)
+		av_dict_set(&opts, "refcounted_frames", "1", 0);
+	if ((ret = avcodec_open2(avctx, codec, &opts)) < 0)
+		goto fail;
+	pre->avctx[avctx->codec_type] = avctx;
+	av_dict_free(&opts);
+	return 0;
+fail:
+	av_dict_free(&opts);
+	avcodec_free_context(&avctx);
+	return ret;
+}
+
+static void preopen_thread(PreopenState* pre)
+{
+	AVFormatContext* ic;
+	AVPacket pkt1, * pkt = &pkt1;
+	AVPacketList* node;
+	AVStream* ref_st;
+	int64_t ref_start = AV_NOPTS_VALUE, ts;
+	unsigned int i;
+	int type;
+
+	//不与当前播放争抢CPU和磁盘
+	SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW);
+	ic = avformat_alloc_context();
+	if (!ic)
+		goto fail;
+	ic->interrupt_callback.callback = preopen_interrupt_cb;
+	ic->interrupt_callback.opaque = pre;
+	pre->file_pb = media_io_open(pre->filename, pre->io_mode, &ic->interrupt_callback);
+	if (pre->file_pb) {
+		ic->pb = pre->file_pb;
+		ic->flags |= AVFMT_FLAG_CUSTOM_IO;
+	}
+	if (avformat_open_input(&ic, pre->filename, NULL, NULL) < 0)
+		goto fail;
+	pre->ic = ic;
+	av_format_inject_global_side_data(ic);
+	pre->probe_cached = probe_cache_load(ic, pre->filename);
+	if (!pre->probe_cached) {
+		if (avformat_find_stream_info(ic, NULL) < 0)
+			goto fail;
+		probe_cache_save(ic, pre->filename);
+	}
+	if (ic->pb)
+		ic->pb->eof_reached = 0;
+
+	//与ReadThread相同的选流规则
+	pre->st_index[AVMEDIA_TYPE_VIDEO] = av_find_best_stream(ic, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+	pre->st_index[AVMEDIA_TYPE_AUDIO] = av_find_best_stream(ic, AVMEDIA_TYPE_AUDIO, -1,
+		pre->st_index[AVMEDIA_TYPE_VIDEO], NULL, 0);
+	pre->st_index[AVMEDIA_TYPE_SUBTITLE] = av_find_best_stream(ic, AVMEDIA_TYPE_SUBTITLE, -1,
+		(pre->st_index[AVMEDIA_TYPE_AUDIO] >= 0 ?
+			pre->st_index[AVMEDIA_TYPE_AUDIO] :
+			pre->st_index[AVMEDIA_TYPE_VIDEO]), NULL, 0);
+	for (i = 0; i < ic->nb_streams; i++)
+		ic->streams[i]->discard = AVDISCARD_ALL;
+	for (type = 0; type < AVMEDIA_TYPE_NB; type++) {
+		if (pre->st_index[type] < 0)
+			continue;
+		ic->streams[pre->st_index[type]]->discard = AVDISCARD_DEFAULT;
+		//解码器打开失败时留给stream_component_open处理
+		preopen_open_decoder(pre, pre->st_index[type]);
+	}
+	if (pre->st_index[AVMEDIA_TYPE_VIDEO] < 0 && pre->st_index[AVMEDIA_TYPE_AUDIO] < 0)
+		goto fail;
+	ref_st = ic->streams[pre->st_index[AVMEDIA_TYPE_VIDEO] >= 0 ?
+		pre->st_index[AVMEDIA_TYPE_VIDEO] : pre->st_index[AVMEDIA_TYPE_AUDIO]];
+
+	//预读开头的一小段数据包，读到上限、结尾或出错时停止，剩下的交给ReadThread
+	av_init_packet(pkt);
+	while (!pre->abort_request && pre->size < PREOPEN_MAX_SIZE) {
+		if (av_read_frame(ic, pkt) < 0)
+			break;
+		if (pkt->stream_index == ref_st->index) {
+			ts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+			if (ts != AV_NOPTS_VALUE) {
+				if (ref_start == AV_NOPTS_VALUE)
+					ref_start = ts;
+				else if ((ts - ref_start) * av_q2d(ref_st->time_base) > PREOPEN_MAX_DURATION) {
+					av_packet_unref(pkt);
+					break;
+				}
+			}
+		}
+		node = (AVPacketList*)av_malloc(sizeof(AVPacketList));
+		if (!node) {
+			av_packet_unref(pkt);
+			break;
+		}
+		node->pkt = *pkt;
+		node->next = NULL;
+		if (pre->last_pkt)
+			pre->last_pkt->next = node;
+		else
+			pre->first_pkt = node;
+		pre->last_pkt = node;
+		pre->nb_packets++;
+		pre->size += pkt->size + sizeof(*node);
+	}
+	pre->ready_time = av_gettime_relative() - pre->open_time;
+	av_log(NULL, AV_LOG_INFO, "preopen: %s ready in %.1fms (%d packets, %d bytes)\n",
+		pre->filename, pre->ready_time / 1000.0, pre->nb_packets, pre->size);
+	pre->state = PREOPEN_READY;
+	return;
+fail:
+	pre->state = PREOPEN_FAILED;
+}
+
+PreopenState* preopen_start(const char* filename, int io_mode, int lowres)
+{
+	PreopenState* pre;
+
+	pre = (PreopenState*)av_mallocz(sizeof(PreopenState));
+	if (!pre)
+		return NULL;
+	pre->filename = av_strdup(filename);
+	if (!pre->filename) {
+		av_free(pre);
+		return NULL;
+	}
+	pre->io_mode = io_mode;
+	pre->lowres = lowres;
+	memset(pre->st_index, -1, sizeof(pre->st_index));
+	pre->open_time = av_gettime_relative();
+	pre->state = PREOPEN_RUNNING;
+	pre->tid = std::thread(preopen_thread, pre);
+	return pre;
+}
+
+int preopen_wait(PreopenState* pre)
+{
+	if (pre->tid.joinable())
+		pre->tid.join();
+	return pre->state;
+}
+
+AVCodecContext* preopen_take_decoder(PreopenState* pre, int stream_index)
+{
+	AVCodecContext* avctx;
+	int type;
+
+	if (pre->state != PREOPEN_READY)
+		return NULL;
+	for (type = 0; type < AVMEDIA_TYPE_NB; type++) {
+		if (pre->avctx[type] && pre->st_index[type] == stream_index) {
+			avctx = pre->avctx[type];
+			pre->avctx[type] = NULL;
+			return avctx;
+		}
+	}
+	return NULL;
+}
+
+int preopen_next_packet(PreopenState* pre, AVPacket* pkt)
+{
+	AVPacketList* node = pre->first_pkt;
+
+	if (!node)
+		return 0;
+	pre->first_pkt = node->next;
+	if (!pre->first_pkt)
+		pre->last_pkt = NULL;
+	pre->nb_packets--;
+	pre->size -= node->pkt.size + sizeof(*node);
+	*pkt = node->pkt;
+	av_free(node);
+	return 1;
+}
+
+void preopen_flush_packets(PreopenState* pre)
+{
+	AVPacket pkt;
+
+	while (preopen_next_packet(pre, &pkt))
+		av_packet_unref(&pkt);
+}
+
+void preopen_close(PreopenState** ppre)
+{
+	PreopenState* pre = *ppre;
+	int type;
+
+	if (!pre)
+		return;
+	pre->abort_request = 1;
+	preopen_wait(pre);
+	preopen_flush_packets(pre);
+	for (type = 0; type < AVMEDIA_TYPE_NB; type++)
+		avcodec_free_context(&pre->avctx[type]);
+	avformat_close_input(&pre->ic);
+	media_io_close(&pre->file_pb);
+	av_freep(&pre->filename);
+	av_freep(ppre);
+}
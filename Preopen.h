@@ -0,0 +1,88 @@
+﻿/*
+ * @file 	preopen.h
+ *
+ * @brief 	后台预打开播放列表中的下一个文件
+ * @note	切换到下一个文件时，ReadThread要依次打开文件、探测流信息、打开解码器，然后才开始读取数据。
+ *			当前文件播放时，由低优先级的后台线程提前完成这些步骤，并预读一小段数据包（受字节数和时长限制）；
+ *			真正切换到该文件时，ReadThread直接接管格式上下文、解码器和预读的包。
+ *			切换到其他文件或再次预打开时，未使用的预打开被取消并释放。
+ */
+#pragma once
+
+#include <thread>
+#include <atomic>
+#include "globalhelper.h"
+
+/* 预读数据包的上限：总字节数、参考流（有视频时为视频流）的时长（秒） */
+#define PREOPEN_MAX_SIZE (8 * 1024 * 1024)
+#define PREOPEN_MAX_DURATION 3.0
+
+//预打开状态
+enum {
+	PREOPEN_RUNNING = 0,	// 后台线程正在打开/预读
+	PREOPEN_READY,	// 已完成，可以接管
+	PREOPEN_FAILED,	// 打开失败，切换时按正常流程打开
+};
+
+typedef struct PreopenState {
+	char* filename;
+	int io_mode;	// MEDIA_IO_*
+	int lowres;	// 视频解码器的lowres，与stream_component_open一致
+	AVFormatContext* ic;	// 已探测的格式上下文，被ReadThread接管后置为NULL
+	AVIOContext* file_pb;	// 自定义输入，随ic一起被接管
+	int probe_cached;	// 是否使用了缓存的探测结果
+	AVCodecContext* avctx[AVMEDIA_TYPE_NB];	// 已打开的解码器，被stream_component_open取走后置为NULL
+	int st_index[AVMEDIA_TYPE_NB];	// 解码器对应的流
+	AVPacketList* first_pkt, * last_pkt;	// 预读的数据包
+	int nb_packets;
+	int size;	// 预读数据包的总字节数
+	int64_t open_time;	// 开始预打开的时刻
+	int64_t ready_time;	// 完成预打开的耗时（微秒）
+	std::atomic<int> state;	// PREOPEN_*
+	std::atomic<int> abort_request;	// 取消预打开/中断接管后的阻塞I/O
+	std::thread tid;
+} PreopenState;
+
+/// <summary>
+/// 启动后台预打开
+/// </summary>
+/// <param name="filename">文件名</param>
+/// <param name="io_mode">本地文件的输入方式（MEDIA_IO_*）</param>
+/// <param name="lowres">视频解码的lowres，超过解码器支持的上限时取上限</param>
+/// <returns>失败时返回NULL</returns>
+PreopenState* preopen_start(const char* filename, int io_mode, int lowres);
+
+/// <summary>
+/// 等待后台线程结束，之后ReadThread可以独占使用预打开的结果
+/// </summary>
+/// <param name="pre"></param>
+/// <returns>PREOPEN_READY/PREOPEN_FAILED</returns>
+int preopen_wait(PreopenState* pre);
+
+/// <summary>
+/// 取走为某个流预先打开的解码器
+/// </summary>
+/// <param name="pre"></param>
+/// <param name="stream_index">流序号</param>
+/// <returns>没有预先打开该流的解码器时返回NULL</returns>
+AVCodecContext* preopen_take_decoder(PreopenState* pre, int stream_index);
+
+/// <summary>
+/// 按读取顺序取出一个预读的数据包
+/// </summary>
+/// <param name="pre"></param>
+/// <param name="pkt">输出的包，所有权转给调用方</param>
+/// <returns>1-取到；0-预读的包已取完</returns>
+int preopen_next_packet(PreopenState* pre, AVPacket* pkt);
+
+/// <summary>
+/// 丢弃剩余的预读数据包（seek后不再需要）
+/// </summary>
+/// <param name="pre"></param>
+void preopen_flush_packets(PreopenState* pre);
+
+/// <summary>
+/// 取消预打开并释放所有未被接管的资源
+/// </summary>
+/// <param name="pre">释放后置为NULL</param>
+void preopen_close(PreopenState** pre);
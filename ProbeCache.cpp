@@ -0,0 +1,300 @@
+﻿/*
+ * @file 	probecache.cpp
+ *
+ * @brief 	本地文件的流探测结果缓存
+ * @note
+ */
+
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QDataStream>
+#include <vector>
+
+#include "probecache.h"
+
+/* 缓存文件标识 "PRB1" */
+#define PROBE_CACHE_MAGIC 0x50524231
+
+//文件头就带有完整流布局的封装
+static const char* const probe_cache_formats[] = { "mov", "matroska" };
+
+//缓存的单个流的探测结果
+typedef struct ProbeStream {
+	AVCodecParameters* par;
+	AVRational time_base;
+	AVRational avg_frame_rate;
+	AVRational r_frame_rate;
+	AVRational sample_aspect_ratio;
+	int64_t start_time;
+	int64_t duration;
+	int64_t nb_frames;
+} ProbeStream;
+
+static int probe_cache_format_ok(AVFormatContext* ic)
+{
+	size_t i;
+
+	if (ic->ctx_flags & AVFMTCTX_NOHEADER)
+		return 0;
+	for (i = 0; i < FF_ARRAY_ELEMS(probe_cache_formats); i++) {
+		if (av_match_name(probe_cache_formats[i], ic->iformat->name))
+			return 1;
+	}
+	return 0;
+}
+
+//只处理本地普通文件，缓存以文件的大小和修改时间作为有效性的键
+static int probe_cache_path(const char* filename, QString& strPath, qint64& nSize, qint64& nMTime)
+{
+	const char* path = filename;
+
+	if (!filename)
+		return 0;
+	av_strstart(filename, "file:", &path);
+	if (strstr(path, "://"))
+		return 0;
+	QFileInfo fileInfo(QString::fromLocal8Bit(path));
+	if (!fileInfo.isFile())
+		return 0;
+	nSize = fileInfo.size();
+	nMTime = fileInfo.lastModified().toMSecsSinceEpoch();
+	strPath = GlobalHelper::GetMediaCachePath(fileInfo.absoluteFilePath(), "probe_cache", ".probe");
+	return 1;
+}
+
+static qint64 probe_cache_read_int(QDataStream& in)
+{
+	qint64 v = 0;
+	in >> v;
+	return v;
+}
+
+static AVRational probe_cache_read_rational(QDataStream& in)
+{
+	AVRational r;
+	r.num = (int)probe_cache_read_int(in);
+	r.den = (int)probe_cache_read_int(in);
+	return r;
+}
+
+static void probe_cache_write_stream(QDataStream& out, AVStream* st)
+{
+	AVCodecParameters* par = st->codecpar;
+
+	out << (qint64)par->codec_type << (qint64)par->codec_id << (qint64)par->codec_tag
+		<< (qint64)par->format << (qint64)par->bit_rate
+		<< (qint64)par->bits_per_coded_sample << (qint64)par->bits_per_raw_sample
+		<< (qint64)par->profile << (qint64)par->level
+		<< (qint64)par->width << (qint64)par->height
+		<< (qint64)par->sample_aspect_ratio.num << (qint64)par->sample_aspect_ratio.den
+		<< (qint64)par->field_order << (qint64)par->color_range << (qint64)par->color_primaries
+		<< (qint64)par->color_trc << (qint64)par->color_space << (qint64)par->chroma_location
+		<< (qint64)par->video_delay
+		<< (qint64)par->channel_layout << (qint64)par->channels << (qint64)par->sample_rate
+		<< (qint64)par->block_align << (qint64)par->frame_size
+		<< (qint64)par->initial_padding << (qint64)par->trailing_padding << (qint64)par->seek_preroll
+		<< QByteArray((const char*)par->extradata, par->extradata_size);
+	out << (qint64)st->time_base.num << (qint64)st->time_base.den
+		<< (qint64)st->avg_frame_rate.num << (qint64)st->avg_frame_rate.den
+		<< (qint64)st->r_frame_rate.num << (qint64)st->r_frame_rate.den
+		<< (qint64)st->sample_aspect_ratio.num << (qint64)st->sample_aspect_ratio.den
+		<< (qint64)st->start_time << (qint64)st->duration << (qint64)st->nb_frames;
+}
+
+//读取顺序必须与probe_cache_write_stream一致
+static int probe_cache_read_stream(QDataStream& in, ProbeStream* ps)
+{
+	AVCodecParameters* par = ps->par;
+	QByteArray extradata;
+
+	par->codec_type = (AVMediaType)probe_cache_read_int(in);
+	par->codec_id = (AVCodecID)probe_cache_read_int(in);
+	par->codec_tag = (uint32_t)probe_cache_read_int(in);
+	par->format = (int)probe_cache_read_int(in);
+	par->bit_rate = probe_cache_read_int(in);
+	par->bits_per_coded_sample = (int)probe_cache_read_int(in);
+	par->bits_per_raw_sample = (int)probe_cache_read_int(in);
+	par->profile = (int)probe_cache_read_int(in);
+	par->level = (int)probe_cache_read_int(in);
+	par->width = (int)probe_cache_read_int(in);
+	par->height = (int)probe_cache_read_int(in);
+	par->sample_aspect_ratio = probe_cache_read_rational(in);
+	par->field_order = (AVFieldOrder)probe_cache_read_int(in);
+	par->color_range = (AVColorRange)probe_cache_read_int(in);
+	par->color_primaries = (AVColorPrimaries)probe_cache_read_int(in);
+	par->color_trc = (AVColorTransferCharacteristic)probe_cache_read_int(in);
+	par->color_space = (AVColorSpace)probe_cache_read_int(in);
+	par->chroma_location = (AVChromaLocation)probe_cache_read_int(in);
+	par->video_delay = (int)probe_cache_read_int(in);
+	par->channel_layout = (uint64_t)probe_cache_read_int(in);
+	par->channels = (int)probe_cache_read_int(in);
+	par->sample_rate = (int)probe_cache_read_int(in);
+	par->block_align = (int)probe_cache_read_int(in);
+	par->frame_size = (int)probe_cache_read_int(in);
+	par->initial_padding = (int)probe_cache_read_int(in);
+	par->trailing_padding = (int)probe_cache_read_int(in);
+	par->seek_preroll = (int)probe_cache_read_int(in);
+	in >> extradata;
+	if (extradata.size() > 0) {
+		par->extradata = (uint8_t*)av_mallocz(extradata.size() + AV_INPUT_BUFFER_PADDING_SIZE);
+		if (!par->extradata)
+			return AVERROR(ENOMEM);
+		memcpy(par->extradata, extradata.constData(), extradata.size());
+		par->extradata_size = extradata.size();
+	}
+	ps->time_base = probe_cache_read_rational(in);
+	ps->avg_frame_rate = probe_cache_read_rational(in);
+	ps->r_frame_rate = probe_cache_read_rational(in);
+	ps->sample_aspect_ratio = probe_cache_read_rational(in);
+	ps->start_time = probe_cache_read_int(in);
+	ps->duration = probe_cache_read_int(in);
+	ps->nb_frames = probe_cache_read_int(in);
+	return 0;
+}
+
+//文件头已给出的参数必须与缓存一致
+static int probe_cache_header_match(const AVCodecParameters* hdr, const AVCodecParameters* par)
+{
+	if (hdr->extradata_size &&
+		(hdr->extradata_size != par->extradata_size || memcmp(hdr->extradata, par->extradata, hdr->extradata_size)))
+		return 0;
+	if ((hdr->width && hdr->width != par->width) ||
+		(hdr->height && hdr->height != par->height) ||
+		(hdr->sample_rate && hdr->sample_rate != par->sample_rate) ||
+		(hdr->channels && hdr->channels != par->channels))
+		return 0;
+	return 1;
+}
+
+//试读开头的几个包，读取中出现新的流或读取出错时不能使用缓存；读完回到开头
+/// <param name="start_time">缓存的起始时间（AV_TIME_BASE）</param>
+/// <returns>1-可以使用缓存</returns>
+static int probe_cache_check_read(AVFormatContext* ic, int64_t start_time)
+{
+	unsigned int nb_streams = ic->nb_streams;
+	AVPacket pkt;
+	int i, ret = 0, ok = 1;
+
+	if (start_time == AV_NOPTS_VALUE)
+		start_time = 0;
+	for (i = 0; i < PROBE_CACHE_CHECK_PACKETS && ok; i++) {
+		ret = av_read_frame(ic, &pkt);
+		if (ret < 0)
+			break;
+		ok = pkt.stream_index < (int)nb_streams && ic->nb_streams == nb_streams;
+		av_packet_unref(&pkt);
+	}
+	if (ret < 0 && ret != AVERROR_EOF)
+		ok = 0;
+	if (avformat_seek_file(ic, -1, INT64_MIN, start_time, start_time, 0) < 0) {
+		//回不到开头时只能从当前位置探测并播放，开头的几个包会丢失
+		av_log(NULL, AV_LOG_WARNING, "probe cache: could not seek back after the check read\n");
+		ok = 0;
+	}
+	return ok;
+}
+
+int probe_cache_load(AVFormatContext* ic, const char* filename)
+{
+	QString strPath;
+	qint64 nSize, nMTime, size, mtime, duration, start_time, bit_rate;
+	quint32 magic = 0;
+	qint32 version = 0, lavf = 0, nb_streams = 0;
+	QByteArray format;
+	std::vector<ProbeStream> streams;
+	bool bMatch = true;
+	unsigned int i;
+
+	if (!probe_cache_format_ok(ic) || !probe_cache_path(filename, strPath, nSize, nMTime))
+		return 0;
+	QFile file(strPath);
+	if (!file.open(QIODevice::ReadOnly))
+		return 0;
+	QDataStream in(&file);
+	in.setVersion(QDataStream::Qt_5_0);
+	in >> magic >> version >> lavf >> size >> mtime >> format >> nb_streams;
+	//FFmpeg版本变化后编码参数的含义可能不同，也视为失效
+	if (in.status() != QDataStream::Ok ||
+		magic != PROBE_CACHE_MAGIC ||
+		version != PROBE_CACHE_VERSION ||
+		lavf != (qint32)avformat_version() ||
+		size != nSize ||
+		mtime != nMTime ||
+		format != QByteArray(ic->iformat->name) ||
+		nb_streams != (qint32)ic->nb_streams)
+		return 0;
+	in >> duration >> start_time >> bit_rate;
+
+	streams.resize(nb_streams);
+	for (i = 0; i < streams.size(); i++) {
+		streams[i].par = avcodec_parameters_alloc();
+		if (!streams[i].par || probe_cache_read_stream(in, &streams[i]) < 0) {
+			bMatch = false;
+			break;
+		}
+		//解封装器从文件头读出的流布局必须与缓存一致（TS等流是在读取过程中才出现的，不一致时正常探测）
+		AVStream* st = ic->streams[i];
+		if (st->codecpar->codec_type != streams[i].par->codec_type ||
+			st->codecpar->codec_id != streams[i].par->codec_id ||
+			av_cmp_q(st->time_base, streams[i].time_base) ||
+			!probe_cache_header_match(st->codecpar, streams[i].par)) {
+			bMatch = false;
+			break;
+		}
+	}
+	if (in.status() != QDataStream::Ok)
+		bMatch = false;
+	//恢复参数之前试读，不能使用缓存时格式上下文保持原样，照常探测
+	if (bMatch && !probe_cache_check_read(ic, start_time))
+		bMatch = false;
+
+	if (bMatch) {
+		for (i = 0; i < streams.size(); i++) {
+			AVStream* st = ic->streams[i];
+			if (avcodec_parameters_copy(st->codecpar, streams[i].par) < 0) {
+				bMatch = false;
+				break;
+			}
+			st->avg_frame_rate = streams[i].avg_frame_rate;
+			st->r_frame_rate = streams[i].r_frame_rate;
+			st->sample_aspect_ratio = streams[i].sample_aspect_ratio;
+			st->start_time = streams[i].start_time;
+			st->duration = streams[i].duration;
+			st->nb_frames = streams[i].nb_frames;
+		}
+		ic->duration = duration;
+		ic->start_time = start_time;
+		ic->bit_rate = bit_rate;
+	}
+	for (i = 0; i < streams.size(); i++)
+		avcodec_parameters_free(&streams[i].par);
+	return bMatch ? 1 : 0;
+}
+
+void probe_cache_save(AVFormatContext* ic, const char* filename)
+{
+	QString strPath;
+	qint64 nSize, nMTime;
+	unsigned int i;
+	bool bOk;
+
+	if (!probe_cache_format_ok(ic) || !probe_cache_path(filename, strPath, nSize, nMTime))
+		return;
+	//先写临时文件再改名，避免留下写了一半的缓存
+	QFile file(strPath + ".tmp");
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+		return;
+	QDataStream out(&file);
+	out.setVersion(QDataStream::Qt_5_0);
+	out << (quint32)PROBE_CACHE_MAGIC << (qint32)PROBE_CACHE_VERSION << (qint32)avformat_version()
+		<< nSize << nMTime << QByteArray(ic->iformat->name) << (qint32)ic->nb_streams;
+	out << (qint64)ic->duration << (qint64)ic->start_time << (qint64)ic->bit_rate;
+	for (i = 0; i < ic->nb_streams; i++)
+		probe_cache_write_stream(out, ic->streams[i]);
+	bOk = out.status() == QDataStream::Ok;
+	file.close();
+	QFile::remove(strPath);
+	if (!bOk || !QFile::rename(strPath + ".tmp", strPath))
+		QFile::remove(strPath + ".tmp");
+}
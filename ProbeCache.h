@@ -0,0 +1,34 @@
+﻿/*
+ * @file 	probecache.h
+ *
+ * @brief 	本地文件的流探测结果缓存
+ * @note	avformat_find_stream_info需要读取并解码一部分数据来补全流的编码参数和时长，
+ *			某些封装（TS、FLV、没有索引的AVI等）要读几MB、耗时几百毫秒才能显示第一帧。
+ *			第一次打开后把流布局、编码参数、extradata和时长保存为以路径、大小、修改时间为键的缓存文件；
+ *			再次打开同一文件时，若解封装器读出的流布局与缓存一致，直接恢复这些参数并跳过探测。
+ *			只用于文件头就带有完整流布局的封装（mov/mp4系列、matroska/webm），TS、FLV等在读取中才出现流的封装照常探测；
+ *			使用前核对文件头已给出的参数，并试读开头的几个包，确认读取中不会出现新的流，否则照常探测。
+ */
+#pragma once
+
+#include "globalhelper.h"
+
+/* 缓存文件格式版本，格式变化时递增，旧文件自动失效 */
+#define PROBE_CACHE_VERSION 1
+/* 使用缓存前试读的包数 */
+#define PROBE_CACHE_CHECK_PACKETS 16
+
+/// <summary>
+/// 用缓存的探测结果补全格式上下文
+/// </summary>
+/// <param name="ic">avformat_open_input打开的格式上下文</param>
+/// <param name="filename">文件名</param>
+/// <returns>1-已补全，可以跳过avformat_find_stream_info；0-没有可用的缓存</returns>
+int probe_cache_load(AVFormatContext* ic, const char* filename);
+
+/// <summary>
+/// avformat_find_stream_info成功后保存探测结果（只保存本地普通文件）
+/// </summary>
+/// <param name="ic"></param>
+/// <param name="filename">文件名</param>
+void probe_cache_save(AVFormatContext* ic, const char* filename);
@@ -0,0 +1,459 @@
+﻿/*
+ * @file 	queuebench.cpp
+ *
+ * @brief 	包队列的基准测试和帧队列的压力测试
+ * @note
+ */
+
+#include <QFile>
+#include <algorithm>
+#include <chrono>
+#include <inttypes.h>
+
+#include "queuebench.h"
+#include "datactl.h"
+
+/* 包负载大小，与常见的视频包相当 */
+#define PACKET_QUEUE_BENCH_PAYLOAD 4096
+/* 压力测试中生产者每隔这么多帧调整一次队列深度 */
+#define FRAME_QUEUE_STRESS_DEPTH_INTERVAL 997
+
+//改造前的包队列（互斥锁+链表，每个包分配一个节点），只用于对比
+typedef struct LegacyPacketList {
+	AVPacket pkt;
+	struct LegacyPacketList* next;
+	int serial;
+} LegacyPacketList;
+
+typedef struct LegacyPacketQueue {
+	LegacyPacketList* first_pkt, * last_pkt;
+	int nb_packets;
+	int size;
+	int64_t duration;
+	int abort_request;
+	int serial;
+	SDL_mutex* mutex;
+	SDL_cond* cond;
+} LegacyPacketQueue;
+
+static int legacy_packet_queue_put_private(LegacyPacketQueue* q, AVPacket* pkt)
+{
+	LegacyPacketList* pkt1;
+
+	if (q->abort_request)
+		return -1;
+	pkt1 = (LegacyPacketList*)av_malloc(sizeof(LegacyPacketList));
+	if (!pkt1)
+		return -1;
+	pkt1->pkt = *pkt;
+	pkt1->next = NULL;
+	if (pkt == &flush_pkt)
+		q->serial++;
+	pkt1->serial = q->serial;
+	if (!q->last_pkt)
+		q->first_pkt = pkt1;
+	else
+		q->last_pkt->next = pkt1;
+	q->last_pkt = pkt1;
+	q->nb_packets++;
+	q->size += pkt1->pkt.size + sizeof(*pkt1);
+	q->duration += pkt1->pkt.duration;
+	SDL_CondSignal(q->cond);
+	return 0;
+}
+
+static int legacy_packet_queue_put(LegacyPacketQueue* q, AVPacket* pkt)
+{
+	int ret;
+
+	SDL_LockMutex(q->mutex);
+	ret = legacy_packet_queue_put_private(q, pkt);
+	SDL_UnlockMutex(q->mutex);
+	if (pkt != &flush_pkt && ret < 0)
+		av_packet_unref(pkt);
+	return ret;
+}
+
+static int legacy_packet_queue_init(LegacyPacketQueue* q)
+{
+	memset(q, 0, sizeof(LegacyPacketQueue));
+	q->mutex = SDL_CreateMutex();
+	q->cond = SDL_CreateCond();
+	if (!q->mutex || !q->cond)
+		return AVERROR(ENOMEM);
+	q->abort_request = 1;
+	return 0;
+}
+
+static void legacy_packet_queue_flush(LegacyPacketQueue* q)
+{
+	LegacyPacketList* pkt, * pkt1;
+
+	SDL_LockMutex(q->mutex);
+	for (pkt = q->first_pkt; pkt; pkt = pkt1) {
+		pkt1 = pkt->next;
+		av_packet_unref(&pkt->pkt);
+		av_freep(&pkt);
+	}
+	q->last_pkt = NULL;
+	q->first_pkt = NULL;
+	q->nb_packets = 0;
+	q->size = 0;
+	q->duration = 0;
+	SDL_UnlockMutex(q->mutex);
+}
+
+static void legacy_packet_queue_destroy(LegacyPacketQueue* q)
+{
+	legacy_packet_queue_flush(q);
+	SDL_DestroyMutex(q->mutex);
+	SDL_DestroyCond(q->cond);
+}
+
+static void legacy_packet_queue_start(LegacyPacketQueue* q)
+{
+	av_init_packet(&flush_pkt);
+	flush_pkt.data = (uint8_t*)&flush_pkt;
+	SDL_LockMutex(q->mutex);
+	q->abort_request = 0;
+	legacy_packet_queue_put_private(q, &flush_pkt);
+	SDL_UnlockMutex(q->mutex);
+}
+
+static int legacy_packet_queue_get(LegacyPacketQueue* q, AVPacket* pkt, int block, int* serial)
+{
+	LegacyPacketList* pkt1;
+	int ret;
+
+	SDL_LockMutex(q->mutex);
+	for (;;) {
+		if (q->abort_request) {
+			ret = -1;
+			break;
+		}
+		pkt1 = q->first_pkt;
+		if (pkt1) {
+			q->first_pkt = pkt1->next;
+			if (!q->first_pkt)
+				q->last_pkt = NULL;
+			q->nb_packets--;
+			q->size -= pkt1->pkt.size + sizeof(*pkt1);
+			q->duration -= pkt1->pkt.duration;
+			*pkt = pkt1->pkt;
+			if (serial)
+				*serial = pkt1->serial;
+			av_free(pkt1);
+			ret = 1;
+			break;
+		}
+		else if (!block) {
+			ret = 0;
+			break;
+		}
+		else {
+			SDL_CondWait(q->cond, q->mutex);
+		}
+	}
+	SDL_UnlockMutex(q->mutex);
+	return ret;
+}
+
+//两种队列共用同一套收发流程
+typedef struct PacketQueueBenchOps {
+	const char* name;
+	int (*init)(void* q);
+	void (*start)(void* q);
+	int (*put)(void* q, AVPacket* pkt);
+	int (*get)(void* q, AVPacket* pkt, int block, int* serial);
+	void (*flush)(void* q);
+	void (*destroy)(void* q);
+	int (*nb_packets)(void* q);
+} PacketQueueBenchOps;
+
+static int ring_init(void* q) { return packet_queue_init((PacketQueue*)q); }
+static void ring_start(void* q) { packet_queue_start((PacketQueue*)q); }
+static int ring_put(void* q, AVPacket* pkt) { return packet_queue_put((PacketQueue*)q, pkt); }
+static int ring_get(void* q, AVPacket* pkt, int block, int* serial) { return packet_queue_get((PacketQueue*)q, pkt, block, serial); }
+static void ring_flush(void* q) { packet_queue_flush((PacketQueue*)q); }
+static void ring_destroy(void* q) { packet_queue_destroy((PacketQueue*)q); }
+static int ring_nb_packets(void* q) { return ((PacketQueue*)q)->nb_packets; }
+
+static int legacy_init(void* q) { return legacy_packet_queue_init((LegacyPacketQueue*)q); }
+static void legacy_start(void* q) { legacy_packet_queue_start((LegacyPacketQueue*)q); }
+static int legacy_put(void* q, AVPacket* pkt) { return legacy_packet_queue_put((LegacyPacketQueue*)q, pkt); }
+static int legacy_get(void* q, AVPacket* pkt, int block, int* serial) { return legacy_packet_queue_get((LegacyPacketQueue*)q, pkt, block, serial); }
+static void legacy_flush(void* q) { legacy_packet_queue_flush((LegacyPacketQueue*)q); }
+static void legacy_destroy(void* q) { legacy_packet_queue_destroy((LegacyPacketQueue*)q); }
+//与ReadThread一样不加锁读取包数
+static int legacy_nb_packets(void* q) { return ((LegacyPacketQueue*)q)->nb_packets; }
+
+static const PacketQueueBenchOps packet_queue_bench_ops[] = {
+	{ "legacy", legacy_init, legacy_start, legacy_put, legacy_get, legacy_flush, legacy_destroy, legacy_nb_packets },
+	{ "ring", ring_init, ring_start, ring_put, ring_get, ring_flush, ring_destroy, ring_nb_packets },
+};
+
+//纳秒时钟，入队时刻记录在包的pos中
+static int64_t packet_queue_bench_now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//消费者的统计
+typedef struct PacketQueueBenchStats {
+	int64_t received;	// 收到的数据包数（不含flush_pkt）
+	int64_t waits;	// 队列为空、需要阻塞等待的次数
+	int64_t errors;	// 播放序列或顺序不对的包数
+	int64_t* latency;	// 每个包从入队到出队的时间（纳秒）
+} PacketQueueBenchStats;
+
+//按解码线程的方式取包，直到收到结束标记（stream_index为-1的空包）
+static void packet_queue_bench_consume(const PacketQueueBenchOps* ops, void* q, PacketQueueBenchStats* st, int packets)
+{
+	AVPacket pkt;
+	int serial = 0, flush_serial = -1;
+	int64_t last_seq = -1, now;
+	int ret;
+
+	for (;;) {
+		ret = ops->get(q, &pkt, 0, &serial);
+		if (ret == 0) {
+			st->waits++;
+			ret = ops->get(q, &pkt, 1, &serial);
+		}
+		if (ret < 0)
+			break;
+		now = packet_queue_bench_now();
+		if (pkt.data == flush_pkt.data) {
+			//每个flush_pkt都带来新的序列
+			if (serial <= flush_serial)
+				st->errors++;
+			flush_serial = serial;
+			continue;
+		}
+		if (!pkt.data && pkt.stream_index < 0)
+			break;
+		if (serial != flush_serial || pkt.pts <= last_seq)
+			st->errors++;
+		last_seq = pkt.pts;
+		if (st->received < packets)
+			st->latency[st->received] = now - pkt.pos;
+		st->received++;
+		av_packet_unref(&pkt);
+	}
+}
+
+//按ReadThread的方式放入packets个包，每flush_interval个包清空一次队列（0表示不清空）
+//队列中的包达到环形缓冲区的槽位数时让出CPU（ReadThread此时停止读取），两种队列的积压上限相同；
+//paced为1时等消费者取走上一个包再放入，测的是消费者阻塞在空队列上时的交接延迟
+/// <returns>清空的次数</returns>
+static int64_t packet_queue_bench_produce(const PacketQueueBenchOps* ops, void* q, AVPacket* ref, int packets, int flush_interval, int paced)
+{
+	AVPacket pkt;
+	int64_t flushes = 0;
+	int i, limit = paced ? 1 : PACKET_QUEUE_CAPACITY;
+
+	for (i = 0; i < packets; i++) {
+		if (flush_interval && i && i % flush_interval == 0) {
+			ops->flush(q);
+			ops->put(q, &flush_pkt);
+			flushes++;
+		}
+		while (ops->nb_packets(q) >= limit)
+			std::this_thread::yield();
+		if (av_packet_ref(&pkt, ref) < 0)
+			break;
+		pkt.pts = pkt.dts = i;
+		pkt.pos = packet_queue_bench_now();
+		if (ops->put(q, &pkt) < 0)
+			break;
+	}
+	//结束标记
+	av_init_packet(&pkt);
+	pkt.data = NULL;
+	pkt.size = 0;
+	pkt.stream_index = -1;
+	ops->put(q, &pkt);
+	return flushes;
+}
+
+//升序排列后的第p百分位（微秒）
+static double packet_queue_bench_percentile(int64_t* v, int64_t n, double p)
+{
+	int64_t k;
+
+	if (n <= 0)
+		return 0;
+	k = FFMIN((int64_t)(p / 100.0 * n), n - 1);
+	std::nth_element(v, v + k, v + n);
+	return v[k] / 1000.0;
+}
+
+int packet_queue_bench(const char* report, int packets)
+{
+	//清空间隔，以及是否逐包交接
+	static const struct { int flush_interval; int paced; } cases[] = {
+		{ 0, 0 }, { 10000, 0 }, { 100, 0 }, { 0, 1 },
+	};
+	void* q;
+	PacketQueueBenchStats st = { 0 };
+	AVPacket ref;
+	QByteArray csv;
+	char line[256];
+	int64_t start, flushes, errors = 0, n;
+	double ms, p50, p99;
+	size_t c, o;
+	int count, ret;
+
+	if ((ret = av_new_packet(&ref, PACKET_QUEUE_BENCH_PAYLOAD)) < 0)
+		return ret;
+	memset(ref.data, 0, ref.size);
+	//两种队列轮流使用同一块内存，init时清零
+	q = av_mallocz(FFMAX(sizeof(PacketQueue), sizeof(LegacyPacketQueue)));
+	st.latency = (int64_t*)av_malloc_array(packets, sizeof(int64_t));
+	if (!q || !st.latency) {
+		ret = AVERROR(ENOMEM);
+		goto end;
+	}
+	av_log(NULL, AV_LOG_INFO, "packet queue bench: %d packets, capacity %d\n", packets, PACKET_QUEUE_CAPACITY);
+	csv = "queue,flush_interval,paced,packets,ms,packets_per_sec,p50_us,p99_us,consumer_waits,flushes,errors\n";
+	for (c = 0; c < FF_ARRAY_ELEMS(cases); c++) {
+		//逐包交接时每个包都要唤醒一次消费者，包数减少到1/10
+		count = cases[c].paced ? FFMAX(packets / 10, 1) : packets;
+		for (o = 0; o < FF_ARRAY_ELEMS(packet_queue_bench_ops); o++) {
+			const PacketQueueBenchOps* ops = &packet_queue_bench_ops[o];
+			if ((ret = ops->init(q)) < 0)
+				goto end;
+			st.received = st.waits = st.errors = 0;
+			ops->start(q);
+			start = av_gettime_relative();
+			std::thread consumer(packet_queue_bench_consume, ops, q, &st, count);
+			flushes = packet_queue_bench_produce(ops, q, &ref, count, cases[c].flush_interval, cases[c].paced);
+			consumer.join();
+			ms = (av_gettime_relative() - start) / 1000.0;
+			ops->destroy(q);
+			//不清空时每个包都应当收到
+			if (!cases[c].flush_interval && st.received != count)
+				st.errors++;
+			errors += st.errors;
+			n = FFMIN(st.received, (int64_t)count);
+			p50 = packet_queue_bench_percentile(st.latency, n, 50);
+			p99 = packet_queue_bench_percentile(st.latency, n, 99);
+			snprintf(line, sizeof(line), "%s,%d,%d,%d,%.1f,%.0f,%.2f,%.2f,%" PRId64 ",%" PRId64 ",%" PRId64 "\n",
+				ops->name, cases[c].flush_interval, cases[c].paced, count, ms, ms > 0 ? count * 1000.0 / ms : 0.0,
+				p50, p99, st.waits, flushes, st.errors);
+			av_log(NULL, AV_LOG_INFO, "packet queue bench: %s", line);
+			csv += line;
+		}
+	}
+	if (report) {
+		QFile file(QString::fromLocal8Bit(report));
+		if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(csv) != csv.size())
+			av_log(NULL, AV_LOG_ERROR, "packet queue bench: could not write %s\n", report);
+	}
+	if (errors)
+		av_log(NULL, AV_LOG_ERROR, "packet queue bench: %" PRId64 " packets out of order or with a stale serial\n", errors);
+	ret = errors ? -1 : 0;
+end:
+	av_packet_unref(&ref);
+	av_free(st.latency);
+	av_free(q);
+	return ret;
+}
+
+//线性同余伪随机数，两端各用固定种子，每次运行的序列相同
+static unsigned frame_queue_stress_rand(unsigned* seed)
+{
+	*seed = *seed * 1103515245u + 12345u;
+	return *seed >> 16;
+}
+
+//消费者的统计
+typedef struct FrameQueueStressStats {
+	int64_t received;
+	int64_t errors;	// 顺序或内容不对的帧数
+} FrameQueueStressStats;
+
+//按渲染线程的方式取帧；随机让出CPU，使队列时满时空
+static void frame_queue_stress_consume(FrameQueue* f, int frames, FrameQueueStressStats* st)
+{
+	unsigned seed = 2;
+	Frame* vp;
+	int64_t i;
+
+	for (i = 0; i < frames; i++) {
+		if (!(vp = frame_queue_peek_readable(f)))
+			break;
+		if (vp->pos != i || vp->frame->pts != i || vp->serial != (int)(i & 0xffff))
+			st->errors++;
+		st->received++;
+		if (!(frame_queue_stress_rand(&seed) & 63))
+			std::this_thread::yield();
+		frame_queue_next(f);
+	}
+}
+
+//按视频解码线程的方式写入frames帧；resize为1时每隔FRAME_QUEUE_STRESS_DEPTH_INTERVAL帧随机调整深度
+static int64_t frame_queue_stress_produce(FrameQueue* f, int frames, int resize)
+{
+	unsigned seed = 1;
+	Frame* vp;
+	int64_t i, depth_changes = 0;
+
+	for (i = 0; i < frames; i++) {
+		if (resize && i && i % FRAME_QUEUE_STRESS_DEPTH_INTERVAL == 0) {
+			frame_queue_set_depth(f, 1 + frame_queue_stress_rand(&seed) % f->capacity);
+			depth_changes++;
+		}
+		if (!(vp = frame_queue_peek_writable(f)))
+			break;
+		vp->pos = i;
+		vp->frame->pts = i;
+		vp->serial = (int)(i & 0xffff);
+		if (!(frame_queue_stress_rand(&seed) & 63))
+			std::this_thread::yield();
+		frame_queue_push(f);
+	}
+	return depth_changes;
+}
+
+int frame_queue_stress(int frames)
+{
+	PacketQueue q;
+	FrameQueue f;
+	FrameQueueStressStats st;
+	int64_t start, depth_changes, errors = 0;
+	double ms;
+	int resize, ret = 0;
+
+	av_log(NULL, AV_LOG_INFO, "frame queue stress: %d frames, capacity %d\n", frames, VIDEO_PICTURE_QUEUE_MAX);
+	for (resize = 0; resize <= 1 && ret >= 0; resize++) {
+		if ((ret = packet_queue_init(&q)) < 0)
+			break;
+		if ((ret = frame_queue_init(&f, &q, VIDEO_PICTURE_QUEUE_MAX, VIDEO_PICTURE_QUEUE_SIZE, 1)) < 0) {
+			frame_queue_destory(&f);
+			packet_queue_destroy(&q);
+			break;
+		}
+		//帧队列以所绑定包队列的abort_request判断是否中止
+		packet_queue_start(&q);
+		memset(&st, 0, sizeof(st));
+		start = av_gettime_relative();
+		std::thread consumer(frame_queue_stress_consume, &f, frames, &st);
+		depth_changes = frame_queue_stress_produce(&f, frames, resize);
+		consumer.join();
+		ms = (av_gettime_relative() - start) / 1000.0;
+		if (st.received != frames)
+			st.errors++;
+		errors += st.errors;
+		av_log(NULL, AV_LOG_INFO, "frame queue stress: %s depth, %.1f ns/frame, %" PRId64 " writer waits, %" PRId64 " reader waits, "
+			"%" PRId64 " depth changes, %" PRId64 " errors\n", resize ? "varying" : "fixed", ms * 1000000.0 / frames,
+			f.write_waits, f.read_waits, depth_changes, st.errors);
+		frame_queue_destory(&f);
+		packet_queue_destroy(&q);
+	}
+	if (ret < 0)
+		return ret;
+	if (errors)
+		av_log(NULL, AV_LOG_ERROR, "frame queue stress: %" PRId64 " frames out of order or torn\n", errors);
+	return errors ? -1 : 0;
+}
@@ -0,0 +1,29 @@
+﻿/*
+ * @file 	queuebench.h
+ *
+ * @brief 	包队列的基准测试和帧队列的压力测试
+ * @note	在两个线程之间按ReadThread和解码线程的方式收发数据包（生产者按固定间隔做seek时的清空并放入flush_pkt），
+ *			同样的负载分别交给改造前的互斥锁+链表队列和现在的环形缓冲区，比较每秒收发的包数、每个包从入队到出队的延迟（p50/p99）
+ *			和消费者因队列为空而阻塞的次数；另有逐包交接的一组，测消费者阻塞在空队列上时的唤醒延迟。
+ *			同时检查每个包的播放序列都等于它之前最近一个flush_pkt的序列、包的顺序没有颠倒，序列号发布的次序不对时会计入错误数。
+ *			帧队列的压力测试按视频解码线程和渲染线程的方式在两个线程之间收发帧（keep_last，生产者不时调整队列深度，两端随机让出CPU），
+ *			检查每一帧都按顺序到达且帧内容（槽位在入队前写入的字段）与序号一致，无锁的发布次序不对时会计入错误数。
+ */
+#pragma once
+
+#include "globalhelper.h"
+
+/// <summary>
+/// 包队列的基准测试，依次测试不清空、几种清空间隔和逐包交接，每种配置先测改造前的队列再测环形缓冲区
+/// </summary>
+/// <param name="report">CSV报告文件，NULL表示只输出日志</param>
+/// <param name="packets">每种配置收发的包数</param>
+/// <returns>0-成功；<0-失败或检查到错误</returns>
+int packet_queue_bench(const char* report, int packets);
+
+/// <summary>
+/// 帧队列的压力测试，依次测试固定深度和运行时调整深度
+/// </summary>
+/// <param name="frames">每种配置收发的帧数</param>
+/// <returns>0-成功；<0-失败或检查到错误</returns>
+int frame_queue_stress(int frames);
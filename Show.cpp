@@ -1,5 +1,4 @@
 ﻿#include <QDebug>
-#include <QMutex>
 
 #include "Show.h"
 #include "globalhelper.h"
@@ -7,7 +6,7 @@
 #pragma execution_character_set("utf-8")
 
 //在VideoCtrl会添加extern关键字
-QMutex g_show_rect_mutex;
+ShowRectLatch g_show_rect;
 
 Show::Show(QWidget *parent)
 	: QWidget(parent)
@@ -68,12 +67,12 @@ void Show::OnFrameDimensionsChanged(int nFrameWidth, int nFrameHeight)
 
 void Show::ChangeShow()
 {
-	g_show_rect_mutex.lock();
 	//没有有效帧
 	if (m_nLastFrameWidth == 0 && m_nLastFrameHeight == 0)
 	{
 		// label 的显示区域设置为窗口的整个区域。
 		ui->label->setGeometry(0, 0, width(), height());
+		show_rect_publish(&g_show_rect, 0, 0, width(), height());
 	}
 	else
 	{
@@ -107,9 +106,9 @@ void Show::ChangeShow()
 		y = (scr_height - height) / 2;
 
 		ui->label->setGeometry(x, y, width, height);
+		//渲染线程下一次显示就按新的区域绘制，不必等SDL的窗口事件
+		show_rect_publish(&g_show_rect, x, y, width, height);
 	}
-
-	g_show_rect_mutex.unlock();
 }
 
 void Show::dragEnterEvent(QDragEnterEvent* event)
@@ -0,0 +1,257 @@
+﻿/*
+ * @file 	swsslice.cpp
+ *
+ * @brief 	swscale回退路径的多线程分片转换
+ * @note
+ */
+
+#include <QFile>
+#include <inttypes.h>
+
+#include "swsslice.h"
+#include "pixelrepack.h"
+
+void sws_slice_init(SwsSlicePool* pool, int nb_threads)
+{
+	if (nb_threads <= 0)
+		nb_threads = FFMIN(av_cpu_count(), SWS_SLICE_AUTO_THREADS);
+	pool->nb_threads = av_clip(nb_threads, 1, SWS_SLICE_MAX_THREADS);
+}
+
+//条带起点处各平面的源指针
+static void sws_slice_src(const AVFrame* frame, int y, const uint8_t* src[4])
+{
+	const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get((enum AVPixelFormat)frame->format);
+	int i, shift;
+
+	for (i = 0; i < 4; i++) {
+		src[i] = frame->data[i];
+		if (!src[i])
+			continue;
+		//调色板格式的data[1]是调色板，不随行偏移
+		if (i == 1 && (desc->flags & (AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_PSEUDOPAL)))
+			continue;
+		shift = (i == 1 || i == 2) && !(desc->flags & AV_PIX_FMT_FLAG_RGB) ? desc->log2_chroma_h : 0;
+		src[i] += (ptrdiff_t)(y >> shift) * frame->linesize[i];
+	}
+}
+
+//转换一条带，index超出当前任务的条带数时什么都不做
+static int sws_slice_run(SwsSlicePool* pool, int index)
+{
+	SwsSlice* s = &pool->slices[index];
+	const AVFrame* frame = pool->frame;
+	const uint8_t* src[4];
+	uint8_t* dst[4] = { NULL };
+	int dst_linesize[4] = { 0 };
+
+	if (index >= pool->nb_slices)
+		return 0;
+	s->sws = sws_getCachedContext(s->sws, frame->width, s->h, (enum AVPixelFormat)frame->format,
+		frame->width, s->h, pool->dst_format, SWS_BICUBIC, NULL, NULL, NULL);
+	if (!s->sws)
+		return -1;
+	sws_slice_src(frame, s->y, src);
+	dst[0] = pool->dst + (ptrdiff_t)s->y * pool->dst_pitch;
+	dst_linesize[0] = pool->dst_pitch;
+	sws_scale(s->sws, src, frame->linesize, 0, s->h, dst, dst_linesize);
+	return 0;
+}
+
+static void sws_slice_worker(SwsSlicePool* pool, int index)
+{
+	int job = 0, ret;
+
+	SDL_LockMutex(pool->mutex);
+	for (;;) {
+		while (!pool->abort_request && pool->job == job)
+			SDL_CondWait(pool->cond, pool->mutex);
+		if (pool->abort_request)
+			break;
+		job = pool->job;
+		SDL_UnlockMutex(pool->mutex);
+		ret = sws_slice_run(pool, index);
+		SDL_LockMutex(pool->mutex);
+		if (ret < 0)
+			pool->failed = 1;
+		if (--pool->pending == 0)
+			SDL_CondSignal(pool->done_cond);
+	}
+	SDL_UnlockMutex(pool->mutex);
+}
+
+//创建工作线程，失败时退化为单线程转换
+static void sws_slice_start(SwsSlicePool* pool)
+{
+	int i;
+
+	if (pool->nb_threads <= 1 || pool->mutex)
+		return;
+	pool->mutex = SDL_CreateMutex();
+	pool->cond = SDL_CreateCond();
+	pool->done_cond = SDL_CreateCond();
+	if (!pool->mutex || !pool->cond || !pool->done_cond) {
+		av_log(NULL, AV_LOG_WARNING, "sws slice: %s, converting on one thread\n", SDL_GetError());
+		pool->nb_threads = 1;
+		return;
+	}
+	//调用线程转换第0条带
+	for (i = 1; i < pool->nb_threads; i++)
+		pool->workers[i] = std::thread(sws_slice_worker, pool, i);
+	pool->nb_workers = pool->nb_threads - 1;
+}
+
+//按帧高和色度的垂直采样划分条带
+static void sws_slice_split(SwsSlicePool* pool, const AVFrame* frame)
+{
+	const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get((enum AVPixelFormat)frame->format);
+	int align = desc ? 1 << desc->log2_chroma_h : 1;
+	int n = av_clip(frame->height / SWS_SLICE_MIN_ROWS, 1, pool->nb_workers + 1);
+	int i, y, next;
+
+	pool->nb_slices = 0;
+	for (i = 0, y = 0; i < n && y < frame->height; i++) {
+		next = i == n - 1 ? frame->height : FFMIN((int)((int64_t)frame->height * (i + 1) / n) & ~(align - 1), frame->height);
+		if (next <= y)
+			continue;
+		pool->slices[pool->nb_slices].y = y;
+		pool->slices[pool->nb_slices].h = next - y;
+		pool->nb_slices++;
+		y = next;
+	}
+}
+
+int sws_slice_convert(SwsSlicePool* pool, const AVFrame* frame, enum AVPixelFormat dst_format, uint8_t* dst, int dst_pitch)
+{
+	int64_t start = av_gettime_relative();
+	int ret;
+
+	sws_slice_start(pool);
+	pool->frame = frame;
+	pool->dst_format = dst_format;
+	pool->dst = dst;
+	pool->dst_pitch = dst_pitch;
+	pool->failed = 0;
+	sws_slice_split(pool, frame);
+	if (pool->nb_slices > 1) {
+		SDL_LockMutex(pool->mutex);
+		pool->pending = pool->nb_workers;
+		pool->job++;
+		SDL_CondBroadcast(pool->cond);
+		SDL_UnlockMutex(pool->mutex);
+	}
+	ret = sws_slice_run(pool, 0);
+	if (pool->nb_slices > 1) {
+		SDL_LockMutex(pool->mutex);
+		while (pool->pending > 0)
+			SDL_CondWait(pool->done_cond, pool->mutex);
+		if (pool->failed)
+			ret = -1;
+		SDL_UnlockMutex(pool->mutex);
+	}
+	pool->frames++;
+	pool->total_us += av_gettime_relative() - start;
+	return ret;
+}
+
+void sws_slice_uninit(SwsSlicePool* pool)
+{
+	int i;
+
+	if (pool->frames)
+		av_log(NULL, AV_LOG_INFO, "sws slice: %" PRId64 " frames on %d threads, %.2fms per frame\n",
+			pool->frames, pool->nb_workers + 1, pool->total_us / 1000.0 / pool->frames);
+	if (pool->mutex) {
+		SDL_LockMutex(pool->mutex);
+		pool->abort_request = 1;
+		SDL_CondBroadcast(pool->cond);
+		SDL_UnlockMutex(pool->mutex);
+	}
+	for (i = 1; i <= pool->nb_workers; i++) {
+		if (pool->workers[i].joinable())
+			pool->workers[i].join();
+	}
+	pool->nb_workers = 0;
+	for (i = 0; i < SWS_SLICE_MAX_THREADS; i++) {
+		sws_freeContext(pool->slices[i].sws);
+		pool->slices[i].sws = NULL;
+	}
+	if (pool->done_cond)
+		SDL_DestroyCond(pool->done_cond);
+	if (pool->cond)
+		SDL_DestroyCond(pool->cond);
+	if (pool->mutex)
+		SDL_DestroyMutex(pool->mutex);
+	pool->done_cond = pool->cond = NULL;
+	pool->mutex = NULL;
+	pool->abort_request = 0;
+}
+
+int sws_slice_bench(const char* report, int iterations)
+{
+	//没有对应纹理格式、走回退路径的常见格式
+	static const enum AVPixelFormat formats[] = {
+		AV_PIX_FMT_YUVJ420P, AV_PIX_FMT_YUV422P10LE, AV_PIX_FMT_YUV444P10LE, AV_PIX_FMT_RGB24,
+	};
+	static const int sizes[][2] = { { 1920, 1080 }, { 3840, 2160 } };
+	SwsSlicePool* pool = NULL;
+	AVFrame* frame = NULL;
+	uint8_t* buf = NULL;
+	QByteArray csv;
+	char line[256];
+	int64_t start;
+	double ms, single_ms;
+	size_t f, s;
+	int threads, max_threads = FFMIN(av_cpu_count(), SWS_SLICE_MAX_THREADS);
+	int n, ret = AVERROR(ENOMEM);
+
+	buf = (uint8_t*)av_malloc((size_t)sizes[1][0] * 4 * sizes[1][1]);
+	frame = av_frame_alloc();
+	if (!buf || !frame)
+		goto end;
+	av_log(NULL, AV_LOG_INFO, "sws bench: 1..%d threads, %d iterations\n", max_threads, iterations);
+	csv = "format,width,height,threads,ms,speedup\n";
+	for (s = 0; s < FF_ARRAY_ELEMS(sizes); s++) {
+		for (f = 0; f < FF_ARRAY_ELEMS(formats); f++) {
+			av_frame_unref(frame);
+			frame->format = formats[f];
+			frame->width = sizes[s][0];
+			frame->height = sizes[s][1];
+			if (av_frame_get_buffer(frame, 32) < 0)
+				goto end;
+			pixel_repack_fill_grey(frame);
+			single_ms = 0;
+			for (threads = 1; threads <= max_threads; threads++) {
+				//池内含std::thread，用new以正确构造
+				pool = new SwsSlicePool();
+				sws_slice_init(pool, threads);
+				//第一次转换包括建立上下文和线程，不计时
+				sws_slice_convert(pool, frame, AV_PIX_FMT_BGRA, buf, frame->width * 4);
+				start = av_gettime_relative();
+				for (n = 0; n < iterations; n++)
+					sws_slice_convert(pool, frame, AV_PIX_FMT_BGRA, buf, frame->width * 4);
+				ms = (av_gettime_relative() - start) / 1000.0 / iterations;
+				pool->frames = 0;
+				sws_slice_uninit(pool);
+				delete pool;
+				pool = NULL;
+				if (threads == 1)
+					single_ms = ms;
+				snprintf(line, sizeof(line), "%s,%d,%d,%d,%.3f,%.2f\n", av_get_pix_fmt_name(formats[f]),
+					frame->width, frame->height, threads, ms, ms > 0 ? single_ms / ms : 0);
+				av_log(NULL, AV_LOG_INFO, "sws bench: %s", line);
+				csv += line;
+			}
+		}
+	}
+	if (report) {
+		QFile file(QString::fromLocal8Bit(report));
+		if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(csv) != csv.size())
+			av_log(NULL, AV_LOG_ERROR, "sws bench: could not write %s\n", report);
+	}
+	ret = 0;
+end:
+	av_frame_free(&frame);
+	av_free(buf);
+	return ret;
+}
@@ -0,0 +1,85 @@
+﻿/*
+ * @file 	swsslice.h
+ *
+ * @brief 	swscale回退路径的多线程分片转换
+ * @note	没有对应纹理格式的帧（YUVJ、12位、RGB24等）在渲染线程上用sws_scale整帧转换为BGRA，4K下一帧要几十毫秒，
+ *			而同一个线程还负责按时钟显示帧。这里把帧按水平方向切成若干条带，每条带有自己的SwsContext，
+ *			由工作线程池并行转换，直接写入锁定的纹理内存中对应的行；调用线程自己转换第一条带并等待其余条带完成。
+ *			sws_scale要求同一个上下文从第一行开始按顺序送入，所以每条带按自己的高度建立上下文，源和目标指针各自偏移到条带起点。
+ *			条带起点按色度的垂直采样对齐；色度垂直插值在条带边界处按边缘处理，与整帧转换相比边界行的色度可能有一个单位的差别。
+ *			工作线程在第一次转换时才创建。sws_slice_bench统计1080p和4K下不同线程数的耗时。
+ */
+#pragma once
+
+#include <thread>
+#include "globalhelper.h"
+
+/* 条带（线程）数上限 */
+#define SWS_SLICE_MAX_THREADS 16
+/* 自动选择时的条带数上限，解码线程同样需要CPU */
+#define SWS_SLICE_AUTO_THREADS 4
+/* 每条带的最少行数，帧较矮时减少条带数 */
+#define SWS_SLICE_MIN_ROWS 64
+
+//一条带
+typedef struct SwsSlice {
+	struct SwsContext* sws;	// 该条带自己的转换上下文
+	int y;	// 起始行
+	int h;	// 行数
+} SwsSlice;
+
+typedef struct SwsSlicePool {
+	int nb_threads;	// 条带数上限（包括调用线程）
+	int nb_workers;	// 已创建的工作线程数
+	std::thread workers[SWS_SLICE_MAX_THREADS];
+	SwsSlice slices[SWS_SLICE_MAX_THREADS];
+	int nb_slices;	// 当前任务的条带数
+	SDL_mutex* mutex;
+	SDL_cond* cond;	// 有新任务或退出
+	SDL_cond* done_cond;	// 工作线程都完成了当前任务
+	int job;	// 任务序号，工作线程据此判断是否有新任务
+	int pending;	// 未完成当前任务的工作线程数
+	int failed;	// 当前任务中有条带无法建立转换上下文
+	int abort_request;
+	//当前任务
+	const AVFrame* frame;
+	enum AVPixelFormat dst_format;	// 打包格式（单平面）
+	uint8_t* dst;
+	int dst_pitch;
+	//统计
+	int64_t frames;
+	int64_t total_us;
+} SwsSlicePool;
+
+/// <summary>
+/// 初始化分片转换池，工作线程在第一次转换时才创建
+/// </summary>
+/// <param name="pool">以全0初始化的结构</param>
+/// <param name="nb_threads">条带数，0表示按CPU核数自动选择（不超过SWS_SLICE_AUTO_THREADS）</param>
+void sws_slice_init(SwsSlicePool* pool, int nb_threads);
+
+/// <summary>
+/// 把帧转换为打包格式写入目标内存，尺寸不变，使用SWS_BICUBIC
+/// </summary>
+/// <param name="pool"></param>
+/// <param name="frame">源帧</param>
+/// <param name="dst_format">单平面的打包格式，如AV_PIX_FMT_BGRA</param>
+/// <param name="dst">目标内存（如SDL_LockTexture返回的像素指针）</param>
+/// <param name="dst_pitch">目标行宽</param>
+/// <returns>0-成功；<0-无法建立转换上下文</returns>
+int sws_slice_convert(SwsSlicePool* pool, const AVFrame* frame, enum AVPixelFormat dst_format, uint8_t* dst, int dst_pitch);
+
+/// <summary>
+/// 结束工作线程并释放所有转换上下文
+/// </summary>
+/// <param name="pool"></param>
+void sws_slice_uninit(SwsSlicePool* pool);
+
+/// <summary>
+/// 基准测试：在1080p和4K下对几种走回退路径的像素格式，分别用1到CPU核数条带转换为BGRA，
+/// 记录每帧的平均耗时和相对单线程的加速比。结果以CSV写入report（为NULL时只输出到日志）。
+/// </summary>
+/// <param name="report">CSV报告的路径，可为NULL</param>
+/// <param name="iterations">每种配置的转换次数</param>
+/// <returns>0-成功；<0-内存不足</returns>
+int sws_slice_bench(const char* report, int iterations);
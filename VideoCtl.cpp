@@ -11,7 +11,6 @@
 
 
 #include <QDebug>
-#include <QMutex>
 
 #include <thread>
 #include "videoctl.h"
@@ -19,11 +18,104 @@
 #pragma execution_character_set("utf-8")
 
 //extern关键字
-extern QMutex g_show_rect_mutex;
+extern ShowRectLatch g_show_rect;
 
 static int framedrop = -1;
 static int infinite_buffer = -1;
-static int64_t audio_callback_time;
+static int file_io_mode = MEDIA_IO_AUTO;	// 本地普通文件的输入方式 MEDIA_IO_*
+static int video_queue_min_depth = VIDEO_PICTURE_QUEUE_SIZE;	// 视频帧队列的最小深度
+static int video_queue_max_depth = VIDEO_PICTURE_QUEUE_MAX;	// 视频帧队列的最大深度（分配的槽位数）
+static int64_t video_queue_budget = VIDEO_PICTURE_QUEUE_BUDGET;	// 视频帧队列中解码图像的内存预算
+static int subpicture_queue_size = SUBPICTURE_QUEUE_SIZE;	// 字幕帧队列深度
+static int sample_queue_size = SAMPLE_QUEUE_SIZE;	// 音频帧队列深度
+static int frame_pool_mode = FRAME_POOL_HUGEPAGES;	// 视频解码器的帧缓冲池 FRAME_POOL_*
+static int video_lowres = 0;	// 视频解码的lowres（解码器支持时按2^lowres缩小）
+static int quality_ladder = 1;	// 视频解码持续过载时逐级降低画质
+static int auto_lowres = 1;	// 显示区域远小于图像时自动使用lowres解码（解码器支持时）
+static int zero_copy_upload = 0;	// 视频解码线程把帧直接写入预先锁定的流式纹理，渲染线程显示时不再拷贝
+static int sws_slice_threads = 0;	// swscale回退路径的条带数，0表示自动
+static int vsync_pacing = 1;	// 从present时刻学习刷新间隔，按vblank节拍安排帧
+
+#if AUDIO_RT_CHECK
+thread_local int audio_rt_thread;
+std::atomic<int64_t> audio_rt_violations;
+std::atomic<const char*> audio_rt_first_violation;
+
+#if defined(_MSC_VER)
+//调试版CRT的分配钩子，捕获回调线程中的malloc/new（包括Qt和标准库内部的分配）
+static int audio_rt_alloc_hook(int allocType, void* userData, size_t size, int blockType, long requestNumber,
+    const unsigned char* filename, int lineNumber)
+{
+    if (audio_rt_thread && allocType != _HOOK_FREE)
+        audio_rt_violation("CRT allocation");
+    return TRUE;
+}
+#elif defined(__GLIBC__)
+//glibc：拦截malloc系列，转发给glibc自己的实现（new和大多数库内部的分配都经过malloc）
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t nmemb, size_t size);
+extern "C" void* __libc_realloc(void* ptr, size_t size);
+
+extern "C" void* malloc(size_t size)
+{
+    if (audio_rt_thread)
+        audio_rt_violation("malloc");
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t nmemb, size_t size)
+{
+    if (audio_rt_thread)
+        audio_rt_violation("calloc");
+    return __libc_calloc(nmemb, size);
+}
+
+extern "C" void* realloc(void* ptr, size_t size)
+{
+    if (audio_rt_thread)
+        audio_rt_violation("realloc");
+    return __libc_realloc(ptr, size);
+}
+#else
+//其他平台无法拦截malloc，至少替换全局operator new
+void* operator new(size_t size)
+{
+    void* ptr;
+
+    if (audio_rt_thread)
+        audio_rt_violation("operator new");
+    ptr = malloc(size ? size : 1);
+    if (!ptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+    free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept
+{
+    free(ptr);
+}
+#endif
+#endif
 
 #define FF_QUIT_EVENT    (SDL_USEREVENT + 2)
 
@@ -97,7 +189,144 @@ void VideoCtl::calculate_display_rect(SDL_Rect* rect,
     rect->h = FFMAX(height, 1);
 }
 
-int VideoCtl::upload_texture(SDL_Texture* tex, AVFrame* frame, struct SwsContext** img_convert_ctx) {
+int VideoCtl::texture_slot_lock(TextureSlot* slot, int64_t key)
+{
+    Uint32 format = (Uint32)(key >> 32);
+    int width = (int)((key >> 16) & 0xFFFF), height = (int)(key & 0xFFFF);
+    void* pixels;
+    int pitch;
+
+    if (realloc_texture(&slot->texture, format, width, height, SDL_BLENDMODE_NONE, 0) < 0 ||
+        SDL_LockTexture(slot->texture, NULL, &pixels, &pitch) < 0)
+        return -1;
+    slot->key = key;
+    pixel_repack_planes(format, (uint8_t*)pixels, pitch, height, slot->pixels, slot->pitch);
+    return 0;
+}
+
+void VideoCtl::video_texture_slots_prepare(VideoState* is)
+{
+    int64_t key = is->tex_slot_key.load();
+    int i, state, rindex = is->pictq.rindex.load(std::memory_order_relaxed), size = is->pictq.size.load();
+    TextureSlot* slot;
+
+    if (!renderer || !key || is->tex_slot_failed)
+        return;
+    //READY的纹理归视频解码线程；已解锁的纹理要保留到帧出队（正在显示的一帧在被替换后才出队）
+    for (i = 0; i < is->pictq.capacity; i++) {
+        slot = &is->tex_slots[i];
+        state = slot->state.load(std::memory_order_acquire);
+        if (state == TEXTURE_SLOT_READY ||
+            (state == TEXTURE_SLOT_SHOWN && (i - rindex + is->pictq.capacity) % is->pictq.capacity < size))
+            continue;
+        if (state == TEXTURE_SLOT_STALE)
+            SDL_UnlockTexture(slot->texture);
+        if (texture_slot_lock(slot, key) < 0) {
+            av_log(NULL, AV_LOG_WARNING, "zero-copy upload disabled: %s\n", SDL_GetError());
+            slot->state.store(TEXTURE_SLOT_NONE);
+            is->tex_slot_failed = 1;
+            return;
+        }
+        slot->state.store(TEXTURE_SLOT_READY, std::memory_order_release);
+    }
+}
+
+void VideoCtl::video_texture_slots_destroy(VideoState* is)
+{
+    int i, state;
+
+    if (is->tex_staged)
+        av_log(NULL, AV_LOG_INFO, "zero-copy upload: %" PRId64 " frames staged, %" PRId64 " uploaded on the render thread\n",
+            is->tex_staged, is->tex_fallback);
+    for (i = 0; is->tex_slots && i < is->pictq.capacity; i++) {
+        state = is->tex_slots[i].state.load();
+        if (state == TEXTURE_SLOT_READY || state == TEXTURE_SLOT_STALE)
+            SDL_UnlockTexture(is->tex_slots[i].texture);
+        if (is->tex_slots[i].texture)
+            SDL_DestroyTexture(is->tex_slots[i].texture);
+        is->tex_slots[i].texture = NULL;
+        is->tex_slots[i].state = TEXTURE_SLOT_NONE;
+    }
+    av_freep(&is->tex_slots);
+}
+
+int VideoCtl::video_texture_upload(VideoState* is, Frame* vp)
+{
+    FrameQueue* f = &is->pictq;
+    const PixelRepack* repack = NULL;
+    int sdl_pix_fmt, r = 0, i, n, used, size;
+    double start;
+
+    //解码线程已写入槽位的纹理，解锁即完成上传
+    if (vp->staged) {
+        TextureSlot* slot = &is->tex_slots[vp - f->queue];
+        SDL_UnlockTexture(slot->texture);
+        slot->state.store(TEXTURE_SLOT_SHOWN, std::memory_order_release);
+        vp->flip_v = 0;
+        vp->uploaded = 1;
+        return 0;
+    }
+    //轮流选一个不被队列中的帧（包括正在显示的一帧）占用的纹理
+    size = f->size.load();
+    for (n = 0; n < TEXTURE_RING_SIZE; n++) {
+        r = (is->vid_texture_next + n) % TEXTURE_RING_SIZE;
+        for (i = 0, used = 0; i < size && !used; i++)
+            used = f->queue[(f->rindex.load(std::memory_order_relaxed) + i) % f->capacity].ring_index == r;
+        if (!used)
+            break;
+    }
+    if (n == TEXTURE_RING_SIZE)
+        return -1;
+    if (vp->frame->format != AV_PIX_FMT_YUV420P && vp->frame->format != AV_PIX_FMT_BGRA)
+        repack = pixel_repack_find(vp->frame->format, renderer_info_ready ? &renderer_info : NULL);
+    sdl_pix_fmt = vp->frame->format == AV_PIX_FMT_YUV420P ? SDL_PIXELFORMAT_YV12 :
+        repack ? repack->sdl_format : SDL_PIXELFORMAT_ARGB8888;
+    start = av_gettime_relative() / 1000000.0;
+    if (realloc_texture(&is->vid_textures[r], sdl_pix_fmt, vp->frame->width, vp->frame->height, SDL_BLENDMODE_NONE, 0) < 0)
+        return -1;
+    if (upload_texture(is->vid_textures[r], vp->frame, repack, &is->img_convert_pool) < 0)
+        return -1;
+    is->tex_upload_cost += TEXTURE_UPLOAD_COST_ALPHA * (av_gettime_relative() / 1000000.0 - start - is->tex_upload_cost);
+    is->vid_texture_next = (r + 1) % TEXTURE_RING_SIZE;
+    vp->ring_index = r;
+    vp->uploaded = 1;
+    //重排时已按行翻正
+    vp->flip_v = !repack && vp->frame->linesize[0] < 0;
+    return 0;
+}
+
+void VideoCtl::video_texture_preupload(VideoState* is, double* remaining_time)
+{
+    FrameQueue* f = &is->pictq;
+    Frame* vp;
+    int i, n, ahead = 0;
+    double start, used = 0.0;
+
+    if (!renderer || !is->video_st)
+        return;
+    start = av_gettime_relative() / 1000000.0;
+    n = frame_queue_nb_remaining(f);
+    for (i = 0; i < n && ahead < TEXTURE_PREUPLOAD_AHEAD; i++) {
+        vp = &f->queue[(f->rindex.load(std::memory_order_relaxed) + f->rindex_shown.load(std::memory_order_relaxed) + i) % f->capacity];
+        //seek之前的帧会被video_refresh直接丢弃
+        if (vp->serial != is->videoq.serial)
+            continue;
+        ahead++;
+        if (vp->uploaded)
+            continue;
+        //剩下的时间不够上传一帧，留到显示时再上传，不推迟下一次刷新
+        if (used + is->tex_upload_cost > *remaining_time)
+            break;
+        if (video_texture_upload(is, vp) < 0)
+            break;
+        used = av_gettime_relative() / 1000000.0 - start;
+        is->tex_preuploaded++;
+    }
+    //上传用掉的时间从等待中扣除
+    *remaining_time = FFMAX(*remaining_time - used, 0.0);
+}
+
+int VideoCtl::upload_texture(SDL_Texture* tex, AVFrame* frame, const PixelRepack* repack, SwsSlicePool* img_convert_pool) {
     int ret = 0;
     switch (frame->format) {
     case AV_PIX_FMT_YUV420P:
@@ -124,24 +353,24 @@ int VideoCtl::upload_texture(SDL_Texture* tex, AVFrame* frame, struct SwsContext
         }
         break;
     default:
+        //渲染器有对应的YUV纹理格式时只做平面拷贝或廉价的重排
+        if (repack) {
+            ret = pixel_repack_upload(tex, repack, frame);
+            break;
+        }
         //当视频帧的格式不是 YUV420P 或 BGRA 时，需要将其转换为 BGRA 格式供 SDL 使用。
         /* This should only happen if we are not using avfilter... */
-        *img_convert_ctx = sws_getCachedContext(*img_convert_ctx,
-            frame->width, frame->height, (AVPixelFormat)frame->format, frame->width, frame->height,
-            AV_PIX_FMT_BGRA, SWS_BICUBIC, NULL, NULL, NULL);
-        if (*img_convert_ctx != NULL) {
+        //按条带分给工作线程转换，直接写入锁定的纹理
+        {
             uint8_t* pixels[4];
             int pitch[4];
             if (!SDL_LockTexture(tex, NULL, (void**)pixels, pitch)) {
-                sws_scale(*img_convert_ctx, (const uint8_t* const*)frame->data, frame->linesize,
-                    0, frame->height, pixels, pitch);
+                ret = sws_slice_convert(img_convert_pool, frame, AV_PIX_FMT_BGRA, pixels[0], pitch[0]);
                 SDL_UnlockTexture(tex);
+                if (ret < 0)
+                    av_log(NULL, AV_LOG_FATAL, "Cannot initialize the conversion context\n");
             }
         }
-        else {
-            av_log(NULL, AV_LOG_FATAL, "Cannot initialize the conversion context\n");
-            ret = -1;
-        }
         break;
     }
     return ret;
@@ -153,6 +382,7 @@ void VideoCtl::video_image_display(VideoState* is)
     Frame* vp;
     Frame* sp = NULL;
     SDL_Rect rect;
+    SDL_Texture* tex;
     vp = frame_queue_peek_last(&is->pictq);
     if (is->subtitle_st) {
         if (frame_queue_nb_remaining(&is->subpq) > 0) {
@@ -201,32 +431,33 @@ void VideoCtl::video_image_display(VideoState* is)
     }
 
     calculate_display_rect(&rect, is->xleft, is->ytop, is->width, is->height, vp->width, vp->height, vp->sar);
+    //按显示区域相对原始图像的大小选择lowres，由视频解码线程在区域稳定后重新打开解码器
+    if (auto_lowres && is->video_st)
+        is->display_lowres = display_lowres_for_rect(is->video_st->codecpar->width, is->video_st->codecpar->height, rect.w, rect.h);
 
+    //通常已在上一次刷新后的空闲时间里上传（video_texture_preupload），这里只需绘制
     if (!vp->uploaded) {
-        int sdl_pix_fmt = vp->frame->format == AV_PIX_FMT_YUV420P ? SDL_PIXELFORMAT_YV12 : SDL_PIXELFORMAT_ARGB8888;
-        if (realloc_texture(&is->vid_texture, sdl_pix_fmt, vp->frame->width, vp->frame->height, SDL_BLENDMODE_NONE, 0) < 0)
-            return;
-        if (upload_texture(is->vid_texture, vp->frame, &is->img_convert_ctx) < 0)
+        if (video_texture_upload(is, vp) < 0)
             return;
-        vp->uploaded = 1;
-        vp->flip_v = vp->frame->linesize[0] < 0;
-        //通知宽高变化
-        if (m_nFrameW != vp->frame->width || m_nFrameH != vp->frame->height)
-        {
-            m_nFrameW = vp->frame->width;
-            m_nFrameH = vp->frame->height;
-            emit SigFrameDimensionsChanged(m_nFrameW, m_nFrameH);
-        }
+        is->tex_late++;
+    }
+    tex = vp->staged ? is->tex_slots[vp - is->pictq.queue].texture : is->vid_textures[vp->ring_index];
+    //通知宽高变化
+    if (m_nFrameW != vp->width || m_nFrameH != vp->height)
+    {
+        m_nFrameW = vp->width;
+        m_nFrameH = vp->height;
+        emit SigFrameDimensionsChanged(m_nFrameW, m_nFrameH);
     }
     //使用 SDL 的扩展渲染函数 SDL_RenderCopyEx 将上传后的视频纹理渲染到目标矩形 rect 上。
 	//renderer：SDL 渲染器，用于实际绘制到窗口上。
-	//is->vid_texture：视频纹理，存储了当前视频帧的数据。
+	//tex：视频纹理（帧上传到的vid_textures之一，或零拷贝上传时帧所在槽位的纹理），存储了当前视频帧的数据。
 	//NULL：表示整个纹理都被用于渲染（无源矩形裁剪）。
 	//&rect：目标显示矩形，计算好后确保视频居中且保持正确比例。
 	//0：旋转角度，这里不进行旋转。
 	//NULL：旋转中心，默认使用中心点。
 	//SDL_RendererFlip 标志：根据 vp->flip_v 判断是否需要垂直翻转。
-    SDL_RenderCopyEx(renderer, is->vid_texture, NULL, &rect, 0, NULL, (SDL_RendererFlip)(vp->flip_v ? SDL_FLIP_VERTICAL : 0));
+    SDL_RenderCopyEx(renderer, tex, NULL, &rect, 0, NULL, (SDL_RendererFlip)(vp->flip_v ? SDL_FLIP_VERTICAL : 0));
     //渲染字幕层（预留）
     if (sp) {
         SDL_RenderCopy(renderer, is->sub_texture, NULL, &rect);
@@ -246,8 +477,18 @@ void VideoCtl::stream_component_close(VideoState* is, int stream_index)
 
     switch (codecpar->codec_type) {
     case AVMEDIA_TYPE_AUDIO:
+        is->audio_ring.abort_request = 1;
         decoder_abort(&is->auddec, &is->sampq);
+        //生产线程会调用SDL_PauseAudio，先等它退出再关闭设备
+        if (is->audio_render_tid.joinable())
+            is->audio_render_tid.join();
         SDL_CloseAudio();
+        audio_ring_destroy(&is->audio_ring);
+#if AUDIO_RT_CHECK
+        if (audio_rt_violations)
+            av_log(NULL, AV_LOG_ERROR, "audio callback is not realtime-safe: %" PRId64 " allocations/locks, first: %s\n",
+                audio_rt_violations.load(), audio_rt_first_violation.load());
+#endif
         decoder_destroy(&is->auddec);
         swr_free(&is->swr_ctx);
         av_freep(&is->audio_buf1);
@@ -263,7 +504,17 @@ void VideoCtl::stream_component_close(VideoState* is, int stream_index)
         break;
     case AVMEDIA_TYPE_VIDEO:
         decoder_abort(&is->viddec, &is->pictq);
+        if (is->video_skip.raises)
+            av_log(NULL, AV_LOG_INFO, "video skip_frame: %d raises, %d lowers, skipped nonref %" PRId64 ", bidir %" PRId64 ", nonkey %" PRId64 "\n",
+                is->video_skip.raises, is->video_skip.lowers, is->video_skip.skipped[SKIP_LEVEL_NONREF],
+                is->video_skip.skipped[SKIP_LEVEL_BIDIR], is->video_skip.skipped[SKIP_LEVEL_NONKEY]);
+        if (is->video_quality.changes)
+            av_log(NULL, AV_LOG_INFO, "video quality: %d changes, lowest %s, ended at %s\n",
+                is->video_quality.changes, quality_level_name(is->video_quality.max_level),
+                quality_level_name(is->video_quality.level));
         decoder_destroy(&is->viddec);
+        //队列中剩余的帧仍引用arena，arena在它们释放后才归还内存
+        frame_pool_uninit(&is->frame_pool);
         break;
     case AVMEDIA_TYPE_SUBTITLE:
         decoder_abort(&is->subdec, &is->subpq);
@@ -296,6 +547,10 @@ void VideoCtl::stream_close(VideoState* is)
 {
     /* XXX: use a special url_shutdown call to abort parse cleanly */
     is->abort_request = 1;
+    //接管的自定义输入仍使用预打开的中断回调
+    if (is->preopen)
+        is->preopen->abort_request = 1;
+    read_wakeup_signal(&is->continue_read_thread);
     is->read_tid.join();
 	if (is->filename) {
 		av_free(is->filename);
@@ -310,6 +565,11 @@ void VideoCtl::stream_close(VideoState* is)
         stream_component_close(is, is->subtitle_stream);
 
     avformat_close_input(&is->ic);
+    media_io_close(&is->file_pb);
+    packet_cache_log(&is->pkt_cache);
+    packet_cache_destroy(&is->pkt_cache);
+    keyframe_index_close(&is->kf_index);
+    preopen_close(&is->preopen);
 
     packet_queue_destroy(&is->videoq);
     packet_queue_destroy(&is->audioq);
@@ -319,13 +579,24 @@ void VideoCtl::stream_close(VideoState* is)
     frame_queue_destory(&is->pictq);
     frame_queue_destory(&is->sampq);
     frame_queue_destory(&is->subpq);
-    SDL_DestroyCond(is->continue_read_thread);
-    sws_freeContext(is->img_convert_ctx);
+    read_wakeup_destroy(&is->continue_read_thread);
+    sws_slice_uninit(&is->img_convert_pool);
+    sws_slice_uninit(&is->stage_convert_pool);
+    frame_pacer_log(&is->pacer);
+    //各线程都已退出，不会再发布
+    stats_reset();
     sws_freeContext(is->sub_convert_ctx);
     av_free(is->filename);
 
-    if (is->vid_texture)
-        SDL_DestroyTexture(is->vid_texture);
+    video_texture_slots_destroy(is);
+
+    if (is->tex_preuploaded || is->tex_late)
+        av_log(NULL, AV_LOG_INFO, "texture upload: %" PRId64 " frames ahead of display, %" PRId64 " at display time\n",
+            is->tex_preuploaded, is->tex_late);
+    for (int i = 0; i < TEXTURE_RING_SIZE; i++) {
+        if (is->vid_textures[i])
+            SDL_DestroyTexture(is->vid_textures[i]);
+    }
     if (is->sub_texture)
         SDL_DestroyTexture(is->sub_texture);
     av_free(is);
@@ -333,7 +604,7 @@ void VideoCtl::stream_close(VideoState* is)
 
 double VideoCtl::get_clock(Clock* c)
 {
-    if (*c->queue_serial != c->serial)
+    if (c->queue_serial && c->queue_serial->load() != c->serial)
         return NAN;
     if (c->paused) {
         return c->pts;
@@ -365,7 +636,7 @@ void VideoCtl::set_clock_speed(Clock* c, double speed)
     c->speed = speed;
 }
 
-void VideoCtl::init_clock(Clock* c, int* queue_serial)
+void VideoCtl::init_clock(Clock* c, const std::atomic<int>* queue_serial)
 {
     c->speed = 1.0;
     c->paused = 0;
@@ -472,7 +743,8 @@ void VideoCtl::stream_seek(VideoState* is, int64_t pos, int64_t rel)
         is->seek_rel = rel;
         is->seek_flags &= ~AVSEEK_FLAG_BYTE;
         is->seek_req = 1;
-        SDL_CondSignal(is->continue_read_thread);
+        is->seek_req_time = av_gettime_relative();
+        read_wakeup_signal(&is->continue_read_thread);
     }
 }
 
@@ -496,6 +768,8 @@ void VideoCtl::stream_toggle_pause(VideoState* is)
     set_clock(&is->extclk, get_clock(&is->extclk), is->extclk.serial);
     // 将 paused 标志取反，并同步设置音频（audclk）、视频（vidclk）和外部（extclk）时钟的暂停标志。
     is->paused = is->audclk.paused = is->vidclk.paused = is->extclk.paused = !is->paused;
+    // 唤醒read_thread处理av_read_pause/av_read_play，以及读到结尾后重新判断播放是否结束
+    read_wakeup_signal(&is->continue_read_thread);
 }
 
 void VideoCtl::toggle_pause(VideoState* is)
@@ -613,6 +887,291 @@ int VideoCtl::get_target_channels()
     return 2;       // 默认
 }
 
+void VideoCtl::stats_publish_buffer(VideoState* is)
+{
+    BufferPolicy* bp = &is->buffer_policy;
+    BufferHealth stHealth;
+
+    memset(&stHealth, 0, sizeof(BufferHealth));
+    stHealth.source_type = bp->source_type;
+    stHealth.audio_duration = FFMAX(packet_queue_seconds(&is->audioq, is->audio_st), 0);
+    stHealth.video_duration = FFMAX(packet_queue_seconds(&is->videoq, is->video_st), 0);
+    stHealth.audio_bitrate = bp->audio.bitrate;
+    stHealth.video_bitrate = bp->video.bitrate;
+    stHealth.low_water = bp->video.low_water;
+    stHealth.high_water = bp->video.high_water;
+    stHealth.bytes = (int64_t)is->audioq.size + is->videoq.size + is->subtitleq.size;
+    stHealth.max_bytes = bp->max_bytes;
+
+    //取各流中最差的健康程度
+    stHealth.level = BUFFER_HEALTH_FULL;
+    if (is->audio_stream >= 0)
+    {
+        stHealth.level = FFMIN(stHealth.level, stream_health_level(is->audio_st, &is->audioq, &bp->audio));
+    }
+    if (is->video_stream >= 0)
+    {
+        stHealth.level = FFMIN(stHealth.level, stream_health_level(is->video_st, &is->videoq, &bp->video));
+    }
+    SDL_LockMutex(m_pStatsMutex);
+    m_stStats.buffer = stHealth;
+    m_stStats.has_buffer = 1;
+    m_stStats.packet_puts = is->audioq.puts + is->videoq.puts + is->subtitleq.puts;
+    m_stStats.packet_node_allocs = is->audioq.node_allocs + is->videoq.node_allocs + is->subtitleq.node_allocs;
+    SDL_UnlockMutex(m_pStatsMutex);
+}
+
+void VideoCtl::stats_publish_video(VideoState* is)
+{
+    SDL_LockMutex(m_pStatsMutex);
+    m_stStats.has_video = 1;
+    m_stStats.video_depth = is->pictq.max_size;
+    m_stStats.video_frames = frame_queue_nb_remaining(&is->pictq);
+    m_stStats.video_depth_changes = is->pictq_depth.changes;
+    m_stStats.pool_frames = is->frame_pool.gets;
+    m_stStats.pool_fallbacks = is->frame_pool.fallbacks;
+    frame_pool_usage(&is->frame_pool, &m_stStats.pool_in_use, &m_stStats.pool_slots, &m_stStats.pool_committed);
+    m_stStats.skip_level = is->video_skip.level;
+    memcpy(m_stStats.skip_skipped, is->video_skip.skipped, sizeof(m_stStats.skip_skipped));
+    m_stStats.quality_level = is->video_quality.level;
+    m_stStats.quality_load = is->video_quality.load;
+    m_stStats.quality_changes = is->video_quality.changes;
+    SDL_UnlockMutex(m_pStatsMutex);
+}
+
+void VideoCtl::stats_publish_audio(VideoState* is)
+{
+    AudioRing* r = &is->audio_ring;
+
+    SDL_LockMutex(m_pStatsMutex);
+    m_stStats.has_audio = 1;
+    m_stStats.audio_callbacks = r->callbacks;
+    m_stStats.audio_underruns = r->underruns;
+    m_stStats.audio_buffered = audio_ring_filled(r) * 1000.0 / is->audio_tgt.bytes_per_sec;
+    SDL_UnlockMutex(m_pStatsMutex);
+}
+
+void VideoCtl::stats_publish_pacing(VideoState* is)
+{
+    FramePacer* p = &is->pacer;
+
+    SDL_LockMutex(m_pStatsMutex);
+    m_stStats.pacing_locked = p->locked;
+    m_stStats.pacing_rate = 1.0 / p->period;
+    m_stStats.pacing_frames = p->frames;
+    m_stStats.pacing_avg_error = p->frames ? p->err_abs_sum * 1000.0 / p->frames : 0.0;
+    m_stStats.pacing_max_error = p->err_max * 1000.0;
+    m_stStats.pacing_missed = p->missed;
+    SDL_UnlockMutex(m_pStatsMutex);
+}
+
+void VideoCtl::stats_reset()
+{
+    SDL_LockMutex(m_pStatsMutex);
+    memset(&m_stStats, 0, sizeof(m_stStats));
+    SDL_UnlockMutex(m_pStatsMutex);
+}
+
+bool VideoCtl::GetBufferHealth(BufferHealth& stHealth)
+{
+    bool bValid;
+    if (m_pStatsMutex == nullptr)
+    {
+        return false;
+    }
+    SDL_LockMutex(m_pStatsMutex);
+    bValid = m_stStats.has_buffer != 0;
+    if (bValid)
+    {
+        stHealth = m_stStats.buffer;
+    }
+    SDL_UnlockMutex(m_pStatsMutex);
+    return bValid;
+}
+
+bool VideoCtl::GetPacketAllocStats(int64_t& nPackets, int64_t& nNodeAllocs)
+{
+    bool bValid;
+    if (m_pStatsMutex == nullptr)
+    {
+        return false;
+    }
+    SDL_LockMutex(m_pStatsMutex);
+    bValid = m_stStats.has_buffer != 0;
+    nPackets = m_stStats.packet_puts;
+    nNodeAllocs = m_stStats.packet_node_allocs;
+    SDL_UnlockMutex(m_pStatsMutex);
+    return bValid;
+}
+
+bool VideoCtl::GetSeekCacheStats(int64_t& nHits, int64_t& nMisses, double& dHitLatency, double& dMissLatency)
+{
+    bool bValid;
+    if (m_pStatsMutex == nullptr)
+    {
+        return false;
+    }
+    SDL_LockMutex(m_pStatsMutex);
+    bValid = m_stStats.active != 0;
+    nHits = m_stStats.seek_hits;
+    nMisses = m_stStats.seek_misses;
+    dHitLatency = m_stStats.seek_hit_latency;
+    dMissLatency = m_stStats.seek_miss_latency;
+    SDL_UnlockMutex(m_pStatsMutex);
+    return bValid;
+}
+
+bool VideoCtl::GetOpenStats(double& dProbeTime, double& dFirstFrameTime, bool& bProbeCached)
+{
+    bool bValid;
+    if (m_pStatsMutex == nullptr)
+    {
+        return false;
+    }
+    SDL_LockMutex(m_pStatsMutex);
+    bValid = m_stStats.active != 0;
+    dProbeTime = m_stStats.probe_time;
+    dFirstFrameTime = m_stStats.first_frame_time;
+    bProbeCached = m_stStats.probe_cached != 0;
+    SDL_UnlockMutex(m_pStatsMutex);
+    return bValid;
+}
+
+bool VideoCtl::GetFrameQueueStats(int& nVideoDepth, int& nVideoFrames, int& nDepthChanges)
+{
+    bool bValid;
+    if (m_pStatsMutex == nullptr)
+    {
+        return false;
+    }
+    SDL_LockMutex(m_pStatsMutex);
+    bValid = m_stStats.has_video != 0;
+    nVideoDepth = m_stStats.video_depth;
+    nVideoFrames = m_stStats.video_frames;
+    nDepthChanges = m_stStats.video_depth_changes;
+    SDL_UnlockMutex(m_pStatsMutex);
+    return bValid;
+}
+
+void VideoCtl::SetFrameQueueDepth(int nVideoMinDepth, int nVideoMaxDepth, int nVideoBudgetMB, int nSampleDepth, int nSubpictureDepth)
+{
+    video_queue_max_depth = FFMAX(nVideoMaxDepth, 2);
+    video_queue_min_depth = av_clip(nVideoMinDepth, 2, video_queue_max_depth);
+    video_queue_budget = (int64_t)FFMAX(nVideoBudgetMB, 1) * 1024 * 1024;
+    sample_queue_size = FFMAX(nSampleDepth, 2);
+    subpicture_queue_size = FFMAX(nSubpictureDepth, 1);
+}
+
+bool VideoCtl::GetFramePoolStats(int64_t& nPoolFrames, int64_t& nFallbacks, int& nSlotsInUse, int& nSlots, int64_t& nCommittedBytes)
+{
+    bool bValid;
+    if (m_pStatsMutex == nullptr)
+    {
+        return false;
+    }
+    SDL_LockMutex(m_pStatsMutex);
+    bValid = m_stStats.has_video != 0;
+    nPoolFrames = m_stStats.pool_frames;
+    nFallbacks = m_stStats.pool_fallbacks;
+    nSlotsInUse = m_stStats.pool_in_use;
+    nSlots = m_stStats.pool_slots;
+    nCommittedBytes = m_stStats.pool_committed;
+    SDL_UnlockMutex(m_pStatsMutex);
+    return bValid;
+}
+
+void VideoCtl::SetFramePoolMode(int nMode)
+{
+    frame_pool_mode = av_clip(nMode, FRAME_POOL_OFF, FRAME_POOL_HUGEPAGES);
+}
+
+void VideoCtl::SetZeroCopyUpload(bool bEnable)
+{
+    zero_copy_upload = bEnable ? 1 : 0;
+}
+
+void VideoCtl::SetSwsSliceThreads(int nThreads)
+{
+    sws_slice_threads = av_clip(nThreads, 0, SWS_SLICE_MAX_THREADS);
+}
+
+void VideoCtl::SetVsyncPacing(bool bEnable)
+{
+    vsync_pacing = bEnable ? 1 : 0;
+}
+
+bool VideoCtl::GetSkipFrameStats(int& nLevel, int64_t& nSkipNonRef, int64_t& nSkipBidir, int64_t& nSkipNonKey)
+{
+    bool bValid;
+    if (m_pStatsMutex == nullptr)
+    {
+        return false;
+    }
+    SDL_LockMutex(m_pStatsMutex);
+    bValid = m_stStats.has_video != 0;
+    nLevel = m_stStats.skip_level;
+    nSkipNonRef = m_stStats.skip_skipped[SKIP_LEVEL_NONREF];
+    nSkipBidir = m_stStats.skip_skipped[SKIP_LEVEL_BIDIR];
+    nSkipNonKey = m_stStats.skip_skipped[SKIP_LEVEL_NONKEY];
+    SDL_UnlockMutex(m_pStatsMutex);
+    return bValid;
+}
+
+bool VideoCtl::GetQualityStats(int& nLevel, double& dDecodeLoad, int& nChanges)
+{
+    bool bValid;
+    if (m_pStatsMutex == nullptr)
+    {
+        return false;
+    }
+    SDL_LockMutex(m_pStatsMutex);
+    bValid = m_stStats.has_video != 0;
+    nLevel = m_stStats.quality_level;
+    dDecodeLoad = m_stStats.quality_load;
+    nChanges = m_stStats.quality_changes;
+    SDL_UnlockMutex(m_pStatsMutex);
+    return bValid;
+}
+
+bool VideoCtl::GetAudioStats(int64_t& nCallbacks, int64_t& nUnderruns, double& dBufferedMs)
+{
+    bool bValid;
+    if (m_pStatsMutex == nullptr)
+    {
+        return false;
+    }
+    SDL_LockMutex(m_pStatsMutex);
+    bValid = m_stStats.has_audio != 0;
+    nCallbacks = m_stStats.audio_callbacks;
+    nUnderruns = m_stStats.audio_underruns;
+    dBufferedMs = m_stStats.audio_buffered;
+    SDL_UnlockMutex(m_pStatsMutex);
+    return bValid;
+}
+
+bool VideoCtl::GetPacingStats(double& dRefreshRate, int64_t& nFrames, double& dAvgErrorMs, double& dMaxErrorMs, int64_t& nMissed)
+{
+    bool bValid;
+    if (m_pStatsMutex == nullptr)
+    {
+        return false;
+    }
+    SDL_LockMutex(m_pStatsMutex);
+    bValid = m_stStats.pacing_locked != 0;
+    dRefreshRate = m_stStats.pacing_rate;
+    nFrames = m_stStats.pacing_frames;
+    dAvgErrorMs = m_stStats.pacing_avg_error;
+    dMaxErrorMs = m_stStats.pacing_max_error;
+    nMissed = m_stStats.pacing_missed;
+    SDL_UnlockMutex(m_pStatsMutex);
+    return bValid;
+}
+
+int VideoCtl::SetDecoderProfiles(const QStringList& listProfiles)
+{
+    return decoder_profile_set_overrides(listProfiles);
+}
+
 int VideoCtl::is_normal_playback_rate()
 {
     if (pf_playback_rate > 0.99 && pf_playback_rate < 1.01)
@@ -644,7 +1203,7 @@ void VideoCtl::video_refresh(void* opaque, double* remaining_time)
             // nothing to do, no picture to display in the queue
         }
         else {
-            double last_duration, duration, delay;
+            double last_duration, duration, delay, switch_time;
             Frame* vp, * lastvp;
 
             /* dequeue the picture */
@@ -656,8 +1215,11 @@ void VideoCtl::video_refresh(void* opaque, double* remaining_time)
                 goto retry;
             }
 
-            if (lastvp->serial != vp->serial)
+            if (lastvp->serial != vp->serial) {
                 is->frame_timer = av_gettime_relative() / 1000000.0;
+                frame_pacer_resync(&is->pacer);
+                seek_latency_check(is, vp->serial);
+            }
 
             if (is->paused)
                 goto display;
@@ -675,9 +1237,11 @@ void VideoCtl::video_refresh(void* opaque, double* remaining_time)
 
 			//如果当前时间还未达到显示下一帧的时刻，则计算剩余等待时间（通过取当前剩余时间与预计差值的较小值更新）
             //然后跳转到显示部分，继续显示当前帧。
-            if (time < is->frame_timer + delay) {
+            //调度器锁定vblank后，切换时刻提前到目标vblank的前一个vblank之后，由present等到目标vblank
+            switch_time = frame_pacer_schedule(&is->pacer, is->frame_timer + delay, last_duration);
+            if (time < switch_time) {
                 //                 qDebug() << "(is->frame_timer + delay) - time " << is->frame_timer + delay - time;
-                *remaining_time = FFMIN(is->frame_timer + delay - time, *remaining_time);
+                *remaining_time = FFMIN(switch_time - time, *remaining_time);
                 goto display;
             }
 
@@ -689,11 +1253,9 @@ void VideoCtl::video_refresh(void* opaque, double* remaining_time)
             if (delay > 0 && time - is->frame_timer > AV_SYNC_THRESHOLD_MAX)
                 is->frame_timer = time;
 
-            //1. 更新视频时钟
-            SDL_LockMutex(is->pictq.mutex);
+            //1. 更新视频时钟（vp只由本线程出队，读取它不需要加锁）
             if (!std::isnan(vp->pts))
                 update_video_pts(is, vp->pts, vp->pos, vp->serial);
-            SDL_UnlockMutex(is->pictq.mutex);
             //            qDebug() << "debug " << __LINE__;
             
             //2. 丢帧逻辑：判断是否需要丢弃当前帧
@@ -748,6 +1310,7 @@ void VideoCtl::video_refresh(void* opaque, double* remaining_time)
             }
             //切换到下一要播放的帧
             frame_queue_next(&is->pictq);
+            frame_pacer_commit(&is->pacer);
             is->force_refresh = 1;
             //            qDebug() << "debug " << __LINE__;
             // step为1，单步模式，当暂停时候seek，step就被设置为1，用以暂停显帧
@@ -757,8 +1320,13 @@ void VideoCtl::video_refresh(void* opaque, double* remaining_time)
         }
     display:
         /* display picture */
-        if (is->force_refresh && is->pictq.rindex_shown)
+        //调度器工作时每个vblank都重新present当前帧，present的返回时刻用来跟踪vblank
+        if ((is->force_refresh || (frame_pacer_active(&is->pacer) && !is->paused)) && is->pictq.rindex_shown) {
             video_display(is);
+            first_frame_check(is);
+        }
+        if (frame_pacer_active(&is->pacer))
+            *remaining_time = FFMIN(*remaining_time, frame_pacer_wait(&is->pacer, av_gettime_relative() / 1000000.0));
     }
     is->force_refresh = 0;
 
@@ -768,12 +1336,14 @@ void VideoCtl::video_refresh(void* opaque, double* remaining_time)
 int VideoCtl::queue_picture(VideoState* is, AVFrame* src_frame, double pts, double duration, int64_t pos, int serial)
 {
     Frame* vp;
+    const PixelRepack* repack;
 
     if (!(vp = frame_queue_peek_writable(&is->pictq)))
         return -1;
 
     vp->sar = src_frame->sample_aspect_ratio;
     vp->uploaded = 0;
+    vp->ring_index = -1;
 
     vp->width = src_frame->width;
     vp->height = src_frame->height;
@@ -784,7 +1354,26 @@ int VideoCtl::queue_picture(VideoState* is, AVFrame* src_frame, double pts, doub
     vp->pos = pos;
     vp->serial = serial;
 
-    av_frame_move_ref(vp->frame, src_frame);
+    //零拷贝上传：直接写入该槽位已锁定的纹理，解码缓冲区立即归还给解码器
+    if (zero_copy_upload) {
+        //渲染器创建前只能用IYUV和ARGB8888
+        repack = pixel_repack_find(src_frame->format,
+            renderer_info_ready.load(std::memory_order_acquire) ? &renderer_info : NULL);
+        vp->staged = texture_slot_stage(&is->tex_slots[vp - is->pictq.queue], &is->tex_slot_key, repack,
+            &is->stage_convert_pool, src_frame);
+    }
+    else {
+        vp->staged = 0;
+    }
+    if (vp->staged) {
+        is->tex_staged++;
+        av_frame_unref(src_frame);
+    }
+    else {
+        if (zero_copy_upload)
+            is->tex_fallback++;
+        av_frame_move_ref(vp->frame, src_frame);
+    }
     frame_queue_push(&is->pictq);
     return 0;
 }
@@ -808,8 +1397,10 @@ int VideoCtl::get_video_frame(VideoState* is, AVFrame* frame)
         frame->sample_aspect_ratio = av_guess_sample_aspect_ratio(is->ic, is->video_st, frame);
         //如果所有条件满足，认为当前帧太“早”，需要丢弃。
         if (framedrop > 0 || (framedrop && get_master_sync_type(is) != AV_SYNC_VIDEO_MASTER)) {
+            double diff = frame->pts != AV_NOPTS_VALUE ? dpts - get_master_clock(is) : NAN;
+            //持续落后时让解码器在解码前就跳过部分帧
+            skip_frame_update(&is->video_skip, &is->viddec, -diff);
             if (frame->pts != AV_NOPTS_VALUE) {
-                double diff = dpts - get_master_clock(is);
                 if (!std::isnan(diff) && fabs(diff) < AV_NOSYNC_THRESHOLD &&
                     diff - is->frame_last_filter_delay < 0 &&
                     is->viddec.pkt_serial == is->vidclk.serial &&
@@ -835,10 +1426,18 @@ int VideoCtl::audio_thread(void* arg)
     int got_frame = 0;
     AVRational tb;
     int ret = 0;
+#if AUDIO_DIRECT_CALLBACK
+    int64_t stats_time = 0;
+#endif
 
     if (!frame)
         return AVERROR(ENOMEM);
     do {
+#if AUDIO_DIRECT_CALLBACK
+        //没有音频生产线程，由解码线程发布音频输出的统计
+        if (stats_publish_due(&stats_time))
+            stats_publish_audio(is);
+#endif
         if ((got_frame = decoder_decode_frame(&is->auddec, frame, NULL)) < 0)
             goto the_end;
         if (got_frame) {
@@ -869,8 +1468,10 @@ int VideoCtl::video_thread(void* arg)
     double pts;
     double duration;
     int ret;
+    int64_t decode_start, decode_time, stats_time = 0;
     AVRational tb = is->video_st->time_base;
     AVRational frame_rate = av_guess_frame_rate(is->ic, is->video_st, NULL);
+    double nominal_duration = frame_rate.num && frame_rate.den ? av_q2d(av_inv_q(frame_rate)) : 0;
 
     if (!frame)
     {
@@ -879,13 +1480,24 @@ int VideoCtl::video_thread(void* arg)
 
     //循环从队列中获取视频帧
     for (;;) {
+        decode_start = av_gettime_relative();
         ret = get_video_frame(is, frame);
         if (ret < 0)
             goto the_end;
+        //等待数据包的时间不算解码耗时
+        decode_time = av_gettime_relative() - decode_start - is->viddec.wait_time;
+        //按解码负载调整画质阶梯，倍速播放时每帧可用的时间相应缩短
+        quality_ladder_update(&is->video_quality, &is->viddec, &is->video_skip, decode_time,
+            nominal_duration / FFMAX(pf_playback_rate, 0.1f), is->viddec.wait_time > 0);
+        video_update_lowres(is);
+        if (stats_publish_due(&stats_time))
+            stats_publish_video(is);
         if (!ret)
             continue;
         //一帧的显示时间
         duration = (frame_rate.num && frame_rate.den ? av_q2d(/*(AVRational) */{ frame_rate.den, frame_rate.num }) : 0);
+        //按解码耗时的抖动和帧大小调整帧队列深度
+        frame_queue_depth_update(&is->pictq_depth, &is->pictq, frame, decode_time, duration, is->viddec.pkt_serial);
         //当前帧的pts（以秒显示）
         pts = (frame->pts == AV_NOPTS_VALUE) ? NAN : frame->pts * av_q2d(tb);
         //将视频帧入队列
@@ -901,6 +1513,37 @@ the_end:
     return 0;
 }
 
+void VideoCtl::video_update_lowres(VideoState* is)
+{
+    QualityLadder* q = &is->video_quality;
+    int lowres;
+    int64_t now;
+
+    //解码器不支持lowres，或者之前重新打开失败过
+    if (!q->lowres_supported)
+        return;
+    //拖动改变窗口大小时显示区域连续变化，稳定一段时间后再采用
+    now = av_gettime_relative();
+    if (is->display_lowres != is->display_lowres_pending) {
+        is->display_lowres_pending = is->display_lowres;
+        is->display_lowres_time = now;
+    }
+    else if (now - is->display_lowres_time >= DISPLAY_LOWRES_SETTLE_TIME) {
+        is->display_lowres_active = is->display_lowres_pending;
+    }
+    lowres = FFMAX(video_lowres, quality_ladder_lowres(q));
+    lowres = FFMAX(lowres, is->display_lowres_active);
+    lowres = FFMIN(lowres, av_codec_get_max_lowres(is->viddec.avctx->codec));
+    if (lowres == av_codec_get_lowres(is->viddec.avctx))
+        return;
+    if (decoder_reopen(&is->viddec, is->video_st, lowres) < 0) {
+        q->lowres_supported = 0;
+        return;
+    }
+    //旧解码器中缓存的帧已丢弃，重新统计
+    skip_frame_reset(&is->video_skip, &is->viddec);
+}
+
 int VideoCtl::subtitle_thread(void* arg)
 {
     VideoState* is = (VideoState*)arg;
@@ -996,29 +1639,26 @@ int VideoCtl::synchronize_audio(VideoState* is, int nb_samples)
     return wanted_nb_samples;
 }
 
-int VideoCtl::audio_decode_frame(VideoState* is)
+int VideoCtl::audio_decode_frame(VideoState* is, double* clock, int* serial)
 {
     int data_size, resampled_data_size; //用于保存原始数据大小和重采样后的数据大小。
     int64_t dec_channel_layout; //存储解码器实际使用的通道布局
-    av_unused double audio_clock0;  //用于保存解码前的音频时钟值（av_unused 表示此变量在某些编译器配置下可能不被使用）。
 	int wanted_nb_samples;  //经过同步调整后希望解码器输出的样本数量。
     Frame* af;
     if (is->paused)
         return -1;
-    //从音频帧队列中获取一帧数据
+    //从音频帧队列中获取一帧数据（在音频生产线程中，可以阻塞等待）
     do {
-#if defined(_WIN32)
-        while (frame_queue_nb_remaining(&is->sampq) == 0) {
-            if ((av_gettime_relative() - audio_callback_time) > 1000000LL * is->audio_hw_buf_size / is->audio_tgt.bytes_per_sec / 2)
-                return -1;
-            av_usleep(1000);
-        }
-#endif
         if (!(af = frame_queue_peek_readable(&is->sampq)))
             return -1;
         frame_queue_next(&is->sampq);
     } while (af->serial != is->audioq.serial);
     //end
+    //没有视频时以第一帧音频统计seek延迟
+    if (!is->video_st) {
+        seek_latency_check(is, af->serial);
+        first_frame_check(is);
+    }
     //计算当前音频帧中数据所占的字节数
     data_size = av_samples_get_buffer_size(NULL, av_frame_get_channels(af->frame),
         af->frame->nb_samples,
@@ -1100,18 +1740,143 @@ int VideoCtl::audio_decode_frame(VideoState* is)
         is->audio_buf = af->frame->data[0];
         resampled_data_size = data_size;
     }
-    //更新音频时钟
-    audio_clock0 = is->audio_clock;
-    /* update the audio clock with the pts */
+    //该帧结束位置的音频时钟，由回调开始播放这一段时更新到is->audio_clock
     if (!std::isnan(af->pts))
         //audio_clock 的计算仍然基于原始帧的信息，而不是重采样后的数据。
-        is->audio_clock = af->pts + (double)af->frame->nb_samples / af->frame->sample_rate;
+        *clock = af->pts + (double)af->frame->nb_samples / af->frame->sample_rate;
     else
-        is->audio_clock = NAN;
-    is->audio_clock_serial = af->serial;
+        *clock = NAN;
+    *serial = af->serial;
     return resampled_data_size;
 }
 
+int VideoCtl::audio_speed_convert_frame(VideoState* is, int audio_size)
+{
+    int sample_size = is->audio_tgt.channels * av_get_bytes_per_sample(is->audio_tgt.fmt);
+    int in_samples, out_samples, num_samples, out_ret = 0;
+
+    // 是否需要做变速
+    if (ffp_get_playback_rate_change())
+    {
+        ffp_set_playback_rate_change(0);
+        // 先释放再创建
+        if (audio_speed_convert)
+            sonicDestroyStream(audio_speed_convert);
+        audio_speed_convert = sonicCreateStream(get_target_frequency(), get_target_channels());
+        // 设置变速系数
+        sonicSetSpeed(audio_speed_convert, ffp_get_playback_rate());
+        //保持音高和节奏不变，声音不会因为速度变化而失真
+        sonicSetPitch(audio_speed_convert, 1.0);
+        sonicSetRate(audio_speed_convert, 1.0);
+    }
+    if (is_normal_playback_rate() || !audio_speed_convert)
+        return audio_size;
+    //根据目标采样格式判断数据类型，调用 Sonic 库的相应接口
+    in_samples = audio_size / sample_size;
+    if (is->audio_tgt.fmt == AV_SAMPLE_FMT_FLT)
+        out_ret = sonicWriteFloatToStream(audio_speed_convert, (float*)is->audio_buf, in_samples);
+    else if (is->audio_tgt.fmt == AV_SAMPLE_FMT_S16)
+        out_ret = sonicWriteShortToStream(audio_speed_convert, (short*)is->audio_buf, in_samples);
+    else
+        av_log(NULL, AV_LOG_ERROR, "sonic unspport ......\n");
+    if (!out_ret)
+        return audio_size;
+    // 从流中读取处理好的数据，可能暂时没有输出
+    num_samples = sonicSamplesAvailable(audio_speed_convert);
+    av_fast_malloc(&is->audio_buf1, &is->audio_buf1_size, num_samples * sample_size);
+    if (!is->audio_buf1)
+        return AVERROR(ENOMEM);
+    if (is->audio_tgt.fmt == AV_SAMPLE_FMT_FLT)
+        out_samples = sonicReadFloatFromStream(audio_speed_convert, (float*)is->audio_buf1, num_samples);
+    else
+        out_samples = sonicReadShortFromStream(audio_speed_convert, (short*)is->audio_buf1, num_samples);
+    is->audio_buf = is->audio_buf1;
+    return out_samples * sample_size;
+}
+
+int VideoCtl::audio_render_thread(void* arg)
+{
+    VideoState* is = (VideoState*)arg;
+    AudioRing* r = &is->audio_ring;
+    //缓冲足够或没有数据时的轮询间隔：SDL缓冲区时长的1/4
+    int poll_us = FFMAX(1000, (int)(250000LL * is->audio_hw_buf_size / is->audio_tgt.bytes_per_sec));
+    double clock;
+    int serial, audio_size, started = 0;
+    int64_t stats_time = 0;
+
+    while (!r->abort_request) {
+        if (stats_publish_due(&stats_time))
+            stats_publish_audio(is);
+        //预填充到目标时长（音频比这还短时解码结束即可）后才开始播放，开头不会先输出静音
+        if (!started && (audio_ring_filled(r) >= r->target || is->auddec.finished == is->audioq.serial)) {
+            SDL_PauseAudio(0);
+            started = 1;
+        }
+        //只保持目标时长的缓冲，避免seek和调音量时延迟过大
+        if (audio_ring_filled(r) >= r->target) {
+            av_usleep(poll_us);
+            continue;
+        }
+        audio_size = audio_decode_frame(is, &clock, &serial);
+        if (audio_size < 0) {
+            //暂停、重采样失败或解码器已中止
+            if (is->auddec.queue->abort_request)
+                break;
+            av_usleep(poll_us);
+            continue;
+        }
+        audio_size = audio_speed_convert_frame(is, audio_size);
+        if (audio_size <= 0)
+            continue;
+        if (audio_ring_write(r, is->audio_buf, audio_size, serial, clock, ffp_get_playback_rate(), poll_us) < 0)
+            break;
+    }
+    return 0;
+}
+
+#if AUDIO_DIRECT_CALLBACK
+//在回调中直接取帧并转换为设备格式，数据留在is->audio_buf中；帧队列为空时不等待，按欠载处理
+static int audio_callback_next_chunk(VideoState* is, AudioChunk* chunk)
+{
+    VideoCtl* pVideoCtl = VideoCtl::GetInstance();
+    int size;
+
+    if (frame_queue_nb_remaining(&is->sampq) == 0)
+        return 0;
+    size = pVideoCtl->audio_decode_frame(is, &chunk->clock, &chunk->serial);
+    if (size >= 0)
+        size = pVideoCtl->audio_speed_convert_frame(is, size);
+    if (size <= 0)
+        return 0;
+    chunk->size = size;
+    chunk->rate = pVideoCtl->ffp_get_playback_rate();
+    return 1;
+}
+
+static void audio_callback_read(VideoState* is, uint8_t* dst, int len, int volume)
+{
+    const uint8_t* src = is->audio_buf + is->audio_buf_index;
+
+    if (dst && volume == SDL_MIX_MAXVOLUME) {
+        memcpy(dst, src, len);
+    }
+    else if (dst) {
+        memset(dst, 0, len);
+        SDL_MixAudio(dst, src, len, volume);
+    }
+}
+#else
+static int audio_callback_next_chunk(VideoState* is, AudioChunk* chunk)
+{
+    return audio_ring_next_chunk(&is->audio_ring, chunk);
+}
+
+static void audio_callback_read(VideoState* is, uint8_t* dst, int len, int volume)
+{
+    audio_ring_read(&is->audio_ring, dst, len, volume);
+}
+#endif
+
 /// <summary>
 /// SDL回调获取数据的函数
 /// </summary>
@@ -1121,121 +1886,49 @@ int VideoCtl::audio_decode_frame(VideoState* is)
 void sdl_audio_callback(void* opaque, Uint8* stream, int len)
 {
     VideoState* is = (VideoState*)opaque;
-    int audio_size, len1;
-    //单例模式
-    VideoCtl* pVideoCtl = VideoCtl::GetInstance();
+    AudioRing* r = &is->audio_ring;
+    AudioChunk chunk;
+    int len1;
+#if AUDIO_RT_CHECK
+    audio_rt_thread = 1;
+#endif
     //提前获取以便于后续调整音频时钟（例如补偿音频硬件缓冲延迟），使得更新后的时钟能更贴近实际播放时刻。
-    audio_callback_time = av_gettime_relative();
-    while (len > 0) {
-        // 从帧队列读取缓存
-        if (is->audio_buf_index >= is->audio_buf_size) {        // 数据已经处理完毕了，需要读取新的
-            audio_size = pVideoCtl->audio_decode_frame(is);
-            //            qDebug() << "1 audio_buf_size: " << audio_size;
-            if (audio_size < 0) {
-                /* if error, just output silence */
-                is->audio_buf = NULL;
-                is->audio_buf_size = SDL_AUDIO_MIN_BUFFER_SIZE / is->audio_tgt.frame_size * is->audio_tgt.frame_size;
-            }
-            else {
-                is->audio_buf_size = audio_size;
-            }
-            is->audio_buf_index = 0;
-            // 2 是否需要做变速
-            if (pVideoCtl->ffp_get_playback_rate_change())
-            {
-                pVideoCtl->ffp_set_playback_rate_change(0);
-                // 初始化
-                if (pVideoCtl->audio_speed_convert)
-                {
-                    // 先释放
-                    sonicDestroyStream(pVideoCtl->audio_speed_convert);
+    is->audio_callback_time = av_gettime_relative();
+    r->callbacks++;
+    //回调运行在SDL的实时音频线程上：所有状态都来自opaque，不分配内存、不加锁、不访问单例。
+    //这里只从PCM环形缓冲区拷贝数据，取帧、重采样和变速都在音频生产线程中完成
+    if (is->paused)
+        memset(stream, 0, len);
+    while (!is->paused && len > 0) {
+        if (is->audio_buf_index >= is->audio_buf_size) {        // 当前段已经播放完毕，取下一段
+            if (!audio_callback_next_chunk(is, &chunk)) {
+                //生产线程没有及时准备好数据，输出静音
+                //只统计当前播放序列已开始播放之后的：seek后重新填充和播放结束后的空缓冲不计
+                if (is->auddec.finished != is->audioq.serial && is->audio_clock_serial == is->audioq.serial) {
+                    r->underruns++;
+                    r->underrun_bytes += len;
                 }
-                // 再创建
-                pVideoCtl->audio_speed_convert = sonicCreateStream(pVideoCtl->get_target_frequency(),
-                    pVideoCtl->get_target_channels());
-                // 设置变速系数
-                sonicSetSpeed(pVideoCtl->audio_speed_convert, pVideoCtl->ffp_get_playback_rate());
-                //确保音频在变速后，声音的音调依然保持原样，不会因为速度变化而失真。
-                //保持音高不变
-                sonicSetPitch(pVideoCtl->audio_speed_convert, 1.0);
-                //保持节奏不变：
-                sonicSetRate(pVideoCtl->audio_speed_convert, 1.0);
+                memset(stream, 0, len);
+                is->audio_buf_size = 0;
+                is->audio_buf_index = 0;
+                break;
             }
-			// 不是正常播放则需要修改
-			// 需要修改  is->audio_buf_index is->audio_buf_size is->audio_buf
-            if (!pVideoCtl->is_normal_playback_rate() && is->audio_buf)
-            {
-                // 当前音频缓冲区（is->audio_buf_size，以字节为单位）的大小转换为样本数。
-				//is->audio_tgt.channels 表示目标音频通道数。
-                //av_get_bytes_per_sample(is->audio_tgt.fmt) 返回目标采样格式中每个样本占用的字节数
-                int actual_out_samples = is->audio_buf_size /
-                    (is->audio_tgt.channels * av_get_bytes_per_sample(is->audio_tgt.fmt));
-                // 计算处理后的点数
-                int out_ret = 0;
-                int out_size = 0;
-                int num_samples = 0;
-                int sonic_samples = 0;
-                //根据目标采样格式判断数据类型，调用 Sonic 库的相应接口
-                if (is->audio_tgt.fmt == AV_SAMPLE_FMT_FLT)
-                {
-                    out_ret = sonicWriteFloatToStream(pVideoCtl->audio_speed_convert,
-                        (float*)is->audio_buf,
-                        actual_out_samples);
-                }
-                else  if (is->audio_tgt.fmt == AV_SAMPLE_FMT_S16)
-                {
-                    out_ret = sonicWriteShortToStream(pVideoCtl->audio_speed_convert,
-                        (short*)is->audio_buf,
-                        actual_out_samples);
-                }
-                else
-                {
-                    av_log(NULL, AV_LOG_ERROR, "sonic unspport ......\n");
-                }
-                num_samples = sonicSamplesAvailable(pVideoCtl->audio_speed_convert);
-                // 2通道  目前只支持2通道；得到输出缓冲区所需的总字节数。
-                out_size = (num_samples)*av_get_bytes_per_sample(is->audio_tgt.fmt) * is->audio_tgt.channels;
-                av_fast_malloc(&is->audio_buf1, &is->audio_buf1_size, out_size);
-                if (out_ret)
-                {
-                    // 从流中读取处理好的数据
-                    if (is->audio_tgt.fmt == AV_SAMPLE_FMT_FLT) {
-                        sonic_samples = sonicReadFloatFromStream(pVideoCtl->audio_speed_convert,
-                            (float*)is->audio_buf1,
-                            num_samples);
-                    }
-                    else  if (is->audio_tgt.fmt == AV_SAMPLE_FMT_S16)
-                    {
-                        sonic_samples = sonicReadShortFromStream(pVideoCtl->audio_speed_convert,
-                            (short*)is->audio_buf1,
-                            num_samples);
-                    }
-                    else
-                    {
-                        qDebug() << "sonic unspport ......";
-                    }
-                    is->audio_buf = is->audio_buf1;
-                    //                    qDebug() << "mdy num_samples: " << num_samples;
-                    //                    qDebug() << "orig audio_buf_size: " << is->audio_buf_size;
-                    //重新计算 is->audio_buf_size 为 sonic_samples 乘以通道数和每个采样的字节数，反映重采样后数据的总大小。
-                    is->audio_buf_size = sonic_samples * is->audio_tgt.channels * av_get_bytes_per_sample(is->audio_tgt.fmt);
-                    //                    qDebug() << "mdy audio_buf_size: " << is->audio_buf_size;
-                    is->audio_buf_index = 0;
-                }
+            is->audio_buf_size = chunk.size;
+            is->audio_buf_index = 0;
+            //seek之前生成的数据直接丢弃
+            if (chunk.serial != is->audioq.serial) {
+                audio_callback_read(is, NULL, chunk.size, SDL_MIX_MAXVOLUME);
+                is->audio_buf_index = chunk.size;
+                continue;
             }
+            is->audio_clock = chunk.clock;
+            is->audio_clock_serial = chunk.serial;
+            is->audio_clock_rate = chunk.rate;
         }
-        if (is->audio_buf_size == 0)
-            continue;
         len1 = is->audio_buf_size - is->audio_buf_index;
         if (len1 > len)
             len1 = len;
-        if (is->audio_buf && is->audio_volume == SDL_MIX_MAXVOLUME)
-            memcpy(stream, (uint8_t*)is->audio_buf + is->audio_buf_index, len1);
-        else {
-            memset(stream, 0, len1);
-            if (is->audio_buf)
-                SDL_MixAudio(stream, (uint8_t*)is->audio_buf + is->audio_buf_index, len1, is->audio_volume);
-        }
+        audio_callback_read(is, stream, len1, is->audio_volume);
         len -= len1;
         stream += len1;
         is->audio_buf_index += len1;
@@ -1243,7 +1936,7 @@ void sdl_audio_callback(void* opaque, Uint8* stream, int len)
     is->audio_write_buf_size = is->audio_buf_size - is->audio_buf_index;
     /* Let's assume the audio driver that is used by SDL has two periods. */
     if (!std::isnan(is->audio_clock)) {
-        double audio_clock = is->audio_clock / pVideoCtl->ffp_get_playback_rate();
+        double audio_clock = is->audio_clock / is->audio_clock_rate;
         //为什么不直接使用audio_decode_frame中的af->pts 
         //因为这个值代表了解码帧的时间戳，但它没有反映数据从解码到实际输出之间的延迟。
         //实际上，解码后的音频数据需要先进入硬件缓冲区，再经过一段延迟后才会被播放。
@@ -1251,11 +1944,14 @@ void sdl_audio_callback(void* opaque, Uint8* stream, int len)
         //audio_clock - (double)(2 * is->audio_hw_buf_size + is->audio_write_buf_size) / is->audio_tgt.bytes_per_sec
         //对 is->audio_clock 进行了补偿，从而得到更接近实际播放时刻的时间戳。同时，audio_callback_time 作为当前回调的时间记录，也被传入以更新时钟的最后更新时间和漂移值。
         //虽然在一开始获取 audio_callback_time 时没有考虑延迟，但在 set_clock_at 中通过减去由缓冲区大小和未写入数据计算出的延迟，确保最终设置的 pts 能反映实际播放的音频时间，进而计算出准确的 pts_drift。
-        pVideoCtl->set_clock_at(&is->audclk, 
+        VideoCtl::set_clock_at(&is->audclk, 
             audio_clock - (double)(2 * is->audio_hw_buf_size + is->audio_write_buf_size) / is->audio_tgt.bytes_per_sec, 
-            is->audio_clock_serial, audio_callback_time / 1000000.0);
-        pVideoCtl->sync_clock_to_slave(&is->extclk, &is->audclk);
+            is->audio_clock_serial, is->audio_callback_time / 1000000.0);
+        VideoCtl::sync_clock_to_slave(&is->extclk, &is->audclk);
     }
+#if AUDIO_RT_CHECK
+    audio_rt_thread = 0;
+#endif
 }
 
 int VideoCtl::audio_open(void* opaque, int64_t wanted_channel_layout, int wanted_nb_channels, int wanted_sample_rate,
@@ -1408,9 +2104,17 @@ int VideoCtl::stream_component_open(VideoState* is, int stream_index)
     int sample_rate, nb_channels;
     int64_t channel_layout;
     int ret = 0;
-    int stream_lowres = 0;
+    int stream_lowres;
     if (stream_index < 0 || stream_index >= ic->nb_streams)
         return -1;
+    stream_lowres = ic->streams[stream_index]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO ? video_lowres : 0;
+    //使用后台预打开的解码器
+    avctx = is->preopen ? preopen_take_decoder(is->preopen, stream_index) : NULL;
+    if (avctx) {
+        codec = (AVCodec*)avctx->codec;
+        decoder_attach_frame_pool(avctx, &is->frame_pool, frame_pool_mode, is->pictq.capacity);
+        goto decoder_opened;
+    }
     //初始化结构体
     avctx = avcodec_alloc_context3(NULL);
     if (!avctx)
@@ -1421,11 +2125,6 @@ int VideoCtl::stream_component_open(VideoState* is, int stream_index)
     av_codec_set_pkt_timebase(avctx, ic->streams[stream_index]->time_base);
     //寻找解码器
     codec = avcodec_find_decoder(avctx->codec_id);
-    switch (avctx->codec_type) {
-    case AVMEDIA_TYPE_AUDIO: is->last_audio_stream = stream_index; break;
-    case AVMEDIA_TYPE_SUBTITLE: is->last_subtitle_stream = stream_index; break;
-    case AVMEDIA_TYPE_VIDEO: is->last_video_stream = stream_index; break;
-    }
     avctx->codec_id = codec->id;
     //设置分辨率级别
     if (stream_lowres > av_codec_get_max_lowres(codec)) {
@@ -1443,15 +2142,16 @@ int VideoCtl::stream_component_open(VideoState* is, int stream_index)
         avctx->flags |= CODEC_FLAG_EMU_EDGE;
 #endif
     opts = nullptr;//filter_codec_opts(codec_opts, avctx->codec_id, ic, ic->streams[stream_index], codec);
-    //让解码器自动选择线程数
-    if (!av_dict_get(opts, "threads", NULL, 0))
-        av_dict_set(&opts, "threads", "auto", 0);
+    //按编码格式和分辨率选择线程数、线程类型等
+    decoder_profile_apply(avctx, &opts);
     //告诉解码器使用低分辨率模式（通常用于减小解码负担或适应设备性能）
     if (stream_lowres)
         av_dict_set_int(&opts, "lowres", stream_lowres, 0);
 	//解码器输出的帧会带有引用计数，这有助于管理内存和避免数据复制，尤其在多线程和复杂处理流程中更安全。
     if (avctx->codec_type == AVMEDIA_TYPE_VIDEO || avctx->codec_type == AVMEDIA_TYPE_AUDIO)
         av_dict_set(&opts, "refcounted_frames", "1", 0);
+    //视频帧从按分辨率划分的arena中分配
+    decoder_attach_frame_pool(avctx, &is->frame_pool, frame_pool_mode, is->pictq.capacity);
     //打开解码器
     if ((ret = avcodec_open2(avctx, codec, &opts)) < 0) {
         goto fail;
@@ -1462,7 +2162,13 @@ int VideoCtl::stream_component_open(VideoState* is, int stream_index)
         ret = AVERROR_OPTION_NOT_FOUND;
         goto fail;
     }
-    is->eof = 0;
+decoder_opened:
+    switch (avctx->codec_type) {
+    case AVMEDIA_TYPE_AUDIO: is->last_audio_stream = stream_index; break;
+    case AVMEDIA_TYPE_SUBTITLE: is->last_subtitle_stream = stream_index; break;
+    case AVMEDIA_TYPE_VIDEO: is->last_video_stream = stream_index; break;
+    }
+    is->read_state = READ_STATE_READING;
     //AVDISCARD_DEFAULT 通常表示保留需要参考的帧，而丢弃一些可丢弃的帧。
     ic->streams[stream_index]->discard = AVDISCARD_DEFAULT;
     switch (avctx->codec_type) {
@@ -1479,6 +2185,11 @@ int VideoCtl::stream_component_open(VideoState* is, int stream_index)
         is->audio_src = is->audio_tgt;
         is->audio_buf_size = 0;
         is->audio_buf_index = 0;
+        is->audio_clock_rate = ffp_get_playback_rate();
+        if ((ret = audio_ring_init(&is->audio_ring, is->audio_tgt.bytes_per_sec, is->audio_hw_buf_size)) < 0) {
+            SDL_CloseAudio();
+            goto fail;
+        }
         //初始化音频同步平均滤波器
         is->audio_diff_avg_coef = exp(log(0.01) / AUDIO_DIFF_AVG_NB);
         is->audio_diff_avg_count = 0;
@@ -1488,7 +2199,7 @@ int VideoCtl::stream_component_open(VideoState* is, int stream_index)
         is->audio_diff_threshold = (double)(is->audio_hw_buf_size) / is->audio_tgt.bytes_per_sec;
         is->audio_stream = stream_index;
         is->audio_st = ic->streams[stream_index];
-        decoder_init(&is->auddec, avctx, &is->audioq, is->continue_read_thread);
+        decoder_init(&is->auddec, avctx, &is->audioq, &is->continue_read_thread);
         //针对特殊格式设置起始PTS
         if ((is->ic->iformat->flags & (AVFMT_NOBINSEARCH | AVFMT_NOGENSEARCH | AVFMT_NO_BYTE_SEEK)) && !is->ic->iformat->read_seek) {
             is->auddec.start_pts = is->audio_st->start_time;
@@ -1497,12 +2208,20 @@ int VideoCtl::stream_component_open(VideoState* is, int stream_index)
         packet_queue_start(is->auddec.queue);
         //创建音频解码线程，开始音频解码
         is->auddec.decode_thread = std::thread(&VideoCtl::audio_thread, this, is);
+#if AUDIO_DIRECT_CALLBACK
         SDL_PauseAudio(0);
+#else
+        //创建音频生产线程，先填充PCM环形缓冲区，由它开始播放
+        is->audio_render_tid = std::thread(&VideoCtl::audio_render_thread, this, is);
+#endif
         break;
     case AVMEDIA_TYPE_VIDEO:
         is->video_stream = stream_index;
         is->video_st = ic->streams[stream_index];
-        decoder_init(&is->viddec, avctx, &is->videoq, is->continue_read_thread);
+        frame_queue_depth_init(&is->pictq_depth, &is->pictq, video_queue_min_depth, video_queue_budget);
+        decoder_init(&is->viddec, avctx, &is->videoq, &is->continue_read_thread);
+        skip_frame_init(&is->video_skip, &is->viddec);
+        quality_ladder_init(&is->video_quality, &is->viddec, quality_ladder);
         packet_queue_start(is->viddec.queue);
         //创建视频解码线程，开始视频解码
         is->viddec.decode_thread = std::thread(&VideoCtl::video_thread, this, is);
@@ -1512,7 +2231,7 @@ int VideoCtl::stream_component_open(VideoState* is, int stream_index)
         is->subtitle_stream = stream_index;
         is->subtitle_st = ic->streams[stream_index];
         //创建字幕解码线程，开始字幕解码
-        decoder_init(&is->subdec, avctx, &is->subtitleq, is->continue_read_thread);
+        decoder_init(&is->subdec, avctx, &is->subtitleq, &is->continue_read_thread);
         packet_queue_start(is->subdec.queue);
         is->subdec.decode_thread = std::thread(&VideoCtl::subtitle_thread, this, is);
         break;
@@ -1521,6 +2240,8 @@ int VideoCtl::stream_component_open(VideoState* is, int stream_index)
     }
     goto out;
 fail:
+    if (avctx->codec_type == AVMEDIA_TYPE_VIDEO)
+        frame_pool_uninit(&is->frame_pool);
     avcodec_free_context(&avctx);
 out:
     av_dict_free(&opts);
@@ -1537,11 +2258,135 @@ int decode_interrupt_cb(void* ctx)
     return is->abort_request;
 }
 
-int VideoCtl::stream_has_enough_packets(AVStream* st, int stream_id, PacketQueue* queue) {
-    return stream_id < 0 ||
+int VideoCtl::stream_has_enough_packets(AVStream* st, int stream_id, PacketQueue* queue, StreamBufferPolicy* policy) {
+    double seconds;
+    if (stream_id < 0 ||
+        queue->abort_request ||
+        (st->disposition & AV_DISPOSITION_ATTACHED_PIC))
+        return 1;
+    seconds = packet_queue_seconds(queue, st);
+    //包不带duration时退回到按包数判断
+    if (seconds < 0)
+        return queue->nb_packets > MIN_FRAMES;
+    return seconds >= policy->high_water;
+}
+
+int VideoCtl::stream_below_low_water(AVStream* st, int stream_id, PacketQueue* queue, StreamBufferPolicy* policy) {
+    double seconds;
+    if (stream_id < 0 ||
         queue->abort_request ||
-        (st->disposition & AV_DISPOSITION_ATTACHED_PIC) ||
-        queue->nb_packets > MIN_FRAMES && (!queue->duration || av_q2d(st->time_base) * queue->duration > 1.0);
+        (st->disposition & AV_DISPOSITION_ATTACHED_PIC))
+        return 0;
+    seconds = packet_queue_seconds(queue, st);
+    if (seconds < 0)
+        return queue->nb_packets <= MIN_FRAMES;
+    return seconds < policy->low_water;
+}
+
+int VideoCtl::stream_buffers_full(VideoState* is)
+{
+    BufferPolicy* bp = &is->buffer_policy;
+    int64_t now = av_gettime_relative();
+
+    stream_buffer_update_bitrate(&bp->audio, &is->audioq, is->audio_st, now);
+    stream_buffer_update_bitrate(&bp->video, &is->videoq, is->video_st, now);
+    stream_buffer_update_bitrate(&bp->subtitle, &is->subtitleq, is->subtitle_st, now);
+    buffer_policy_update_limit(bp);
+
+    if ((int64_t)is->audioq.size + is->videoq.size + is->subtitleq.size > bp->max_bytes)
+        return 1;
+    if (stream_has_enough_packets(is->audio_st, is->audio_stream, &is->audioq, &bp->audio) &&
+        stream_has_enough_packets(is->video_st, is->video_stream, &is->videoq, &bp->video) &&
+        stream_has_enough_packets(is->subtitle_st, is->subtitle_stream, &is->subtitleq, &bp->subtitle)) {
+        bp->full = 1;
+    }
+    //字幕包稀疏，不参与低水位判断
+    else if (bp->full &&
+        (stream_below_low_water(is->audio_st, is->audio_stream, &is->audioq, &bp->audio) ||
+            stream_below_low_water(is->video_st, is->video_stream, &is->videoq, &bp->video))) {
+        bp->full = 0;
+    }
+    return bp->full;
+}
+
+int VideoCtl::stream_read_blocked(VideoState* is)
+{
+    return (infinite_buffer < 1 && stream_buffers_full(is)) ||
+        packet_queue_full(&is->audioq) || packet_queue_full(&is->videoq) || packet_queue_full(&is->subtitleq);
+}
+
+void VideoCtl::stream_wait_for_drain(VideoState* is)
+{
+    BufferPolicy* bp = &is->buffer_policy;
+    int bytes_full = (int64_t)is->audioq.size + is->videoq.size + is->subtitleq.size > bp->max_bytes;
+
+    packet_queue_set_wake(&is->audioq, is->audio_stream >= 0 ? is->audio_st : NULL, &bp->audio, bytes_full);
+    packet_queue_set_wake(&is->videoq, is->video_stream >= 0 ? is->video_st : NULL, &bp->video, bytes_full);
+    packet_queue_set_wake(&is->subtitleq, NULL, &bp->subtitle, bytes_full);
+    //总字节数超限时按所有队列合计判断，降到上限的7/8以下才唤醒，避免每消费一个包就唤醒一次
+    is->continue_read_thread.wake_bytes = bytes_full ? bp->max_bytes - bp->max_bytes / 8 : -1;
+    //先登记休眠再复查，与消费者“先出队再检查登记”配合，避免丢失唤醒
+    //复查与读取循环使用同一判断，不休眠时ReadThread一定能继续读取，不会空转
+    read_wakeup_prepare(&is->continue_read_thread);
+    if (!stream_read_blocked(is)) {
+        read_wakeup_cancel(&is->continue_read_thread);
+        return;
+    }
+    read_wakeup_wait(&is->continue_read_thread, -1);
+}
+
+int VideoCtl::stream_play_finished(VideoState* is)
+{
+    return !is->paused &&
+        (!is->audio_st || (is->auddec.finished == is->audioq.serial && frame_queue_nb_remaining(&is->sampq) == 0)) &&
+        (!is->video_st || (is->viddec.finished == is->videoq.serial && frame_queue_nb_remaining(&is->pictq) == 0));
+}
+
+void VideoCtl::seek_latency_check(VideoState* is, int serial)
+{
+    int64_t latency;
+    if (is->seek_wait_serial < 0 || serial != is->seek_wait_serial)
+        return;
+    is->seek_wait_serial = -1;
+    latency = av_gettime_relative() - is->seek_req_time;
+    SDL_LockMutex(m_pStatsMutex);
+    if (is->seek_from_cache) {
+        is->pkt_cache.hit_latency += latency;
+        is->pkt_cache.hit_latency_count++;
+        m_stStats.seek_hit_latency = is->pkt_cache.hit_latency / 1000.0 / is->pkt_cache.hit_latency_count;
+    }
+    else {
+        is->pkt_cache.miss_latency += latency;
+        is->pkt_cache.miss_latency_count++;
+        m_stStats.seek_miss_latency = is->pkt_cache.miss_latency / 1000.0 / is->pkt_cache.miss_latency_count;
+    }
+    SDL_UnlockMutex(m_pStatsMutex);
+    av_log(NULL, AV_LOG_VERBOSE, "seek to first frame: %.1fms (%s)\n",
+        latency / 1000.0, is->seek_from_cache ? "packet cache" : "demuxer");
+}
+
+void VideoCtl::first_frame_check(VideoState* is)
+{
+    if (is->first_frame_time)
+        return;
+    is->first_frame_time = av_gettime_relative() - is->open_time;
+    SDL_LockMutex(m_pStatsMutex);
+    m_stStats.first_frame_time = is->first_frame_time / 1000.0;
+    SDL_UnlockMutex(m_pStatsMutex);
+    av_log(NULL, AV_LOG_INFO, "first frame: %.1fms after open (open+probe %.1fms, %s)\n",
+        is->first_frame_time / 1000.0, is->probe_time / 1000.0,
+        is->preopen && is->preopen->state == PREOPEN_READY ? "preopened" :
+        is->probe_cached ? "warm, probe cache" : "cold");
+}
+
+int VideoCtl::get_source_type(AVFormatContext* s)
+{
+    if (is_realtime(s))
+        return BUFFER_SOURCE_REALTIME;
+    if ((s->iformat->flags & AVFMT_NOFILE) ||
+        (s->url && strstr(s->url, "://") && strncmp(s->url, "file:", 5)))
+        return BUFFER_SOURCE_NETWORK;
+    return BUFFER_SOURCE_LOCAL;
 }
 
 int VideoCtl::is_realtime(AVFormatContext* s)
@@ -1573,21 +2418,29 @@ void VideoCtl::ReadThread(VideoState* is)
     AVDictionaryEntry* t;
     AVDictionary** opts;
     int orig_nb_streams;
-    SDL_mutex* wait_mutex = SDL_CreateMutex();
     int scan_all_pmts_set = 0;
     int64_t pkt_ts;
+    int from_cache;
+    int64_t stats_time = 0;
     //ffplay中用户命令行输入的
     const char* wanted_stream_spec[AVMEDIA_TYPE_NB] = { 0 };
-    if (!wait_mutex) {
-        av_log(NULL, AV_LOG_FATAL, "SDL_CreateMutex(): %s\n", SDL_GetError());
-        ret = AVERROR(ENOMEM);
-        goto fail;
-    }
     memset(st_index, -1, sizeof(st_index));
     is->last_video_stream = is->video_stream = -1;
     is->last_audio_stream = is->audio_stream = -1;
     is->last_subtitle_stream = is->subtitle_stream = -1;
-    is->eof = 0;
+    is->read_state = READ_STATE_READING;
+    //切换到后台已预打开的文件：接管格式上下文和自定义输入，跳过打开和探测
+    if (is->preopen && preopen_wait(is->preopen) == PREOPEN_READY) {
+        ic = is->preopen->ic;
+        is->preopen->ic = NULL;
+        is->file_pb = is->preopen->file_pb;
+        is->preopen->file_pb = NULL;
+        is->probe_cached = is->preopen->probe_cached;
+        ic->interrupt_callback.callback = decode_interrupt_cb;
+        ic->interrupt_callback.opaque = is;
+        is->ic = ic;
+        goto stream_info_ready;
+    }
     //构建 处理封装格式 结构体
     ic = avformat_alloc_context();
     if (!ic) {
@@ -1598,6 +2451,12 @@ void VideoCtl::ReadThread(VideoState* is)
     //设置中断回调函数
     ic->interrupt_callback.callback = decode_interrupt_cb;
     ic->interrupt_callback.opaque = is;
+    //本地普通文件改用内存映射或预读缓存输入，其他输入（网络流等）仍走默认协议
+    is->file_pb = media_io_open(is->filename, file_io_mode, &ic->interrupt_callback);
+    if (is->file_pb) {
+        ic->pb = is->file_pb;
+        ic->flags |= AVFMT_FLAG_CUSTOM_IO;
+    }
     //打开文件，获得封装等信息
     err = avformat_open_input(&ic, is->filename, is->iformat, nullptr/*&format_opts*/);
     if (err < 0) {
@@ -1610,21 +2469,33 @@ void VideoCtl::ReadThread(VideoState* is)
     av_format_inject_global_side_data(ic);
     opts = nullptr;// setup_find_stream_info_opts(ic, codec_opts);
     orig_nb_streams = ic->nb_streams;
-    //读取一部分视音频数据并且获得一些相关的信息
-    err = avformat_find_stream_info(ic, opts);
-    //     for (i = 0; i < orig_nb_streams; i++)
-    //         av_dict_free(&opts[i]);
-    //     av_freep(&opts);
-    if (err < 0) {
-        av_log(NULL, AV_LOG_WARNING,
-            "%s: could not find codec parameters\n", is->filename);
-        ret = -1;
-        goto fail;
-    }
+    //再次打开同一本地文件时直接使用缓存的探测结果，不再读取并解码数据
+    is->probe_cached = probe_cache_load(ic, is->filename);
+    if (!is->probe_cached) {
+        //读取一部分视音频数据并且获得一些相关的信息
+        err = avformat_find_stream_info(ic, opts);
+        //     for (i = 0; i < orig_nb_streams; i++)
+        //         av_dict_free(&opts[i]);
+        //     av_freep(&opts);
+        if (err < 0) {
+            av_log(NULL, AV_LOG_WARNING,
+                "%s: could not find codec parameters\n", is->filename);
+            ret = -1;
+            goto fail;
+        }
+        probe_cache_save(ic, is->filename);
+    }
+stream_info_ready:
+    is->probe_time = av_gettime_relative() - is->open_time;
+    SDL_LockMutex(m_pStatsMutex);
+    m_stStats.probe_time = is->probe_time / 1000.0;
+    m_stStats.probe_cached = is->probe_cached;
+    SDL_UnlockMutex(m_pStatsMutex);
     if (ic->pb)
         ic->pb->eof_reached = 0; // FIXME hack, ffplay maybe should not use avio_feof() to test for the end
     is->max_frame_duration = (ic->iformat->flags & AVFMT_TS_DISCONT) ? 10.0 : 3600.0;
     is->realtime = is_realtime(ic);
+    buffer_policy_init(&is->buffer_policy, get_source_type(ic));
     emit SigVideoTotalSeconds(ic->duration / 1000000LL);
     //ffplay命令行：查找用户命令行制定的流是否有效
     for (i = 0; i < ic->nb_streams; i++) {
@@ -1684,6 +2555,9 @@ void VideoCtl::ReadThread(VideoState* is)
         ret = -1;
         goto fail;
     }
+    //本地文件容器索引不完整时，加载或在后台建立关键帧索引
+    keyframe_index_open(&is->kf_index, ic, is->filename,
+        is->video_stream >= 0 ? is->video_stream : is->audio_stream);
     //只在实时流的时候有效
     if (infinite_buffer < 0 && is->realtime)
         infinite_buffer = 1;
@@ -1703,14 +2577,41 @@ void VideoCtl::ReadThread(VideoState* is)
             int64_t seek_target = is->seek_pos;
             int64_t seek_min = is->seek_rel > 0 ? seek_target - is->seek_rel + 2 : INT64_MIN;
             int64_t seek_max = is->seek_rel < 0 ? seek_target - is->seek_rel - 2 : INT64_MAX;
+            int64_t kf_pts = AV_NOPTS_VALUE, kf_pos = -1;
             // FIXME the +-2 is due to rounding being not done in the correct direction in generation
             //      of the seek_pos/seek_rel variables
-            ret = avformat_seek_file(is->ic, -1, seek_min, seek_target, seek_max, is->seek_flags);
+            //目标落在回看窗口内时直接回放缓存的包，不移动解封装器的读位置
+            packet_cache_set_streams(&is->pkt_cache, is->audio_stream, is->video_stream, is->subtitle_stream);
+            is->seek_from_cache = !(is->seek_flags & AVSEEK_FLAG_BYTE) && packet_cache_seek(&is->pkt_cache, seek_target);
+            if (is->seek_from_cache) {
+                is->pkt_cache.hits++;
+                ret = 0;
+            }
+            else {
+                is->pkt_cache.misses++;
+                packet_cache_clear(&is->pkt_cache);
+                if (is->preopen)
+                    preopen_flush_packets(is->preopen);
+                //容器索引不完整时，用关键帧索引直接按字节偏移跳到目标前的关键帧
+                if (!(is->seek_flags & AVSEEK_FLAG_BYTE))
+                    kf_pos = keyframe_index_lookup(&is->kf_index, seek_target, &kf_pts);
+                ret = -1;
+                if (kf_pos >= 0 && kf_pts >= seek_min && kf_pts <= seek_max)
+                    ret = avformat_seek_file(is->ic, -1, INT64_MIN, kf_pos, INT64_MAX, AVSEEK_FLAG_BYTE);
+                if (ret < 0)
+                    ret = avformat_seek_file(is->ic, -1, seek_min, seek_target, seek_max, is->seek_flags);
+            }
+            SDL_LockMutex(m_pStatsMutex);
+            m_stStats.seek_hits = is->pkt_cache.hits;
+            m_stStats.seek_misses = is->pkt_cache.misses;
+            SDL_UnlockMutex(m_pStatsMutex);
             if (ret < 0) {
                 av_log(NULL, AV_LOG_ERROR,
                     "%s: error while seeking\n", is->ic->filename);
             }
             else {
+                //从下一个播放序列的第一帧开始统计seek延迟
+                is->seek_wait_serial = (is->video_stream >= 0 ? is->videoq.serial : is->audioq.serial) + 1;
                 if (is->audio_stream >= 0) {
                     packet_queue_flush(&is->audioq);
                     packet_queue_put(&is->audioq, &flush_pkt);
@@ -1732,7 +2633,7 @@ void VideoCtl::ReadThread(VideoState* is)
             }
             is->seek_req = 0;
             is->queue_attachments_req = 1;
-            is->eof = 0;
+            is->read_state = READ_STATE_READING;
             //seek（定位）操作后如果处于暂停状态，通常希望立即显示定位后的新画面，而不会一直停留在上一个画面上。
             if (is->paused)
                 step_to_next_frame(is);
@@ -1749,48 +2650,57 @@ void VideoCtl::ReadThread(VideoState* is)
             is->queue_attachments_req = 0;
         }
         /* if the queue are full, no need to read more */
-        if (infinite_buffer < 1 &&
-            (is->audioq.size + is->videoq.size + is->subtitleq.size > MAX_QUEUE_SIZE
-                || (stream_has_enough_packets(is->audio_st, is->audio_stream, &is->audioq) &&
-                    stream_has_enough_packets(is->video_st, is->video_stream, &is->videoq) &&
-                    stream_has_enough_packets(is->subtitle_st, is->subtitle_stream, &is->subtitleq)))) {
-            /* wait 10 ms */
-            SDL_LockMutex(wait_mutex);
-            SDL_CondWaitTimeout(is->continue_read_thread, wait_mutex, 10);
-            SDL_UnlockMutex(wait_mutex);
+        //环形缓冲区任一已满时也不再读取，保证packet_queue_put不会阻塞ReadThread（否则暂停时无法响应seek）
+        //休眠到消费者把队列消费到低水位以下，或有seek/暂停/退出命令
+        if (stream_read_blocked(is)) {
+            //休眠期间不再发布，先发布缓冲已满时的状况
+            stats_publish_buffer(is);
+            stream_wait_for_drain(is);
             continue;
         }
-        if (!is->paused &&
-            (!is->audio_st || (is->auddec.finished == is->audioq.serial && frame_queue_nb_remaining(&is->sampq) == 0)) &&
-            (!is->video_st || (is->viddec.finished == is->videoq.serial && frame_queue_nb_remaining(&is->pictq) == 0))) {
-
-            //播放结束
-            emit SigStop();
+        if (stats_publish_due(&stats_time))
+            stats_publish_buffer(is);
+        //已读到结尾：不再调用av_read_frame，休眠到解码结束/帧队列排空时判断一次播放结束
+        if (is->read_state != READ_STATE_READING) {
+            read_wakeup_prepare(&is->continue_read_thread);
+            if (is->read_state == READ_STATE_EOF && stream_play_finished(is)) {
+                read_wakeup_cancel(&is->continue_read_thread);
+                //播放结束
+                is->read_state = READ_STATE_FINISHED;
+                emit SigStop();
+                continue;
+            }
+            read_wakeup_wait(&is->continue_read_thread, -1);
             continue;
         }
-        //按帧读取
-        ret = av_read_frame(ic, pkt);
+        //按帧读取：回看缓存回放中时直接取缓存的包
+        packet_cache_set_streams(&is->pkt_cache, is->audio_stream, is->video_stream, is->subtitle_stream);
+        from_cache = packet_cache_next(&is->pkt_cache, pkt);
+        if (from_cache)
+            ret = 0;
+        //先送出预打开时预读的包
+        else if (is->preopen && preopen_next_packet(is->preopen, pkt))
+            ret = 0;
+        else
+            ret = av_read_frame(ic, pkt);
         if (ret < 0) {
-            if ((ret == AVERROR_EOF || avio_feof(ic->pb)) && !is->eof) {
+            if (ret == AVERROR_EOF || avio_feof(ic->pb)) {
                 if (is->video_stream >= 0)
                     packet_queue_put_nullpacket(&is->videoq, is->video_stream);
                 if (is->audio_stream >= 0)
                     packet_queue_put_nullpacket(&is->audioq, is->audio_stream);
                 if (is->subtitle_stream >= 0)
                     packet_queue_put_nullpacket(&is->subtitleq, is->subtitle_stream);
-                is->eof = 1;
+                is->read_state = READ_STATE_EOF;
+                continue;
             }
             //检查是否有 I/O 错误
             if (ic->pb && ic->pb->error)
                 break;
-            SDL_LockMutex(wait_mutex);
-            SDL_CondWaitTimeout(is->continue_read_thread, wait_mutex, 10);
-            SDL_UnlockMutex(wait_mutex);
+            //暂时读不到数据（如网络流EAGAIN），没有可等待的事件，短暂休眠后重试（命令仍可提前唤醒）
+            read_wakeup_wait(&is->continue_read_thread, 10);
             continue;
         }
-        else {
-            is->eof = 0;
-        }
         /* check if packet is in play range specified by user, then queue, otherwise discard */
         stream_start_time = ic->streams[pkt->stream_index]->start_time;
         pkt_ts = pkt->pts == AV_NOPTS_VALUE ? pkt->dts : pkt->pts;
@@ -1800,14 +2710,21 @@ void VideoCtl::ReadThread(VideoState* is)
             (double)(0) / 1000000
             <= ((double)AV_NOPTS_VALUE / 1000000);
         //按数据帧的类型存放至对应队列
+        //回放的包已经在回看窗口中，新读到的包才需要加入窗口
         if (pkt->stream_index == is->audio_stream && pkt_in_play_range) {
+            if (!from_cache)
+                packet_cache_add(&is->pkt_cache, pkt, is->audio_st);
             packet_queue_put(&is->audioq, pkt);
         }
         else if (pkt->stream_index == is->video_stream && pkt_in_play_range
             && !(is->video_st->disposition & AV_DISPOSITION_ATTACHED_PIC)) {
+            if (!from_cache)
+                packet_cache_add(&is->pkt_cache, pkt, is->video_st);
             packet_queue_put(&is->videoq, pkt);
         }
         else if (pkt->stream_index == is->subtitle_stream && pkt_in_play_range) {
+            if (!from_cache)
+                packet_cache_add(&is->pkt_cache, pkt, is->subtitle_st);
             packet_queue_put(&is->subtitleq, pkt);
         }
         else {
@@ -1825,17 +2742,19 @@ fail:
         event.user.data1 = is;
         SDL_PushEvent(&event);
     }
-    SDL_DestroyMutex(wait_mutex);
     return;
 }
 
-VideoState* VideoCtl::stream_open(const char* filename)
+VideoState* VideoCtl::stream_open(const char* filename, PreopenState* preopen)
 {
     VideoState* is;
     //构造视频状态类
     is = (VideoState*)av_mallocz(sizeof(VideoState));
-    if (!is)
+    if (!is) {
+        preopen_close(&preopen);
         return NULL;
+    }
+    is->preopen = preopen;
     //视频文件名，实际上是分配了空间
     is->filename = av_strdup(filename);
     if (!is->filename)
@@ -1845,28 +2764,40 @@ VideoState* VideoCtl::stream_open(const char* filename)
     is->xleft = 0;
     /* start video display */
     //初始化视频帧队列
-    if (frame_queue_init(&is->pictq, &is->videoq, VIDEO_PICTURE_QUEUE_SIZE, 1) < 0)
+    if (frame_queue_init(&is->pictq, &is->videoq, video_queue_max_depth, video_queue_min_depth, 1) < 0)
+        goto fail;
+    //零拷贝上传的纹理槽位与视频帧队列的槽位一一对应，深度可以超过VIDEO_PICTURE_QUEUE_MAX
+    is->tex_slots = (TextureSlot*)av_mallocz_array(is->pictq.capacity, sizeof(TextureSlot));
+    if (!is->tex_slots)
         goto fail;
     //初始化字幕帧队列
-    if (frame_queue_init(&is->subpq, &is->subtitleq, SUBPICTURE_QUEUE_SIZE, 0) < 0)
+    if (frame_queue_init(&is->subpq, &is->subtitleq, subpicture_queue_size, subpicture_queue_size, 0) < 0)
         goto fail;
     //初始化音频帧队列
-    if (frame_queue_init(&is->sampq, &is->audioq, SAMPLE_QUEUE_SIZE, 1) < 0)
+    if (frame_queue_init(&is->sampq, &is->audioq, sample_queue_size, sample_queue_size, 1) < 0)
         goto fail;
     //初始化队列中的数据包
     if (packet_queue_init(&is->videoq) < 0 ||
         packet_queue_init(&is->audioq) < 0 ||
         packet_queue_init(&is->subtitleq) < 0)
         goto fail;
-    //构建控制继续读取线程的信号量
-    if (!(is->continue_read_thread = SDL_CreateCond())) {
-        av_log(NULL, AV_LOG_FATAL, "SDL_CreateCond(): %s\n", SDL_GetError());
+    if (packet_cache_init(&is->pkt_cache) < 0)
         goto fail;
-    }
+    is->seek_wait_serial = -1;
+    is->open_time = av_gettime_relative();
+    sws_slice_init(&is->img_convert_pool, sws_slice_threads);
+    sws_slice_init(&is->stage_convert_pool, sws_slice_threads);
+    frame_pacer_init(&is->pacer, vsync_pacing);
+    //构建控制继续读取线程的唤醒器，消费者通过队列上的指针在低水位时唤醒读线程
+    if (read_wakeup_init(&is->continue_read_thread) < 0)
+        goto fail;
+    read_wakeup_add_queue(&is->continue_read_thread, &is->videoq);
+    read_wakeup_add_queue(&is->continue_read_thread, &is->audioq);
+    read_wakeup_add_queue(&is->continue_read_thread, &is->subtitleq);
     //视频、音频 时钟
     init_clock(&is->vidclk, &is->videoq.serial);
     init_clock(&is->audclk, &is->audioq.serial);
-    init_clock(&is->extclk, &is->extclk.serial);
+    init_clock(&is->extclk, NULL);
     is->audio_clock_serial = -1;
     //音量
     if (startup_volume < 0)
@@ -1982,8 +2913,14 @@ void VideoCtl::refresh_loop_wait_event(VideoState* is, SDL_Event* event) {
         if (remaining_time > 0.0)
             av_usleep((int64_t)(remaining_time * 1000000.0));
         remaining_time = REFRESH_RATE;
+        if (zero_copy_upload)
+            video_texture_slots_prepare(is);
         if (!is->paused || is->force_refresh)
             video_refresh(is, &remaining_time);
+        //趁等待下一次刷新的时间上传后面的帧
+        video_texture_preupload(is, &remaining_time);
+        if (frame_pacer_active(&is->pacer) && stats_publish_due(&is->stats_render_time))
+            stats_publish_pacing(is);
         SDL_PumpEvents();
     }
 }
@@ -2168,15 +3105,25 @@ void VideoCtl::video_display(VideoState* is)
         video_open(is);
     if (renderer)
     {
-        //恰好显示控件大小在变化，则不刷新显示
-        if (g_show_rect_mutex.tryLock())
-        {
-            SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255); // 设置渲染颜色为黑色
-            SDL_RenderClear(renderer);  // 清除渲染器内容
-            video_image_display(is);    // 将视频帧渲染到当前渲染目标上
-            SDL_RenderPresent(renderer);    //将渲染器的内容呈现到关联的窗口上，更新显示
-            g_show_rect_mutex.unlock();
+        SDL_Rect show_rect;
+        if (!is->pacer.started) {
+            //初始刷新间隔取显示模式的刷新率，之后按present的时刻修正
+            SDL_DisplayMode mode;
+            int refresh_rate = !SDL_GetWindowDisplayMode(window, &mode) ? mode.refresh_rate : 0;
+            frame_pacer_start(&is->pacer, refresh_rate,
+                renderer_info_ready && (renderer_info.flags & SDL_RENDERER_PRESENTVSYNC));
         }
+        //显示控件大小在变化时按Qt线程最近发布的区域绘制，不跳过这一帧
+        show_rect_read(&g_show_rect, &show_rect);
+        if (show_rect.w > 0 && show_rect.h > 0) {
+            screen_width = is->width = show_rect.w;
+            screen_height = is->height = show_rect.h;
+        }
+        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255); // 设置渲染颜色为黑色
+        SDL_RenderClear(renderer);  // 清除渲染器内容
+        video_image_display(is);    // 将视频帧渲染到当前渲染目标上
+        SDL_RenderPresent(renderer);    //将渲染器的内容呈现到关联的窗口上，更新显示
+        frame_pacer_presented(&is->pacer, av_gettime_relative() / 1000000.0);
     }
 
 }
@@ -2205,8 +3152,12 @@ int VideoCtl::video_open(VideoState* is)
                 renderer = SDL_CreateRenderer(window, -1, 0);
             }
             if (renderer) {
-                if (!SDL_GetRendererInfo(renderer, &info))
+                if (!SDL_GetRendererInfo(renderer, &info)) {
                     av_log(NULL, AV_LOG_VERBOSE, "Initialized %s renderer.\n", info.name);
+                    //支持的纹理格式决定非YUV420P帧的上传方式
+                    renderer_info = info;
+                    renderer_info_ready.store(1, std::memory_order_release);
+                }
             }
         }
     }
@@ -2235,6 +3186,7 @@ void VideoCtl::do_exit(VideoState*& is)
     }
     if (renderer)
     {
+        renderer_info_ready = 0;
         SDL_DestroyRenderer(renderer);
         renderer = nullptr;
     }
@@ -2281,15 +3233,30 @@ void VideoCtl::OnStop()
     m_bPlayLoop = false;
 }
 
+void VideoCtl::OnPreOpen(QString strFileName)
+{
+    QByteArray file_name = strFileName.toLocal8Bit();
+    if (m_pPreopen && !strcmp(m_pPreopen->filename, file_name.constData()))
+    {
+        return;
+    }
+    //同一时间只保留一个预打开，限制内存占用
+    preopen_close(&m_pPreopen);
+    m_pPreopen = preopen_start(file_name.constData(), file_io_mode, video_lowres);
+}
+
 VideoCtl::VideoCtl(QObject* parent) :
     QObject(parent),
     m_bInited(false),
     m_CurStream(nullptr),
+    m_pPreopen(nullptr),
+    m_pStatsMutex(nullptr),
     m_bPlayLoop(false),
     screen_width(0),
     screen_height(0),
     startup_volume(30),
     renderer(nullptr),
+    renderer_info_ready(0),
     window(nullptr),
     m_nFrameW(0),
     m_nFrameH(0),
@@ -2323,6 +3290,16 @@ bool VideoCtl::Init()
     }
     SDL_EventState(SDL_SYSWMEVENT, SDL_IGNORE);
     SDL_EventState(SDL_USEREVENT, SDL_IGNORE);
+    m_pStatsMutex = SDL_CreateMutex();
+    if (!m_pStatsMutex)
+    {
+        av_log(NULL, AV_LOG_FATAL, "SDL_CreateMutex(): %s\n", SDL_GetError());
+        return false;
+    }
+    memset(&m_stStats, 0, sizeof(m_stStats));
+#if AUDIO_RT_CHECK && defined(_MSC_VER)
+    _CrtSetAllocHook(audio_rt_alloc_hook);
+#endif
 
     //注册自定义锁
     if (av_lockmgr_register(lockmgr))
@@ -2331,6 +3308,11 @@ bool VideoCtl::Init()
         return false;
     }
 
+    //配置文件中的解码器线程配置覆盖内置表
+    QStringList listProfiles;
+    GlobalHelper::GetDecoderProfiles(listProfiles);
+    SetDecoderProfiles(listProfiles);
+
     m_bInited = true;
 
     return true;
@@ -2360,6 +3342,9 @@ VideoCtl::~VideoCtl()
     }
 
     do_exit(m_CurStream);
+    preopen_close(&m_pPreopen);
+    if (m_pStatsMutex)
+        SDL_DestroyMutex(m_pStatsMutex);
 
     av_lockmgr_register(NULL);
 
@@ -2386,14 +3371,20 @@ bool VideoCtl::StartPlay(QString strFileName, WId widPlayWid)
     char file_name[1024];
     memset(file_name, 0, 1024);
     sprintf(file_name, "%s", strFileName.toLocal8Bit().data());
-    //打开流
-    is = stream_open(file_name);
+    //打开流：该文件已在后台预打开时由新的播放接管，否则取消预打开
+    if (m_pPreopen && strcmp(m_pPreopen->filename, file_name))
+        preopen_close(&m_pPreopen);
+    is = stream_open(file_name, m_pPreopen);
+    m_pPreopen = nullptr;
     if (!is) {
         av_log(NULL, AV_LOG_FATAL, "Failed to initialize VideoState!\n");
         do_exit(m_CurStream);
     }
 
     m_CurStream = is;
+    SDL_LockMutex(m_pStatsMutex);
+    m_stStats.active = 1;
+    SDL_UnlockMutex(m_pStatsMutex);
 
     //事件循环
     m_tPlayLoopThread = std::thread(&VideoCtl::LoopThread, this, is);
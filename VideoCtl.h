@@ -32,11 +32,20 @@ public:
    */
     bool StartPlay(QString strFileName, WId widPlayWid);
 	/// <summary>
-    /// 实现了从帧队列中取数据、必要的重采样处理以及音频时钟的更新，为后续音频播放和同步提供数据。
+    /// 实现了从帧队列中取数据和必要的重采样处理，为后续音频播放和同步提供数据（is->audio_buf）。
     /// </summary>
     /// <param name="is"></param>
+    /// <param name="clock">输出该帧结束位置的音频时钟</param>
+    /// <param name="serial">输出该帧的播放序列</param>
     /// <returns>重采样后的数据大小（或直接返回原始数据大小，如果没有重采样）</returns>
-    int audio_decode_frame(VideoState* is);
+    int audio_decode_frame(VideoState* is, double* clock, int* serial);
+    /// <summary>
+    /// 非正常速率播放时用sonic对is->audio_buf中的数据变速，结果放在audio_buf1中
+    /// </summary>
+    /// <param name="is"></param>
+    /// <param name="audio_size">audio_decode_frame输出的字节数</param>
+    /// <returns>变速后的字节数，sonic暂时没有输出时为0</returns>
+    int audio_speed_convert_frame(VideoState* is, int audio_size);
     /// <summary>
     /// 
     /// </summary>
@@ -51,13 +60,13 @@ public:
     /// <param name="pts"></param>
     /// <param name="serial"></param>
     /// <param name="time">当前时间</param>
-    void set_clock_at(Clock* c, double pts, int serial, double time);
+    static void set_clock_at(Clock* c, double pts, int serial, double time);
     /// <summary>
     /// 
     /// </summary>
     /// <param name="c"></param>
     /// <param name="slave"></param>
-    void sync_clock_to_slave(Clock* c, Clock* slave);
+    static void sync_clock_to_slave(Clock* c, Clock* slave);
     /// <summary>
     /// 
     /// </summary>
@@ -158,6 +167,11 @@ public:
     /// 终止的入口
     /// </summary>
     void OnStop();
+    /// <summary>
+    /// 与Playlist::SigPreOpen连接，在后台预打开下一个文件，之后StartPlay同一文件时直接接管
+    /// </summary>
+    /// <param name="strFileName"></param>
+    void OnPreOpen(QString strFileName);
 private:
     explicit VideoCtl(QObject* parent = nullptr);
     /**
@@ -188,12 +202,23 @@ private:
     /// <returns></returns>
     int audio_thread(void* arg);
     /// <summary>
+    /// 音频生产线程：取帧、重采样、变速后写入PCM环形缓冲区，供SDL音频回调拷贝
+    /// </summary>
+    /// <param name="arg"></param>
+    /// <returns></returns>
+    int audio_render_thread(void* arg);
+    /// <summary>
     /// 
     /// </summary>
     /// <param name="arg"></param>
     /// <returns></returns>
     int video_thread(void* arg);
     /// <summary>
+    /// 在视频解码线程中按设置、画质阶梯和显示区域大小确定lowres，与当前解码器不一致时重新打开解码器
+    /// </summary>
+    /// <param name="is"></param>
+    void video_update_lowres(VideoState* is);
+    /// <summary>
     /// 
     /// </summary>
     /// <param name="arg"></param>
@@ -226,13 +251,87 @@ private:
     /// <returns></returns>
     int stream_component_open(VideoState* is, int stream_index);
     /// <summary>
-    /// 
+    /// 流的包队列是否已达到缓冲策略的高水位
+    /// </summary>
+    /// <param name="st"></param>
+    /// <param name="stream_id"></param>
+    /// <param name="queue"></param>
+    /// <param name="policy">该流的缓冲策略</param>
+    /// <returns></returns>
+    int stream_has_enough_packets(AVStream* st, int stream_id, PacketQueue* queue, StreamBufferPolicy* policy);
+    /// <summary>
+    /// 流的包队列是否已低于缓冲策略的低水位
     /// </summary>
     /// <param name="st"></param>
     /// <param name="stream_id"></param>
     /// <param name="queue"></param>
+    /// <param name="policy">该流的缓冲策略</param>
     /// <returns></returns>
-    int stream_has_enough_packets(AVStream* st, int stream_id, PacketQueue* queue);
+    int stream_below_low_water(AVStream* st, int stream_id, PacketQueue* queue, StreamBufferPolicy* policy);
+    /// <summary>
+    /// 更新码率估算并判断ReadThread是否应停止读取（带高低水位滞回）
+    /// </summary>
+    /// <param name="is"></param>
+    /// <returns>1-缓冲已满</returns>
+    int stream_buffers_full(VideoState* is);
+    /// <summary>
+    /// ReadThread是否不能读取新包：缓冲已满（infinite_buffer时不判断），或任一环形缓冲区已满
+    /// </summary>
+    /// <param name="is"></param>
+    /// <returns>1-不能读取</returns>
+    int stream_read_blocked(VideoState* is);
+    /// <summary>
+    /// 缓冲已满时设置各队列的唤醒阈值并休眠，直到被消费到低水位以下或收到seek/暂停/退出命令
+    /// </summary>
+    /// <param name="is"></param>
+    void stream_wait_for_drain(VideoState* is);
+    /// <summary>
+    /// 读到结尾后，解码是否已结束且帧队列已播放完
+    /// </summary>
+    /// <param name="is"></param>
+    /// <returns>1-播放结束</returns>
+    int stream_play_finished(VideoState* is);
+    /// <summary>
+    /// 由ReadThread计算缓冲健康状况并发布到统计快照
+    /// </summary>
+    /// <param name="is"></param>
+    void stats_publish_buffer(VideoState* is);
+    /// <summary>
+    /// 由视频解码线程把视频解码相关的统计发布到统计快照
+    /// </summary>
+    /// <param name="is"></param>
+    void stats_publish_video(VideoState* is);
+    /// <summary>
+    /// 由音频生产线程把音频输出的统计发布到统计快照
+    /// </summary>
+    /// <param name="is"></param>
+    void stats_publish_audio(VideoState* is);
+    /// <summary>
+    /// 由渲染线程把按vblank安排帧的统计发布到统计快照
+    /// </summary>
+    /// <param name="is"></param>
+    void stats_publish_pacing(VideoState* is);
+    /// <summary>
+    /// 清空统计快照，在播放的各线程都退出后调用
+    /// </summary>
+    void stats_reset();
+    /// <summary>
+    /// seek后新播放序列的第一帧可显示时，统计seek延迟
+    /// </summary>
+    /// <param name="is"></param>
+    /// <param name="serial">帧的播放序列</param>
+    void seek_latency_check(VideoState* is, int serial);
+    /// <summary>
+    /// 第一帧显示（没有视频时为第一帧音频）时，统计从打开到首帧的耗时
+    /// </summary>
+    /// <param name="is"></param>
+    void first_frame_check(VideoState* is);
+    /// <summary>
+    /// 判断数据源类型（本地文件/网络/实时流）
+    /// </summary>
+    /// <param name="s"></param>
+    /// <returns>BUFFER_SOURCE_*</returns>
+    int get_source_type(AVFormatContext* s);
     /// <summary>
     /// 
     /// </summary>
@@ -253,8 +352,9 @@ private:
     /// 总起函数，初始化AVPacket队列、AVFrame队列、初始化时钟等等，并开辟Readthread线程
     /// </summary>
     /// <param name="filename">：媒体源</param>
+    /// <param name="preopen">：该媒体源的后台预打开结果，可以为NULL，所有权转给VideoState</param>
     /// <returns>VideoState*</returns>
-    VideoState* stream_open(const char* filename);
+    VideoState* stream_open(const char* filename, PreopenState* preopen);
     /// <summary>
     /// 
     /// </summary>
@@ -341,9 +441,40 @@ private:
     /// </summary>
     /// <param name="tex"></param>
     /// <param name="frame"></param>
-    /// <param name="img_convert_ctx"></param>
+    /// <param name="repack">非YUV420P/BGRA帧对应的纹理格式（pixel_repack_find），为NULL时用swscale转换为BGRA</param>
+    /// <param name="img_convert_pool">其余格式用swscale分片转换为BGRA</param>
     /// <returns></returns>
-    int upload_texture(SDL_Texture* tex, AVFrame* frame, struct SwsContext** img_convert_ctx);
+    int upload_texture(SDL_Texture* tex, AVFrame* frame, const PixelRepack* repack, SwsSlicePool* img_convert_pool);
+    /// <summary>
+    /// 上传一帧：零拷贝写入的帧解锁其槽位的纹理，其余的帧上传到vid_textures中未被占用的一个
+    /// </summary>
+    /// <param name="is"></param>
+    /// <param name="vp">视频帧队列中的帧</param>
+    /// <returns>0-成功</returns>
+    int video_texture_upload(VideoState* is, Frame* vp);
+    /// <summary>
+    /// 渲染线程在两次刷新之间提前上传队列中接下来的TEXTURE_PREUPLOAD_AHEAD帧，显示时只需绘制
+    /// </summary>
+    /// <param name="is"></param>
+    /// <param name="remaining_time">距离下一次刷新的时间（秒），只在够上传一帧时上传，并扣除上传用掉的时间</param>
+    void video_texture_preupload(VideoState* is, double* remaining_time);
+    /// <summary>
+    /// 按key（texture_slot_key）重建并锁定槽位的纹理，发布各平面的像素指针
+    /// </summary>
+    /// <param name="slot"></param>
+    /// <param name="key">纹理格式和尺寸</param>
+    /// <returns>0-成功</returns>
+    int texture_slot_lock(TextureSlot* slot, int64_t key);
+    /// <summary>
+    /// 渲染线程为零拷贝上传准备纹理：锁定所有空闲槽位的纹理，重建格式或尺寸不一致的纹理
+    /// </summary>
+    /// <param name="is"></param>
+    void video_texture_slots_prepare(VideoState* is);
+    /// <summary>
+    /// 解锁并销毁所有槽位的纹理
+    /// </summary>
+    /// <param name="is"></param>
+    void video_texture_slots_destroy(VideoState* is);
     /// <summary>
     /// 
     /// </summary>
@@ -365,14 +496,14 @@ private:
     /// </summary>
     /// <param name="c"></param>
     /// <returns></returns>
-    double get_clock(Clock* c);
+    static double get_clock(Clock* c);
 	/// <summary>
     /// 
     /// </summary>
     /// <param name="c">：is->的Clock</param>
     /// <param name="pts"></param>
     /// <param name="serial"></param>
-    void set_clock(Clock* c, double pts, int serial);
+    static void set_clock(Clock* c, double pts, int serial);
     /// <summary>
     /// 
     /// </summary>
@@ -383,8 +514,8 @@ private:
     /// 初始化时钟，设置速度为1.0，设置Clock的序列号，内部调用set_clock()
     /// </summary>
     /// <param name="c">：is->的Clock</param>
-    /// <param name="queue_serial">：is->PacketQueue的serial，该值在初始化包队列的时候默认值为0</param>
-    void init_clock(Clock* c, int* queue_serial);
+    /// <param name="queue_serial">：is->PacketQueue的serial，该值在初始化包队列的时候默认值为0；NULL表示时钟不随包队列失效（外部时钟）</param>
+    void init_clock(Clock* c, const std::atomic<int>* queue_serial);
     int get_master_sync_type(VideoState* is);
     double get_master_clock(VideoState* is);
     void check_external_clock_speed(VideoState* is);
@@ -443,6 +574,125 @@ public:
     int64_t get_target_frequency();
     int     get_target_channels();
     int   is_normal_playback_rate();
+    /// <summary>
+    /// 查询回看缓存的seek命中情况
+    /// </summary>
+    /// <param name="nHits">由缓存完成的seek次数</param>
+    /// <param name="nMisses">需要重新定位解封装器的seek次数</param>
+    /// <param name="dHitLatency">命中时seek到第一帧的平均耗时（毫秒）</param>
+    /// <param name="dMissLatency">未命中时seek到第一帧的平均耗时（毫秒）</param>
+    /// <returns>false-当前没有播放</returns>
+    bool GetSeekCacheStats(int64_t& nHits, int64_t& nMisses, double& dHitLatency, double& dMissLatency);
+    /// <summary>
+    /// 查询当前的缓冲健康状况（ReadThread每STATS_PUBLISH_INTERVAL发布一次，休眠等待消费时保持休眠前的值）
+    /// </summary>
+    /// <param name="stHealth">输出的缓冲状况</param>
+    /// <returns>false-当前没有播放</returns>
+    bool GetBufferHealth(BufferHealth& stHealth);
+    /// <summary>
+    /// 查询包队列的内存分配情况：稳态播放时节点分配次数不随包数增长（每个包0次）
+    /// </summary>
+    /// <param name="nPackets">放入各包队列的数据包数</param>
+    /// <param name="nNodeAllocs">为存放数据包分配节点内存的次数（环形缓冲区只在打开时各分配一次）</param>
+    /// <returns>false-当前没有播放</returns>
+    bool GetPacketAllocStats(int64_t& nPackets, int64_t& nNodeAllocs);
+    /// <summary>
+    /// 查询打开当前文件的耗时，用于对比冷启动和使用探测缓存的打开
+    /// </summary>
+    /// <param name="dProbeTime">打开文件并获得流信息的耗时（毫秒）</param>
+    /// <param name="dFirstFrameTime">从打开到第一帧显示的耗时（毫秒），0表示还未显示</param>
+    /// <param name="bProbeCached">是否使用了缓存的探测结果</param>
+    /// <returns>false-当前没有播放</returns>
+    bool GetOpenStats(double& dProbeTime, double& dFirstFrameTime, bool& bProbeCached);
+    /// <summary>
+    /// 查询视频帧队列当前的深度（视频解码线程每STATS_PUBLISH_INTERVAL发布一次）
+    /// </summary>
+    /// <param name="nVideoDepth">当前允许缓冲的帧数</param>
+    /// <param name="nVideoFrames">当前已缓冲、未显示的帧数</param>
+    /// <param name="nDepthChanges">本次播放中深度的调整次数</param>
+    /// <returns>false-当前没有播放</returns>
+    bool GetFrameQueueStats(int& nVideoDepth, int& nVideoFrames, int& nDepthChanges);
+    /// <summary>
+    /// 设置帧队列深度，下次打开文件时生效
+    /// </summary>
+    /// <param name="nVideoMinDepth">视频帧队列的最小深度</param>
+    /// <param name="nVideoMaxDepth">视频帧队列的最大深度</param>
+    /// <param name="nVideoBudgetMB">视频帧队列中解码图像的内存预算（MB）</param>
+    /// <param name="nSampleDepth">音频帧队列深度</param>
+    /// <param name="nSubpictureDepth">字幕帧队列深度</param>
+    void SetFrameQueueDepth(int nVideoMinDepth, int nVideoMaxDepth, int nVideoBudgetMB, int nSampleDepth, int nSubpictureDepth);
+    /// <summary>
+    /// 查询视频解码器帧缓冲池的使用情况（视频解码线程每STATS_PUBLISH_INTERVAL发布一次）
+    /// </summary>
+    /// <param name="nPoolFrames">从arena分配的帧数</param>
+    /// <param name="nFallbacks">回退到FFmpeg默认分配的帧数</param>
+    /// <param name="nSlotsInUse">当前arena中借出的槽位数</param>
+    /// <param name="nSlots">当前arena的槽位总数</param>
+    /// <param name="nCommittedBytes">当前arena已提交物理内存的字节数</param>
+    /// <returns>false-当前没有播放</returns>
+    bool GetFramePoolStats(int64_t& nPoolFrames, int64_t& nFallbacks, int& nSlotsInUse, int& nSlots, int64_t& nCommittedBytes);
+    /// <summary>
+    /// 设置视频解码器帧缓冲池的工作方式，下次打开视频流时生效
+    /// </summary>
+    /// <param name="nMode">FRAME_POOL_OFF/FRAME_POOL_ON/FRAME_POOL_HUGEPAGES</param>
+    void SetFramePoolMode(int nMode);
+    /// <summary>
+    /// 开关零拷贝上传：视频解码线程在帧入队时把它直接写入渲染线程预先锁定的流式纹理（没有对应纹理格式的帧用swscale转换为BGRA），
+    /// 渲染线程只需解锁，不再拷贝或转换整帧。每个视频帧槽位各占一个纹理。
+    /// </summary>
+    /// <param name="bEnable"></param>
+    void SetZeroCopyUpload(bool bEnable);
+    /// <summary>
+    /// 设置swscale回退路径（没有对应纹理格式的帧转换为BGRA）的条带数，下次打开文件时生效
+    /// </summary>
+    /// <param name="nThreads">0表示按CPU核数自动选择</param>
+    void SetSwsSliceThreads(int nThreads);
+    /// <summary>
+    /// 设置是否按显示器的vblank节拍安排视频帧（需要渲染器开启垂直同步），下次打开文件时生效
+    /// </summary>
+    /// <param name="bEnable"></param>
+    void SetVsyncPacing(bool bEnable);
+    /// <summary>
+    /// 设置解码器线程配置的覆盖项（格式见decoderprofile.h），下次打开解码器时生效
+    /// </summary>
+    /// <param name="listProfiles">覆盖项，按顺序匹配，优先于内置配置表</param>
+    /// <returns>有效的覆盖项条数</returns>
+    int SetDecoderProfiles(const QStringList& listProfiles);
+    /// <summary>
+    /// 查询视频解码前丢帧的情况（视频解码线程每STATS_PUBLISH_INTERVAL发布一次）
+    /// </summary>
+    /// <param name="nLevel">当前级别SKIP_LEVEL_*</param>
+    /// <param name="nSkipNonRef">跳过不被参考的帧时被跳过的帧数</param>
+    /// <param name="nSkipBidir">跳过B帧时被跳过的帧数</param>
+    /// <param name="nSkipNonKey">只解码关键帧时被跳过的帧数</param>
+    /// <returns>false-当前没有播放</returns>
+    bool GetSkipFrameStats(int& nLevel, int64_t& nSkipNonRef, int64_t& nSkipBidir, int64_t& nSkipNonKey);
+    /// <summary>
+    /// 查询视频画质阶梯的状态（视频解码线程每STATS_PUBLISH_INTERVAL发布一次）
+    /// </summary>
+    /// <param name="nLevel">当前级别QUALITY_LEVEL_*</param>
+    /// <param name="dDecodeLoad">每帧解码耗时与帧时长之比的滑动平均</param>
+    /// <param name="nChanges">本次播放中级别的调整次数</param>
+    /// <returns>false-当前没有播放</returns>
+    bool GetQualityStats(int& nLevel, double& dDecodeLoad, int& nChanges);
+    /// <summary>
+    /// 查询音频输出的情况（音频生产线程每STATS_PUBLISH_INTERVAL发布一次）
+    /// </summary>
+    /// <param name="nCallbacks">SDL音频回调次数</param>
+    /// <param name="nUnderruns">回调时没有数据、只能输出静音的次数</param>
+    /// <param name="dBufferedMs">PCM环形缓冲区中已准备好的数据时长（毫秒）</param>
+    /// <returns>false-当前没有播放音频</returns>
+    bool GetAudioStats(int64_t& nCallbacks, int64_t& nUnderruns, double& dBufferedMs);
+    /// <summary>
+    /// 查询按vblank安排帧的情况（渲染线程每STATS_PUBLISH_INTERVAL发布一次）
+    /// </summary>
+    /// <param name="dRefreshRate">从present时刻学到的刷新率（Hz）</param>
+    /// <param name="nFrames">记录了误差的帧数</param>
+    /// <param name="dAvgErrorMs">present时刻相对理想时刻的平均误差（绝对值，毫秒）</param>
+    /// <param name="dMaxErrorMs">最大误差（毫秒）</param>
+    /// <param name="nMissed">晚于计划的vblank显示的帧数</param>
+    /// <returns>false-当前没有播放，或调度器未锁定刷新间隔</returns>
+    bool GetPacingStats(double& dRefreshRate, int64_t& nFrames, double& dAvgErrorMs, double& dMaxErrorMs, int64_t& nMissed);
 private:
     static VideoCtl* m_pInstance; //< 单例指针
 
@@ -453,9 +703,16 @@ private:
 
     //管家
     VideoState* m_CurStream;
+    //播放列表中下一个文件的后台预打开
+    PreopenState* m_pPreopen;
+    //界面查询的统计快照，由播放的各线程发布
+    SDL_mutex* m_pStatsMutex;
+    PlaybackStats m_stStats;
 
     SDL_Window* window;
     SDL_Renderer* renderer;
+    SDL_RendererInfo renderer_info;	//渲染器支持的纹理格式，由渲染线程在创建渲染器时填写
+    std::atomic<int> renderer_info_ready;	//renderer_info已填写，视频解码线程可以读取
     WId play_wid;//播放窗口
 
     //当窗口发生变化的时候；
@@ -12,10 +12,70 @@ extern "C" {
 #pragma comment (lib, "swresample.lib")
 #pragma comment (lib, "swscale.lib")
 #include <libavutil/avutil.h>
+#include <libavutil/parseutils.h>
 }
+#include "decoderprofile.h"
+#include "pixelrepack.h"
+#include "swsslice.h"
+#include "queuebench.h"
+#include "mediaio.h"
+
+/* ׼ģʽÿý֡ */
+#define DECODER_BENCH_FRAMES 600
+/* ϴ׼Ĭϵ֡ߴÿָʽת */
+#define UPLOAD_BENCH_SIZE "3840x2160"
+#define UPLOAD_BENCH_ITERATIONS 100
+/* Ƭת׼ÿõת */
+#define SWS_BENCH_ITERATIONS 30
+/* л׼ÿշİ */
+#define PACKET_QUEUE_BENCH_PACKETS 1000000
+/* ֡ѹÿշ֡ */
+#define FRAME_QUEUE_STRESS_FRAMES 1000000
+
 int main(int argc, char *argv[])
 {
     QApplication a(argc, argv);
+	//߳õĻ׼ԣPlayer --decoder-bench <ļ> [.csv] [֡]
+	if (argc >= 3 && strcmp(argv[1], "--decoder-bench") == 0)
+	{
+		int nFrames = argc >= 5 ? atoi(argv[4]) : DECODER_BENCH_FRAMES;
+		return decoder_profile_bench(argv[2], argc >= 4 ? argv[3] : NULL, nFrames > 0 ? nFrames : DECODER_BENCH_FRAMES) < 0 ? -1 : 0;
+	}
+	//ظʽϴĻ׼ԣPlayer --upload-bench [x] [.csv] []
+	if (argc >= 2 && strcmp(argv[1], "--upload-bench") == 0)
+	{
+		int nWidth, nHeight;
+		int nIterations = argc >= 5 ? atoi(argv[4]) : UPLOAD_BENCH_ITERATIONS;
+		if (av_parse_video_size(&nWidth, &nHeight, argc >= 3 ? argv[2] : UPLOAD_BENCH_SIZE) < 0)
+		{
+			qDebug() << "invalid frame size";
+			return -1;
+		}
+		return pixel_repack_bench(nWidth, nHeight, argc >= 4 ? argv[3] : NULL, nIterations > 0 ? nIterations : UPLOAD_BENCH_ITERATIONS) < 0 ? -1 : 0;
+	}
+	//swscaleƬת߳׼ԣPlayer --sws-bench [.csv] []
+	if (argc >= 2 && strcmp(argv[1], "--sws-bench") == 0)
+	{
+		int nIterations = argc >= 4 ? atoi(argv[3]) : SWS_BENCH_ITERATIONS;
+		return sws_slice_bench(argc >= 3 ? argv[2] : NULL, nIterations > 0 ? nIterations : SWS_BENCH_ITERATIONS) < 0 ? -1 : 0;
+	}
+	//շseekյĻ׼ԣPlayer --packet-queue-bench [.csv] []
+	if (argc >= 2 && strcmp(argv[1], "--packet-queue-bench") == 0)
+	{
+		int nPackets = argc >= 4 ? atoi(argv[3]) : PACKET_QUEUE_BENCH_PACKETS;
+		return packet_queue_bench(argc >= 3 ? argv[2] : NULL, nPackets > 0 ? nPackets : PACKET_QUEUE_BENCH_PACKETS) < 0 ? -1 : 0;
+	}
+	//֡շѹԣPlayer --frame-queue-stress [֡]
+	if (argc >= 2 && strcmp(argv[1], "--frame-queue-stress") == 0)
+	{
+		int nFrames = argc >= 3 ? atoi(argv[2]) : FRAME_QUEUE_STRESS_FRAMES;
+		return frame_queue_stress(nFrames > 0 ? nFrames : FRAME_QUEUE_STRESS_FRAMES) < 0 ? -1 : 0;
+	}
+	//ĬfileЭ顢ڴӳԤĶȡ׼ԣPlayer --io-bench <ļ> [.csv]
+	if (argc >= 3 && strcmp(argv[1], "--io-bench") == 0)
+	{
+		return media_io_bench(argv[2], argc >= 4 ? argv[3] : NULL) < 0 ? -1 : 0;
+	}
 	//ʹõֿ⣬ΪUIͼƬ
 	QFontDatabase::addApplicationFont(":/Player/res/fontawesome-webfont.ttf");
 	//QFontDatabase::addApplicationFont(":/Player/res/fa-solid-900.ttf");